@@ -0,0 +1,203 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "compilecache.hpp"
+#include "program.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+
+using namespace quickcalc;
+
+namespace {
+    // Formulas like the ones customer scripts are made of, one definition and a statement using it
+    const char *ARITHMETIC = "(3.5 - 1.25) * (3.5 + 1.25) / 7 + 2 * 4 - 9 / 3 + (1 - 2) * (3 - 4) * (5 - 6)";
+    const char *CALLS = "let poly(a) = a * a * 3 - a / 2 + 1; let twice(a) = poly(a) + poly(a + 1);"
+                        "twice(1) + twice(2) + twice(3) + twice(4)";
+    const char *FIB = "let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); fib(";
+    const char *FACTORIAL = "let fact(n) = if(le(n, 1), 1, n * fact(n - 1)); fact(";
+    const char *LOOPS = "let f(x) = x * x - 1; sum(i, 1, 1000, f(i) / i) + prod(i, 1, 20, 1 + 1 / i)";
+
+    // Script of many statements, so lexing and parsing dominate
+    std::string generateScript(size_t statements) {
+        std::ostringstream script;
+        for (size_t i = 0; i < statements; i++) {
+            script << "let f" << i << "(x, y) = x * " << i << ".5 + f" << (i > 0 ? i - 1 : 0)
+                   << "(y, x) / (y - 2);\n";
+        }
+        script << "1";
+        return script.str();
+    }
+
+    // Replays tokens read beforehand, so parsing can be measured without lexing
+    class ReplayLexer: public ILexer {
+        const std::vector<Token> &_tokens;
+        size_t _next = 0;
+    public:
+        explicit ReplayLexer(const std::vector<Token> &tokens): _tokens(tokens) {
+        }
+
+        Token read() override {
+            return _tokens[_next++];
+        }
+
+        Token peek() override {
+            return _tokens[_next];
+        }
+
+        bool done() const {
+            return _next >= _tokens.size();
+        }
+    };
+
+
+    // Runs every statement but the last once, then only the last is measured
+    template<typename Engine>
+    void evaluateLast(benchmark::State &state, Engine &engine, const std::string &source) {
+        std::vector<StmtNode::ptr> nodes = parseAll(source);
+        for (size_t i = 0; i + 1 < nodes.size(); i++) {
+            nodes[i]->accept(engine);
+        }
+        for (auto _ : state) {
+            nodes.back()->accept(engine);
+            benchmark::DoNotOptimize(engine.lastResult());
+        }
+    }
+
+    void executeLast(benchmark::State &state, const std::string &source) {
+        Executor executor;
+        loadConcepts(executor.getState());
+        evaluateLast(state, executor, source);
+    }
+
+    void runLast(benchmark::State &state, const std::string &source, const VMOptions &options) {
+        VM vm(options);
+        evaluateLast(state, vm, source);
+    }
+
+    VMOptions jitOptions() {
+        VMOptions options;
+        options.arguments = ArgumentMode::BY_NEED;
+        options.jit = true;
+        return options;
+    }
+}
+
+static void BM_LexerThroughput(benchmark::State &state) {
+    std::string script = generateScript(1000);
+    for (auto _ : state) {
+        std::istringstream input(script);
+        Lexer lexer(input);
+        while (!input.eof()) {
+            benchmark::DoNotOptimize(lexer.read());
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * script.size()));
+}
+BENCHMARK(BM_LexerThroughput);
+
+static void BM_ParserParse(benchmark::State &state) {
+    std::string script = generateScript(1000);
+    std::vector<Token> tokens;
+    std::istringstream input(script);
+    Lexer lexer(input);
+    while (!input.eof()) {
+        tokens.push_back(lexer.read());
+    }
+    size_t statements = 0;
+    for (auto _ : state) {
+        ReplayLexer replay(tokens);
+        Parser parser(replay);
+        while (!replay.done()) {
+            benchmark::DoNotOptimize(parser.parse());
+            statements++;
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(statements));
+}
+BENCHMARK(BM_ParserParse);
+
+static void BM_ExecutorArithmetic(benchmark::State &state) {
+    executeLast(state, ARITHMETIC);
+}
+BENCHMARK(BM_ExecutorArithmetic);
+
+static void BM_ExecutorCalls(benchmark::State &state) {
+    executeLast(state, CALLS);
+}
+BENCHMARK(BM_ExecutorCalls);
+
+static void BM_ExecutorLoops(benchmark::State &state) {
+    executeLast(state, LOOPS);
+}
+BENCHMARK(BM_ExecutorLoops);
+
+static void BM_ExecutorFib(benchmark::State &state) {
+    executeLast(state, FIB + std::to_string(state.range(0)) + ")");
+}
+BENCHMARK(BM_ExecutorFib)->Arg(15)->Arg(20);
+
+static void BM_ExecutorFactorial(benchmark::State &state) {
+    executeLast(state, FACTORIAL + std::to_string(state.range(0)) + ")");
+}
+BENCHMARK(BM_ExecutorFactorial)->Arg(20)->Arg(150);
+
+static void BM_VmCalls(benchmark::State &state) {
+    runLast(state, CALLS, VMOptions());
+}
+BENCHMARK(BM_VmCalls);
+
+static void BM_VmFib(benchmark::State &state) {
+    runLast(state, FIB + std::to_string(state.range(0)) + ")", VMOptions());
+}
+BENCHMARK(BM_VmFib)->Arg(20);
+
+static void BM_JitFib(benchmark::State &state) {
+    runLast(state, FIB + std::to_string(state.range(0)) + ")", jitOptions());
+}
+BENCHMARK(BM_JitFib)->Arg(20);
+
+// Parses and compiles a formula each time it's evaluated, what the compile cache saves
+static void BM_CompileAndEvaluate(benchmark::State &state) {
+    ExecutionContext context;
+    for (auto _ : state) {
+        CompileCache cache(1 << 20);
+        benchmark::DoNotOptimize(cache.get(CALLS)->evaluate(context, 0));
+    }
+}
+BENCHMARK(BM_CompileAndEvaluate);
+
+static void BM_CachedEvaluate(benchmark::State &state) {
+    ExecutionContext context;
+    CompileCache cache(1 << 20);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.get(CALLS)->evaluate(context, 0));
+    }
+}
+BENCHMARK(BM_CachedEvaluate);
+
+// Lexes, parses and runs a whole script each iteration, as the command line does
+static void BM_EndToEndScript(benchmark::State &state) {
+    std::string script = std::string(CALLS) + ";" + LOOPS + ";" + FIB + "12)";
+    for (auto _ : state) {
+        std::istringstream input(script);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        Executor executor;
+        loadConcepts(executor.getState());
+        std::vector<StmtNode::ptr> nodes;
+        while (!input.eof()) {
+            nodes.push_back(parser.parse());
+            nodes.back()->accept(executor);
+        }
+        benchmark::DoNotOptimize(executor.lastResult());
+    }
+}
+BENCHMARK(BM_EndToEndScript);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Compares two runs of the benchmarks target, saved with --benchmark_out=file.json
+
+Usage: compare.py baseline.json current.json [--threshold 0.1]
+
+Prints the change in CPU time of every benchmark in both runs, and exits with status 1 if any got slower
+by more than the threshold, so it can fail a build. Runs with repetitions are compared by their medians.
+"""
+import argparse
+import json
+import sys
+
+# Nanoseconds in each time_unit Google Benchmark writes
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    """Gives the CPU time in nanoseconds of every benchmark in a JSON run, by name"""
+    with open(path) as file:
+        run = json.load(file)
+    times = {}
+    medians = {}
+    for benchmark in run["benchmarks"]:
+        if "error_occurred" in benchmark and benchmark["error_occurred"]:
+            continue
+        time = benchmark["cpu_time"] * UNITS[benchmark.get("time_unit", "ns")]
+        if benchmark.get("run_type") == "aggregate":
+            if benchmark.get("aggregate_name") == "median":
+                medians[benchmark["run_name"]] = time
+        else:
+            # Repetitions without aggregates keep the fastest
+            name = benchmark.get("run_name", benchmark["name"])
+            times[name] = min(time, times.get(name, time))
+    times.update(medians)
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flags benchmarks which got slower than a stored baseline")
+    parser.add_argument("baseline", help="JSON output of the baseline run")
+    parser.add_argument("current", help="JSON output of the run to check")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="Largest slowdown allowed, as a fraction of the baseline time (default 0.1)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    width = max([len(name) for name in current] + [len("Benchmark")])
+    print(f"{'Benchmark':<{width}} {'Baseline ns':>14} {'Current ns':>14} {'Change':>9}")
+    for name, time in current.items():
+        if name not in baseline:
+            print(f"{name:<{width}} {'-':>14} {time:>14.1f}       new")
+            continue
+        change = time / baseline[name] - 1.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  improved"
+        print(f"{name:<{width}} {baseline[name]:>14.1f} {time:>14.1f} {change:>+8.1%}{flag}")
+    for name in baseline:
+        if name not in current:
+            print(f"{name:<{width}} {baseline[name]:>14.1f} {'-':>14}   missing")
+
+    if regressions:
+        print(f"Benchmarks slower than the baseline by more than {args.threshold:.0%}: {regressions}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "batch.hpp"
+#include "concepts.hpp"
+
+using namespace quickcalc;
+
+namespace {
+    struct Workload {
+        const char *name;
+        double (*libm)(double, double);
+        // Reference with more precision, to measure errors of both against
+        long double (*reference)(long double, long double);
+        // Arguments are drawn uniformly from [low, high], or from its logarithm if logarithmic
+        double low, high;
+        bool logarithmic;
+        // Only used by pow, the range its exponents are drawn uniformly from
+        double secondLow, secondHigh;
+    };
+
+    const Workload WORKLOADS[] = {
+        { "sqrt", [] (double x, double) { return std::sqrt(x); },
+          [] (long double x, long double) { return sqrtl(x); }, 1e-300, 1e300, true, 0, 0 },
+        { "exp", [] (double x, double) { return std::exp(x); },
+          [] (long double x, long double) { return expl(x); }, -700, 700, false, 0, 0 },
+        { "log", [] (double x, double) { return std::log(x); },
+          [] (long double x, long double) { return logl(x); }, 1e-300, 1e300, true, 0, 0 },
+        { "sin", [] (double x, double) { return std::sin(x); },
+          [] (long double x, long double) { return sinl(x); }, -1e5, 1e5, false, 0, 0 },
+        { "cos", [] (double x, double) { return std::cos(x); },
+          [] (long double x, long double) { return cosl(x); }, -1e5, 1e5, false, 0, 0 },
+        { "tan", [] (double x, double) { return std::tan(x); },
+          [] (long double x, long double) { return tanl(x); }, -1e5, 1e5, false, 0, 0 },
+        { "pow", [] (double x, double y) { return std::pow(x, y); },
+          [] (long double x, long double y) { return powl(x, y); }, 1e-3, 1e3, true, -100, 100 },
+    };
+
+    // Distance from the reference in units of the last place of a double
+    double ulps(double value, long double reference) {
+        if (std::isnan(value) || std::isnan(reference)) {
+            return std::isnan(value) && std::isnan(reference) ? 0.0 : INFINITY;
+        }
+        double rounded = static_cast<double>(reference);
+        if (std::isinf(rounded)) {
+            return value == rounded ? 0.0 : INFINITY;
+        }
+        int exponent;
+        std::frexp(rounded, &exponent);
+        double ulp = std::ldexp(1.0, std::max(exponent, -1021) - 53);
+        return static_cast<double>(std::abs(value - reference) / ulp);
+    }
+
+    template<typename Run>
+    double fastest(Run run) {
+        double best = 0.0;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = repeat == 0 ? elapsed.count() : std::min(best, elapsed.count());
+        }
+        return best;
+    }
+}
+
+/**
+ * Usage: mathbench [values]
+ *
+ * Prints the throughput of each math function through libm, a native call per value and the batch kernels,
+ * with the largest errors of libm and of the kernels against long double results.
+ */
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024 * 1024;
+    std::mt19937_64 random(17);
+
+    std::cout << "Evaluating " << count << " values with the " << BatchEvaluator::kernels() << " kernels" << std::endl;
+    std::cout << std::setw(6) << "" << std::setw(14) << "libm Mval/s" << std::setw(14) << "call Mval/s"
+              << std::setw(14) << "batch Mval/s" << std::setw(12) << "libm ulp" << std::setw(12) << "kernel ulp"
+              << std::endl;
+    const NativeLibrary &math = mathConcepts();
+    for (const Workload &workload : WORKLOADS) {
+        const NativeDefinition *function = std::find_if(math.functions, math.functions + math.count,
+            [&workload] (const NativeDefinition &definition) { return std::strcmp(definition.name, workload.name) == 0; });
+        if (function == math.functions + math.count) {
+            std::cerr << workload.name << " isn't a math concept" << std::endl;
+            return 1;
+        }
+        bool binary = function->minArgs > 1;
+
+        std::vector<double> x(count), y(count, 0.0);
+        std::uniform_real_distribution<double> first(workload.logarithmic ? std::log(workload.low) : workload.low,
+                                                     workload.logarithmic ? std::log(workload.high) : workload.high);
+        std::uniform_real_distribution<double> second(workload.secondLow, workload.secondHigh);
+        for (size_t i = 0; i < count; i++) {
+            x[i] = workload.logarithmic ? std::exp(first(random)) : first(random);
+            if (binary) {
+                y[i] = second(random);
+            }
+        }
+
+        std::vector<double> libm(count), calls(count), batch(count);
+        double libmSeconds = fastest([&] {
+            for (size_t i = 0; i < count; i++) {
+                libm[i] = workload.libm(x[i], y[i]);
+            }
+        });
+        double callSeconds = fastest([&] {
+            double args[2];
+            for (size_t i = 0; i < count; i++) {
+                args[0] = x[i];
+                args[1] = y[i];
+                calls[i] = function->call(args, function->minArgs);
+            }
+        });
+        const double *columns[] = { x.data(), y.data() };
+        double batchSeconds = fastest([&] {
+            function->columns(columns, function->minArgs, batch.data(), count);
+        });
+
+        double libmError = 0.0;
+        double kernelError = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            if (std::memcmp(&calls[i], &batch[i], sizeof(double)) != 0) {
+                std::cerr << workload.name << " calls and batches differ at " << x[i] << ", " << y[i] << std::endl;
+                return 1;
+            }
+            long double reference = workload.reference(x[i], y[i]);
+            libmError = std::max(libmError, ulps(libm[i], reference));
+            kernelError = std::max(kernelError, ulps(batch[i], reference));
+        }
+
+        std::cout << std::fixed << std::setprecision(2) << std::setw(6) << workload.name
+                  << std::setw(14) << count / libmSeconds / 1e6 << std::setw(14) << count / callSeconds / 1e6
+                  << std::setw(14) << count / batchSeconds / 1e6 << std::setprecision(3)
+                  << std::setw(12) << libmError << std::setw(12) << kernelError << std::endl;
+    }
+    return 0;
+}
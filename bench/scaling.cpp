@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+
+using namespace quickcalc;
+
+namespace {
+    struct Workload {
+        const char *name;
+        const char *source;
+    };
+
+    // The last statement of each is evaluated over columns x and y
+    const Workload WORKLOADS[] = {
+        { "arithmetic", "(x - y) * (x + y) / 7 + if(gt(x, y), x * 3, y - 1) * 2" },
+        { "calls", "let poly(a) = a * a * 3 - a / 2 + 1; poly(x) - poly(y) * if(lt(x, 0), 2, 3)" },
+    };
+
+    // Fastest of a few runs, in seconds
+    double fastest(VM &vm, const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                   double *results, WorkerPool &pool) {
+        double best = 0.0;
+        for (int repeat = 0; repeat < 5; repeat++) {
+            auto start = std::chrono::steady_clock::now();
+            vm.evaluate(program, columns, rows, results, pool);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = repeat == 0 ? elapsed.count() : std::min(best, elapsed.count());
+        }
+        return best;
+    }
+}
+
+/**
+ * Usage: batchscaling [rows] [most workers]
+ *
+ * Prints the throughput of batch evaluation for doubling numbers of workers, up to the number of hardware threads
+ * unless given.
+ */
+int main(int argc, char **argv) {
+    size_t rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16 * 1024 * 1024;
+    size_t most = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    most = std::max<size_t>(most, 1);
+
+    std::vector<double> x(rows);
+    std::vector<double> y(rows);
+    for (size_t row = 0; row < rows; row++) {
+        x[row] = static_cast<double>(row % 1000) / 8 - 60;
+        y[row] = static_cast<double>(row % 777) / 4 - 90;
+    }
+    std::vector<double> results(rows);
+
+    std::vector<size_t> counts;
+    for (size_t workers = 1; workers < most; workers *= 2) {
+        counts.push_back(workers);
+    }
+    counts.push_back(most);
+
+    std::cout << "Evaluating " << rows << " rows with the " << BatchEvaluator::kernels() << " kernels" << std::endl;
+    for (const Workload &workload : WORKLOADS) {
+        std::istringstream input(workload.source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        std::vector<StmtNode::ptr> nodes;
+        while (!input.eof()) {
+            nodes.push_back(parser.parse());
+        }
+        VM vm(VMOptions { ArgumentMode::BY_NEED });
+        for (size_t i = 0; i + 1 < nodes.size(); i++) {
+            nodes[i]->accept(vm);
+        }
+        BatchProgram program = vm.prepare(static_cast<ExprStmtNode *>(nodes.back().get())->expression(), { "x", "y" });
+
+        std::cout << std::endl << workload.name << ": " << workload.source << std::endl;
+        std::cout << std::setw(8) << "workers" << std::setw(12) << "ms" << std::setw(12) << "Mrows/s"
+                  << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::endl;
+        double single = 0.0;
+        for (size_t workers : counts) {
+            WorkerPool pool(workers);
+            double seconds = fastest(vm, program, { x.data(), y.data() }, rows, results.data(), pool);
+            if (workers == 1) {
+                single = seconds;
+            }
+            double speedup = single / seconds;
+            std::cout << std::fixed << std::setprecision(2) << std::setw(8) << workers << std::setw(12) << seconds * 1000
+                      << std::setw(12) << rows / seconds / 1e6 << std::setw(10) << speedup
+                      << std::setw(11) << speedup / workers * 100 << "%" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -1,17 +1,23 @@
 #pragma once
+#include <cstddef>
 #include <memory>
 #include <vector>
 #include <string>
+#include <unordered_set>
 
 namespace quickcalc {
     class Node;
     class NodeVisitor;
+    class SharedExprNode;
 
     class Node {
     public:
+        virtual ~Node() = default;
         virtual void accept(NodeVisitor &visitor) = 0;
         virtual bool operator==(const Node &other) const = 0;
         bool operator!=(const Node &other) const;
+        // Structural hash, nodes which compare equal hash the same
+        virtual size_t hash() const = 0;
         virtual bool canSafeDelete() const;
     };
 
@@ -22,7 +28,11 @@ namespace quickcalc {
 
     class ExprNode: public Node {
     public:
-        using ptr = std::unique_ptr<ExprNode>;
+        // Shared so that passes can turn trees into DAGs
+        using ptr = std::shared_ptr<ExprNode>;
+
+        // Copies the tree, expressions shared within it are copied separately for each use
+        virtual ptr clone() const = 0;
     };
 
     class ExprStmtNode: public StmtNode {
@@ -30,9 +40,11 @@ namespace quickcalc {
     public:
         ExprStmtNode(ExprNode::ptr &&expression);
         ExprNode *expression() const;
+        ExprNode::ptr &mutableExpression();
 
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
     };
 
     class FuncDefNode: public StmtNode {
@@ -43,10 +55,12 @@ namespace quickcalc {
         FuncDefNode(const std::string &name, ExprNode::ptr &&expression, std::vector<std::string> &&paramNames);
         const std::string &name() const;
         ExprNode *expression() const;
+        ExprNode::ptr &mutableExpression();
         const std::vector<std::string> &paramNames() const;
 
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
         bool canSafeDelete() const override;
     };
 
@@ -56,8 +70,10 @@ namespace quickcalc {
         ConstNode(double value);
         double value() const;
 
+        ExprNode::ptr clone() const override;
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
     };
     
     enum class UnaryOperation: int {
@@ -72,9 +88,12 @@ namespace quickcalc {
         UnaryOperationNode(UnaryOperation operation, ExprNode::ptr &&value);
         UnaryOperation operation() const;
         ExprNode *value() const;
+        ExprNode::ptr &mutableValue();
 
+        ExprNode::ptr clone() const override;
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
     };
 
     enum class BinaryOperation: int {
@@ -92,26 +111,55 @@ namespace quickcalc {
         ExprNode::ptr _lhs, _rhs;
     public:
         BinaryOperationNode(BinaryOperation operation, ExprNode::ptr &&lhs, ExprNode::ptr &&rhs);
+        ~BinaryOperationNode() override;
         BinaryOperation operation() const;
         ExprNode *lhs() const;
         ExprNode *rhs() const;
+        ExprNode::ptr &mutableLhs();
+        ExprNode::ptr &mutableRhs();
 
+        ExprNode::ptr clone() const override;
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
     };
 
     class FunctionInvocationNode: public ExprNode {
         std::string _name;
-        std::vector<std::unique_ptr<ExprNode>> _params;
+        std::vector<ExprNode::ptr> _params;
     public:
-        FunctionInvocationNode(const std::string &name, std::vector<std::unique_ptr<ExprNode>> &&params);
+        FunctionInvocationNode(const std::string &name, std::vector<ExprNode::ptr> &&params);
         const std::string &name() const;
-        const std::vector<std::unique_ptr<ExprNode>> &params() const;
+        const std::vector<ExprNode::ptr> &params() const;
+        std::vector<ExprNode::ptr> &mutableParams();
+
+        ExprNode::ptr clone() const override;
+        void accept(NodeVisitor &visitor) override;
+        bool operator==(const Node &other) const override;
+        size_t hash() const override;
+    };
 
+    // Evaluated at most once each time the expression it's part of is evaluated, made by CommonSubexpressions
+    class SharedExprNode: public ExprNode {
+        ExprNode::ptr _value;
+        int _slot;
+    public:
+        SharedExprNode(ExprNode::ptr &&value, int slot);
+        ExprNode *value() const;
+        ExprNode::ptr &mutableValue();
+        // Index of the shared expression within the statement it's part of
+        int slot() const;
+
+        ExprNode::ptr clone() const override;
         void accept(NodeVisitor &visitor) override;
         bool operator==(const Node &other) const override;
+        size_t hash() const override;
     };
 
+    size_t countNodes(Node *node);
+    std::unordered_set<std::string> collectNames(ExprNode *node);
+    size_t hashCombine(size_t seed, size_t value);
+
     class NodeVisitor {
         NodeVisitor *_next;
     public:
@@ -122,6 +170,7 @@ namespace quickcalc {
         virtual void visit(UnaryOperationNode *node);
         virtual void visit(BinaryOperationNode *node);
         virtual void visit(FunctionInvocationNode *node);
+        virtual void visit(SharedExprNode *node);
     protected:
         NodeVisitor();
         NodeVisitor(NodeVisitor *next);
@@ -0,0 +1,133 @@
+#pragma once
+#include "ast.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+#include "strictness.hpp"
+#include "symbols.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace quickcalc {
+    // Each instruction works on a whole block of rows, if modifying check the kernels in batchkernels.hpp
+    enum class BatchOpCode: uint8_t {
+        CONST = 0,
+        COLUMN,
+        CALL,
+        // Calls a vectorizable native function for every row, and a native function which isn't only
+        // for the rows calls are made for
+        NATIVE,
+        CALL_NATIVE,
+        NEGATE,
+        NOT,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        AND,
+        OR,
+        XOR,
+        EQ,
+        NE,
+        GT,
+        LT,
+        GE,
+        LE,
+        // Narrows the rows calls are made for to those where the value on top is true, or false for MASK_ELSE
+        // with the value at the depth given, both branches of an if are evaluated for every row
+        MASK,
+        MASK_ELSE,
+        UNMASK,
+        // Picks the second from top where the third from top is true and the top otherwise
+        SELECT,
+        // Picks the top where the second from top is true and the second from top otherwise
+        SELECT_CONDITION,
+        LOAD_SHARED,
+        STORE_SHARED,
+    };
+
+    struct BatchInstruction {
+        BatchOpCode opcode;
+        int32_t operand;
+    };
+
+    // Call to a defined function, made once per row with its arguments evaluated
+    struct BatchCall {
+        int32_t callee;
+        int32_t args;
+    };
+
+    struct BatchNativeCall {
+        NativeCall call;
+        // Only set for vectorizable functions which can be given whole columns
+        NativeColumns columns;
+        int32_t args;
+    };
+
+    // Expression compiled to be evaluated over many rows at once, parameters are read from columns
+    struct BatchProgram {
+        std::vector<std::string> columns;
+        std::vector<BatchInstruction> code;
+        std::vector<double> constants;
+        std::vector<BatchCall> calls;
+        std::vector<BatchNativeCall> natives;
+        // Every global slot called, used to check the program is complete before running it
+        std::vector<int32_t> globals;
+        int maxStack = 0;
+        int maxMasks = 0;
+        int sharedSlots = 0;
+    };
+
+    class BatchCompiler: public NodeVisitor {
+        SymbolTable &_symbols;
+        Strictness::Lookup _strictness;
+        BatchProgram _program;
+        std::unordered_map<uint64_t, int32_t> _constants;
+        std::unordered_map<const SharedExprNode *, int32_t> _shared;
+        int _depth;
+        int _masks;
+        // Number of calls, to defined functions or native functions which aren't vectorizable, compiled so far
+        size_t _calls;
+        // Calls mustn't be made for rows a branch doesn't take, so values involving them aren't shared
+        bool _share;
+    public:
+        BatchCompiler(SymbolTable &symbols, const Strictness::Lookup &strictness);
+
+        BatchProgram compile(ExprNode *node, const std::vector<std::string> &columns);
+
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+    private:
+        void compileBuiltin(Builtin builtin, FunctionInvocationNode *node);
+        void emit(BatchOpCode opcode, int32_t operand = 0);
+        void emitConst(double value);
+        void adjustDepth(int change);
+    };
+
+    // Runs batch programs block by block, with the kernels the processor supports best
+    class BatchEvaluator {
+    public:
+        // Calls a defined function for a single row
+        using Call = std::function<double(int32_t callee, const double *args, size_t count)>;
+    private:
+        Call _call;
+        std::vector<double> _registers;
+        std::vector<double> _args;
+        std::vector<const double *> _columns;
+        std::vector<double> _results;
+    public:
+        explicit BatchEvaluator(const Call &call);
+
+        void evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                      double *results);
+
+        static const char *kernels();
+    };
+}
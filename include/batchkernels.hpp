@@ -0,0 +1,130 @@
+#pragma once
+#include "batch.hpp"
+#include "concepts.hpp"
+#include "mathkernels.hpp"
+#include <cstddef>
+
+namespace quickcalc {
+    // Kernels for one instruction set, every block length is a multiple of 4 lanes
+    struct BatchKernelTable {
+        const char *name;
+        void (*unary)(BatchOpCode opcode, double *a, size_t lanes);
+        void (*binary)(BatchOpCode opcode, double *a, const double *b, size_t lanes);
+        // Sets mask to parent where value is true, or false if inverted, and zero elsewhere
+        void (*mask)(double *mask, const double *parent, const double *value, bool invert, size_t lanes);
+        // Sets condition to a where it's true and b elsewhere
+        void (*select)(double *condition, const double *a, const double *b, size_t lanes);
+        // Replaces a with the function of a, and of b for functions of two arguments
+        void (*math)(MathFunction function, double *a, const double *b, size_t lanes);
+    };
+
+    const BatchKernelTable &portableKernels();
+    // Only built when the compiler can target AVX, the caller checks the processor supports it
+    const BatchKernelTable *avxKernels();
+    // Fastest kernels the processor supports
+    const BatchKernelTable &selectKernels();
+
+    /**
+     * @brief Kernels written once over a vector type
+     *
+     * Simd gives the vector width and operations, which must round and compare exactly as scalar
+     * doubles do, and convert to 64 bit integers exactly as toInteger does.
+     */
+    template<typename Simd>
+    struct BatchKernels {
+        using V = typename Simd::V;
+
+        static V isFalse(V value) {
+            return Simd::lessThan(Simd::abs(value), Simd::broadcast(QC_EPSILON));
+        }
+
+        static V fromMask(V mask) {
+            return Simd::bitAnd(mask, Simd::broadcast(QC_TRUE));
+        }
+
+        static void unary(BatchOpCode opcode, double *a, size_t lanes) {
+            for (size_t i = 0; i < lanes; i += Simd::WIDTH) {
+                V value = Simd::load(a + i);
+                value = opcode == BatchOpCode::NEGATE ? Simd::negate(value) : Simd::integerNot(value);
+                Simd::store(a + i, value);
+            }
+        }
+
+        template<typename Operation>
+        static void apply(double *a, const double *b, size_t lanes, Operation operation) {
+            for (size_t i = 0; i < lanes; i += Simd::WIDTH) {
+                Simd::store(a + i, operation(Simd::load(a + i), Simd::load(b + i)));
+            }
+        }
+
+        static void binary(BatchOpCode opcode, double *a, const double *b, size_t lanes) {
+            switch (opcode) {
+            case BatchOpCode::ADD:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::add(x, y); });
+                break;
+            case BatchOpCode::SUBTRACT:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::subtract(x, y); });
+                break;
+            case BatchOpCode::MULTIPLY:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::multiply(x, y); });
+                break;
+            case BatchOpCode::DIVIDE:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::divide(x, y); });
+                break;
+            case BatchOpCode::AND:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::integerAnd(x, y); });
+                break;
+            case BatchOpCode::OR:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::integerOr(x, y); });
+                break;
+            case BatchOpCode::XOR:
+                apply(a, b, lanes, [] (V x, V y) { return Simd::integerXor(x, y); });
+                break;
+            case BatchOpCode::EQ:
+                apply(a, b, lanes, [] (V x, V y) {
+                    return fromMask(Simd::lessThan(Simd::abs(Simd::subtract(x, y)), Simd::broadcast(QC_EPSILON)));
+                });
+                break;
+            case BatchOpCode::NE:
+                apply(a, b, lanes, [] (V x, V y) {
+                    return fromMask(Simd::lessEqual(Simd::broadcast(QC_EPSILON), Simd::abs(Simd::subtract(x, y))));
+                });
+                break;
+            case BatchOpCode::GT:
+                apply(a, b, lanes, [] (V x, V y) { return fromMask(Simd::lessThan(y, x)); });
+                break;
+            case BatchOpCode::LT:
+                apply(a, b, lanes, [] (V x, V y) { return fromMask(Simd::lessThan(x, y)); });
+                break;
+            case BatchOpCode::GE:
+                apply(a, b, lanes, [] (V x, V y) { return fromMask(Simd::lessEqual(y, x)); });
+                break;
+            default:
+                apply(a, b, lanes, [] (V x, V y) { return fromMask(Simd::lessEqual(x, y)); });
+                break;
+            }
+        }
+
+        static void mask(double *mask, const double *parent, const double *value, bool invert, size_t lanes) {
+            for (size_t i = 0; i < lanes; i += Simd::WIDTH) {
+                V taken = isFalse(Simd::load(value + i));
+                V parentMask = Simd::load(parent + i);
+                // NaN isn't false, so the inverse of isFalse is what picks the first branch
+                Simd::store(mask + i, invert ? Simd::bitAnd(taken, parentMask) : Simd::bitAndNot(taken, parentMask));
+            }
+        }
+
+        static void select(double *condition, const double *a, const double *b, size_t lanes) {
+            for (size_t i = 0; i < lanes; i += Simd::WIDTH) {
+                V otherwise = isFalse(Simd::load(condition + i));
+                V result = Simd::bitOr(Simd::bitAnd(otherwise, Simd::load(b + i)), Simd::bitAndNot(otherwise, Simd::load(a + i)));
+                Simd::store(condition + i, result);
+            }
+        }
+
+        static const BatchKernelTable &table(const char *name) {
+            static const BatchKernelTable kernels = { name, &unary, &binary, &mask, &select, &MathKernels<Simd>::evaluate };
+            return kernels;
+        }
+    };
+}
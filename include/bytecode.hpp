@@ -0,0 +1,111 @@
+#pragma once
+#include "natives.hpp"
+#include "reduction.hpp"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace quickcalc {
+    // If modifying check OPCODES in bytecode.cpp
+    enum class OpCode: uint8_t {
+        CONST = 0,
+        ARG,
+        CALL,
+        TAIL_CALL,
+        // Calls a native function with the arguments on top of the stack, which it replaces with the result
+        CALL_NATIVE,
+        RETURN,
+        JUMP,
+        JUMP_IF_FALSE,
+        DUP,
+        POP,
+        NEGATE,
+        // Bitwise operators take and give 64 bit integers, held in stack slots in place of doubles
+        NOT,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        AND,
+        OR,
+        XOR,
+        // Pushes the operand as an integer
+        INTEGER,
+        // Converts the value on top of the stack for a bitwise operator, or a bitwise operator's result back
+        TO_INTEGER,
+        TO_DOUBLE,
+        EQ,
+        NE,
+        GT,
+        LT,
+        GE,
+        LE,
+        // Pushes the value of a shared expression and runs the following jump if it has been evaluated
+        LOAD_SHARED,
+        STORE_SHARED,
+        // Pushes the value of a name bound by a loop, which is kept in a shared slot
+        LOAD_LOCAL,
+        // Takes the bounds of a loop off the stack, skipping to its end with the result if there's nothing to do
+        LOOP_BEGIN,
+        // Combines the value of the body with the loop's result, then runs the body again or pushes the result
+        LOOP_NEXT,
+    };
+
+    struct Instruction {
+        OpCode opcode;
+        int32_t operand;
+    };
+
+    struct CallSite {
+        // Global slot of the function being called
+        int32_t callee;
+        // Entry point of each argument's code, arguments are evaluated by name in the caller's frame
+        // Arguments the callee is strict in may be evaluated by the caller, with an entry point of -1
+        std::vector<int32_t> args;
+        // Number of arguments evaluated by the caller, which are on the stack in order
+        int32_t strictArgs = 0;
+    };
+
+    struct NativeCallSite {
+        NativeCall function;
+        // Index of the native function, only used to describe the call
+        int32_t native;
+        // Number of arguments, all evaluated by the caller and on the stack in order
+        int32_t args;
+    };
+
+    struct Function;
+
+    struct Loop {
+        Reduction reduction;
+        // Shared slots of the index and, for folds, the accumulator
+        int32_t index;
+        int32_t accumulator;
+        // Entry point of the body, and the instruction after the loop
+        int32_t body;
+        int32_t end;
+        // Only set for loops whose body uses nothing but its index and pure functions, compiled on its own
+        // with the index in shared slot 0, so parts of the range can be run by other threads
+        std::shared_ptr<const Function> split;
+    };
+
+    struct Function {
+        std::string name;
+        std::vector<std::string> paramNames;
+        std::vector<Instruction> code;
+        std::vector<double> constants;
+        std::vector<CallSite> callSites;
+        std::vector<NativeCallSite> nativeCalls;
+        std::vector<Loop> loops;
+        // Every global slot called, used to check the program is complete before running it
+        std::vector<int32_t> globals;
+        int maxStack = 0;
+        // Number of names bound by loops followed by shared expressions, whose values are kept in the frame of each call
+        int sharedSlots = 0;
+    };
+}
+
+std::ostream &operator<<(std::ostream &stream, quickcalc::OpCode opcode);
+std::ostream &operator<<(std::ostream &stream, const quickcalc::Function &function);
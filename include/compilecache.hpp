@@ -0,0 +1,66 @@
+#pragma once
+#include "context.hpp"
+#include "program.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace quickcalc {
+    struct CompileCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        // Estimated bytes held by the cached programs and their source text
+        size_t bytes = 0;
+    };
+
+    /**
+     * @brief Programs compiled from source text, shared by every caller which asks for the same text
+     *
+     * Programs never change once built and any number of threads can evaluate them, so callers get the
+     * same program for the same source. The cache is split into shards by the hash of the source, each
+     * locked separately and evicting its least recently used programs once it holds more than its share of
+     * the capacity. Sources are parsed and compiled without holding a lock, so a slow compile never
+     * blocks lookups, and two threads missing on the same source at once may both compile it.
+     */
+    class CompileCache {
+        struct Entry {
+            uint64_t hash;
+            std::string source;
+            std::shared_ptr<const Program> program;
+            size_t bytes;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            // Most recently used first
+            std::list<Entry> entries;
+            // Keyed by the hash of the source, which is compared as well to rule out collisions
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+            size_t bytes = 0;
+            CompileCacheStats stats;
+        };
+
+        VMOptions _options;
+        size_t _shardCapacity;
+        std::unique_ptr<Shard[]> _shards;
+        size_t _shardCount;
+    public:
+        explicit CompileCache(size_t capacity, const VMOptions &options = VMOptions(), size_t shards = 16);
+        CompileCache(const CompileCache &) = delete;
+        CompileCache &operator=(const CompileCache &) = delete;
+
+        std::shared_ptr<const Program> get(const std::string &source);
+        void clear();
+
+        CompileCacheStats stats() const;
+
+    private:
+        static std::unique_ptr<Program> compile(const std::string &source, const VMOptions &options);
+    };
+}
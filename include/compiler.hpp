@@ -0,0 +1,83 @@
+#pragma once
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "concepts.hpp"
+#include "strictness.hpp"
+#include "symbols.hpp"
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace quickcalc {
+    class CompileError: public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    class Compiler: public NodeVisitor {
+    public:
+        // Whether a defined global, and everything it calls, is pure
+        using Purity = std::function<bool(int32_t slot)>;
+    private:
+        // Name bound by a loop, innermost last
+        struct Local {
+            const std::string *name;
+            int32_t slot;
+        };
+
+        struct PendingArg {
+            ExprNode *expression;
+            int callSite;
+            int index;
+            // Arguments are evaluated in the caller's frame, so see the names of the loops the call is in
+            std::vector<Local> locals;
+        };
+
+        SymbolTable &_symbols;
+        Strictness::Lookup _strictness;
+        Purity _pure;
+        Function _function;
+        std::deque<PendingArg> _pendingArgs;
+        std::unordered_map<uint64_t, int32_t> _constants;
+        std::unordered_set<int32_t> _globals;
+        std::vector<Local> _locals;
+        int _localSlots;
+        int _depth;
+        // Set while compiling an expression whose value is returned directly from the function
+        bool _tail;
+        // Set while compiling a bitwise operator whose result is an operand of another, so stays an integer
+        bool _integer;
+    public:
+        explicit Compiler(SymbolTable &symbols, const Strictness::Lookup &strictness = nullptr,
+                          const Purity &pure = nullptr);
+
+        Function compile(FuncDefNode *node);
+        Function compile(ExprNode *node, const std::string &name = "<script>");
+
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+        Binding resolve(const std::string &name);
+
+    private:
+        Function finish(ExprNode *body, const std::string *index = nullptr);
+        void compileBuiltin(Builtin builtin, FunctionInvocationNode *node, bool tail);
+        void compileLoop(Builtin builtin, FunctionInvocationNode *node);
+        bool splittable(const LoopCall &loop);
+        bool tryGetLocal(const std::string &name, int32_t &slot) const;
+        void compileInteger(ExprNode *node);
+        void emitBinary(BinaryOperation operation);
+        void emit(OpCode opcode, int32_t operand = 0);
+        void emitConst(double value);
+        int emitJump(OpCode opcode);
+        void patchJump(int offset);
+        void adjustDepth(int change);
+    };
+}
@@ -1,6 +1,57 @@
 #pragma once
 #include "executor.hpp"
+#include "natives.hpp"
+#include "reduction.hpp"
+#include <cmath>
 
 namespace quickcalc {
+    constexpr double QC_FALSE = 0.0;
+    constexpr double QC_TRUE = 1.0;
+    constexpr double QC_EPSILON = 1e-15;
+    // C++17 doesn't define a pi constant, so we'll use our own
+    constexpr double QC_PI = 3.1415926535897932384626433832795028841971693993751058209749445923078164063;
+
+    // Builtins the compiler knows how to emit inline, if modifying check BUILTINS in concepts.cpp
+    enum class Builtin: int {
+        IF = 0,
+        EQ,
+        NE,
+        GT,
+        LT,
+        GE,
+        LE,
+        TRUE,
+        FALSE,
+        EPSILON,
+        PI,
+        SUM,
+        PROD,
+        MINOF,
+        MAXOF,
+        FOLD,
+    };
+
+    // Arguments of a call to one of the loops, which evaluate body with index bound to each index in turn
+    struct LoopCall {
+        Reduction reduction;
+        const std::string *index;
+        // Only set for folds, bound to the value of the body at the previous index, or init at the first
+        const std::string *accumulator;
+        ExprNode *lo;
+        ExprNode *hi;
+        ExprNode *init;
+        ExprNode *body;
+    };
+
     void loadConcepts(ExecutorState &state);
+    bool tryGetBuiltin(const std::string &name, Builtin &builtin);
+    double callBuiltin(Builtin builtin, Executor &exec, const std::vector<ExprNode::ptr> &params);
+    bool isLoop(Builtin builtin);
+    bool tryGetLoop(Builtin builtin, const std::vector<ExprNode::ptr> &params, LoopCall &loop);
+    // Elementary functions, registered as native functions before any others
+    const NativeLibrary &mathConcepts();
+
+    inline bool isFalse(double value) {
+        return std::abs(value) < QC_EPSILON;
+    }
 }
@@ -0,0 +1,127 @@
+#pragma once
+#include "bytecode.hpp"
+#include "framestack.hpp"
+#include "jit.hpp"
+#include "memo.hpp"
+#include "pool.hpp"
+#include "reduction.hpp"
+#include "strictness.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace quickcalc {
+    enum class ArgumentMode: int {
+        // Arguments are evaluated every time they're used, as the executor does
+        BY_NAME = 0,
+        // Arguments are evaluated at most once per call, by the caller if the callee is strict
+        BY_NEED,
+    };
+
+    struct VMOptions {
+        ArgumentMode arguments = ArgumentMode::BY_NAME;
+        // Number of values to preallocate on the operand stack, grows when needed
+        size_t stackSize = 1024;
+        // Number of bytes to preallocate for call frames, grows when needed
+        size_t frameStackSize = 64 * 1024;
+        // Most bytes the call frames, and separately the operand stack, may grow to
+        size_t memoryLimit = 256 * 1024 * 1024;
+        // Number of results to cache per function, 0 disables memoization
+        size_t memoEntries = 0;
+        // Keep the value of each definition without parameters until something it uses is redefined
+        bool cacheConstants = false;
+        // Compile functions which only take evaluated arguments to machine code, when the platform allows it
+        bool jit = false;
+        // Bytes of native stack machine code may use before handing the call back to the interpreter
+        size_t nativeStackSize = 256 * 1024;
+        // Threads to split large sum, prod, minof and maxof loops between, 1 runs every loop on the calling thread
+        size_t loopWorkers = 1;
+    };
+
+    // Compiled code of a global, indexed by slot, which is everything the interpreter needs to call it
+    struct Code {
+        std::unique_ptr<Function> function;
+        // Only set for memoized functions
+        std::unique_ptr<MemoCache> memo;
+        // Only set for functions compiled to machine code
+        std::unique_ptr<NativeCode> native;
+    };
+
+    /**
+     * @brief Stacks and call frames for running bytecode on one thread
+     *
+     * Code is only ever read, so any number of contexts can run the same code at once, as long as
+     * none of them memoize.
+     */
+    class ExecutionContext {
+        // Frames are allocated from the frame stack and refer to each other by offset
+        // Function calls passed by need are followed by an ArgValue per argument, then calls and scripts
+        // are followed by an ArgValue per shared expression
+        struct Frame {
+            // Code being executed, arguments run in the code of the function which passed them
+            const Function *function;
+            const Instruction *returnPc;
+            size_t previous;
+            // Frame holding the arguments visible to the executing code
+            size_t env;
+            // Only set for function calls, the arguments passed and the frame to evaluate them in
+            const CallSite *site;
+            size_t callerEnv;
+            // Only set for arguments passed by need, the value to fill in on return
+            size_t cache;
+            // Only set for calls which missed the memo cache, the cache to fill in on return
+            MemoCache *memo;
+            // Offset of the values of shared expressions, only used by frames which are an env
+            size_t shared;
+        };
+
+        struct ArgValue {
+            double value;
+            bool ready;
+        };
+
+        // Loop being run in place, with its index and accumulator in the shared slots starting at slots
+        struct LoopState {
+            const Loop *loop;
+            size_t slots;
+            double lo;
+            // Offset of the index the body is run with next, loops end when it reaches length
+            uint64_t next;
+            uint64_t length;
+            PairwiseReduction result;
+        };
+
+        std::vector<double> _stack;
+        FrameStack _frames;
+        size_t _sp;
+        size_t _memoryLimit;
+        size_t _nativeStackSize;
+        bool _memoize;
+        // Calls a function with evaluated arguments, kept between calls to the same function
+        Function _callScript;
+        StrictMask _callStrict;
+        bool _callByNeed;
+        // Loops being run, innermost last
+        std::vector<LoopState> _loops;
+        // Only created once a loop is split, each worker runs parts of it with a context of its own
+        size_t _loopWorkers;
+        VMOptions _splitOptions;
+        std::unique_ptr<WorkerPool> _pool;
+        std::vector<std::unique_ptr<ExecutionContext>> _splits;
+    public:
+        ExecutionContext();
+        explicit ExecutionContext(const VMOptions &options);
+
+        double run(const Function &entry, const std::vector<Code> &code, bool byNeed);
+        double call(const std::vector<Code> &code, bool byNeed, int32_t slot, StrictMask strict, const double *args,
+                    size_t count);
+
+    private:
+        double run(const Function &entry, const std::vector<Code> &code, bool byNeed, const double *index);
+        double runSplit(const Loop &loop, double lo, uint64_t length, const std::vector<Code> &code, bool byNeed);
+        static void bindArgs(ArgValue *args, const CallSite &site, const double *strictArgs);
+        static void clearShared(ArgValue *shared, const Function &function);
+        void reserveStack(size_t size);
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "ast.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace quickcalc {
+    // Merges structurally equal subexpressions of a statement, and shares those used more than once
+    class CommonSubexpressions: public NodeVisitor {
+        // Identifies a node by its contents, with children compared by identity once they're merged
+        struct Key {
+            int kind;
+            int operation;
+            uint64_t value;
+            std::string name;
+            std::vector<const ExprNode *> children;
+
+            bool operator==(const Key &other) const;
+        };
+        struct KeyHash {
+            size_t operator()(const Key &key) const;
+        };
+
+        std::unordered_map<Key, ExprNode::ptr, KeyHash> _nodes;
+        // Number of merged nodes referring to each merged node
+        std::unordered_map<const ExprNode *, size_t> _uses;
+        // Merged nodes, children before their parents
+        std::vector<ExprNode::ptr> _order;
+        size_t _merged;
+        // Filled in by visits with the node visited
+        Key _key;
+        std::vector<ExprNode::ptr *> _children;
+        bool _unwrap;
+    public:
+        CommonSubexpressions();
+
+        size_t eliminate(StmtNode *node);
+
+        void visit(ExprStmtNode *node) override;
+        void visit(FuncDefNode *node) override;
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+    private:
+        void eliminate(ExprNode::ptr &root);
+        void share();
+        void inspect(ExprNode *node);
+    };
+}
@@ -1,6 +1,12 @@
 #pragma once
 #include "ast.hpp"
+#include "profiler.hpp"
+#include "stats.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <stack>
+#include <stdexcept>
 #include <unordered_map>
 #include <string>
 #include <functional>
@@ -10,31 +16,105 @@ namespace quickcalc {
     class Executor;
     class ExecutorState;
 
+    // What a name refers to, resolved by the executor without going through a closure
+    enum class FuncKind: uint8_t {
+        // One of the builtins in concepts.hpp
+        BUILTIN = 0,
+        // A definition made with let
+        DEFINITION,
+        // A parameter of the call being evaluated
+        ARGUMENT,
+        // A function supplied by the host program, given its arguments unevaluated
+        HOST,
+        // A native function from natives.hpp, given the values of its arguments
+        NATIVE,
+        // The index or accumulator of a loop being evaluated
+        VALUE,
+    };
+
+#ifdef QC_FUEL
+    constexpr bool FUEL_METERED = true;
+#else
+    constexpr bool FUEL_METERED = false;
+#endif
+    // Fuel which never runs out in practice, every node evaluated uses one unit
+    constexpr uint64_t UNLIMITED_FUEL = UINT64_MAX;
+
+    // Thrown when an evaluation runs out of fuel and the checkpoint doesn't give it any more
+    class FuelExhausted: public std::runtime_error {
+    public:
+        FuelExhausted();
+    };
+
     class ExecutorState {
         friend class Executor;
+        friend class ValueBinding;
     public:
-        using Func = std::function<double(Executor &executor, const std::vector<ExprNode::ptr> &)>;
+        // Host function, given its arguments unevaluated
+        using Native = std::function<double(Executor &executor, const std::vector<ExprNode::ptr> &)>;
+
+        struct Func {
+            FuncKind kind = FuncKind::BUILTIN;
+            // Builtin value for builtins, index into args for arguments, index of native functions
+            int32_t index = 0;
+            // Only set for definitions
+            FuncDefNode *definition = nullptr;
+            // Only set for arguments, the arguments of the call which bound the parameter
+            const std::vector<ExprNode::ptr> *args = nullptr;
+            // Only set for host functions, shared by every state the function is copied to
+            std::shared_ptr<const Native> host;
+            // Only set for values, updated by the loop which bound it
+            const double *value = nullptr;
+
+            static Func ofBuiltin(int32_t index);
+            static Func ofDefinition(FuncDefNode *definition);
+            static Func ofArgument(int32_t index, const std::vector<ExprNode::ptr> *args);
+            static Func ofHost(std::shared_ptr<const Native> host);
+            static Func ofNative(int32_t index);
+            static Func ofValue(const double *value);
+        };
     private:
         std::unordered_map<std::string, Func> _funcMap;
+        // Values of shared expressions evaluated in this state
+        std::unordered_map<const ExprNode *, double> _shared;
         const ExecutorState *_parent;
+        // Only set for the state of a call, parameters are looked up here rather than stored in the map
+        const std::vector<std::string> *_paramNames;
+        const std::vector<ExprNode::ptr> *_args;
     public:
         ExecutorState();
         ExecutorState(ExecutorState *parent);
 
         void setFunction(const std::string &name, const Func &function);
-        void setFunction(const std::string &name, Func &&function);
-        void setFunction(std::string &&name, Func &&function);
+        void setFunction(const std::string &name, Native &&function);
+        void bindArgs(const std::vector<std::string> &paramNames, const std::vector<ExprNode::ptr> &args);
 
-        const Func &getFunction(const std::string &name) const;
+        Func getFunction(const std::string &name) const;
         bool hasFunction(const std::string &name) const;
-        bool tryGetFunction(const std::string &name, const Func *&function) const;
+        bool tryGetFunction(const std::string &name, Func &function) const;
+        bool tryGetFunction(const std::string &name, Func &function, uint64_t &hops) const;
     };
 
     class Executor: public NodeVisitor {
+    public:
+        // Called when an evaluation runs out of fuel, gives how much more to carry on with, or 0 to stop it
+        using Checkpoint = std::function<uint64_t(Executor &executor)>;
+    private:
         std::stack<double> _valueStack;
         std::stack<ExecutorState> _stateStack;
         double _lastResult;
         bool _hasResult;
+#ifdef QC_FUEL
+        uint64_t _fuel = UNLIMITED_FUEL;
+        // Fuel each statement starts with
+        uint64_t _budget = UNLIMITED_FUEL;
+        Checkpoint _checkpoint;
+#endif
+        // Only set while profiling, records every call other than reading a parameter or loop value
+        Profiler *_profiler = nullptr;
+        // Native functions this executor has called, so the registry is only locked the first time
+        std::unordered_map<std::string, int32_t> _natives;
+        Stats _stats;
     public:
         Executor();
         Executor(NodeVisitor *next);
@@ -45,8 +125,11 @@ namespace quickcalc {
         void visit(UnaryOperationNode *node) override;
         void visit(BinaryOperationNode *node) override;
         void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
 
         double evaluate(ExprNode *node);
+        double call(FuncDefNode *definition, const std::vector<ExprNode::ptr> &args);
+        double callNative(int32_t index, const std::vector<ExprNode::ptr> &args);
 
         double lastResult() const;
         bool hasResult() const;
@@ -59,5 +142,39 @@ namespace quickcalc {
         ExecutorState &pushState(ExecutorState &&state);
         ExecutorState &pushState(const ExecutorState &state);
         ExecutorState popState();
+
+        void setFuelBudget(uint64_t budget);
+        void setFuel(uint64_t fuel);
+        uint64_t fuel() const;
+        void setCheckpoint(const Checkpoint &checkpoint);
+        void setProfiler(Profiler *profiler);
+        const Stats &stats() const;
+
+    private:
+        void invoke(FunctionInvocationNode *node, const ExecutorState::Func &func);
+        bool tryGetNative(const std::string &name, int32_t &index);
+        int64_t integer(ExprNode *node);
+        void refuel();
+
+        // Uses one unit of fuel for a node about to be evaluated
+        void burn() {
+#ifdef QC_FUEL
+            if (_fuel-- == 0) {
+                refuel();
+            }
+#endif
+        }
+    };
+
+    // Binds a name to a value in the innermost state for as long as it lives, then restores what the name hid
+    class ValueBinding {
+        Executor &_executor;
+        const std::string &_name;
+        std::optional<ExecutorState::Func> _hidden;
+    public:
+        ValueBinding(Executor &executor, const std::string &name, const double *value);
+        ValueBinding(const ValueBinding &) = delete;
+        ValueBinding &operator=(const ValueBinding &) = delete;
+        ~ValueBinding();
     };
 }
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+
+namespace quickcalc {
+    /**
+     * @brief Runs a function on its own stack, so it can suspend itself anywhere and be resumed later
+     *
+     * A suspended fiber may be resumed by any thread, but only one at a time. Executors keep nothing in
+     * thread locals, so evaluations don't notice moving between threads. Other bodies mustn't rely on them
+     * across a yield, compilers may keep their addresses, or values like the thread's id, from before it.
+     */
+    class Fiber {
+    public:
+        using Body = std::function<void()>;
+        // Same as the main thread's stack on most systems, only the pages used are ever committed
+        static constexpr size_t DEFAULT_STACK = 8 << 20;
+    private:
+        // Saved registers, kept out of the header as they're platform specific
+        struct Context;
+
+        std::unique_ptr<Context> _context;
+        void *_stack;
+        size_t _stackSize;
+        Body _body;
+        std::exception_ptr _error;
+        bool _running;
+        bool _finished;
+    public:
+        explicit Fiber(size_t stackSize = DEFAULT_STACK);
+        Fiber(const Fiber &) = delete;
+        Fiber &operator=(const Fiber &) = delete;
+        ~Fiber();
+
+        static bool available();
+
+        void start(Body &&body);
+        bool resume();
+        void yield();
+        bool finished() const;
+
+    private:
+        static void entry(unsigned int high, unsigned int low);
+        void run();
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "ast.hpp"
+#include "executor.hpp"
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace quickcalc {
+    // Folds constant subtrees and applies identities which preserve NaN and signed zeros
+    class Folder: public NodeVisitor {
+        // Evaluates constant subtrees exactly as they would be evaluated at run time
+        Executor _executor;
+        // Names defined, used as parameters or bound by loops so far, which may no longer refer to a builtin
+        std::unordered_set<std::string> _shadowed;
+        // Only set at the top level of an expression statement, where builtins can be folded
+        bool _foldBuiltins;
+        // Set by visits when the node visited should be replaced
+        ExprNode::ptr _replacement;
+    public:
+        Folder();
+
+        size_t fold(StmtNode *node);
+
+        void visit(ExprStmtNode *node) override;
+        void visit(FuncDefNode *node) override;
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+    private:
+        void fold(ExprNode::ptr &node);
+        ExprNode::ptr simplify(BinaryOperationNode *node);
+        ExprNode::ptr evaluate(ExprNode *node);
+    };
+}
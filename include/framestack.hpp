@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace quickcalc {
+    // Contiguous region which call frames are bump allocated from, frames are referred to by offset
+    class FrameStack {
+        // Allocations are rounded up to this, so everything allocated is aligned for a double or pointer
+        static constexpr size_t WORD = sizeof(uint64_t);
+
+        std::unique_ptr<std::byte[]> _memory;
+        size_t _capacity;
+        size_t _top;
+        size_t _limit;
+
+        template<typename T>
+        static constexpr bool storable() {
+            // Objects are moved with memcpy when the stack grows and abandoned when it's popped
+            return std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T> && alignof(T) <= WORD;
+        }
+    public:
+        FrameStack(size_t capacity, size_t limit = SIZE_MAX);
+
+        size_t push(size_t size);
+        void pop(size_t offset);
+
+        size_t top() const;
+        size_t capacity() const;
+
+        /**
+         * @brief Starts the lifetime of a copy of value in space from push, it lasts until the space is popped
+         */
+        template<typename T>
+        T *emplace(size_t offset, const T &value) {
+            static_assert(storable<T>(), "Frame stack objects must be trivially copyable and destructible");
+            return new (_memory.get() + offset) T(value);
+        }
+
+        /**
+         * @brief Starts the lifetime of count uninitialised objects in space from push, side by side
+         */
+        template<typename T>
+        T *emplaceArray(size_t offset, size_t count) {
+            static_assert(storable<T>(), "Frame stack objects must be trivially copyable and destructible");
+            std::byte *storage = _memory.get() + offset;
+            for (size_t i = 0; i < count; i++) {
+                new (storage + i * sizeof(T)) T;
+            }
+            return std::launder(reinterpret_cast<T *>(storage));
+        }
+
+        /**
+         * @brief Gives an object emplaced at offset, pointers are invalidated if the stack grows
+         */
+        template<typename T>
+        T *at(size_t offset) {
+            static_assert(storable<T>(), "Frame stack objects must be trivially copyable and destructible");
+            return std::launder(reinterpret_cast<T *>(_memory.get() + offset));
+        }
+
+        template<typename T>
+        const T *at(size_t offset) const {
+            static_assert(storable<T>(), "Frame stack objects must be trivially copyable and destructible");
+            return std::launder(reinterpret_cast<const T *>(_memory.get() + offset));
+        }
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "ast.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace quickcalc {
+    // Replaces calls to small definitions with a copy of their body, redoing it when they're redefined
+    class Inliner: public NodeVisitor {
+        struct Definition {
+            FuncDefNode *node;
+            // Body as it was defined, before anything was inlined into it
+            ExprNode::ptr original;
+            // Names which, if defined or used as a parameter later, mean the body must be inlined again
+            std::unordered_set<std::string> dependencies;
+            // Names the body refers to other than its parameters
+            std::unordered_set<std::string> freeNames;
+            // Order of definition, bodies are inlined again in this order so helpers are updated first
+            size_t order;
+            bool inlinable;
+        };
+
+        size_t _maxSize;
+        std::unordered_map<std::string, Definition> _definitions;
+        // Every parameter name seen so far, a call to one of these may not reach the definition
+        std::unordered_set<std::string> _shadowed;
+        std::vector<FuncDefNode *> _rebuilt;
+        size_t _order;
+        size_t _inlined;
+        // Only set while inlining into a definition
+        const std::vector<std::string> *_paramNames;
+        std::unordered_set<std::string> *_dependencies;
+        // Names bound by the loops whose arguments are being inlined into
+        std::vector<std::string> _loopNames;
+        // Set by visits when the node visited should be replaced
+        ExprNode::ptr _replacement;
+    public:
+        explicit Inliner(size_t maxSize = 16);
+
+        size_t inlineCalls(StmtNode *node);
+        const std::vector<FuncDefNode *> &rebuilt() const;
+
+        void visit(ExprStmtNode *node) override;
+        void visit(FuncDefNode *node) override;
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+    private:
+        void expand(ExprNode::ptr &node);
+        void inlineBody(Definition &definition);
+        bool canInline(const Definition &helper, const FunctionInvocationNode *call) const;
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "ast.hpp"
+#include <cstdint>
+
+namespace quickcalc {
+    // Bitwise operators work on 64 bit integers, and give the integer result rounded to the nearest double
+
+    // Integers past this aren't all exactly representable as doubles
+    constexpr int64_t EXACT_INTEGER = int64_t(1) << 53;
+
+    /**
+     * @brief Converts an operand of a bitwise operator to an integer
+     *
+     * Truncates like cvttsd2si, so NaN and values out of range give INT64_MIN on every engine.
+     */
+    inline int64_t toInteger(double value) {
+        if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0)) {
+            return INT64_MIN;
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    /**
+     * @brief Gives the integer a bitwise operator's result converts to once it's rounded to a double
+     *
+     * Results passed straight to another bitwise operator stay integers, so are rounded when they're used,
+     * which only changes them when they're too large to be exact.
+     */
+    inline int64_t roundInteger(int64_t value) {
+        if (value >= -EXACT_INTEGER && value < EXACT_INTEGER) {
+            return value;
+        }
+        return toInteger(static_cast<double>(value));
+    }
+
+    inline bool isBitwise(BinaryOperation operation) {
+        return operation == BinaryOperation::AND || operation == BinaryOperation::OR
+               || operation == BinaryOperation::XOR;
+    }
+
+    inline int64_t bitwise(BinaryOperation operation, int64_t lhs, int64_t rhs) {
+        switch (operation) {
+        case BinaryOperation::AND:
+            return lhs & rhs;
+        case BinaryOperation::OR:
+            return lhs | rhs;
+        default:
+            return lhs ^ rhs;
+        }
+    }
+}
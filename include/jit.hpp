@@ -0,0 +1,73 @@
+#pragma once
+#include "bytecode.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace quickcalc {
+    // Shared by every native call made from one run of the virtual machine
+    struct JitContext {
+        // Native code gives up once the stack pointer drops below this address
+        uintptr_t stackLimit;
+        // Set when native code gave up, the result is meaningless and the call must be interpreted instead
+        bool bailed;
+    };
+
+    // Machine code for one function, called with the values of all of its arguments
+    class NativeCode {
+    public:
+        using Entry = double (*)(const double *args, JitContext *context);
+    private:
+        void *_memory;
+        size_t _size;
+        // Native callers load the entry point from here, so functions can call each other before they're all compiled
+        Entry _entry;
+    public:
+        NativeCode();
+        NativeCode(const NativeCode &) = delete;
+        NativeCode &operator=(const NativeCode &) = delete;
+        ~NativeCode();
+
+        double call(const double *args, JitContext &context) const;
+
+        friend class Jit;
+    };
+
+    // Translates bytecode into x86-64 machine code, for functions which never need to evaluate an argument lazily
+    class Jit {
+    public:
+        // Gives the native code of a global which native code can call, which may not be compiled yet
+        using Lookup = std::function<NativeCode *(int32_t slot)>;
+    private:
+        struct Fixup {
+            size_t position;
+            int32_t target;
+        };
+
+        Lookup _callees;
+        std::vector<uint8_t> _code;
+        std::vector<int> _depths;
+        std::vector<size_t> _labels;
+        std::vector<Fixup> _fixups;
+        std::vector<size_t> _exits;
+        std::vector<size_t> _bailouts;
+        // Start of the function after its prologue
+        size_t _body;
+    public:
+        explicit Jit(const Lookup &callees);
+
+        static bool available();
+        static bool supports(const Function &function);
+
+        bool compile(const Function &function, int32_t slot, NativeCode &code);
+
+    private:
+        int analyse(const Function &function);
+        bool translate(const Function &function, int32_t slot, size_t pc, int stackSlots);
+        void emitCompare(OpCode opcode, int depth);
+        void emitBitwise(OpCode opcode, int depth);
+        void emitRoundInteger();
+        void emitIsFalse(int depth);
+    };
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include "stats.hpp"
 #include <variant>
 #include <istream>
 #include <ostream>
@@ -53,11 +54,14 @@ namespace quickcalc {
         Token _pending;
         bool _ready;
         int _line, _col;
+        Stats _stats;
 
     public:
         explicit Lexer(std::istream &input);
         Token read() override;
         Token peek() override;
+
+        const Stats &stats() const;
         
     private:
         Token readToken();
@@ -0,0 +1,382 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace quickcalc {
+    // Elementary functions with a vector implementation, if modifying check MATH in concepts.cpp
+    enum class MathFunction: int {
+        SQRT = 0,
+        EXP,
+        LOG,
+        SIN,
+        COS,
+        TAN,
+        POW,
+    };
+
+    /**
+     * @brief Elementary functions written once over a vector type, like BatchKernels
+     *
+     * Only correctly rounded operations are used, so every vector type gives the same bits as one
+     * lane at a time does, and the executor, virtual machines and batches agree. The approximations
+     * are those of fdlibm, without branches, and arguments outside the range they cover are passed
+     * to libm a lane at a time. Largest errors mathbench has seen, in units in the last place:
+     *
+     * sqrt 0.5, exp 0.9, log 0.75, sin and cos 0.8, tan 2.2, pow 0.85
+     *
+     * sin, cos and tan use libm when |x| >= 2^20 pi/2, log when x isn't positive and normal, and pow
+     * when x isn't positive and normal or the result is outside [2^-1020, 2^1020].
+     */
+    template<typename Simd>
+    struct MathKernels {
+        using V = typename Simd::V;
+
+        static V constant(uint64_t bits) {
+            double value;
+            std::memcpy(&value, &bits, sizeof(double));
+            return Simd::broadcast(value);
+        }
+
+        static V select(V mask, V a, V b) {
+            return Simd::bitOr(Simd::bitAnd(mask, a), Simd::bitAndNot(mask, b));
+        }
+
+        static V invert(V mask) {
+            return Simd::bitAndNot(mask, constant(~uint64_t(0)));
+        }
+
+        // Nearest integer, ties to even, for magnitudes below 2^51
+        static V round(V x) {
+            V magic = Simd::broadcast(0x1.8p52);
+            return Simd::subtract(Simd::add(x, magic), magic);
+        }
+
+        // Integer held in the low bits of a double, as left by adding 2^52 or 1.5 * 2^52
+        static V lowBits(V x, uint64_t mask) {
+            V twoTo52 = Simd::broadcast(0x1p52);
+            return Simd::subtract(Simd::bitOr(Simd::bitAnd(x, constant(mask)), twoTo52), twoTo52);
+        }
+
+        // 2^n for integer n from -1022 to 1023
+        static V pow2(V n) {
+            return Simd::shiftLeft(Simd::add(n, Simd::broadcast(0x1p52 + 1023)), 52);
+        }
+
+        static V polynomial(V x, double c0, double c1) {
+            return Simd::add(Simd::broadcast(c0), Simd::multiply(x, Simd::broadcast(c1)));
+        }
+
+        template<typename... Coefficients>
+        static V polynomial(V x, double c0, Coefficients... rest) {
+            return Simd::add(Simd::broadcast(c0), Simd::multiply(x, polynomial(x, rest...)));
+        }
+
+        /* exp */
+
+        static constexpr double LN2_HI = 6.93147180369123816490e-01;
+        static constexpr double LN2_LO = 1.90821492927058770002e-10;
+        static constexpr double INV_LN2 = 1.44269504088896338700e+00;
+
+        // e^(hi - lo) * 2^k, where |hi - lo| is at most about ln(2) / 2
+        static V expReduced(V hi, V lo, V k) {
+            V r = Simd::subtract(hi, lo);
+            V t = Simd::multiply(r, r);
+            V c = Simd::subtract(r, Simd::multiply(t, polynomial(t,
+                1.66666666666666019037e-01, -2.77777777770155933842e-03, 6.61375632143793436117e-05,
+                -1.65339022054652515390e-06, 4.13813679705723846039e-08)));
+            V two = Simd::broadcast(2.0);
+            V quotient = Simd::divide(Simd::multiply(r, c), Simd::subtract(two, c));
+            V y = Simd::subtract(Simd::broadcast(1.0), Simd::subtract(Simd::subtract(lo, quotient), hi));
+            // Scaled in two steps, so neither factor over or underflows when only the result does
+            V half = round(Simd::multiply(k, Simd::broadcast(0.5)));
+            return Simd::multiply(Simd::multiply(y, pow2(half)), pow2(Simd::subtract(k, half)));
+        }
+
+        static V exp(V x, V &special) {
+            special = Simd::broadcast(0.0);
+            // Clamped results still over or underflow, NaN compares false so is kept
+            V low = Simd::broadcast(-746.0);
+            V high = Simd::broadcast(710.0);
+            x = select(Simd::lessThan(x, low), low, select(Simd::lessThan(high, x), high, x));
+            V k = round(Simd::multiply(x, Simd::broadcast(INV_LN2)));
+            V hi = Simd::subtract(x, Simd::multiply(k, Simd::broadcast(LN2_HI)));
+            V lo = Simd::multiply(k, Simd::broadcast(LN2_LO));
+            return expReduced(hi, lo, k);
+        }
+
+        /* log */
+
+        static V normal(V x) {
+            return Simd::bitAnd(Simd::lessEqual(Simd::broadcast(0x1p-1022), x),
+                Simd::lessThan(x, Simd::broadcast(INFINITY)));
+        }
+
+        // Unbiased exponent of a positive normal x
+        static V exponent(V x) {
+            return Simd::subtract(lowBits(Simd::shiftRight(x, 52), 0x7ff), Simd::broadcast(1023.0));
+        }
+
+        // x scaled into [1, 2)
+        static V mantissa(V x) {
+            return Simd::bitOr(Simd::bitAnd(x, constant(0x000fffffffffffff)), constant(0x3ff0000000000000));
+        }
+
+        static V log(V x, V &special) {
+            special = invert(normal(x));
+            // x = 2^k (1 + f), with 1 + f from sqrt(2) / 2 to sqrt(2)
+            V k = exponent(x);
+            V m = mantissa(x);
+            V large = Simd::lessThan(Simd::broadcast(1.41421356237309504880), m);
+            m = select(large, Simd::multiply(m, Simd::broadcast(0.5)), m);
+            k = select(large, Simd::add(k, Simd::broadcast(1.0)), k);
+            V f = Simd::subtract(m, Simd::broadcast(1.0));
+
+            // log(1 + f) = f - f^2 / 2 + s (f^2 / 2 + R), with s = f / (2 + f)
+            V hfsq = Simd::multiply(Simd::broadcast(0.5), Simd::multiply(f, f));
+            V s = Simd::divide(f, Simd::add(Simd::broadcast(2.0), f));
+            V z = Simd::multiply(s, s);
+            V w = Simd::multiply(z, z);
+            V r = Simd::add(Simd::multiply(z, polynomial(w, 6.666666666666735130e-01, 2.857142874366239149e-01,
+                1.818357216161805012e-01, 1.479819860511658591e-01)), Simd::multiply(w, polynomial(w,
+                3.999999999940941908e-01, 2.222219843214978396e-01, 1.531383769920937332e-01)));
+            V result = Simd::multiply(s, Simd::add(hfsq, r));
+            result = Simd::add(result, Simd::multiply(k, Simd::broadcast(LN2_LO)));
+            result = Simd::add(Simd::subtract(result, hfsq), f);
+            return Simd::add(result, Simd::multiply(k, Simd::broadcast(LN2_HI)));
+        }
+
+        /* pow */
+
+        // Clears the low 32 bits, leaving a double whose products with another such double are exact
+        static V truncate(V x) {
+            return Simd::bitAnd(x, constant(0xffffffff00000000));
+        }
+
+        // fdlibm's pow, which carries log2(x) and y log2(x) with extra precision
+        static V pow(V x, V y, V &special) {
+            // x = 2^n m, with m from sqrt(3) / 2 to sqrt(3), then compared to 1 or 1.5 if above sqrt(3/2)
+            V n = exponent(x);
+            V m = mantissa(x);
+            V large = Simd::lessEqual(Simd::broadcast(1.73205080756887719318), m);
+            m = select(large, Simd::multiply(m, Simd::broadcast(0.5)), m);
+            n = select(large, Simd::add(n, Simd::broadcast(1.0)), n);
+            V middle = Simd::lessEqual(Simd::broadcast(1.22474487139158894067), m);
+            V base = select(middle, Simd::broadcast(1.5), Simd::broadcast(1.0));
+            V dpHi = Simd::bitAnd(middle, Simd::broadcast(5.84962487220764160156e-01));
+            V dpLo = Simd::bitAnd(middle, Simd::broadcast(1.35003920212974897128e-08));
+
+            // s = (m - base) / (m + base) as sHi + sLo
+            V u = Simd::subtract(m, base);
+            V v = Simd::divide(Simd::broadcast(1.0), Simd::add(m, base));
+            V s = Simd::multiply(u, v);
+            V sHi = truncate(s);
+            V tHi = truncate(Simd::add(m, base));
+            V tLo = Simd::subtract(m, Simd::subtract(tHi, base));
+            V sLo = Simd::multiply(v, Simd::subtract(Simd::subtract(u, Simd::multiply(sHi, tHi)), Simd::multiply(sHi, tLo)));
+
+            // log2(m / base) = 2 / (3 ln(2)) (3 s + s^3 + ...)
+            V s2 = Simd::multiply(s, s);
+            V r = Simd::multiply(Simd::multiply(s2, s2), polynomial(s2, 5.99999999999994648725e-01,
+                4.28571428578550184252e-01, 3.33333329818377432918e-01, 2.72728123808534006489e-01,
+                2.30660745775561754067e-01, 2.06975017800338417784e-01));
+            r = Simd::add(r, Simd::multiply(sLo, Simd::add(sHi, s)));
+            s2 = Simd::multiply(sHi, sHi);
+            V three = Simd::broadcast(3.0);
+            tHi = truncate(Simd::add(Simd::add(three, s2), r));
+            tLo = Simd::subtract(r, Simd::subtract(Simd::subtract(tHi, three), s2));
+            u = Simd::multiply(sHi, tHi);
+            v = Simd::add(Simd::multiply(sLo, tHi), Simd::multiply(tLo, s));
+            V pHi = truncate(Simd::add(u, v));
+            V pLo = Simd::subtract(v, Simd::subtract(pHi, u));
+            V zHi = Simd::multiply(Simd::broadcast(9.61796700954437255859e-01), pHi);
+            V zLo = Simd::add(Simd::add(Simd::multiply(Simd::broadcast(-7.02846165095275826516e-09), pHi),
+                Simd::multiply(pLo, Simd::broadcast(9.61796693925975554329e-01))), dpLo);
+
+            // log2(x) as t1 + t2
+            V t1 = truncate(Simd::add(Simd::add(Simd::add(zHi, zLo), dpHi), n));
+            V t2 = Simd::subtract(zLo, Simd::subtract(Simd::subtract(Simd::subtract(t1, n), dpHi), zHi));
+
+            // y log2(x) as pHi + pLo
+            V yHi = truncate(y);
+            pLo = Simd::add(Simd::multiply(Simd::subtract(y, yHi), t1), Simd::multiply(y, t2));
+            pHi = Simd::multiply(yHi, t1);
+            V z = Simd::add(pLo, pHi);
+            // NaN compares false, so is special too
+            special = invert(Simd::bitAnd(normal(x), Simd::lessThan(Simd::abs(z), Simd::broadcast(1020.0))));
+
+            // 2^(pHi + pLo) = 2^k e^((pHi - k + pLo) ln(2))
+            V k = round(z);
+            pHi = Simd::subtract(pHi, k);
+            V t = truncate(Simd::add(pLo, pHi));
+            u = Simd::multiply(t, Simd::broadcast(6.93147182464599609375e-01));
+            v = Simd::add(Simd::multiply(Simd::subtract(pLo, Simd::subtract(t, pHi)),
+                Simd::broadcast(6.93147180559945286227e-01)), Simd::multiply(t, Simd::broadcast(-1.90465429995776804525e-09)));
+            z = Simd::add(u, v);
+            V w = Simd::subtract(v, Simd::subtract(z, u));
+            t = Simd::multiply(z, z);
+            t1 = Simd::subtract(z, Simd::multiply(t, polynomial(t,
+                1.66666666666666019037e-01, -2.77777777770155933842e-03, 6.61375632143793436117e-05,
+                -1.65339022054652515390e-06, 4.13813679705723846039e-08)));
+            r = Simd::subtract(Simd::divide(Simd::multiply(z, t1), Simd::subtract(t1, Simd::broadcast(2.0))),
+                Simd::add(w, Simd::multiply(z, w)));
+            z = Simd::subtract(Simd::broadcast(1.0), Simd::subtract(r, z));
+            return Simd::multiply(z, pow2(k));
+        }
+
+        /* sin, cos and tan */
+
+        // Below 2^20 pi/2, where multiples of the parts of pi/2 are exact
+        static constexpr double REDUCIBLE = 1647099.0;
+
+        // a - b as sum + error, exactly
+        static V twoDifference(V a, V b, V &error) {
+            V sum = Simd::subtract(a, b);
+            V bb = Simd::subtract(sum, a);
+            error = Simd::subtract(Simd::subtract(a, Simd::subtract(sum, bb)), Simd::add(b, bb));
+            return sum;
+        }
+
+        // x less the nearest multiple n of pi/2, as hi + lo, with the multiple held in the low bits of quadrant
+        static void trigReduce(V x, V &hi, V &lo, V &quadrant) {
+            V n = round(Simd::multiply(x, Simd::broadcast(6.36619772367581382433e-01)));
+            quadrant = Simd::add(n, Simd::broadcast(0x1.8p52));
+            // pi/2 split into parts of 33 bits, so each multiple is exact, and the first difference too
+            V r = Simd::subtract(x, Simd::multiply(n, Simd::broadcast(1.57079632673412561417e+00)));
+            V error2, error3;
+            r = twoDifference(r, Simd::multiply(n, Simd::broadcast(6.07710050630396597660e-11)), error2);
+            r = twoDifference(r, Simd::multiply(n, Simd::broadcast(2.02226624871116645580e-21)), error3);
+            V w = Simd::subtract(Simd::multiply(n, Simd::broadcast(8.47842766036889956997e-32)), Simd::add(error3, error2));
+            hi = Simd::subtract(r, w);
+            lo = Simd::subtract(Simd::subtract(r, hi), w);
+        }
+
+        // sin(x + y) for |x| up to pi/4 and y much smaller
+        static V sinKernel(V x, V y) {
+            V z = Simd::multiply(x, x);
+            V w = Simd::multiply(z, z);
+            V r = Simd::add(polynomial(z, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+                2.75573137070700676789e-06), Simd::multiply(Simd::multiply(z, w),
+                polynomial(z, -2.50507602534068634195e-08, 1.58969099521155010221e-10)));
+            V v = Simd::multiply(z, x);
+            V inner = Simd::subtract(Simd::multiply(Simd::broadcast(0.5), y), Simd::multiply(v, r));
+            inner = Simd::subtract(Simd::subtract(Simd::multiply(z, inner), y),
+                Simd::multiply(v, Simd::broadcast(-1.66666666666666324348e-01)));
+            return Simd::subtract(x, inner);
+        }
+
+        // cos(x + y) for |x| up to pi/4 and y much smaller
+        static V cosKernel(V x, V y) {
+            V z = Simd::multiply(x, x);
+            V w = Simd::multiply(z, z);
+            V r = Simd::add(Simd::multiply(z, polynomial(z, 4.16666666666666019037e-02,
+                -1.38888888888741095749e-03, 2.48015872894767294178e-05)), Simd::multiply(Simd::multiply(w, w),
+                polynomial(z, -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11)));
+            V hz = Simd::multiply(Simd::broadcast(0.5), z);
+            V one = Simd::broadcast(1.0);
+            w = Simd::subtract(one, hz);
+            V correction = Simd::subtract(Simd::multiply(z, r), Simd::multiply(x, y));
+            return Simd::add(w, Simd::add(Simd::subtract(Simd::subtract(one, w), hz), correction));
+        }
+
+        static V trig(MathFunction function, V x, V &special) {
+            special = invert(Simd::lessThan(Simd::abs(x), Simd::broadcast(REDUCIBLE)));
+            V hi, lo, quadrant;
+            trigReduce(x, hi, lo, quadrant);
+            V sin = sinKernel(hi, lo);
+            V cos = cosKernel(hi, lo);
+            V half = Simd::broadcast(0.5);
+            V odd = Simd::lessThan(half, lowBits(quadrant, 1));
+            V negative = Simd::lessThan(half, lowBits(quadrant, 2));
+            V result;
+            switch (function) {
+            case MathFunction::SIN:
+                result = select(odd, cos, sin);
+                return select(negative, Simd::negate(result), result);
+            case MathFunction::COS:
+                result = select(odd, Simd::negate(sin), cos);
+                return select(negative, Simd::negate(result), result);
+            default:
+                // The sign flips every half turn, so only odd quadrants matter
+                return select(odd, Simd::negate(Simd::divide(cos, sin)), Simd::divide(sin, cos));
+            }
+        }
+
+        /* evaluation */
+
+        // Fallback is called for the lanes operation marks as special, with the original arguments
+        template<typename Operation, typename Fallback>
+        static void apply(double *a, const double *b, size_t lanes, Operation operation, Fallback fallback) {
+            for (size_t i = 0; i < lanes; i += Simd::WIDTH) {
+                V x = Simd::load(a + i);
+                V y = b ? Simd::load(b + i) : x;
+                V special;
+                Simd::store(a + i, operation(x, y, special));
+                if (Simd::any(special)) {
+                    double xs[Simd::WIDTH], ys[Simd::WIDTH], masks[Simd::WIDTH];
+                    Simd::store(xs, x);
+                    Simd::store(ys, y);
+                    Simd::store(masks, special);
+                    for (size_t lane = 0; lane < Simd::WIDTH; lane++) {
+                        uint64_t bits;
+                        std::memcpy(&bits, masks + lane, sizeof(double));
+                        if (bits) {
+                            a[i + lane] = fallback(xs[lane], ys[lane]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Unary operations take x and special, and their fallbacks take x
+        template<typename Operation, typename Fallback>
+        static void apply(double *a, size_t lanes, Operation operation, Fallback fallback) {
+            apply(a, nullptr, lanes, [operation] (V x, V, V &special) { return operation(x, special); },
+                [fallback] (double x, double) { return fallback(x); });
+        }
+
+        /**
+         * @brief Replaces each lane of a with the function of it, and of b for pow
+         *
+         * @param function Function to evaluate
+         * @param a First argument of each lane, replaced with the result
+         * @param b Second argument of each lane, only read by pow
+         * @param lanes Number of lanes, a multiple of the vector width
+         */
+        static void evaluate(MathFunction function, double *a, const double *b, size_t lanes) {
+            switch (function) {
+            case MathFunction::SQRT:
+                apply(a, lanes, [] (V x, V &special) {
+                    special = Simd::broadcast(0.0);
+                    return Simd::sqrt(x);
+                }, [] (double x) { return std::sqrt(x); });
+                break;
+            case MathFunction::EXP:
+                apply(a, lanes, [] (V x, V &special) { return exp(x, special); },
+                    [] (double x) { return std::exp(x); });
+                break;
+            case MathFunction::LOG:
+                apply(a, lanes, [] (V x, V &special) { return log(x, special); },
+                    [] (double x) { return std::log(x); });
+                break;
+            case MathFunction::SIN:
+                apply(a, lanes, [] (V x, V &special) { return trig(MathFunction::SIN, x, special); },
+                    [] (double x) { return std::sin(x); });
+                break;
+            case MathFunction::COS:
+                apply(a, lanes, [] (V x, V &special) { return trig(MathFunction::COS, x, special); },
+                    [] (double x) { return std::cos(x); });
+                break;
+            case MathFunction::TAN:
+                apply(a, lanes, [] (V x, V &special) { return trig(MathFunction::TAN, x, special); },
+                    [] (double x) { return std::tan(x); });
+                break;
+            case MathFunction::POW:
+                apply(a, b, lanes, [] (V x, V y, V &special) { return pow(x, y, special); },
+                    [] (double x, double y) { return std::pow(x, y); });
+                break;
+            }
+        }
+    };
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+namespace quickcalc {
+    struct MemoStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t size = 0;
+    };
+
+    // Bounded cache of a function's results keyed on the bit patterns of its arguments, evicted by clock
+    class MemoCache {
+        // Entries are identified by index, the index one past the last entry is the probe
+        struct KeyHash {
+            const MemoCache *cache;
+            size_t operator()(size_t entry) const;
+        };
+        struct KeyEqual {
+            const MemoCache *cache;
+            bool operator()(size_t a, size_t b) const;
+        };
+
+        size_t _arity;
+        size_t _capacity;
+        std::vector<double> _keys;
+        std::vector<double> _values;
+        std::vector<bool> _referenced;
+        std::unordered_set<size_t, KeyHash, KeyEqual> _entries;
+        size_t _hand;
+        MemoStats _stats;
+    public:
+        MemoCache(size_t arity, size_t capacity);
+        MemoCache(const MemoCache &) = delete;
+        MemoCache &operator=(const MemoCache &) = delete;
+
+        size_t arity() const;
+        double *probe();
+        bool find(double &value);
+        void insert(double value);
+
+        const MemoStats &stats() const;
+
+    private:
+        size_t evict();
+    };
+}
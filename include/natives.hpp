@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace quickcalc {
+    // Called with the value of every argument, in order, possibly from several threads at once and from
+    // machine code, so it mustn't throw
+    using NativeCall = double (*)(const double *args, size_t count);
+    // Called with a column per argument, each with a value per row, and fills in a result per row
+    using NativeColumns = void (*)(const double *const *args, size_t count, double *results, size_t rows);
+
+    // Layout of NativeDefinition and NativeLibrary, libraries built against another version aren't loaded
+    constexpr uint32_t NATIVE_ABI_VERSION = 1;
+    // maxArgs of a function taking any number of arguments
+    constexpr uint32_t NATIVE_VARIADIC = UINT32_MAX;
+
+    enum NativeFlags: uint32_t {
+        // The result only depends on the arguments, so calls may be folded, shared and memoized
+        NATIVE_PURE = 1,
+        // Calls are safe to make for rows a branch doesn't take, so batches evaluate them for a whole block
+        NATIVE_VECTORIZABLE = 2,
+    };
+
+    // Function given to registerNative, or exported by a library, with the same layout in every compiler
+    struct NativeDefinition {
+        const char *name;
+        NativeCall call;
+        // Optional, only used for vectorizable functions
+        NativeColumns columns;
+        uint32_t minArgs;
+        uint32_t maxArgs;
+        uint32_t flags;
+    };
+
+    // Returned by the entry point of a library, which must stay valid until the process exits
+    struct NativeLibrary {
+        uint32_t abiVersion;
+        uint32_t count;
+        const NativeDefinition *functions;
+    };
+
+    // Name of the entry point every library exports with C linkage, taking nothing and returning a NativeLibrary
+    constexpr const char *NATIVE_ENTRY = "quickcalcNatives";
+    using NativeEntry = const NativeLibrary *(*)();
+
+    /**
+     * @brief Builtin taking evaluated arguments, registered for the rest of the process
+     *
+     * User definitions shadow native functions as they do builtins, native functions are resolved after
+     * builtins so can't replace them.
+     */
+    struct NativeFunction {
+        std::string name;
+        NativeCall call;
+        NativeColumns columns;
+        size_t minArgs;
+        size_t maxArgs;
+        bool pure;
+        bool vectorizable;
+
+        bool accepts(size_t count) const;
+        std::string arityError(size_t count) const;
+    };
+
+    int32_t registerNative(const NativeDefinition &definition);
+    size_t loadNativeLibrary(const std::string &path);
+    bool tryGetNative(const std::string &name, int32_t &index);
+    const NativeFunction &nativeFunction(int32_t index);
+}
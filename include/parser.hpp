@@ -1,23 +1,29 @@
 #pragma once
 #include "lexer.hpp"
 #include "ast.hpp"
+#include "stats.hpp"
 
 namespace quickcalc {
     class Parser {
         ILexer &_lexer;
+        int _depth;
+        Stats _stats;
 
     public:
         Parser(ILexer &lexer);
         std::unique_ptr<StmtNode> parse();
 
+        const Stats &stats() const;
+
     private:
         std::unique_ptr<StmtNode> exprStmt();
         std::unique_ptr<StmtNode> funcDef();
-        std::unique_ptr<ExprNode> additive();
-        std::unique_ptr<ExprNode> multiplicative();
-        std::unique_ptr<ExprNode> expression();
-        std::unique_ptr<ExprNode> brackets();
-        std::unique_ptr<ExprNode> funcCall();
+        ExprNode::ptr additive();
+        ExprNode::ptr multiplicative();
+        ExprNode::ptr expression();
+        ExprNode::ptr primary();
+        ExprNode::ptr brackets();
+        ExprNode::ptr funcCall();
 
         std::string generateError(const std::string &message, const Token &token);
     };
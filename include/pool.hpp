@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quickcalc {
+    /**
+     * @brief Fixed set of threads which share out ranges of items, stealing from each other when idle
+     *
+     * The thread calling run is always worker 0, so a pool of one worker starts no threads.
+     */
+    class WorkerPool {
+    public:
+        // Processes items [begin, end) on the given worker, the same worker never runs two tasks at once
+        using Task = std::function<void(size_t worker, size_t begin, size_t end)>;
+    private:
+        // Chunks a worker has left to run, packed as begin and end indices so both change together
+        struct alignas(64) Queue {
+            std::atomic<uint64_t> range { 0 };
+        };
+
+        std::vector<std::thread> _threads;
+        std::unique_ptr<Queue[]> _queues;
+        size_t _workers;
+        std::mutex _mutex;
+        std::condition_variable _started;
+        std::condition_variable _finished;
+        // Incremented to start each run, threads wait for it to change
+        uint64_t _run;
+        size_t _running;
+        bool _stopping;
+        // Only valid during a run
+        const Task *_task;
+        size_t _items;
+        size_t _chunk;
+        std::atomic<bool> _failed;
+        std::exception_ptr _error;
+    public:
+        explicit WorkerPool(size_t workers = std::thread::hardware_concurrency());
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+        ~WorkerPool();
+
+        size_t size() const;
+        void run(size_t items, size_t chunk, const Task &task);
+
+    private:
+        void loop(size_t worker);
+        void work(size_t worker);
+        bool take(size_t worker, uint32_t &chunk);
+        bool steal(size_t worker, uint32_t &chunk);
+    };
+}
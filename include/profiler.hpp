@@ -0,0 +1,94 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace quickcalc {
+    /**
+     * @brief Times the calls an executor makes to definitions and builtins, by name
+     *
+     * Each call costs two reads of the clock and a lookup of the name, and an executor without a profiler
+     * only checks for one, so it's cheap enough to attach to a sample of evaluations. Every call is
+     * recorded under the stack of calls it was made from, which can be written out as collapsed stacks
+     * for flame graph tools. Recursive calls, direct or not, are folded into the outermost call of the
+     * same function still in progress, so no function appears twice in a stack and deep recursion
+     * records no more stacks than shallow recursion does.
+     */
+    class Profiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct Function {
+            std::string name;
+            uint64_t calls = 0;
+            // Time from entering to leaving the outermost call, so recursion isn't counted twice
+            Clock::duration inclusive = Clock::duration::zero();
+            // Time in the function itself, not in the functions it called
+            Clock::duration exclusive = Clock::duration::zero();
+            // Most calls of the function in progress at once
+            size_t maxDepth = 0;
+        };
+
+        // Records one call for as long as it lives, including when the call throws
+        class Call {
+            Profiler &_profiler;
+        public:
+            Call(Profiler &profiler, const std::string &name);
+            Call(const Call &) = delete;
+            Call &operator=(const Call &) = delete;
+            ~Call();
+        };
+    private:
+        struct Entry {
+            Function function;
+            size_t depth = 0;
+            // Stack of the outermost call in progress, which recursive calls are recorded under
+            uint32_t stack = 0;
+        };
+
+        // Node of the tree of every stack of calls seen
+        struct Stack {
+            uint32_t function;
+            uint32_t parent;
+            Clock::duration exclusive = Clock::duration::zero();
+            // Function and stack of each call made from here, there are rarely enough to be worth hashing
+            std::vector<std::pair<uint32_t, uint32_t>> children;
+
+            Stack(uint32_t function, uint32_t parent): function(function), parent(parent) {
+            }
+        };
+
+        struct Frame {
+            uint32_t function;
+            uint32_t stack;
+            Clock::time_point start;
+            // Inclusive time of the calls made by this one so far
+            Clock::duration children;
+        };
+
+        std::vector<Entry> _functions;
+        std::unordered_map<std::string, uint32_t> _names;
+        // Names are usually the same string every time a call site is reached, so are found by address first
+        std::unordered_map<const std::string *, uint32_t> _addresses;
+        std::vector<Stack> _stacks;
+        std::vector<Frame> _frames;
+    public:
+        Profiler();
+
+        void enter(const std::string &name);
+        void leave();
+
+        std::vector<Function> functions() const;
+        void report(std::ostream &stream) const;
+        void writeCollapsed(std::ostream &stream) const;
+        void clear();
+
+    private:
+        uint32_t intern(const std::string &name);
+    };
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "context.hpp"
+#include "strictness.hpp"
+#include "symbols.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace quickcalc {
+    /**
+     * @brief Set of definitions and formulas compiled once, which never changes afterwards
+     *
+     * Every name is resolved when the program is built, and nothing refers back to the statements it was
+     * built from. Any number of threads can evaluate the same program at once, each with its own
+     * execution context. Results aren't memoized, as memo caches can't be shared between threads.
+     */
+    class Program {
+        SymbolTable _symbols;
+        std::vector<Code> _code;
+        std::vector<StrictMask> _strict;
+        // Compiled expression statements, in the order they were given
+        std::vector<Function> _formulas;
+        bool _byNeed;
+    public:
+        explicit Program(const std::vector<StmtNode *> &statements, const VMOptions &options = VMOptions());
+
+        size_t formulas() const;
+        int32_t function(const std::string &name) const;
+        size_t arity(int32_t function) const;
+        size_t bytes() const;
+
+        double evaluate(ExecutionContext &context, size_t formula) const;
+        double call(ExecutionContext &context, int32_t function, const double *args, size_t count) const;
+        double call(ExecutionContext &context, int32_t function, const std::vector<double> &args) const;
+    };
+}
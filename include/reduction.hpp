@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace quickcalc {
+    // How the values of a loop's body are combined, if modifying check the loop builtins in concepts.cpp
+    enum class Reduction: int {
+        SUM = 0,
+        PRODUCT,
+        MINIMUM,
+        MAXIMUM,
+        // Each value replaces an accumulator the body refers to by name, so indices are visited in order
+        FOLD,
+    };
+
+    // Indices combined one after another before blocks are combined pairwise
+    constexpr uint64_t REDUCTION_BLOCK = 1024;
+
+    double reductionIdentity(Reduction reduction);
+    double combine(Reduction reduction, double a, double b);
+    bool rangeLength(double lo, double hi, uint64_t &length);
+
+    /**
+     * @brief Combines the values of a loop in an order which doesn't depend on how the loop is run
+     *
+     * Values are combined left to right within blocks of REDUCTION_BLOCK, and whole blocks are combined
+     * pairwise as a balanced tree, like carries in a binary counter. Any aligned run of a power of two
+     * blocks is combined into one value before anything outside it, so threads can each reduce runs of
+     * their own and combine them with addBlocks, giving the same bits as a single thread.
+     */
+    class PairwiseReduction {
+        struct Entry {
+            double value;
+            uint64_t blocks;
+        };
+
+        Reduction _reduction;
+        // Values of the block being filled, combined so far
+        double _block;
+        uint64_t _count;
+        // Combined runs of whole blocks, each half the size of the one below, so never more than 64
+        Entry _entries[64];
+        size_t _size;
+    public:
+        explicit PairwiseReduction(Reduction reduction = Reduction::SUM);
+
+        void add(double value);
+        void addBlocks(double value, uint64_t blocks);
+        void addPartial(double value);
+        double result() const;
+    };
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "ast.hpp"
+#include "executor.hpp"
+#include "fiber.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace quickcalc {
+    struct SchedulerOptions {
+        // Threads evaluating statements, at least one
+        size_t workers = 1;
+        // Nodes a statement evaluates before it yields to the next session waiting for its turn
+        uint64_t slice = 10000;
+        // Nodes each statement may evaluate in total before it's stopped with FuelExhausted
+        uint64_t fuel = UNLIMITED_FUEL;
+        // Stack of each evaluation in progress, only the pages it uses are committed
+        size_t stackSize = Fiber::DEFAULT_STACK;
+    };
+
+    /**
+     * @brief Interleaves the statements of many sessions on a few threads, a slice at a time
+     *
+     * Every session has its own executor, so its own definitions, and runs its statements in the order
+     * they were submitted. Sessions with work take turns on the workers: each statement evaluates one
+     * slice of nodes on its own fiber, then yields to the back of the queue until every other waiting
+     * session has had a turn. A cheap statement is never held up by more than a slice from each session
+     * ahead of it, however expensive theirs are. Suspended statements only keep their fiber's stack, and
+     * are resumed by whichever worker is free. Without fuel metering statements run to completion once
+     * started.
+     */
+    class Scheduler {
+    public:
+        // What a statement gave, nothing for definitions
+        using Result = std::optional<double>;
+    private:
+        struct Task {
+            StmtNode::ptr statement;
+            std::promise<Result> result;
+        };
+
+        struct Session {
+            size_t id = 0;
+            Executor executor;
+            std::deque<Task> tasks;
+            // Runs the statement at the front of tasks, only set while it's in progress
+            std::unique_ptr<Fiber> fiber;
+            // Definitions the executor refers to, kept for as long as the session lives
+            std::vector<StmtNode::ptr> definitions;
+            // Fuel the statement in progress has left after the slice it's evaluating
+            uint64_t fuel = 0;
+            // Set while the session is queued or being run by a worker
+            bool scheduled = false;
+            bool closed = false;
+        };
+
+        SchedulerOptions _options;
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _ready;
+        std::unordered_map<size_t, std::unique_ptr<Session>> _sessions;
+        std::deque<Session *> _queue;
+        // Fibers of finished statements, kept for the next to start
+        std::vector<std::unique_ptr<Fiber>> _fibers;
+        size_t _nextSession;
+        // Read by statements as they yield, without the lock
+        std::atomic<bool> _stopping;
+    public:
+        explicit Scheduler(const SchedulerOptions &options = SchedulerOptions());
+        Scheduler(const Scheduler &) = delete;
+        Scheduler &operator=(const Scheduler &) = delete;
+        ~Scheduler();
+
+        size_t open();
+        void close(size_t session);
+        std::future<Result> submit(size_t session, StmtNode::ptr statement);
+
+        size_t sessions();
+
+    private:
+        void loop();
+        void run(Session &session);
+        void start(Session &session);
+        uint64_t checkpoint(Session &session);
+    };
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "ast.hpp"
+#include "vm.hpp"
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace quickcalc {
+    /**
+     * @brief Keeps the result of every statement up to date as definitions change, like a spreadsheet
+     *
+     * Only results which depend on a changed definition, directly or through other definitions, are
+     * recomputed. Definitions without parameters are cached by the virtual machine until something
+     * they use changes, so unchanged values are never evaluated twice.
+     */
+    class Session: public NodeVisitor {
+        struct Formula {
+            // Copy of the statement's expression, statements don't need to outlive the session
+            ExprNode::ptr expression;
+            double value = 0.0;
+            std::exception_ptr error;
+        };
+
+        VM _vm;
+        std::vector<Formula> _formulas;
+        // Names each definition calls, other than its parameters
+        std::unordered_map<std::string, std::unordered_set<std::string>> _calls;
+        // Definitions, and separately formulas, which call each name
+        std::unordered_map<std::string, std::unordered_set<std::string>> _callers;
+        std::unordered_map<std::string, std::vector<size_t>> _readers;
+        std::vector<size_t> _updated;
+        size_t _recomputed;
+        double _lastResult;
+        bool _hasResult;
+    public:
+        explicit Session(const VMOptions &options = VMOptions());
+
+        void visit(ExprStmtNode *node) override;
+        void visit(FuncDefNode *node) override;
+
+        double lastResult() const;
+        bool hasResult() const;
+
+        size_t formulas() const;
+        double value(size_t formula) const;
+        const std::vector<size_t> &updated() const;
+        size_t recomputed() const;
+
+    private:
+        void recompute(Formula &formula);
+    };
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "integer.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace quickcalc {
+    // One lane at a time, with masks held as the bit patterns of doubles
+    struct ScalarSimd {
+        using V = double;
+        static constexpr size_t WIDTH = 1;
+
+        static uint64_t bits(double value) {
+            uint64_t result;
+            std::memcpy(&result, &value, sizeof(double));
+            return result;
+        }
+
+        static double fromBits(uint64_t value) {
+            double result;
+            std::memcpy(&result, &value, sizeof(double));
+            return result;
+        }
+
+        static V load(const double *values) { return *values; }
+        static void store(double *values, V value) { *values = value; }
+        static V broadcast(double value) { return value; }
+        static V add(V a, V b) { return a + b; }
+        static V subtract(V a, V b) { return a - b; }
+        static V multiply(V a, V b) { return a * b; }
+        static V divide(V a, V b) { return a / b; }
+        static V sqrt(V a) { return std::sqrt(a); }
+        static V abs(V a) { return std::abs(a); }
+        static V negate(V a) { return -a; }
+        static V integerNot(V a) { return static_cast<double>(~toInteger(a)); }
+        static V integerAnd(V a, V b) { return static_cast<double>(toInteger(a) & toInteger(b)); }
+        static V integerOr(V a, V b) { return static_cast<double>(toInteger(a) | toInteger(b)); }
+        static V integerXor(V a, V b) { return static_cast<double>(toInteger(a) ^ toInteger(b)); }
+        static V lessThan(V a, V b) { return fromBits(a < b ? ~uint64_t(0) : 0); }
+        static V lessEqual(V a, V b) { return fromBits(a <= b ? ~uint64_t(0) : 0); }
+        static V bitAnd(V a, V b) { return fromBits(bits(a) & bits(b)); }
+        static V bitOr(V a, V b) { return fromBits(bits(a) | bits(b)); }
+        static V bitAndNot(V a, V b) { return fromBits(~bits(a) & bits(b)); }
+        // Shift the bits of each lane as a 64 bit integer
+        static V shiftLeft(V a, int count) { return fromBits(bits(a) << count); }
+        static V shiftRight(V a, int count) { return fromBits(bits(a) >> count); }
+        static bool any(V mask) { return bits(mask) != 0; }
+    };
+
+    // Neither SSE2 nor AVX convert doubles to 64 bit integers, so bitwise operators are done a lane at a time
+    template<typename Simd>
+    typename Simd::V eachLane(typename Simd::V a, typename Simd::V b, double (*operation)(double, double)) {
+        double lhs[Simd::WIDTH], rhs[Simd::WIDTH];
+        Simd::store(lhs, a);
+        Simd::store(rhs, b);
+        for (size_t i = 0; i < Simd::WIDTH; i++) {
+            lhs[i] = operation(lhs[i], rhs[i]);
+        }
+        return Simd::load(lhs);
+    }
+
+#ifdef __SSE2__
+    struct Sse2Simd {
+        using V = __m128d;
+        static constexpr size_t WIDTH = 2;
+
+        static V load(const double *values) { return _mm_loadu_pd(values); }
+        static void store(double *values, V value) { _mm_storeu_pd(values, value); }
+        static V broadcast(double value) { return _mm_set1_pd(value); }
+        static V add(V a, V b) { return _mm_add_pd(a, b); }
+        static V subtract(V a, V b) { return _mm_sub_pd(a, b); }
+        static V multiply(V a, V b) { return _mm_mul_pd(a, b); }
+        static V divide(V a, V b) { return _mm_div_pd(a, b); }
+        static V sqrt(V a) { return _mm_sqrt_pd(a); }
+        static V abs(V a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+        static V negate(V a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+        static V integerNot(V a) { return eachLane<Sse2Simd>(a, a, [] (double x, double) { return ScalarSimd::integerNot(x); }); }
+        static V integerAnd(V a, V b) { return eachLane<Sse2Simd>(a, b, ScalarSimd::integerAnd); }
+        static V integerOr(V a, V b) { return eachLane<Sse2Simd>(a, b, ScalarSimd::integerOr); }
+        static V integerXor(V a, V b) { return eachLane<Sse2Simd>(a, b, ScalarSimd::integerXor); }
+        static V lessThan(V a, V b) { return _mm_cmplt_pd(a, b); }
+        static V lessEqual(V a, V b) { return _mm_cmple_pd(a, b); }
+        static V bitAnd(V a, V b) { return _mm_and_pd(a, b); }
+        static V bitOr(V a, V b) { return _mm_or_pd(a, b); }
+        static V bitAndNot(V a, V b) { return _mm_andnot_pd(a, b); }
+        static V shiftLeft(V a, int count) { return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a), count)); }
+        static V shiftRight(V a, int count) { return _mm_castsi128_pd(_mm_srli_epi64(_mm_castpd_si128(a), count)); }
+        static bool any(V mask) { return _mm_movemask_pd(mask) != 0; }
+    };
+#endif
+}
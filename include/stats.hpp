@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+namespace quickcalc {
+#ifdef QC_STATS
+    constexpr bool STATS_COUNTED = true;
+#else
+    constexpr bool STATS_COUNTED = false;
+#endif
+
+    // Work done by each phase, every counter stays at 0 in builds without QC_STATS
+    struct Stats {
+        // Tokens read by lexers
+        uint64_t tokens = 0;
+        // Nodes built by parsers
+        uint64_t nodes = 0;
+        uint64_t statePushes = 0;
+        uint64_t statePops = 0;
+        // Names looked up by executors, and the parent states walked past to find them
+        uint64_t lookups = 0;
+        uint64_t lookupHops = 0;
+        // Most values an executor held on its stack at once
+        uint64_t valuePeak = 0;
+
+        Stats &operator+=(const Stats &other);
+        void print(std::ostream &stream) const;
+    };
+
+    // Adds to a counter, compiled out entirely without QC_STATS
+    inline void count(uint64_t &counter, uint64_t amount = 1) {
+#ifdef QC_STATS
+        counter += amount;
+#else
+        static_cast<void>(counter);
+        static_cast<void>(amount);
+#endif
+    }
+}
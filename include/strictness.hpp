@@ -0,0 +1,44 @@
+#pragma once
+#include "ast.hpp"
+#include "concepts.hpp"
+#include "symbols.hpp"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace quickcalc {
+    // Bit i is set if parameter i is always evaluated, parameters past the 64th are never strict
+    using StrictMask = uint64_t;
+
+    constexpr StrictMask ALL_STRICT = ~StrictMask(0);
+
+    class Strictness: public NodeVisitor {
+    public:
+        // Gives the strictness of a defined global, 0 if unknown
+        using Lookup = std::function<StrictMask(int32_t slot)>;
+    private:
+        SymbolTable &_symbols;
+        Lookup _lookup;
+        const std::vector<std::string> *_paramNames;
+        std::vector<int32_t> _callees;
+        bool _impure;
+        StrictMask _result;
+    public:
+        Strictness(SymbolTable &symbols, const Lookup &lookup);
+
+        StrictMask analyse(FuncDefNode *node);
+        StrictMask analyse(ExprNode *node, const std::vector<std::string> &paramNames);
+        const std::vector<int32_t> &callees() const;
+        bool impure() const;
+
+        void visit(ConstNode *node) override;
+        void visit(UnaryOperationNode *node) override;
+        void visit(BinaryOperationNode *node) override;
+        void visit(FunctionInvocationNode *node) override;
+        void visit(SharedExprNode *node) override;
+
+    private:
+        StrictMask loop(Builtin builtin, const std::vector<ExprNode::ptr> &params);
+        StrictMask evaluated(ExprNode *node);
+    };
+}
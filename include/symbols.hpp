@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace quickcalc {
+    enum class BindingKind: int {
+        PARAMETER = 0,
+        GLOBAL,
+        BUILTIN,
+        NATIVE,
+    };
+
+    // What a name refers to, index is a parameter index, global slot, Builtin value or native function
+    struct Binding {
+        BindingKind kind;
+        int index;
+    };
+
+    class SymbolTable {
+        std::unordered_map<std::string, int> _slots;
+        std::vector<std::string> _names;
+        std::vector<bool> _defined;
+    public:
+        Binding resolve(const std::vector<std::string> &paramNames, const std::string &name);
+        int slot(const std::string &name);
+        bool tryGetSlot(const std::string &name, int &slot) const;
+        const std::string &name(int slot) const;
+        size_t size() const;
+
+        void define(int slot);
+        bool isDefined(int slot) const;
+        bool isDefined(const std::string &name) const;
+    };
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "ast.hpp"
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "compiler.hpp"
+#include "context.hpp"
+#include "jit.hpp"
+#include "memo.hpp"
+#include "pool.hpp"
+#include "strictness.hpp"
+#include "symbols.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace quickcalc {
+    class VM: public NodeVisitor {
+        // Definition of a global and what's known about it, its compiled code is kept separately
+        struct Global {
+            FuncDefNode *node = nullptr;
+            // Generation in which everything reachable from this function was last checked to be defined
+            uint64_t linked = 0;
+            std::vector<int32_t> callees;
+            // Calls a native function which isn't pure
+            bool impure = false;
+            StrictMask strict = 0;
+            bool strictKnown = false;
+            // Whether the function has been considered for compiling to machine code since it last changed
+            bool nativeKnown = false;
+        };
+
+        VMOptions _options;
+        SymbolTable _symbols;
+        std::vector<Global> _globals;
+        // Compiled code of each global, only ever read while running
+        std::vector<Code> _code;
+        uint64_t _generation;
+        ExecutionContext _context;
+        // Contexts for the other workers of a pool, kept between batches
+        std::vector<std::unique_ptr<ExecutionContext>> _workers;
+        double _lastResult;
+        bool _hasResult;
+    public:
+        VM();
+        explicit VM(size_t stackSize);
+        explicit VM(const VMOptions &options);
+
+        void visit(ExprStmtNode *node) override;
+        void visit(FuncDefNode *node) override;
+
+        double evaluate(ExprNode *node);
+        Function prepare(ExprNode *node);
+        double evaluate(const Function &script);
+        BatchProgram prepare(ExprNode *node, const std::vector<std::string> &columns);
+        void evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                      double *results);
+        void evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                      double *results, WorkerPool &pool);
+
+        double lastResult() const;
+        bool hasResult() const;
+
+        bool isDefined(const std::string &name) const;
+        StrictMask strictness(const std::string &name);
+        MemoStats memoStats(const std::string &name) const;
+        bool isNative(const std::string &name) const;
+
+    private:
+        void invalidate(int32_t slot);
+        void resizeGlobals();
+        void reset(size_t slot);
+        bool memoizable(int32_t slot);
+        bool reachesImpure(int32_t slot);
+        bool takesEvaluatedArgs(int32_t slot);
+        StrictMask strictness(int32_t slot);
+        Compiler makeCompiler();
+        void link(const std::vector<int32_t> &globals);
+        const Function &compile(int32_t slot);
+        void compileNative(const std::vector<int32_t> &slots);
+        double run(const Function &function);
+        double call(int32_t slot, const double *args, size_t count);
+
+        friend class Program;
+    };
+}
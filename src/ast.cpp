@@ -1,7 +1,28 @@
 #include "ast.hpp"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_set>
 
 using namespace quickcalc;
 
+namespace {
+    // Distinguishes node types with the same children when hashing
+    enum class NodeKind: size_t {
+        EXPR_STMT = 1,
+        FUNC_DEF,
+        CONST,
+        UNARY_OPERATION,
+        BINARY_OPERATION,
+        FUNCTION_INVOCATION,
+        SHARED_EXPR,
+    };
+
+    size_t kindHash(NodeKind kind, size_t value) {
+        return hashCombine(static_cast<size_t>(kind), value);
+    }
+}
+
 bool Node::operator!=(const Node &other) const {
     return !(*this == other);
 }
@@ -17,6 +38,10 @@ ExprNode *ExprStmtNode::expression() const {
     return _expression.get();
 }
 
+ExprNode::ptr &ExprStmtNode::mutableExpression() {
+    return _expression;
+}
+
 void ExprStmtNode::accept(NodeVisitor &visitor) {
     visitor.visit(this);
 }
@@ -29,6 +54,10 @@ bool ExprStmtNode::operator==(const Node &other) const {
     return *_expression == *otherStmt._expression;
 }
 
+size_t ExprStmtNode::hash() const {
+    return kindHash(NodeKind::EXPR_STMT, _expression->hash());
+}
+
 FuncDefNode::FuncDefNode(const std::string &name, ExprNode::ptr &&expression, std::vector<std::string> &&paramNames):
     _name(name), _expression(std::move(expression)), _paramNames(std::move(paramNames)) {
 }
@@ -41,6 +70,10 @@ ExprNode *FuncDefNode::expression() const {
     return _expression.get();
 }
 
+ExprNode::ptr &FuncDefNode::mutableExpression() {
+    return _expression;
+}
+
 const std::vector<std::string> &FuncDefNode::paramNames() const {
     return _paramNames;
 }
@@ -59,6 +92,14 @@ bool FuncDefNode::operator==(const Node &other) const {
            && *_expression == *otherStmt._expression;
 }
 
+size_t FuncDefNode::hash() const {
+    size_t hash = kindHash(NodeKind::FUNC_DEF, std::hash<std::string>()(_name));
+    for (const std::string &param : _paramNames) {
+        hash = hashCombine(hash, std::hash<std::string>()(param));
+    }
+    return hashCombine(hash, _expression->hash());
+}
+
 bool FuncDefNode::canSafeDelete() const {
     return false;
 }
@@ -71,6 +112,10 @@ double ConstNode::value() const {
     return _value;
 }
 
+ExprNode::ptr ConstNode::clone() const {
+    return std::make_unique<ConstNode>(_value);
+}
+
 void ConstNode::accept(NodeVisitor &visitor) {
     visitor.visit(this);
 }
@@ -83,6 +128,14 @@ bool ConstNode::operator==(const Node &other) const {
     return _value == otherExpr._value;
 }
 
+size_t ConstNode::hash() const {
+    // 0 and -0 compare equal, so must hash the same
+    double value = _value == 0.0 ? 0.0 : _value;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return kindHash(NodeKind::CONST, std::hash<uint64_t>()(bits));
+}
+
 UnaryOperationNode::UnaryOperationNode(UnaryOperation operation, ExprNode::ptr &&value): _operation(operation), _value(std::move(value)) {
 }
 
@@ -94,6 +147,14 @@ ExprNode *UnaryOperationNode::value() const {
     return _value.get();
 }
 
+ExprNode::ptr &UnaryOperationNode::mutableValue() {
+    return _value;
+}
+
+ExprNode::ptr UnaryOperationNode::clone() const {
+    return std::make_unique<UnaryOperationNode>(_operation, _value->clone());
+}
+
 void UnaryOperationNode::accept(NodeVisitor &visitor) {
     visitor.visit(this);
 }
@@ -107,9 +168,23 @@ bool UnaryOperationNode::operator==(const Node &other) const {
            && *_value == *otherExpr._value;
 }
 
+size_t UnaryOperationNode::hash() const {
+    return hashCombine(kindHash(NodeKind::UNARY_OPERATION, static_cast<size_t>(_operation)), _value->hash());
+}
+
 BinaryOperationNode::BinaryOperationNode(BinaryOperation operation, ExprNode::ptr &&lhs, ExprNode::ptr &&rhs): _operation(operation), _lhs(std::move(lhs)), _rhs(std::move(rhs)) {
 }
 
+BinaryOperationNode::~BinaryOperationNode() {
+    // Long chains lean right, release them iteratively so destroying them can't overflow the stack
+    ExprNode::ptr next = std::move(_rhs);
+    while (next.use_count() == 1 && dynamic_cast<BinaryOperationNode *>(next.get())) {
+        auto *binary = static_cast<BinaryOperationNode *>(next.get());
+        ExprNode::ptr rhs = std::move(binary->_rhs);
+        next = std::move(rhs);
+    }
+}
+
 BinaryOperation BinaryOperationNode::operation() const {
     return _operation;
 }
@@ -122,6 +197,30 @@ ExprNode *BinaryOperationNode::rhs() const {
     return _rhs.get();
 }
 
+ExprNode::ptr &BinaryOperationNode::mutableLhs() {
+    return _lhs;
+}
+
+ExprNode::ptr &BinaryOperationNode::mutableRhs() {
+    return _rhs;
+}
+
+ExprNode::ptr BinaryOperationNode::clone() const {
+    // Copy the right spine iteratively, linking each copy to the one above it
+    ExprNode::ptr root;
+    ExprNode::ptr *slot = &root;
+    const ExprNode *next = this;
+    while (auto *binary = dynamic_cast<const BinaryOperationNode *>(next)) {
+        auto copy = std::make_unique<BinaryOperationNode>(binary->_operation, binary->_lhs->clone(), nullptr);
+        ExprNode::ptr *rhs = &copy->_rhs;
+        *slot = std::move(copy);
+        slot = rhs;
+        next = binary->_rhs.get();
+    }
+    *slot = next->clone();
+    return root;
+}
+
 void BinaryOperationNode::accept(NodeVisitor &visitor) {
     visitor.visit(this);
 }
@@ -130,13 +229,40 @@ bool BinaryOperationNode::operator==(const Node &other) const {
     if (typeid(*this) != typeid(other)) {
         return false;
     }
-    const BinaryOperationNode &otherExpr = static_cast<const BinaryOperationNode&>(other);
-    return _operation == otherExpr._operation
-           && *_lhs == *otherExpr._lhs
-           && *_rhs == *otherExpr._rhs;
+    // Long chains lean right, so walk down both of them iteratively
+    const BinaryOperationNode *lhs = this;
+    const BinaryOperationNode *rhs = static_cast<const BinaryOperationNode *>(&other);
+    for (;;) {
+        if (lhs->_operation != rhs->_operation || *lhs->_lhs != *rhs->_lhs) {
+            return false;
+        }
+        auto *nextLhs = dynamic_cast<const BinaryOperationNode *>(lhs->_rhs.get());
+        auto *nextRhs = dynamic_cast<const BinaryOperationNode *>(rhs->_rhs.get());
+        if (!nextLhs || !nextRhs) {
+            return *lhs->_rhs == *rhs->_rhs;
+        }
+        lhs = nextLhs;
+        rhs = nextRhs;
+    }
 }
 
-FunctionInvocationNode::FunctionInvocationNode(const std::string &name, std::vector<std::unique_ptr<ExprNode>> &&params):
+size_t BinaryOperationNode::hash() const {
+    // Hashed from the bottom of the right spine up, so long chains don't recurse
+    std::vector<const BinaryOperationNode *> spine;
+    const ExprNode *next = this;
+    while (auto *binary = dynamic_cast<const BinaryOperationNode *>(next)) {
+        spine.push_back(binary);
+        next = binary->_rhs.get();
+    }
+    size_t hash = next->hash();
+    for (size_t i = spine.size(); i-- > 0;) {
+        size_t node = kindHash(NodeKind::BINARY_OPERATION, static_cast<size_t>(spine[i]->_operation));
+        hash = hashCombine(hashCombine(node, spine[i]->_lhs->hash()), hash);
+    }
+    return hash;
+}
+
+FunctionInvocationNode::FunctionInvocationNode(const std::string &name, std::vector<ExprNode::ptr> &&params):
     _name(name), _params(std::move(params)) {
 }
 
@@ -144,10 +270,23 @@ const std::string &FunctionInvocationNode::name() const {
     return _name;
 }
 
-const std::vector<std::unique_ptr<ExprNode>> &FunctionInvocationNode::params() const {
+const std::vector<ExprNode::ptr> &FunctionInvocationNode::params() const {
+    return _params;
+}
+
+std::vector<ExprNode::ptr> &FunctionInvocationNode::mutableParams() {
     return _params;
 }
 
+ExprNode::ptr FunctionInvocationNode::clone() const {
+    std::vector<ExprNode::ptr> params;
+    params.reserve(_params.size());
+    for (const ExprNode::ptr &param : _params) {
+        params.push_back(param->clone());
+    }
+    return std::make_unique<FunctionInvocationNode>(_name, std::move(params));
+}
+
 void FunctionInvocationNode::accept(NodeVisitor &visitor) {
     visitor.visit(this);
 }
@@ -168,6 +307,161 @@ bool FunctionInvocationNode::operator==(const Node &other) const {
     return true;
 }
 
+size_t FunctionInvocationNode::hash() const {
+    size_t hash = kindHash(NodeKind::FUNCTION_INVOCATION, std::hash<std::string>()(_name));
+    for (const ExprNode::ptr &param : _params) {
+        hash = hashCombine(hash, param->hash());
+    }
+    return hash;
+}
+
+SharedExprNode::SharedExprNode(ExprNode::ptr &&value, int slot): _value(std::move(value)), _slot(slot) {
+}
+
+ExprNode *SharedExprNode::value() const {
+    return _value.get();
+}
+
+ExprNode::ptr &SharedExprNode::mutableValue() {
+    return _value;
+}
+
+int SharedExprNode::slot() const {
+    return _slot;
+}
+
+ExprNode::ptr SharedExprNode::clone() const {
+    return _value->clone();
+}
+
+void SharedExprNode::accept(NodeVisitor &visitor) {
+    visitor.visit(this);
+}
+
+bool SharedExprNode::operator==(const Node &other) const {
+    if (typeid(*this) != typeid(other)) {
+        return false;
+    }
+    const SharedExprNode &otherExpr = static_cast<const SharedExprNode&>(other);
+    return *_value == *otherExpr._value;
+}
+
+size_t SharedExprNode::hash() const {
+    return kindHash(NodeKind::SHARED_EXPR, _value->hash());
+}
+
+namespace {
+    // Collects the names called in a tree without recursing
+    class NameCollector: public NodeVisitor {
+        std::vector<ExprNode *> _pending;
+        std::unordered_set<std::string> _names;
+    public:
+        std::unordered_set<std::string> collect(ExprNode *node) {
+            _names.clear();
+            _pending.push_back(node);
+            while (!_pending.empty()) {
+                ExprNode *next = _pending.back();
+                _pending.pop_back();
+                next->accept(*this);
+            }
+            return std::move(_names);
+        }
+
+        void visit(ConstNode *) override {
+        }
+
+        void visit(UnaryOperationNode *node) override {
+            _pending.push_back(node->value());
+        }
+
+        void visit(BinaryOperationNode *node) override {
+            _pending.push_back(node->lhs());
+            _pending.push_back(node->rhs());
+        }
+
+        void visit(FunctionInvocationNode *node) override {
+            _names.insert(node->name());
+            for (const ExprNode::ptr &param : node->params()) {
+                _pending.push_back(param.get());
+            }
+        }
+
+        void visit(SharedExprNode *node) override {
+            _pending.push_back(node->value());
+        }
+    };
+
+    class NodeCounter: public NodeVisitor {
+        std::vector<Node *> _pending;
+    public:
+        size_t count(Node *node) {
+            size_t count = 0;
+            _pending.push_back(node);
+            while (!_pending.empty()) {
+                Node *next = _pending.back();
+                _pending.pop_back();
+                next->accept(*this);
+                count++;
+            }
+            return count;
+        }
+
+        void visit(ExprStmtNode *node) override {
+            _pending.push_back(node->expression());
+        }
+
+        void visit(FuncDefNode *node) override {
+            _pending.push_back(node->expression());
+        }
+
+        void visit(ConstNode *) override {
+        }
+
+        void visit(UnaryOperationNode *node) override {
+            _pending.push_back(node->value());
+        }
+
+        void visit(BinaryOperationNode *node) override {
+            _pending.push_back(node->lhs());
+            _pending.push_back(node->rhs());
+        }
+
+        void visit(FunctionInvocationNode *node) override {
+            for (const ExprNode::ptr &param : node->params()) {
+                _pending.push_back(param.get());
+            }
+        }
+
+        void visit(SharedExprNode *node) override {
+            _pending.push_back(node->value());
+        }
+    };
+}
+
+/**
+ * @brief Counts the nodes in a tree without recursing, shared expressions are counted for each use
+ * 
+ * @param node Root of the tree
+ * @return size_t Number of nodes, including the root
+ */
+size_t quickcalc::countNodes(Node *node) {
+    return NodeCounter().count(node);
+}
+
+/**
+ * @brief Finds every name called in an expression, including parameters
+ * 
+ * @param node Expression to search
+ * @return std::unordered_set<std::string> Names called
+ */
+std::unordered_set<std::string> quickcalc::collectNames(ExprNode *node) {
+    return NameCollector().collect(node);
+}
+
+size_t quickcalc::hashCombine(size_t seed, size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
 NodeVisitor::NodeVisitor(): _next(nullptr) {
 }
 
@@ -209,3 +503,9 @@ void NodeVisitor::visit(FunctionInvocationNode *node) {
         _next->visit(node);
     }
 }
+
+void NodeVisitor::visit(SharedExprNode *node) {
+    if (_next) {
+        _next->visit(node);
+    }
+}
@@ -0,0 +1,510 @@
+#include "batch.hpp"
+#include "batchkernels.hpp"
+#include "compiler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    // Rows evaluated together, fewer when the program needs a lot of registers
+    constexpr size_t BLOCK_LANES = 256;
+    constexpr size_t REGISTER_MEMORY = 8 * 1024 * 1024;
+
+#ifdef __SSE2__
+    using Simd = Sse2Simd;
+    constexpr const char *PORTABLE_NAME = "sse2";
+#else
+    using Simd = ScalarSimd;
+    constexpr const char *PORTABLE_NAME = "scalar";
+#endif
+
+    bool active(const double *mask, size_t lane) {
+        uint64_t bits;
+        std::memcpy(&bits, mask + lane, sizeof(double));
+        return bits != 0;
+    }
+}
+
+const BatchKernelTable &quickcalc::portableKernels() {
+    return BatchKernels<Simd>::table(PORTABLE_NAME);
+}
+
+#ifndef QC_BATCH_AVX
+const BatchKernelTable *quickcalc::avxKernels() {
+    return nullptr;
+}
+#endif
+
+const BatchKernelTable &quickcalc::selectKernels() {
+#ifdef QC_BATCH_AVX
+    static const BatchKernelTable *best = __builtin_cpu_supports("avx") ? avxKernels() : &portableKernels();
+    return *best;
+#else
+    return portableKernels();
+#endif
+}
+
+/**
+ * @brief Construct a new batch compiler
+ *
+ * @param symbols Global names, slots are allocated for names which haven't been seen yet
+ * @param strictness Strictness of defined functions, arguments are only evaluated for every row when it's safe
+ */
+BatchCompiler::BatchCompiler(SymbolTable &symbols, const Strictness::Lookup &strictness):
+    _symbols(symbols), _strictness(strictness), _depth(0), _masks(0), _calls(0), _share(true) {
+}
+
+/**
+ * @brief Compiles an expression to be evaluated over columns of inputs
+ *
+ * Both branches of an if are evaluated for every row, as arithmetic can't fail, while calls to
+ * defined functions are only made for the rows which take the branch they're in, as are calls to
+ * native functions which aren't vectorizable. Arguments to defined functions must be evaluated for
+ * every row, so one which calls a function has to be an argument the callee always uses.
+ *
+ * @param node Expression to compile
+ * @param columns Names of the columns, which shadow every other name
+ * @return BatchProgram Compiled expression
+ */
+BatchProgram BatchCompiler::compile(ExprNode *node, const std::vector<std::string> &columns) {
+    for (bool share : { true, false }) {
+        _program = BatchProgram();
+        _program.columns = columns;
+        _constants.clear();
+        _shared.clear();
+        _depth = 0;
+        _masks = 0;
+        _calls = 0;
+        _share = share;
+        node->accept(*this);
+        // Shared values are computed for every row, so they mustn't involve calls
+        if (_calls == 0 || _program.sharedSlots == 0) {
+            break;
+        }
+    }
+    _program.code.shrink_to_fit();
+    return std::move(_program);
+}
+
+void BatchCompiler::visit(ConstNode *node) {
+    emitConst(node->value());
+}
+
+void BatchCompiler::visit(UnaryOperationNode *node) {
+    node->value()->accept(*this);
+    emit(node->operation() == UnaryOperation::NEGATE ? BatchOpCode::NEGATE : BatchOpCode::NOT);
+}
+
+void BatchCompiler::visit(BinaryOperationNode *node) {
+    // Long chains lean right, so walk down them iteratively and emit the operations in reverse
+    std::vector<BinaryOperation> operations;
+    ExprNode *rhs = node;
+    while (auto *binary = dynamic_cast<BinaryOperationNode *>(rhs)) {
+        binary->lhs()->accept(*this);
+        operations.push_back(binary->operation());
+        rhs = binary->rhs();
+    }
+    rhs->accept(*this);
+    for (auto it = operations.rbegin(); it != operations.rend(); it++) {
+        switch (*it) {
+        case BinaryOperation::ADD:
+            emit(BatchOpCode::ADD);
+            break;
+        case BinaryOperation::SUBTRACT:
+            emit(BatchOpCode::SUBTRACT);
+            break;
+        case BinaryOperation::MULTIPLY:
+            emit(BatchOpCode::MULTIPLY);
+            break;
+        case BinaryOperation::DIVIDE:
+            emit(BatchOpCode::DIVIDE);
+            break;
+        case BinaryOperation::AND:
+            emit(BatchOpCode::AND);
+            break;
+        case BinaryOperation::OR:
+            emit(BatchOpCode::OR);
+            break;
+        case BinaryOperation::XOR:
+            emit(BatchOpCode::XOR);
+            break;
+        }
+    }
+}
+
+void BatchCompiler::visit(FunctionInvocationNode *node) {
+    Binding binding = _symbols.resolve(_program.columns, node->name());
+    switch (binding.kind) {
+    case BindingKind::PARAMETER:
+        emit(BatchOpCode::COLUMN, binding.index);
+        break;
+    case BindingKind::BUILTIN:
+        compileBuiltin(static_cast<Builtin>(binding.index), node);
+        break;
+    case BindingKind::NATIVE: {
+        const NativeFunction &native = nativeFunction(binding.index);
+        const std::vector<ExprNode::ptr> &params = node->params();
+        if (!native.accepts(params.size())) {
+            throw CompileError(native.arityError(params.size()));
+        }
+        for (const ExprNode::ptr &param : params) {
+            param->accept(*this);
+        }
+        int32_t count = static_cast<int32_t>(params.size());
+        emit(native.vectorizable ? BatchOpCode::NATIVE : BatchOpCode::CALL_NATIVE,
+             static_cast<int32_t>(_program.natives.size()));
+        _program.natives.push_back({ native.call, native.columns, count });
+        if (!native.vectorizable) {
+            _calls++;
+        }
+        adjustDepth(1 - count);
+        break;
+    }
+    case BindingKind::GLOBAL: {
+        // Undefined functions are reported when the program is linked
+        const std::vector<ExprNode::ptr> &params = node->params();
+        StrictMask strict = _strictness && _symbols.isDefined(binding.index) ? _strictness(binding.index) : ALL_STRICT;
+        for (size_t i = 0; i < params.size(); i++) {
+            size_t calls = _calls;
+            params[i]->accept(*this);
+            bool used = i < 64 && (strict & (StrictMask(1) << i));
+            if (_calls != calls && !used) {
+                throw CompileError("Can't evaluate a call to " + node->name() + " in a batch, as it may not use argument "
+                                   + std::to_string(i + 1));
+            }
+        }
+        int32_t count = static_cast<int32_t>(params.size());
+        emit(BatchOpCode::CALL, static_cast<int32_t>(_program.calls.size()));
+        _program.calls.push_back({ binding.index, count });
+        _calls++;
+        if (std::find(_program.globals.begin(), _program.globals.end(), binding.index) == _program.globals.end()) {
+            _program.globals.push_back(binding.index);
+        }
+        adjustDepth(1 - count);
+        break;
+    }
+    }
+}
+
+void BatchCompiler::visit(SharedExprNode *node) {
+    if (!_share) {
+        node->value()->accept(*this);
+        return;
+    }
+    // Nothing is skipped, so the first occurrence is always evaluated first
+    auto it = _shared.find(node);
+    if (it != _shared.end()) {
+        emit(BatchOpCode::LOAD_SHARED, it->second);
+        return;
+    }
+    node->value()->accept(*this);
+    int32_t slot = _program.sharedSlots++;
+    _shared.emplace(node, slot);
+    emit(BatchOpCode::STORE_SHARED, slot);
+}
+
+void BatchCompiler::compileBuiltin(Builtin builtin, FunctionInvocationNode *node) {
+    const std::vector<ExprNode::ptr> &params = node->params();
+    switch (builtin) {
+    case Builtin::IF:
+        if (params.size() < 2) {
+            emitConst(NAN);
+        } else if (params.size() == 2) {
+            // if(a, b) results in a when a is false
+            params[0]->accept(*this);
+            emit(BatchOpCode::MASK);
+            params[1]->accept(*this);
+            emit(BatchOpCode::UNMASK);
+            emit(BatchOpCode::SELECT_CONDITION);
+        } else {
+            params[0]->accept(*this);
+            int condition = _depth - 1;
+            emit(BatchOpCode::MASK);
+            params[1]->accept(*this);
+            emit(BatchOpCode::MASK_ELSE, condition);
+            params[2]->accept(*this);
+            emit(BatchOpCode::UNMASK);
+            emit(BatchOpCode::SELECT);
+        }
+        break;
+    case Builtin::EQ:
+    case Builtin::NE:
+    case Builtin::GT:
+    case Builtin::LT:
+    case Builtin::GE:
+    case Builtin::LE:
+        if (params.size() < 2) {
+            emitConst(NAN);
+            break;
+        }
+        params[0]->accept(*this);
+        params[1]->accept(*this);
+        switch (builtin) {
+        case Builtin::EQ:
+            emit(BatchOpCode::EQ);
+            break;
+        case Builtin::NE:
+            emit(BatchOpCode::NE);
+            break;
+        case Builtin::GT:
+            emit(BatchOpCode::GT);
+            break;
+        case Builtin::LT:
+            emit(BatchOpCode::LT);
+            break;
+        case Builtin::GE:
+            emit(BatchOpCode::GE);
+            break;
+        default:
+            emit(BatchOpCode::LE);
+            break;
+        }
+        break;
+    case Builtin::TRUE:
+        emitConst(QC_TRUE);
+        break;
+    case Builtin::FALSE:
+        emitConst(QC_FALSE);
+        break;
+    case Builtin::EPSILON:
+        emitConst(QC_EPSILON);
+        break;
+    case Builtin::PI:
+        emitConst(QC_PI);
+        break;
+    case Builtin::SUM:
+    case Builtin::PROD:
+    case Builtin::MINOF:
+    case Builtin::MAXOF:
+    case Builtin::FOLD:
+        // Every row would need a loop of its own, which a definition called per row can run
+        throw CompileError("Can't evaluate " + node->name() + " in a batch, move it into a definition instead");
+    }
+}
+
+void BatchCompiler::emit(BatchOpCode opcode, int32_t operand) {
+    _program.code.push_back({ opcode, operand });
+    switch (opcode) {
+    case BatchOpCode::CONST:
+    case BatchOpCode::COLUMN:
+    case BatchOpCode::LOAD_SHARED:
+        adjustDepth(1);
+        break;
+    case BatchOpCode::ADD:
+    case BatchOpCode::SUBTRACT:
+    case BatchOpCode::MULTIPLY:
+    case BatchOpCode::DIVIDE:
+    case BatchOpCode::AND:
+    case BatchOpCode::OR:
+    case BatchOpCode::XOR:
+    case BatchOpCode::EQ:
+    case BatchOpCode::NE:
+    case BatchOpCode::GT:
+    case BatchOpCode::LT:
+    case BatchOpCode::GE:
+    case BatchOpCode::LE:
+    case BatchOpCode::SELECT_CONDITION:
+        adjustDepth(-1);
+        break;
+    case BatchOpCode::SELECT:
+        adjustDepth(-2);
+        break;
+    case BatchOpCode::MASK:
+        _masks++;
+        _program.maxMasks = std::max(_program.maxMasks, _masks);
+        break;
+    case BatchOpCode::UNMASK:
+        _masks--;
+        break;
+    default:
+        break;
+    }
+}
+
+void BatchCompiler::emitConst(double value) {
+    // Key on the bit pattern so NaN and -0.0 get their own entries
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(double));
+    auto it = _constants.find(bits);
+    if (it == _constants.end()) {
+        it = _constants.emplace(bits, static_cast<int32_t>(_program.constants.size())).first;
+        _program.constants.push_back(value);
+    }
+    emit(BatchOpCode::CONST, it->second);
+}
+
+void BatchCompiler::adjustDepth(int change) {
+    _depth += change;
+    _program.maxStack = std::max(_program.maxStack, _depth);
+}
+
+/**
+ * @brief Construct a new batch evaluator
+ *
+ * @param call Makes a call to a defined function for one row
+ */
+BatchEvaluator::BatchEvaluator(const Call &call): _call(call) {
+}
+
+/**
+ * @brief Evaluates a program for every row
+ *
+ * @param program Compiled expression
+ * @param columns Input for each of the program's columns, in the same order, each with a value per row
+ * @param rows Number of rows
+ * @param results Output with space for a value per row
+ */
+void BatchEvaluator::evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                              double *results) {
+    if (columns.size() != program.columns.size()) {
+        throw std::invalid_argument("Expected " + std::to_string(program.columns.size()) + " columns");
+    }
+    const BatchKernelTable &kernels = selectKernels();
+
+    // Every register is a block of lanes, a multiple of 4 so the kernels never need a scalar tail
+    size_t registers = program.maxStack + program.sharedSlots + program.maxMasks + 1;
+    size_t lanes = std::min(BLOCK_LANES, std::max<size_t>(4, REGISTER_MEMORY / sizeof(double) / registers)) & ~size_t(3);
+    _registers.resize(registers * lanes);
+    double *stack = _registers.data();
+    double *shared = stack + program.maxStack * lanes;
+    double *masks = shared + program.sharedSlots * lanes;
+    auto block = [lanes] (double *base, size_t index) {
+        return base + index * lanes;
+    };
+
+    const double allLanes = [] {
+        uint64_t bits = ~uint64_t(0);
+        double result;
+        std::memcpy(&result, &bits, sizeof(double));
+        return result;
+    }();
+
+    for (size_t start = 0; start < rows; start += lanes) {
+        size_t count = std::min(lanes, rows - start);
+        size_t width = (count + 3) & ~size_t(3);
+        std::fill_n(masks, count, allLanes);
+        std::fill(masks + count, masks + width, 0.0);
+        size_t sp = 0;
+        size_t mask = 0;
+
+        for (const BatchInstruction &instruction : program.code) {
+            switch (instruction.opcode) {
+            case BatchOpCode::CONST:
+                std::fill_n(block(stack, sp++), width, program.constants[instruction.operand]);
+                break;
+            case BatchOpCode::COLUMN: {
+                double *values = block(stack, sp++);
+                std::copy_n(columns[instruction.operand] + start, count, values);
+                std::fill(values + count, values + width, 0.0);
+                break;
+            }
+            case BatchOpCode::CALL: {
+                const BatchCall &call = program.calls[instruction.operand];
+                size_t first = sp - call.args;
+                double *values = block(stack, first);
+                sp = first + 1;
+                const double *active = block(masks, mask);
+                _args.resize(call.args);
+                double constant = NAN;
+                bool called = false;
+                for (size_t lane = 0; lane < count; lane++) {
+                    if (!::active(active, lane)) {
+                        continue;
+                    }
+                    if (call.args == 0) {
+                        // Without arguments the result is the same for every row
+                        if (!called) {
+                            constant = _call(call.callee, nullptr, 0);
+                            called = true;
+                        }
+                        values[lane] = constant;
+                        continue;
+                    }
+                    for (int32_t i = 0; i < call.args; i++) {
+                        _args[i] = block(stack, first + i)[lane];
+                    }
+                    values[lane] = _call(call.callee, _args.data(), call.args);
+                }
+                break;
+            }
+            case BatchOpCode::NATIVE:
+            case BatchOpCode::CALL_NATIVE: {
+                const BatchNativeCall &call = program.natives[instruction.operand];
+                size_t first = sp - call.args;
+                double *values = block(stack, first);
+                sp = first + 1;
+                if (call.columns) {
+                    _columns.resize(call.args);
+                    for (int32_t i = 0; i < call.args; i++) {
+                        _columns[i] = block(stack, first + i);
+                    }
+                    _results.resize(count);
+                    call.columns(_columns.data(), call.args, _results.data(), count);
+                    std::copy_n(_results.data(), count, values);
+                    std::fill(values + count, values + width, 0.0);
+                    break;
+                }
+                // Vectorizable functions are called for every row, other native functions only for active rows
+                const double *active = instruction.opcode == BatchOpCode::NATIVE ? nullptr : block(masks, mask);
+                _args.resize(call.args);
+                for (size_t lane = 0; lane < count; lane++) {
+                    if (active && !::active(active, lane)) {
+                        continue;
+                    }
+                    for (int32_t i = 0; i < call.args; i++) {
+                        _args[i] = block(stack, first + i)[lane];
+                    }
+                    values[lane] = call.call(_args.data(), call.args);
+                }
+                break;
+            }
+            case BatchOpCode::NEGATE:
+            case BatchOpCode::NOT:
+                kernels.unary(instruction.opcode, block(stack, sp - 1), width);
+                break;
+            case BatchOpCode::MASK:
+                kernels.mask(block(masks, mask + 1), block(masks, mask), block(stack, sp - 1), false, width);
+                mask++;
+                break;
+            case BatchOpCode::MASK_ELSE:
+                kernels.mask(block(masks, mask), block(masks, mask - 1), block(stack, instruction.operand), true, width);
+                break;
+            case BatchOpCode::UNMASK:
+                mask--;
+                break;
+            case BatchOpCode::SELECT:
+                kernels.select(block(stack, sp - 3), block(stack, sp - 2), block(stack, sp - 1), width);
+                sp -= 2;
+                break;
+            case BatchOpCode::SELECT_CONDITION:
+                kernels.select(block(stack, sp - 2), block(stack, sp - 1), block(stack, sp - 2), width);
+                sp--;
+                break;
+            case BatchOpCode::LOAD_SHARED:
+                std::copy_n(block(shared, instruction.operand), width, block(stack, sp++));
+                break;
+            case BatchOpCode::STORE_SHARED:
+                std::copy_n(block(stack, sp - 1), width, block(shared, instruction.operand));
+                break;
+            default:
+                kernels.binary(instruction.opcode, block(stack, sp - 2), block(stack, sp - 1), width);
+                sp--;
+                break;
+            }
+        }
+        std::copy_n(stack, count, results + start);
+    }
+}
+
+/**
+ * @brief Gets the name of the instruction set the kernels use on this processor
+ *
+ * @return const char* One of avx, sse2 or scalar
+ */
+const char *BatchEvaluator::kernels() {
+    return selectKernels().name;
+}
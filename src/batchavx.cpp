@@ -0,0 +1,52 @@
+#include "batchkernels.hpp"
+#include "simd.hpp"
+#include <immintrin.h>
+
+using namespace quickcalc;
+
+namespace {
+    // Built with AVX enabled, only called once the processor is known to support it
+    struct Avx {
+        using V = __m256d;
+        static constexpr size_t WIDTH = 4;
+
+        static V load(const double *values) { return _mm256_loadu_pd(values); }
+        static void store(double *values, V value) { _mm256_storeu_pd(values, value); }
+        static V broadcast(double value) { return _mm256_set1_pd(value); }
+        static V add(V a, V b) { return _mm256_add_pd(a, b); }
+        static V subtract(V a, V b) { return _mm256_sub_pd(a, b); }
+        static V multiply(V a, V b) { return _mm256_mul_pd(a, b); }
+        static V divide(V a, V b) { return _mm256_div_pd(a, b); }
+        static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+        static V abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+        static V negate(V a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+        static V integerNot(V a) { return eachLane<Avx>(a, a, [] (double x, double) { return ScalarSimd::integerNot(x); }); }
+        static V integerAnd(V a, V b) { return eachLane<Avx>(a, b, ScalarSimd::integerAnd); }
+        static V integerOr(V a, V b) { return eachLane<Avx>(a, b, ScalarSimd::integerOr); }
+        static V integerXor(V a, V b) { return eachLane<Avx>(a, b, ScalarSimd::integerXor); }
+        // Ordered comparisons, so NaN compares false as it does for scalars
+        static V lessThan(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+        static V lessEqual(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+        static V bitAnd(V a, V b) { return _mm256_and_pd(a, b); }
+        static V bitOr(V a, V b) { return _mm256_or_pd(a, b); }
+        static V bitAndNot(V a, V b) { return _mm256_andnot_pd(a, b); }
+        // AVX has no 256 bit integer shifts, so each half is shifted on its own
+        static V shiftLeft(V a, int count) {
+            __m256i bits = _mm256_castpd_si256(a);
+            __m128i low = _mm_slli_epi64(_mm256_castsi256_si128(bits), count);
+            __m128i high = _mm_slli_epi64(_mm256_extractf128_si256(bits, 1), count);
+            return _mm256_castsi256_pd(_mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1));
+        }
+        static V shiftRight(V a, int count) {
+            __m256i bits = _mm256_castpd_si256(a);
+            __m128i low = _mm_srli_epi64(_mm256_castsi256_si128(bits), count);
+            __m128i high = _mm_srli_epi64(_mm256_extractf128_si256(bits, 1), count);
+            return _mm256_castsi256_pd(_mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1));
+        }
+        static bool any(V mask) { return _mm256_movemask_pd(mask) != 0; }
+    };
+}
+
+const BatchKernelTable *quickcalc::avxKernels() {
+    return &BatchKernels<Avx>::table("avx");
+}
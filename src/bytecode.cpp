@@ -0,0 +1,122 @@
+#include "bytecode.hpp"
+
+using namespace quickcalc;
+
+namespace {
+    // If modifying check OpCode enum in bytecode.hpp
+    const char *OPCODES[] = {
+        "CONST",
+        "ARG",
+        "CALL",
+        "TAIL_CALL",
+        "CALL_NATIVE",
+        "RETURN",
+        "JUMP",
+        "JUMP_IF_FALSE",
+        "DUP",
+        "POP",
+        "NEGATE",
+        "NOT",
+        "ADD",
+        "SUBTRACT",
+        "MULTIPLY",
+        "DIVIDE",
+        "AND",
+        "OR",
+        "XOR",
+        "INTEGER",
+        "TO_INTEGER",
+        "TO_DOUBLE",
+        "EQ",
+        "NE",
+        "GT",
+        "LT",
+        "GE",
+        "LE",
+        "LOAD_SHARED",
+        "STORE_SHARED",
+        "LOAD_LOCAL",
+        "LOOP_BEGIN",
+        "LOOP_NEXT",
+    };
+
+    // Builtin giving each Reduction
+    const char *REDUCTIONS[] = {
+        "sum",
+        "prod",
+        "minof",
+        "maxof",
+        "fold",
+    };
+
+    constexpr int OPCODE_COUNT = sizeof(OPCODES) / sizeof(char*);
+
+    bool hasOperand(OpCode opcode) {
+        switch (opcode) {
+        case OpCode::CONST:
+        case OpCode::INTEGER:
+        case OpCode::ARG:
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::CALL_NATIVE:
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::LOAD_SHARED:
+        case OpCode::STORE_SHARED:
+        case OpCode::LOAD_LOCAL:
+        case OpCode::LOOP_BEGIN:
+        case OpCode::LOOP_NEXT:
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+std::ostream &operator<<(std::ostream &stream, OpCode opcode) {
+    int offset = static_cast<int>(opcode);
+
+    if (offset < 0 || offset >= OPCODE_COUNT) {
+        return stream << "Bad opcode";
+    }
+
+    return stream << OPCODES[offset];
+}
+
+std::ostream &operator<<(std::ostream &stream, const Function &function) {
+    stream << function.name << ":\n";
+    for (size_t i = 0; i < function.code.size(); i++) {
+        const Instruction &instruction = function.code[i];
+        stream << "  " << i << "\t" << instruction.opcode;
+        if (hasOperand(instruction.opcode)) {
+            stream << " " << instruction.operand;
+        }
+        switch (instruction.opcode) {
+        case OpCode::CONST:
+            stream << "\t; " << function.constants[instruction.operand];
+            break;
+        case OpCode::ARG:
+            stream << "\t; " << function.paramNames[instruction.operand];
+            break;
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+            stream << "\t; global " << function.callSites[instruction.operand].callee;
+            break;
+        case OpCode::CALL_NATIVE:
+            stream << "\t; " << nativeFunction(function.nativeCalls[instruction.operand].native).name;
+            break;
+        case OpCode::LOOP_BEGIN: {
+            const Loop &loop = function.loops[instruction.operand];
+            stream << "\t; " << REDUCTIONS[static_cast<int>(loop.reduction)] << " to " << loop.end;
+            if (loop.split) {
+                stream << ", split";
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        stream << "\n";
+    }
+    return stream;
+}
@@ -0,0 +1,123 @@
+#include "compilecache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+using namespace quickcalc;
+
+/**
+ * @brief Construct a new, empty cache
+ *
+ * @param capacity Most bytes of programs and source to keep, split evenly between the shards
+ * @param options How programs are compiled, memoization is ignored
+ * @param shards Number of separately locked parts, at least one
+ */
+CompileCache::CompileCache(size_t capacity, const VMOptions &options, size_t shards): _options(options),
+    _shardCount(std::max<size_t>(shards, 1)) {
+    _shardCapacity = capacity / _shardCount;
+    _shards = std::make_unique<Shard[]>(_shardCount);
+}
+
+/**
+ * @brief Gives the program compiled from source, compiling and caching it if it isn't cached
+ *
+ * Sources which fail to parse or compile aren't cached, and neither are programs too big for a shard.
+ *
+ * @param source Statements separated by semicolons, as the command line takes them
+ * @return std::shared_ptr<const Program> Program which stays valid after it's evicted, for as long as it's held
+ * @throws std::runtime_error The source doesn't parse, or CompileError if it doesn't compile
+ */
+std::shared_ptr<const Program> CompileCache::get(const std::string &source) {
+    uint64_t hash = std::hash<std::string>()(source);
+    // The low bits pick the bucket within the shard, so the shard comes from the high bits
+    Shard &shard = _shards[(hash >> 32) % _shardCount];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(hash);
+        if (found != shard.index.end() && found->second->source == source) {
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            shard.stats.hits++;
+            return found->second->program;
+        }
+        shard.stats.misses++;
+    }
+
+    std::shared_ptr<const Program> program = compile(source, _options);
+    size_t bytes = program->bytes() + source.capacity() + sizeof(Entry);
+    if (bytes > _shardCapacity) {
+        return program;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+        if (found->second->source == source) {
+            // Another thread compiled the same source first, every caller should share its program
+            shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+            return found->second->program;
+        }
+        // Only one source is kept per hash, the newer one is more likely to be asked for again
+        shard.bytes -= found->second->bytes;
+        shard.entries.erase(found->second);
+        shard.index.erase(found);
+        shard.stats.evictions++;
+    }
+    while (shard.bytes + bytes > _shardCapacity) {
+        Entry &oldest = shard.entries.back();
+        shard.index.erase(oldest.hash);
+        shard.bytes -= oldest.bytes;
+        shard.entries.pop_back();
+        shard.stats.evictions++;
+    }
+    shard.entries.push_front(Entry { hash, source, program, bytes });
+    shard.index.emplace(hash, shard.entries.begin());
+    shard.bytes += bytes;
+    return program;
+}
+
+/**
+ * @brief Drops every cached program, counting each as evicted, programs already handed out stay valid
+ */
+void CompileCache::clear() {
+    for (size_t i = 0; i < _shardCount; i++) {
+        Shard &shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.stats.evictions += shard.entries.size();
+        shard.entries.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+    }
+}
+
+/**
+ * @brief Gives the counters of every shard added together
+ */
+CompileCacheStats CompileCache::stats() const {
+    CompileCacheStats total;
+    for (size_t i = 0; i < _shardCount; i++) {
+        Shard &shard = _shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.stats.hits;
+        total.misses += shard.stats.misses;
+        total.evictions += shard.stats.evictions;
+        total.entries += shard.entries.size();
+        total.bytes += shard.bytes;
+    }
+    return total;
+}
+
+std::unique_ptr<Program> CompileCache::compile(const std::string &source, const VMOptions &options) {
+    std::istringstream input(source);
+    Lexer lexer(input);
+    Parser parser(lexer);
+    // Programs don't refer back to their statements, so they're dropped once it's built
+    std::vector<StmtNode::ptr> nodes;
+    std::vector<StmtNode *> statements;
+    while (!input.eof()) {
+        statements.push_back(nodes.emplace_back(parser.parse()).get());
+    }
+    return std::make_unique<Program>(statements, options);
+}
@@ -0,0 +1,600 @@
+#include "compiler.hpp"
+#include "integer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace quickcalc;
+
+namespace {
+    // Whether a node is a bitwise operator, so its result can be left as an integer
+    bool isIntegral(ExprNode *node) {
+        if (auto *unary = dynamic_cast<UnaryOperationNode *>(node)) {
+            return unary->operation() == UnaryOperation::NOT;
+        }
+        auto *binary = dynamic_cast<BinaryOperationNode *>(node);
+        return binary && isBitwise(binary->operation());
+    }
+
+    // Checks a loop body only uses names bound inside it, builtins and pure functions
+    class ClosedCheck: public NodeVisitor {
+        SymbolTable &_symbols;
+        const Compiler::Purity &_pure;
+        // Names of the function and loops outside the body, which it mustn't use
+        const std::vector<std::string> &_outside;
+        std::vector<const std::string *> _bound;
+        bool _closed;
+    public:
+        ClosedCheck(SymbolTable &symbols, const Compiler::Purity &pure, const std::vector<std::string> &outside):
+            NodeVisitor(), _symbols(symbols), _pure(pure), _outside(outside), _closed(true) {
+        }
+
+        bool check(const LoopCall &loop) {
+            _bound = { loop.index };
+            _closed = true;
+            loop.body->accept(*this);
+            return _closed;
+        }
+
+        void visit(ConstNode *) override {
+        }
+
+        void visit(UnaryOperationNode *node) override {
+            node->value()->accept(*this);
+        }
+
+        void visit(BinaryOperationNode *node) override {
+            ExprNode *rhs = node;
+            while (auto *binary = dynamic_cast<BinaryOperationNode *>(rhs)) {
+                binary->lhs()->accept(*this);
+                rhs = binary->rhs();
+            }
+            rhs->accept(*this);
+        }
+
+        void visit(FunctionInvocationNode *node) override {
+            const std::string &name = node->name();
+            for (const std::string *bound : _bound) {
+                if (*bound == name) {
+                    return;
+                }
+            }
+            if (std::find(_outside.begin(), _outside.end(), name) != _outside.end()) {
+                _closed = false;
+                return;
+            }
+            const std::vector<ExprNode::ptr> &params = node->params();
+            Binding binding = _symbols.resolve({}, name);
+            LoopCall loop;
+            if (binding.kind == BindingKind::BUILTIN && tryGetLoop(static_cast<Builtin>(binding.index), params, loop)) {
+                loop.lo->accept(*this);
+                loop.hi->accept(*this);
+                if (loop.init) {
+                    loop.init->accept(*this);
+                }
+                size_t bound = _bound.size();
+                _bound.push_back(loop.index);
+                if (loop.accumulator) {
+                    _bound.push_back(loop.accumulator);
+                }
+                loop.body->accept(*this);
+                _bound.resize(bound);
+                return;
+            } else if (binding.kind == BindingKind::NATIVE) {
+                _closed = _closed && nativeFunction(binding.index).pure;
+            } else if (binding.kind == BindingKind::GLOBAL) {
+                _closed = _closed && _symbols.isDefined(binding.index) && _pure(binding.index);
+            }
+            for (const ExprNode::ptr &param : params) {
+                param->accept(*this);
+            }
+        }
+
+        void visit(SharedExprNode *) override {
+            // Kept in the frame of the function the body is part of
+            _closed = false;
+        }
+    };
+}
+
+/**
+ * @brief Construct a new bytecode compiler
+ * 
+ * @param symbols Global names, slots are allocated for names which haven't been seen yet
+ * @param strictness If set, arguments to defined functions which are strict in them are evaluated before the call
+ * @param pure If set, loops whose body only calls pure functions may be split between threads
+ */
+Compiler::Compiler(SymbolTable &symbols, const Strictness::Lookup &strictness, const Purity &pure):
+    _symbols(symbols), _strictness(strictness), _pure(pure), _localSlots(0), _depth(0), _tail(false), _integer(false) {
+}
+
+/**
+ * @brief Compiles the body of a function definition
+ * 
+ * @param node Definition to compile
+ * @return Function Compiled function, parameters are referenced by index
+ */
+Function Compiler::compile(FuncDefNode *node) {
+    _function = Function();
+    _function.name = node->name();
+    _function.paramNames = node->paramNames();
+    return finish(node->expression());
+}
+
+/**
+ * @brief Compiles a standalone expression as a function without parameters
+ * 
+ * @param node Expression to compile
+ * @param name Name to give the function
+ * @return Function Compiled function
+ */
+Function Compiler::compile(ExprNode *node, const std::string &name) {
+    _function = Function();
+    _function.name = name;
+    return finish(node);
+}
+
+void Compiler::visit(ConstNode *node) {
+    emitConst(node->value());
+}
+
+void Compiler::visit(UnaryOperationNode *node) {
+    _tail = false;
+    bool integer = _integer;
+    _integer = false;
+    switch (node->operation()) {
+    case UnaryOperation::NEGATE:
+        node->value()->accept(*this);
+        emit(OpCode::NEGATE);
+        break;
+    case UnaryOperation::NOT:
+        compileInteger(node->value());
+        emit(OpCode::NOT);
+        if (!integer) {
+            emit(OpCode::TO_DOUBLE);
+        }
+        break;
+    }
+}
+
+void Compiler::visit(BinaryOperationNode *node) {
+    // Long chains lean right, so walk down them iteratively and emit the operations in reverse
+    _tail = false;
+    bool integer = _integer;
+    _integer = false;
+    std::vector<BinaryOperation> operations;
+    ExprNode *rhs = node;
+    while (auto *binary = dynamic_cast<BinaryOperationNode *>(rhs)) {
+        if (isBitwise(binary->operation())) {
+            compileInteger(binary->lhs());
+        } else {
+            binary->lhs()->accept(*this);
+        }
+        operations.push_back(binary->operation());
+        rhs = binary->rhs();
+    }
+    if (isBitwise(operations.back())) {
+        compileInteger(rhs);
+    } else {
+        rhs->accept(*this);
+    }
+    // Each result is the right operand of the operation before, converted if only one of them is bitwise
+    for (size_t i = operations.size(); i-- > 0;) {
+        emitBinary(operations[i]);
+        bool wanted = i > 0 ? isBitwise(operations[i - 1]) : integer;
+        if (isBitwise(operations[i]) && !wanted) {
+            emit(OpCode::TO_DOUBLE);
+        } else if (!isBitwise(operations[i]) && wanted) {
+            emit(OpCode::TO_INTEGER);
+        }
+    }
+}
+
+/**
+ * @brief Compiles an operand of a bitwise operator, leaving it on the stack as an integer
+ *
+ * Constants are converted as they're compiled, and bitwise operators keep their results as integers,
+ * so only other operands need converting when they're evaluated.
+ */
+void Compiler::compileInteger(ExprNode *node) {
+    if (auto *constant = dynamic_cast<ConstNode *>(node)) {
+        int64_t value = toInteger(constant->value());
+        if (value >= INT32_MIN && value <= INT32_MAX) {
+            emit(OpCode::INTEGER, static_cast<int32_t>(value));
+            return;
+        }
+    }
+    if (isIntegral(node)) {
+        _integer = true;
+        node->accept(*this);
+        return;
+    }
+    node->accept(*this);
+    emit(OpCode::TO_INTEGER);
+}
+
+void Compiler::emitBinary(BinaryOperation operation) {
+    switch (operation) {
+    case BinaryOperation::ADD:
+        emit(OpCode::ADD);
+        break;
+    case BinaryOperation::SUBTRACT:
+        emit(OpCode::SUBTRACT);
+        break;
+    case BinaryOperation::MULTIPLY:
+        emit(OpCode::MULTIPLY);
+        break;
+    case BinaryOperation::DIVIDE:
+        emit(OpCode::DIVIDE);
+        break;
+    case BinaryOperation::AND:
+        emit(OpCode::AND);
+        break;
+    case BinaryOperation::OR:
+        emit(OpCode::OR);
+        break;
+    case BinaryOperation::XOR:
+        emit(OpCode::XOR);
+        break;
+    }
+}
+
+void Compiler::visit(FunctionInvocationNode *node) {
+    bool tail = _tail;
+    _tail = false;
+    int32_t local;
+    if (tryGetLocal(node->name(), local)) {
+        emit(OpCode::LOAD_LOCAL, local);
+        return;
+    }
+    Binding binding = resolve(node->name());
+    switch (binding.kind) {
+    case BindingKind::PARAMETER:
+        emit(OpCode::ARG, binding.index);
+        break;
+    case BindingKind::BUILTIN:
+        compileBuiltin(static_cast<Builtin>(binding.index), node, tail);
+        break;
+    case BindingKind::NATIVE: {
+        const NativeFunction &native = nativeFunction(binding.index);
+        const std::vector<ExprNode::ptr> &params = node->params();
+        if (!native.accepts(params.size())) {
+            throw CompileError(native.arityError(params.size()));
+        }
+        for (const ExprNode::ptr &param : params) {
+            param->accept(*this);
+        }
+        int32_t count = static_cast<int32_t>(params.size());
+        emit(OpCode::CALL_NATIVE, static_cast<int32_t>(_function.nativeCalls.size()));
+        _function.nativeCalls.push_back({ native.call, binding.index, count });
+        adjustDepth(-count);
+        break;
+    }
+    case BindingKind::GLOBAL: {
+        const std::vector<ExprNode::ptr> &params = node->params();
+        StrictMask strict = _strictness && _symbols.isDefined(binding.index) ? _strictness(binding.index) : 0;
+        std::vector<int32_t> args(params.size());
+        int32_t strictArgs = 0;
+        for (size_t i = 0; i < params.size(); i++) {
+            if (i < 64 && (strict & (StrictMask(1) << i))) {
+                params[i]->accept(*this);
+                args[i] = -1;
+                strictArgs++;
+            }
+        }
+
+        int callSite = static_cast<int>(_function.callSites.size());
+        for (size_t i = 0; i < params.size(); i++) {
+            if (args[i] >= 0) {
+                _pendingArgs.push_back({ params[i].get(), callSite, static_cast<int>(i), _locals });
+            }
+        }
+        // The caller's frame can only be replaced if no argument needs to be evaluated in it
+        bool tailCall = tail && static_cast<size_t>(strictArgs) == args.size();
+        _function.callSites.push_back({ binding.index, std::move(args), strictArgs });
+        if (_globals.insert(binding.index).second) {
+            _function.globals.push_back(binding.index);
+        }
+        emit(tailCall ? OpCode::TAIL_CALL : OpCode::CALL, callSite);
+        adjustDepth(-strictArgs);
+        break;
+    }
+    }
+}
+
+void Compiler::visit(SharedExprNode *node) {
+    _tail = false;
+    _function.sharedSlots = std::max(_function.sharedSlots, node->slot() + 1);
+    emit(OpCode::LOAD_SHARED, node->slot());
+    int end = emitJump(OpCode::JUMP);
+    node->value()->accept(*this);
+    emit(OpCode::STORE_SHARED, node->slot());
+    patchJump(end);
+}
+
+Binding Compiler::resolve(const std::string &name) {
+    return _symbols.resolve(_function.paramNames, name);
+}
+
+/**
+ * @brief Finds the slot of a name bound by a loop being compiled, which shadows everything else
+ */
+bool Compiler::tryGetLocal(const std::string &name, int32_t &slot) const {
+    for (auto it = _locals.rbegin(); it != _locals.rend(); it++) {
+        if (*it->name == name) {
+            slot = it->slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Compiles the body followed by the code for every argument passed by name
+ * 
+ * @param body Expression which produces the function's result
+ * @param index If set, a name bound to shared slot 0 throughout, as the index of a loop's body compiled on its own
+ * @return Function The finished function
+ */
+Function Compiler::finish(ExprNode *body, const std::string *index) {
+    _pendingArgs.clear();
+    _constants.clear();
+    _globals.clear();
+    _locals.clear();
+    _localSlots = 0;
+    if (index) {
+        _locals.push_back({ index, 0 });
+        _localSlots = 1;
+    }
+    _depth = 0;
+    _tail = true;
+    body->accept(*this);
+    emit(OpCode::RETURN);
+
+    // Arguments are evaluated in their own frame, so start with an empty stack
+    while (!_pendingArgs.empty()) {
+        PendingArg arg = std::move(_pendingArgs.front());
+        _pendingArgs.pop_front();
+        _function.callSites[arg.callSite].args[arg.index] = static_cast<int32_t>(_function.code.size());
+        _locals = std::move(arg.locals);
+        _depth = 0;
+        _tail = false;
+        arg.expression->accept(*this);
+        emit(OpCode::RETURN);
+    }
+    _locals.clear();
+
+    // Names bound by loops come first, and how many there are is only known now
+    if (_localSlots > 0) {
+        for (Instruction &instruction : _function.code) {
+            if (instruction.opcode == OpCode::LOAD_SHARED || instruction.opcode == OpCode::STORE_SHARED) {
+                instruction.operand += _localSlots;
+            }
+        }
+        _function.sharedSlots += _localSlots;
+    }
+
+    _function.code.shrink_to_fit();
+    _function.constants.shrink_to_fit();
+    _function.callSites.shrink_to_fit();
+    _function.nativeCalls.shrink_to_fit();
+    _function.loops.shrink_to_fit();
+    _function.globals.shrink_to_fit();
+    return std::move(_function);
+}
+
+void Compiler::compileBuiltin(Builtin builtin, FunctionInvocationNode *node, bool tail) {
+    const std::vector<ExprNode::ptr> &params = node->params();
+    switch (builtin) {
+    case Builtin::IF:
+        if (params.size() < 2) {
+            emitConst(NAN);
+        } else if (params.size() == 2) {
+            // if(a, b) results in a when a is false
+            params[0]->accept(*this);
+            emit(OpCode::DUP);
+            int otherwise = emitJump(OpCode::JUMP_IF_FALSE);
+            emit(OpCode::POP);
+            _tail = tail;
+            params[1]->accept(*this);
+            patchJump(otherwise);
+        } else {
+            params[0]->accept(*this);
+            int otherwise = emitJump(OpCode::JUMP_IF_FALSE);
+            _tail = tail;
+            params[1]->accept(*this);
+            int end = emitJump(OpCode::JUMP);
+            // Only one branch is left on the stack
+            adjustDepth(-1);
+            patchJump(otherwise);
+            _tail = tail;
+            params[2]->accept(*this);
+            patchJump(end);
+        }
+        break;
+    case Builtin::EQ:
+    case Builtin::NE:
+    case Builtin::GT:
+    case Builtin::LT:
+    case Builtin::GE:
+    case Builtin::LE:
+        if (params.size() < 2) {
+            emitConst(NAN);
+            break;
+        }
+        params[0]->accept(*this);
+        params[1]->accept(*this);
+        switch (builtin) {
+        case Builtin::EQ:
+            emit(OpCode::EQ);
+            break;
+        case Builtin::NE:
+            emit(OpCode::NE);
+            break;
+        case Builtin::GT:
+            emit(OpCode::GT);
+            break;
+        case Builtin::LT:
+            emit(OpCode::LT);
+            break;
+        case Builtin::GE:
+            emit(OpCode::GE);
+            break;
+        default:
+            emit(OpCode::LE);
+            break;
+        }
+        break;
+    case Builtin::TRUE:
+        emitConst(QC_TRUE);
+        break;
+    case Builtin::FALSE:
+        emitConst(QC_FALSE);
+        break;
+    case Builtin::EPSILON:
+        emitConst(QC_EPSILON);
+        break;
+    case Builtin::PI:
+        emitConst(QC_PI);
+        break;
+    case Builtin::SUM:
+    case Builtin::PROD:
+    case Builtin::MINOF:
+    case Builtin::MAXOF:
+    case Builtin::FOLD:
+        compileLoop(builtin, node);
+        break;
+    }
+}
+
+/**
+ * @brief Compiles a loop, which runs its body in place with the names it binds kept in slots of the frame
+ * 
+ * The bounds, and the initial value of a fold, are evaluated once before the loop starts.
+ */
+void Compiler::compileLoop(Builtin builtin, FunctionInvocationNode *node) {
+    LoopCall call;
+    if (!tryGetLoop(builtin, node->params(), call)) {
+        emitConst(NAN);
+        return;
+    }
+    call.lo->accept(*this);
+    _tail = false;
+    call.hi->accept(*this);
+    if (call.init) {
+        _tail = false;
+        call.init->accept(*this);
+    }
+
+    size_t bound = _locals.size();
+    int32_t index = static_cast<int32_t>(bound);
+    int32_t accumulator = call.accumulator ? index + 1 : -1;
+    Loop loop { call.reduction, index, accumulator, 0, 0, nullptr };
+    if (splittable(call)) {
+        Compiler split(_symbols, _strictness, _pure);
+        split._function.name = _function.name + "/" + node->name();
+        loop.split = std::make_shared<const Function>(split.finish(call.body, call.index));
+        for (int32_t global : loop.split->globals) {
+            if (_globals.insert(global).second) {
+                _function.globals.push_back(global);
+            }
+        }
+    }
+    int32_t id = static_cast<int32_t>(_function.loops.size());
+    _function.loops.push_back(std::move(loop));
+    emit(OpCode::LOOP_BEGIN, id);
+    adjustDepth(call.init ? -3 : -2);
+
+    _function.loops[id].body = static_cast<int32_t>(_function.code.size());
+    _locals.push_back({ call.index, index });
+    if (call.accumulator) {
+        _locals.push_back({ call.accumulator, accumulator });
+    }
+    _localSlots = std::max(_localSlots, static_cast<int>(_locals.size()));
+    _tail = false;
+    call.body->accept(*this);
+    _locals.resize(bound);
+    // Leaves the result in place of the body's value
+    emit(OpCode::LOOP_NEXT, id);
+    _function.loops[id].end = static_cast<int32_t>(_function.code.size());
+}
+
+/**
+ * @brief Checks whether parts of a loop's range can be run on other threads, which share nothing with it
+ * 
+ * Folds visit their indices in order, and bodies which use anything else bound in the function, or call
+ * anything which isn't pure, have to be run where they are.
+ */
+bool Compiler::splittable(const LoopCall &loop) {
+    if (!_pure || loop.reduction == Reduction::FOLD) {
+        return false;
+    }
+    std::vector<std::string> outside = _function.paramNames;
+    for (const Local &local : _locals) {
+        outside.push_back(*local.name);
+    }
+    return ClosedCheck(_symbols, _pure, outside).check(loop);
+}
+
+void Compiler::emit(OpCode opcode, int32_t operand) {
+    _function.code.push_back({ opcode, operand });
+    switch (opcode) {
+    case OpCode::CONST:
+    case OpCode::INTEGER:
+    case OpCode::ARG:
+    case OpCode::LOAD_LOCAL:
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+    case OpCode::CALL_NATIVE:
+    case OpCode::DUP:
+        adjustDepth(1);
+        break;
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::POP:
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE:
+    case OpCode::AND:
+    case OpCode::OR:
+    case OpCode::XOR:
+    case OpCode::EQ:
+    case OpCode::NE:
+    case OpCode::GT:
+    case OpCode::LT:
+    case OpCode::GE:
+    case OpCode::LE:
+        adjustDepth(-1);
+        break;
+    default:
+        break;
+    }
+}
+
+void Compiler::emitConst(double value) {
+    // Key on the bit pattern so NaN and -0.0 get their own entries
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(double));
+    auto it = _constants.find(bits);
+    if (it == _constants.end()) {
+        it = _constants.emplace(bits, static_cast<int32_t>(_function.constants.size())).first;
+        _function.constants.push_back(value);
+    }
+    emit(OpCode::CONST, it->second);
+}
+
+int Compiler::emitJump(OpCode opcode) {
+    emit(opcode, -1);
+    return static_cast<int>(_function.code.size() - 1);
+}
+
+void Compiler::patchJump(int offset) {
+    _function.code[offset].operand = static_cast<int32_t>(_function.code.size());
+}
+
+void Compiler::adjustDepth(int change) {
+    _depth += change;
+    if (_depth > _function.maxStack) {
+        _function.maxStack = _depth;
+    }
+}
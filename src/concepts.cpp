@@ -1,24 +1,21 @@
 #include "concepts.hpp"
+#include "batchkernels.hpp"
+#include "simd.hpp"
+#include <algorithm>
 #include <unordered_map>
 #include <cmath>
+#include <stdexcept>
 
 using namespace quickcalc;
 
 namespace {
-    constexpr double QC_FALSE = 0.0;
-    constexpr double QC_TRUE = 1.0;
-    constexpr double QC_EPSILON = 1e-15;
-    // C++17 doesn't define a pi constant, so we'll use our own
-    constexpr double QC_PI = 3.1415926535897932384626433832795028841971693993751058209749445923078164063;
-    
     double qcIf(Executor &exec, const std::vector<ExprNode::ptr> &params) {
         if (params.size() < 2) {
             return NAN;
         }
         double param0 = exec.evaluate(params[0].get());
 
-        // false
-        if (abs(param0) < QC_EPSILON) {
+        if (isFalse(param0)) {
             if (params.size() >= 3) {
                 return exec.evaluate(params[2].get());
             } else {
@@ -33,14 +30,14 @@ namespace {
         if (params.size() < 2) {
             return NAN;
         }
-        return abs(exec.evaluate(params[0].get()) - exec.evaluate(params[1].get())) < QC_EPSILON;
+        return std::abs(exec.evaluate(params[0].get()) - exec.evaluate(params[1].get())) < QC_EPSILON;
     }
 
     double qcNe(Executor &exec, const std::vector<ExprNode::ptr> &params) {
         if (params.size() < 2) {
             return NAN;
         }
-        return abs(exec.evaluate(params[0].get()) - exec.evaluate(params[1].get())) >= QC_EPSILON;
+        return std::abs(exec.evaluate(params[0].get()) - exec.evaluate(params[1].get())) >= QC_EPSILON;
     }
 
     double qcGt(Executor &exec, const std::vector<ExprNode::ptr> &params) {
@@ -87,25 +84,207 @@ namespace {
         return QC_PI;
     }
 
-    std::unordered_map<std::string, ExecutorState::Func> functions = {
-        { "if", &qcIf },
-        { "eq", &qcEq },
-        { "ne", &qcNe },
-        { "gt", &qcGt },
-        { "lt", &qcLt },
-        { "ge", &qcGe },
-        { "le", &qcLe },
-        { "TRUE", &qcTrue },
-        { "true", &qcTrue },
-        { "FALSE", &qcFalse },
-        { "false", &qcFalse },
-        { "EPSILON", &qcEpsilon },
-        { "PI", &qcPi },
+    // Names bound by a loop are written as a call without arguments
+    const std::string *boundName(const ExprNode *node) {
+        auto *invocation = dynamic_cast<const FunctionInvocationNode *>(node);
+        return invocation && invocation->params().empty() ? &invocation->name() : nullptr;
+    }
+
+    double qcLoop(Builtin builtin, Executor &exec, const std::vector<ExprNode::ptr> &params) {
+        LoopCall loop;
+        if (!tryGetLoop(builtin, params, loop)) {
+            return NAN;
+        }
+        double lo = exec.evaluate(loop.lo);
+        double hi = exec.evaluate(loop.hi);
+        double accumulator = loop.init ? exec.evaluate(loop.init) : 0.0;
+        uint64_t length;
+        if (!rangeLength(lo, hi, length)) {
+            return NAN;
+        }
+
+        // Every index is worked out from lo, as other engines may start part way through the range
+        double index = lo;
+        ValueBinding indexBinding(exec, *loop.index, &index);
+        if (loop.reduction == Reduction::FOLD) {
+            ValueBinding accumulatorBinding(exec, *loop.accumulator, &accumulator);
+            for (uint64_t i = 0; i < length; i++) {
+                index = lo + static_cast<double>(i);
+                accumulator = exec.evaluate(loop.body);
+            }
+            return accumulator;
+        }
+        PairwiseReduction result(loop.reduction);
+        for (uint64_t i = 0; i < length; i++) {
+            index = lo + static_cast<double>(i);
+            result.add(exec.evaluate(loop.body));
+        }
+        return result.result();
+    }
+
+    // If modifying check Builtin enum in concepts.hpp
+    std::unordered_map<std::string, Builtin> BUILTINS = {
+        { "if", Builtin::IF },
+        { "eq", Builtin::EQ },
+        { "ne", Builtin::NE },
+        { "gt", Builtin::GT },
+        { "lt", Builtin::LT },
+        { "ge", Builtin::GE },
+        { "le", Builtin::LE },
+        { "TRUE", Builtin::TRUE },
+        { "true", Builtin::TRUE },
+        { "FALSE", Builtin::FALSE },
+        { "false", Builtin::FALSE },
+        { "EPSILON", Builtin::EPSILON },
+        { "PI", Builtin::PI },
+        { "sum", Builtin::SUM },
+        { "prod", Builtin::PROD },
+        { "minof", Builtin::MINOF },
+        { "maxof", Builtin::MAXOF },
+        { "fold", Builtin::FOLD },
     };
+
+    // Uses the same approximations as the batch kernels, so every engine gives the same result
+    template<MathFunction FUNCTION>
+    double mathCall(const double *args, size_t count) {
+        double result = args[0];
+        MathKernels<ScalarSimd>::evaluate(FUNCTION, &result, count > 1 ? args + 1 : nullptr, 1);
+        return result;
+    }
+
+    template<MathFunction FUNCTION>
+    void mathColumns(const double *const *args, size_t count, double *results, size_t rows) {
+        std::copy_n(args[0], rows, results);
+        const double *second = count > 1 ? args[1] : nullptr;
+        // Batch kernels take whole blocks of 4 lanes
+        size_t blocks = rows & ~size_t(3);
+        selectKernels().math(FUNCTION, results, second, blocks);
+        MathKernels<ScalarSimd>::evaluate(FUNCTION, results + blocks, second ? second + blocks : nullptr, rows - blocks);
+    }
+
+    template<MathFunction FUNCTION>
+    constexpr NativeDefinition math(const char *name, uint32_t args) {
+        return { name, &mathCall<FUNCTION>, &mathColumns<FUNCTION>, args, args, NATIVE_PURE | NATIVE_VECTORIZABLE };
+    }
+
+    // If modifying check MathFunction enum in mathkernels.hpp
+    const NativeDefinition MATH[] = {
+        math<MathFunction::SQRT>("sqrt", 1),
+        math<MathFunction::EXP>("exp", 1),
+        math<MathFunction::LOG>("log", 1),
+        math<MathFunction::SIN>("sin", 1),
+        math<MathFunction::COS>("cos", 1),
+        math<MathFunction::TAN>("tan", 1),
+        math<MathFunction::POW>("pow", 2),
+    };
+
+    const NativeLibrary MATH_LIBRARY = { NATIVE_ABI_VERSION, sizeof(MATH) / sizeof(MATH[0]), MATH };
 }
 
 void quickcalc::loadConcepts(ExecutorState &state) {
-    for (auto &func : functions) {
-        state.setFunction(func.first, func.second);
+    for (auto &builtin : BUILTINS) {
+        state.setFunction(builtin.first, ExecutorState::Func::ofBuiltin(static_cast<int32_t>(builtin.second)));
+    }
+}
+
+double quickcalc::callBuiltin(Builtin builtin, Executor &exec, const std::vector<ExprNode::ptr> &params) {
+    switch (builtin) {
+    case Builtin::IF:
+        return qcIf(exec, params);
+    case Builtin::EQ:
+        return qcEq(exec, params);
+    case Builtin::NE:
+        return qcNe(exec, params);
+    case Builtin::GT:
+        return qcGt(exec, params);
+    case Builtin::LT:
+        return qcLt(exec, params);
+    case Builtin::GE:
+        return qcGe(exec, params);
+    case Builtin::LE:
+        return qcLe(exec, params);
+    case Builtin::TRUE:
+        return qcTrue(exec, params);
+    case Builtin::FALSE:
+        return qcFalse(exec, params);
+    case Builtin::EPSILON:
+        return qcEpsilon(exec, params);
+    case Builtin::PI:
+        return qcPi(exec, params);
+    case Builtin::SUM:
+    case Builtin::PROD:
+    case Builtin::MINOF:
+    case Builtin::MAXOF:
+    case Builtin::FOLD:
+        return qcLoop(builtin, exec, params);
+    }
+    throw std::logic_error("Unknown builtin");
+}
+
+bool quickcalc::isLoop(Builtin builtin) {
+    switch (builtin) {
+    case Builtin::SUM:
+    case Builtin::PROD:
+    case Builtin::MINOF:
+    case Builtin::MAXOF:
+    case Builtin::FOLD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Picks out the parts of a call to a loop, sum(i, lo, hi, body) or fold(i, lo, hi, acc, init, body)
+ * 
+ * @param builtin Builtin being called
+ * @param params Arguments of the call
+ * @param loop Filled in with the parts, which point into params
+ * @return false The builtin isn't a loop, or is missing arguments or a name to bind, so the result is NaN
+ */
+bool quickcalc::tryGetLoop(Builtin builtin, const std::vector<ExprNode::ptr> &params, LoopCall &loop) {
+    switch (builtin) {
+    case Builtin::SUM:
+        loop.reduction = Reduction::SUM;
+        break;
+    case Builtin::PROD:
+        loop.reduction = Reduction::PRODUCT;
+        break;
+    case Builtin::MINOF:
+        loop.reduction = Reduction::MINIMUM;
+        break;
+    case Builtin::MAXOF:
+        loop.reduction = Reduction::MAXIMUM;
+        break;
+    case Builtin::FOLD:
+        loop.reduction = Reduction::FOLD;
+        break;
+    default:
+        return false;
+    }
+    bool fold = loop.reduction == Reduction::FOLD;
+    if (params.size() < (fold ? 6 : 4)) {
+        return false;
+    }
+    loop.index = boundName(params[0].get());
+    loop.lo = params[1].get();
+    loop.hi = params[2].get();
+    loop.accumulator = fold ? boundName(params[3].get()) : nullptr;
+    loop.init = fold ? params[4].get() : nullptr;
+    loop.body = params[fold ? 5 : 3].get();
+    return loop.index && (!fold || loop.accumulator);
+}
+
+const NativeLibrary &quickcalc::mathConcepts() {
+    return MATH_LIBRARY;
+}
+
+bool quickcalc::tryGetBuiltin(const std::string &name, Builtin &builtin) {
+    auto it = BUILTINS.find(name);
+    if (it != BUILTINS.end()) {
+        builtin = it->second;
+        return true;
+    } else {
+        return false;
     }
 }
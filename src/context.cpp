@@ -0,0 +1,520 @@
+#include "context.hpp"
+#include "concepts.hpp"
+#include "integer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    constexpr size_t NO_CACHE = SIZE_MAX;
+    // Loops shorter than this aren't worth waking other threads for
+    constexpr uint64_t MIN_SPLIT_LENGTH = 16 * REDUCTION_BLOCK;
+    // Parts of a split loop per worker, so workers which finish early can take more
+    constexpr uint64_t SPLIT_RUNS_PER_WORKER = 4;
+
+    // Bitwise operators keep integers in stack slots in place of doubles, rounding them as they're used
+    int64_t integerAt(const double &slot) {
+        int64_t value;
+        std::memcpy(&value, &slot, sizeof(int64_t));
+        return value;
+    }
+
+    void setInteger(double &slot, int64_t value) {
+        std::memcpy(&slot, &value, sizeof(int64_t));
+    }
+}
+
+ExecutionContext::ExecutionContext(): ExecutionContext(VMOptions()) {
+}
+
+/**
+ * @brief Construct a new execution context
+ * 
+ * @param options How much to preallocate, how far to grow and whether to use memo caches, arguments are
+ * passed however the code being run was compiled to
+ */
+ExecutionContext::ExecutionContext(const VMOptions &options): _stack(options.stackSize),
+    _frames(options.frameStackSize, options.memoryLimit), _sp(0), _memoryLimit(options.memoryLimit),
+    _nativeStackSize(options.nativeStackSize), _memoize(options.memoEntries > 0 || options.cacheConstants), _callStrict(0), _callByNeed(false),
+    _loopWorkers(std::max<size_t>(options.loopWorkers, 1)), _splitOptions(options) {
+    // Parts of a split loop run on one thread each, and contexts of other threads can't share memo caches
+    _splitOptions.loopWorkers = 1;
+    _splitOptions.memoEntries = 0;
+    _splitOptions.cacheConstants = false;
+}
+
+/**
+ * @brief Runs a function compiled without parameters, such as a script
+ * 
+ * @param entry Function to run
+ * @param code Code of every global, everything reachable from entry must be compiled
+ * @param byNeed Whether the code was compiled to pass arguments by need
+ * @return double Result of the function
+ */
+double ExecutionContext::run(const Function &entry, const std::vector<Code> &code, bool byNeed) {
+    return run(entry, code, byNeed, nullptr);
+}
+
+/**
+ * @brief Runs a function compiled without parameters, possibly the body of a split loop
+ * 
+ * @param index If set, the value of the index kept in shared slot 0 by the body of a loop
+ */
+double ExecutionContext::run(const Function &entry, const std::vector<Code> &code, bool byNeed, const double *index) {
+    const size_t baseTop = _frames.top();
+    const size_t baseSp = _sp;
+    const size_t baseLoops = _loops.size();
+
+    const Function *function = &entry;
+    const Instruction *pc = entry.code.data();
+    reserveStack(_sp + entry.maxStack);
+    size_t current = _frames.push(sizeof(Frame) + entry.sharedSlots * sizeof(ArgValue));
+    _frames.emplace(current, Frame {
+        function, nullptr, current, current, nullptr, current, NO_CACHE, nullptr, current + sizeof(Frame)
+    });
+    clearShared(_frames.emplaceArray<ArgValue>(current + sizeof(Frame), entry.sharedSlots), entry);
+    if (index) {
+        *_frames.at<ArgValue>(current + sizeof(Frame)) = { *index, true };
+    }
+
+    double *stack = _stack.data();
+    size_t sp = _sp;
+
+    // Native code is given a fixed amount of stack, and isn't entered again until a call which ran out returns
+    JitContext context = { 0, false };
+    uintptr_t here = reinterpret_cast<uintptr_t>(&context);
+    context.stackLimit = here > _nativeStackSize ? here - _nativeStackSize : 0;
+    size_t interpreted = NO_CACHE;
+
+    try {
+        for (;;) {
+            const Instruction &instruction = *pc++;
+            switch (instruction.opcode) {
+            case OpCode::CONST:
+                stack[sp++] = function->constants[instruction.operand];
+                break;
+            case OpCode::ARG: {
+                size_t envOffset = _frames.at<Frame>(current)->env;
+                const Frame *env = _frames.at<Frame>(envOffset);
+                if (static_cast<size_t>(instruction.operand) >= env->site->args.size()) {
+                    throw std::runtime_error("Undefined function " + env->function->paramNames[instruction.operand]);
+                }
+                size_t cache = NO_CACHE;
+                if (byNeed) {
+                    cache = envOffset + sizeof(Frame) + instruction.operand * sizeof(ArgValue);
+                    const ArgValue *arg = _frames.at<ArgValue>(cache);
+                    if (arg->ready) {
+                        stack[sp++] = arg->value;
+                        break;
+                    }
+                }
+                size_t callerEnv = env->callerEnv;
+                int32_t entryPoint = env->site->args[instruction.operand];
+                function = _frames.at<Frame>(callerEnv)->function;
+                size_t offset = _frames.push(sizeof(Frame));
+                _frames.emplace(offset, Frame { function, pc, current, callerEnv, nullptr, callerEnv, cache, nullptr, 0 });
+                current = offset;
+                pc = function->code.data() + entryPoint;
+                reserveStack(sp + function->maxStack);
+                stack = _stack.data();
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL: {
+                const CallSite &site = function->callSites[instruction.operand];
+                MemoCache *memo = _memoize ? code[site.callee].memo.get() : nullptr;
+                size_t strictArgs = static_cast<size_t>(site.strictArgs);
+                if (memo && strictArgs == site.args.size() && site.args.size() == memo->arity()) {
+                    double value;
+                    std::copy_n(stack + sp - site.strictArgs, site.strictArgs, memo->probe());
+                    if (memo->find(value)) {
+                        sp -= site.strictArgs;
+                        stack[sp++] = value;
+                        break;
+                    }
+                } else {
+                    memo = nullptr;
+                }
+
+                // Linking guarantees everything reachable is compiled
+                const Function *callee = code[site.callee].function.get();
+                const NativeCode *native = code[site.callee].native.get();
+                bool bailed = false;
+                if (native && interpreted == NO_CACHE && strictArgs == site.args.size()
+                    && site.args.size() >= callee->paramNames.size()) {
+                    double value = native->call(stack + sp - site.strictArgs, context);
+                    if (!context.bailed) {
+                        sp -= site.strictArgs;
+                        stack[sp++] = value;
+                        break;
+                    }
+                    // Ran out of native stack, so interpret the call instead
+                    context.bailed = false;
+                    bailed = true;
+                }
+                size_t argCount = byNeed ? site.args.size() : 0;
+                size_t shared = sizeof(Frame) + argCount * sizeof(ArgValue);
+                size_t frameSize = shared + callee->sharedSlots * sizeof(ArgValue);
+                const Frame *frame = _frames.at<Frame>(current);
+                if (instruction.opcode == OpCode::TAIL_CALL && !frame->memo) {
+                    // Every argument has been evaluated, so the new frame can take the place of the current one
+                    Frame replaced = *frame;
+                    _frames.pop(current);
+                    _frames.push(frameSize);
+                    _frames.emplace(current, Frame {
+                        callee, replaced.returnPc, replaced.previous, current, &site, replaced.callerEnv, NO_CACHE,
+                        memo, current + shared
+                    });
+                } else {
+                    size_t callerEnv = frame->env;
+                    size_t offset = _frames.push(frameSize);
+                    _frames.emplace(offset, Frame {
+                        callee, pc, current, offset, &site, callerEnv, NO_CACHE, memo, offset + shared
+                    });
+                    current = offset;
+                }
+                if (bailed) {
+                    interpreted = current;
+                }
+                ArgValue *args = _frames.emplaceArray<ArgValue>(current + sizeof(Frame), argCount + callee->sharedSlots);
+                if (byNeed) {
+                    sp -= site.strictArgs;
+                    bindArgs(args, site, stack + sp);
+                }
+                clearShared(args + argCount, *callee);
+                function = callee;
+                pc = function->code.data();
+                reserveStack(sp + function->maxStack);
+                stack = _stack.data();
+                break;
+            }
+            case OpCode::CALL_NATIVE: {
+                const NativeCallSite &site = function->nativeCalls[instruction.operand];
+                sp -= site.args;
+                stack[sp] = site.function(stack + sp, site.args);
+                sp++;
+                break;
+            }
+            case OpCode::RETURN: {
+                const Frame *frame = _frames.at<Frame>(current);
+                if (frame->cache != NO_CACHE) {
+                    *_frames.at<ArgValue>(frame->cache) = { stack[sp - 1], true };
+                }
+                if (frame->memo) {
+                    const ArgValue *args = _frames.at<ArgValue>(current + sizeof(Frame));
+                    double *key = frame->memo->probe();
+                    for (size_t i = 0; i < frame->memo->arity(); i++) {
+                        key[i] = args[i].value;
+                    }
+                    frame->memo->insert(stack[sp - 1]);
+                }
+                if (current == interpreted) {
+                    interpreted = NO_CACHE;
+                }
+                pc = frame->returnPc;
+                size_t previous = frame->previous;
+                _frames.pop(current);
+                if (current == baseTop) {
+                    _sp = baseSp;
+                    return stack[sp - 1];
+                }
+                current = previous;
+                function = _frames.at<Frame>(current)->function;
+                break;
+            }
+            case OpCode::JUMP:
+                pc = function->code.data() + instruction.operand;
+                break;
+            case OpCode::LOAD_SHARED: {
+                const Frame *env = _frames.at<Frame>(_frames.at<Frame>(current)->env);
+                const ArgValue *shared = _frames.at<ArgValue>(env->shared + instruction.operand * sizeof(ArgValue));
+                if (shared->ready) {
+                    stack[sp++] = shared->value;
+                } else {
+                    // Skip the jump past the code which evaluates it
+                    pc++;
+                }
+                break;
+            }
+            case OpCode::STORE_SHARED: {
+                const Frame *env = _frames.at<Frame>(_frames.at<Frame>(current)->env);
+                *_frames.at<ArgValue>(env->shared + instruction.operand * sizeof(ArgValue)) = { stack[sp - 1], true };
+                break;
+            }
+            case OpCode::LOAD_LOCAL: {
+                const Frame *env = _frames.at<Frame>(_frames.at<Frame>(current)->env);
+                stack[sp++] = _frames.at<ArgValue>(env->shared + instruction.operand * sizeof(ArgValue))->value;
+                break;
+            }
+            case OpCode::LOOP_BEGIN: {
+                const Loop &loop = function->loops[instruction.operand];
+                bool fold = loop.reduction == Reduction::FOLD;
+                double init = fold ? stack[--sp] : 0.0;
+                double hi = stack[--sp];
+                double lo = stack[--sp];
+                uint64_t length;
+                if (!rangeLength(lo, hi, length)) {
+                    stack[sp++] = NAN;
+                } else if (length == 0) {
+                    stack[sp++] = fold ? init : reductionIdentity(loop.reduction);
+                } else if (loop.split && _loopWorkers > 1 && length >= MIN_SPLIT_LENGTH) {
+                    stack[sp++] = runSplit(loop, lo, length, code, byNeed);
+                } else {
+                    // The body runs in the frame the loop is in, with its names in that frame's shared slots
+                    size_t slots = _frames.at<Frame>(_frames.at<Frame>(current)->env)->shared;
+                    ArgValue *values = _frames.at<ArgValue>(slots);
+                    values[loop.index] = { lo, true };
+                    if (fold) {
+                        values[loop.accumulator] = { init, true };
+                    }
+                    _loops.push_back({ &loop, slots, lo, 1, length, PairwiseReduction(loop.reduction) });
+                    break;
+                }
+                pc = function->code.data() + loop.end;
+                break;
+            }
+            case OpCode::LOOP_NEXT: {
+                LoopState &state = _loops.back();
+                const Loop &loop = *state.loop;
+                ArgValue *values = _frames.at<ArgValue>(state.slots);
+                double value = stack[--sp];
+                bool fold = loop.reduction == Reduction::FOLD;
+                if (fold) {
+                    values[loop.accumulator].value = value;
+                } else {
+                    state.result.add(value);
+                }
+                if (state.next < state.length) {
+                    // Worked out from lo every time, as split loops start part way through the range
+                    values[loop.index].value = state.lo + static_cast<double>(state.next++);
+                    pc = function->code.data() + loop.body;
+                } else {
+                    stack[sp++] = fold ? value : state.result.result();
+                    _loops.pop_back();
+                }
+                break;
+            }
+            case OpCode::JUMP_IF_FALSE:
+                if (isFalse(stack[--sp])) {
+                    pc = function->code.data() + instruction.operand;
+                }
+                break;
+            case OpCode::DUP:
+                stack[sp] = stack[sp - 1];
+                sp++;
+                break;
+            case OpCode::POP:
+                sp--;
+                break;
+            case OpCode::NEGATE:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case OpCode::NOT:
+                setInteger(stack[sp - 1], ~roundInteger(integerAt(stack[sp - 1])));
+                break;
+            case OpCode::ADD:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] + stack[sp];
+                break;
+            case OpCode::SUBTRACT:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] - stack[sp];
+                break;
+            case OpCode::MULTIPLY:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] * stack[sp];
+                break;
+            case OpCode::DIVIDE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] / stack[sp];
+                break;
+            case OpCode::AND:
+                sp--;
+                setInteger(stack[sp - 1], roundInteger(integerAt(stack[sp - 1])) & roundInteger(integerAt(stack[sp])));
+                break;
+            case OpCode::OR:
+                sp--;
+                setInteger(stack[sp - 1], roundInteger(integerAt(stack[sp - 1])) | roundInteger(integerAt(stack[sp])));
+                break;
+            case OpCode::XOR:
+                sp--;
+                setInteger(stack[sp - 1], roundInteger(integerAt(stack[sp - 1])) ^ roundInteger(integerAt(stack[sp])));
+                break;
+            case OpCode::INTEGER:
+                setInteger(stack[sp++], instruction.operand);
+                break;
+            case OpCode::TO_INTEGER:
+                setInteger(stack[sp - 1], toInteger(stack[sp - 1]));
+                break;
+            case OpCode::TO_DOUBLE:
+                stack[sp - 1] = static_cast<double>(integerAt(stack[sp - 1]));
+                break;
+            case OpCode::EQ:
+                sp--;
+                stack[sp - 1] = std::abs(stack[sp - 1] - stack[sp]) < QC_EPSILON;
+                break;
+            case OpCode::NE:
+                sp--;
+                stack[sp - 1] = std::abs(stack[sp - 1] - stack[sp]) >= QC_EPSILON;
+                break;
+            case OpCode::GT:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] > stack[sp];
+                break;
+            case OpCode::LT:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] < stack[sp];
+                break;
+            case OpCode::GE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] >= stack[sp];
+                break;
+            case OpCode::LE:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] <= stack[sp];
+                break;
+            }
+        }
+    } catch (...) {
+        _frames.pop(baseTop);
+        _sp = baseSp;
+        _loops.erase(_loops.begin() + baseLoops, _loops.end());
+        throw;
+    }
+}
+
+/**
+ * @brief Runs a loop whose body was compiled on its own, sharing parts of its range between threads
+ * 
+ * Each part is a power of two blocks long, aligned to the start of the range, so reducing the parts and
+ * then combining them gives the same result as running the whole loop in place.
+ * 
+ * @param loop Loop to run, which has a split body
+ * @param lo First index
+ * @param length Number of indices
+ * @return double Result of the loop
+ */
+double ExecutionContext::runSplit(const Loop &loop, double lo, uint64_t length, const std::vector<Code> &code,
+                                  bool byNeed) {
+    if (!_pool) {
+        _pool = std::make_unique<WorkerPool>(_loopWorkers);
+        for (size_t worker = 0; worker < _loopWorkers; worker++) {
+            _splits.push_back(std::make_unique<ExecutionContext>(_splitOptions));
+        }
+    }
+
+    uint64_t blocks = (length + REDUCTION_BLOCK - 1) / REDUCTION_BLOCK;
+    uint64_t partBlocks = 1;
+    while (blocks / partBlocks > _loopWorkers * SPLIT_RUNS_PER_WORKER) {
+        partBlocks *= 2;
+    }
+    uint64_t partLength = partBlocks * REDUCTION_BLOCK;
+    size_t parts = static_cast<size_t>((length + partLength - 1) / partLength);
+    std::vector<double> results(parts);
+    _pool->run(parts, 1, [&] (size_t worker, size_t begin, size_t end) {
+        ExecutionContext &context = *_splits[worker];
+        for (size_t part = begin; part < end; part++) {
+            uint64_t first = part * partLength;
+            uint64_t last = std::min(length, first + partLength);
+            PairwiseReduction result(loop.reduction);
+            for (uint64_t i = first; i < last; i++) {
+                double index = lo + static_cast<double>(i);
+                result.add(context.run(*loop.split, code, byNeed, &index));
+            }
+            results[part] = result.result();
+        }
+    });
+
+    PairwiseReduction result(loop.reduction);
+    for (size_t part = 0; part + 1 < parts; part++) {
+        result.addBlocks(results[part], partBlocks);
+    }
+    if (length % partLength == 0) {
+        result.addBlocks(results.back(), partBlocks);
+    } else {
+        result.addPartial(results.back());
+    }
+    return result.result();
+}
+
+
+/**
+ * @brief Calls a compiled function with arguments which have already been evaluated
+ * 
+ * Arguments are passed just as a compiled call would pass constants, so the call is memoized or
+ * runs natively whenever it would be from bytecode.
+ * 
+ * @param code Code of every global, everything reachable from the function must be compiled
+ * @param byNeed Whether the code was compiled to pass arguments by need
+ * @param slot Global slot of the function
+ * @param strict Strictness of the function, only used when passing by need
+ * @param args Value of each argument
+ * @param count Number of arguments
+ * @return double Result of the call
+ */
+double ExecutionContext::call(const std::vector<Code> &code, bool byNeed, int32_t slot, StrictMask strict,
+                              const double *args, size_t count) {
+    Function &script = _callScript;
+    strict = byNeed ? strict : 0;
+    if (script.callSites.empty() || script.callSites[0].callee != slot || script.constants.size() != count
+        || _callStrict != strict || _callByNeed != byNeed) {
+        script = Function();
+        script.name = "<call>";
+        CallSite site { slot, std::vector<int32_t>(count), 0 };
+        for (size_t i = 0; i < count; i++) {
+            if (i < 64 && (strict & (StrictMask(1) << i))) {
+                script.code.push_back({ OpCode::CONST, static_cast<int32_t>(i) });
+                site.args[i] = -1;
+                site.strictArgs++;
+            }
+        }
+        script.code.push_back({ OpCode::CALL, 0 });
+        script.code.push_back({ OpCode::RETURN, 0 });
+        // Arguments passed by name each get code of their own
+        for (size_t i = 0; i < count; i++) {
+            if (site.args[i] == 0) {
+                site.args[i] = static_cast<int32_t>(script.code.size());
+                script.code.push_back({ OpCode::CONST, static_cast<int32_t>(i) });
+                script.code.push_back({ OpCode::RETURN, 0 });
+            }
+        }
+        script.maxStack = std::max(site.strictArgs, 1);
+        script.callSites.push_back(std::move(site));
+        script.globals.push_back(slot);
+        script.constants.resize(count);
+        _callStrict = strict;
+        _callByNeed = byNeed;
+    }
+    std::copy_n(args, count, script.constants.begin());
+    return run(script, code, byNeed);
+}
+
+void ExecutionContext::bindArgs(ArgValue *args, const CallSite &site, const double *strictArgs) {
+    // Arguments the callee is strict in have already been evaluated and are on the stack in order
+    for (size_t i = 0; i < site.args.size(); i++) {
+        if (site.args[i] < 0) {
+            args[i] = { *strictArgs++, true };
+        } else {
+            args[i] = { 0.0, false };
+        }
+    }
+}
+
+void ExecutionContext::clearShared(ArgValue *shared, const Function &function) {
+    for (int i = 0; i < function.sharedSlots; i++) {
+        shared[i] = { 0.0, false };
+    }
+}
+
+void ExecutionContext::reserveStack(size_t size) {
+    if (size > _stack.size()) {
+        if (size * sizeof(double) > _memoryLimit) {
+            throw std::runtime_error("Memory limit exceeded");
+        }
+        _stack.resize(std::min(std::max(size, _stack.size() * 2), _memoryLimit / sizeof(double)));
+    }
+}
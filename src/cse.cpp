@@ -0,0 +1,203 @@
+#include "cse.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+#include <cstring>
+#include <functional>
+
+using namespace quickcalc;
+
+namespace {
+    enum KeyKind {
+        CONST = 0,
+        UNARY_OPERATION,
+        BINARY_OPERATION,
+        FUNCTION_INVOCATION,
+    };
+
+    struct Pending {
+        ExprNode::ptr *node;
+        bool childrenDone;
+    };
+}
+
+bool CommonSubexpressions::Key::operator==(const Key &other) const {
+    return kind == other.kind && operation == other.operation && value == other.value
+           && name == other.name && children == other.children;
+}
+
+size_t CommonSubexpressions::KeyHash::operator()(const Key &key) const {
+    size_t hash = hashCombine(static_cast<size_t>(key.kind), static_cast<size_t>(key.operation));
+    hash = hashCombine(hash, std::hash<uint64_t>()(key.value));
+    hash = hashCombine(hash, std::hash<std::string>()(key.name));
+    for (const ExprNode *child : key.children) {
+        hash = hashCombine(hash, std::hash<const ExprNode *>()(child));
+    }
+    return hash;
+}
+
+CommonSubexpressions::CommonSubexpressions(): NodeVisitor(), _merged(0), _unwrap(false) {
+}
+
+/**
+ * @brief Turns a statement's expression into a DAG in place, before it's executed
+ * 
+ * Subexpressions which are equal by structure end up as the same node. Those used more than once,
+ * other than constants, are wrapped in a SharedExprNode so each is evaluated at most once whenever
+ * the statement, or the function being defined, is evaluated. Expressions have no side effects, other
+ * than calls to native functions which aren't pure and are left alone, and everything in one function
+ * body sees the same names, so this doesn't change the result. The bodies of loops see names of their
+ * own, and are left as they are.
+ * 
+ * @param node Statement to transform
+ * @return size_t Number of nodes merged away
+ */
+size_t CommonSubexpressions::eliminate(StmtNode *node) {
+    _merged = 0;
+    node->accept(*this);
+    return _merged;
+}
+
+void CommonSubexpressions::visit(ExprStmtNode *node) {
+    eliminate(node->mutableExpression());
+}
+
+void CommonSubexpressions::visit(FuncDefNode *node) {
+    eliminate(node->mutableExpression());
+}
+
+void CommonSubexpressions::visit(ConstNode *node) {
+    // Keyed on the bit pattern so 0 and -0 are kept apart
+    double value = node->value();
+    _key.kind = CONST;
+    std::memcpy(&_key.value, &value, sizeof(double));
+}
+
+void CommonSubexpressions::visit(UnaryOperationNode *node) {
+    _key.kind = UNARY_OPERATION;
+    _key.operation = static_cast<int>(node->operation());
+    _children.push_back(&node->mutableValue());
+}
+
+void CommonSubexpressions::visit(BinaryOperationNode *node) {
+    _key.kind = BINARY_OPERATION;
+    _key.operation = static_cast<int>(node->operation());
+    _children.push_back(&node->mutableLhs());
+    _children.push_back(&node->mutableRhs());
+}
+
+void CommonSubexpressions::visit(FunctionInvocationNode *node) {
+    _key.kind = FUNCTION_INVOCATION;
+    _key.name = node->name();
+    // Calls to native functions which aren't pure may give different results, so are never merged
+    int32_t index;
+    if (tryGetNative(node->name(), index) && !nativeFunction(index).pure) {
+        _key.value = reinterpret_cast<uintptr_t>(node);
+    }
+    // A loop's body sees the names it binds, so only its bounds are merged with anything outside it
+    Builtin builtin;
+    LoopCall loop;
+    if (tryGetBuiltin(node->name(), builtin) && isLoop(builtin)) {
+        _key.value = reinterpret_cast<uintptr_t>(node);
+        std::vector<ExprNode::ptr> &params = node->mutableParams();
+        if (tryGetLoop(builtin, params, loop)) {
+            _children.push_back(&params[1]);
+            _children.push_back(&params[2]);
+            if (loop.init) {
+                _children.push_back(&params[4]);
+            }
+        }
+        return;
+    }
+    for (ExprNode::ptr &param : node->mutableParams()) {
+        _children.push_back(&param);
+    }
+}
+
+void CommonSubexpressions::visit(SharedExprNode *) {
+    // Left by an earlier pass, sharing is worked out again from scratch
+    _unwrap = true;
+}
+
+/**
+ * @brief Merges equal subexpressions from the bottom up, without recursing
+ * 
+ * @param root Owner of the expression
+ */
+void CommonSubexpressions::eliminate(ExprNode::ptr &root) {
+    _nodes.clear();
+    _uses.clear();
+    _order.clear();
+
+    std::vector<Pending> pending = { { &root, false } };
+    while (!pending.empty()) {
+        ExprNode::ptr &node = *pending.back().node;
+        inspect(node.get());
+        if (_unwrap) {
+            ExprNode::ptr value = static_cast<SharedExprNode *>(node.get())->mutableValue();
+            node = std::move(value);
+            continue;
+        }
+        if (!pending.back().childrenDone) {
+            pending.back().childrenDone = true;
+            for (ExprNode::ptr *child : _children) {
+                pending.push_back({ child, false });
+            }
+            continue;
+        }
+        pending.pop_back();
+
+        // Children have been merged, so the key only matches nodes which are equal by structure
+        for (ExprNode::ptr *child : _children) {
+            _key.children.push_back(child->get());
+        }
+        auto it = _nodes.find(_key);
+        if (it == _nodes.end()) {
+            for (const ExprNode *child : _key.children) {
+                _uses[child]++;
+            }
+            _order.push_back(node);
+            _nodes.emplace(std::move(_key), node);
+        } else if (it->second != node) {
+            // Reached through a node which was already merged
+            node = it->second;
+            _merged++;
+        }
+    }
+    _uses[root.get()]++;
+    share();
+}
+
+/**
+ * @brief Wraps merged nodes which are used more than once so their values are kept
+ */
+void CommonSubexpressions::share() {
+    std::unordered_map<const ExprNode *, ExprNode::ptr> wrappers;
+    int slots = 0;
+    for (const ExprNode::ptr &node : _order) {
+        if (_uses[node.get()] >= 2 && !dynamic_cast<ConstNode *>(node.get())) {
+            wrappers[node.get()] = std::make_shared<SharedExprNode>(ExprNode::ptr(node), slots++);
+        }
+    }
+    if (!wrappers.empty()) {
+        for (const ExprNode::ptr &node : _order) {
+            inspect(node.get());
+            for (ExprNode::ptr *child : _children) {
+                auto it = wrappers.find(child->get());
+                if (it != wrappers.end()) {
+                    *child = it->second;
+                }
+            }
+        }
+    }
+
+    _nodes.clear();
+    _uses.clear();
+    _order.clear();
+}
+
+void CommonSubexpressions::inspect(ExprNode *node) {
+    _key = Key();
+    _children.clear();
+    _unwrap = false;
+    node->accept(*this);
+}
@@ -1,9 +1,16 @@
 #include "executor.hpp"
+#include "concepts.hpp"
+#include "integer.hpp"
+#include "natives.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <stdexcept>
 
 using namespace quickcalc;
 
+FuelExhausted::FuelExhausted(): std::runtime_error("Evaluation ran out of fuel") {
+}
+
 Executor::Executor(): NodeVisitor() {
     pushState();
 }
@@ -13,47 +20,57 @@ Executor::Executor(NodeVisitor *next): NodeVisitor(next) {
 }
 
 void Executor::visit(ExprStmtNode *node) {
-    _lastResult = evaluate(node->expression());
+    // Shared expressions at the top level may depend on definitions made since they were last evaluated
+    getState()._shared.clear();
+#ifdef QC_FUEL
+    _fuel = _budget;
+#endif
+    size_t values = _valueStack.size();
+    try {
+        if (_profiler) {
+            Profiler::Call call(*_profiler, "<script>");
+            _lastResult = evaluate(node->expression());
+        } else {
+            _lastResult = evaluate(node->expression());
+        }
+    } catch (...) {
+        // Calls restore their own states as they unwind, but operands already evaluated are left behind
+        while (_valueStack.size() > values) {
+            _valueStack.pop();
+        }
+        throw;
+    }
     _hasResult = true;
 }
 
 void Executor::visit(FuncDefNode *node) {
-    getState().setFunction(node->name(), [node] (Executor &exec, const std::vector<ExprNode::ptr> &params) {
-        ExecutorState &newState = exec.pushState();
-        for (int i = 0; i < params.size() && i < node->paramNames().size(); i++) {
-            const ExprNode::ptr &ast = params[i];
-            newState.setFunction(node->paramNames()[i], [&ast] (Executor &exec, const std::vector<ExprNode::ptr> &) {
-                ExecutorState prevState = exec.popState();
-                double val = exec.evaluate(ast.get());
-                exec.pushState(std::move(prevState));
-                return val;
-            });
-        }
-        double result = exec.evaluate(node->expression());
-        exec.popState();
-        return result;
-    });
+    getState().setFunction(node->name(), ExecutorState::Func::ofDefinition(node));
     _hasResult = false;
 }
 
 void Executor::visit(ConstNode *node) {
-    _valueStack.push(node->value());
+    burn();
+    push(node->value());
 }
 
 void Executor::visit(UnaryOperationNode *node) {
-    node->value()->accept(*this);
-    double value = pop();
     switch (node->operation()) {
     case UnaryOperation::NEGATE:
-        push(-value);
+        burn();
+        push(-evaluate(node->value()));
         break;
     case UnaryOperation::NOT:
-        push(~static_cast<int32_t>(value));
+        push(static_cast<double>(integer(node)));
         break;
     }
 }
 
 void Executor::visit(BinaryOperationNode *node) {
+    if (isBitwise(node->operation())) {
+        push(static_cast<double>(integer(node)));
+        return;
+    }
+    burn();
     node->lhs()->accept(*this);
     node->rhs()->accept(*this);
     double rhs = pop();
@@ -70,27 +87,77 @@ void Executor::visit(BinaryOperationNode *node) {
         result = lhs * rhs;
         break;
     case BinaryOperation::DIVIDE:
+    default:
         result = lhs / rhs;
         break;
-    case BinaryOperation::AND:
-        result = static_cast<int32_t>(lhs) & static_cast<int32_t>(rhs);
+    }
+    push(result);
+}
+
+void Executor::visit(FunctionInvocationNode *node) {
+    burn();
+    ExecutorState::Func func;
+    count(_stats.lookups);
+    if (!getState().tryGetFunction(node->name(), func, _stats.lookupHops)) {
+        int32_t index;
+        if (!tryGetNative(node->name(), index)) {
+            throw std::runtime_error("Undefined function " + node->name());
+        }
+        func = ExecutorState::Func::ofNative(index);
+    }
+    if (_profiler && func.kind != FuncKind::ARGUMENT && func.kind != FuncKind::VALUE) {
+        Profiler::Call call(*_profiler, node->name());
+        invoke(node, func);
+    } else {
+        invoke(node, func);
+    }
+}
+
+void Executor::invoke(FunctionInvocationNode *node, const ExecutorState::Func &func) {
+    switch (func.kind) {
+    case FuncKind::BUILTIN:
+        push(callBuiltin(static_cast<Builtin>(func.index), *this, node->params()));
         break;
-    case BinaryOperation::OR:
-        result = static_cast<int32_t>(lhs) | static_cast<int32_t>(rhs);
+    case FuncKind::DEFINITION:
+        push(call(func.definition, node->params()));
         break;
-    case BinaryOperation::XOR:
-        result = static_cast<int32_t>(lhs) ^ static_cast<int32_t>(rhs);
+    case FuncKind::ARGUMENT: {
+        // Arguments are evaluated with the innermost state set aside, as they were passed from outside it
+        ExecutorState state = popState();
+        double value;
+        try {
+            value = evaluate((*func.args)[func.index].get());
+        } catch (...) {
+            pushState(std::move(state));
+            throw;
+        }
+        pushState(std::move(state));
+        push(value);
+        break;
+    }
+    case FuncKind::HOST:
+        push((*func.host)(*this, node->params()));
+        break;
+    case FuncKind::NATIVE:
+        push(callNative(func.index, node->params()));
+        break;
+    case FuncKind::VALUE:
+        push(*func.value);
         break;
     }
-    push(result);
 }
 
-void Executor::visit(FunctionInvocationNode *node) {
-    const ExecutorState::Func *func;
-    if (getState().tryGetFunction(node->name(), func)) {
-        push((*func)(*this, node->params()));
+void Executor::visit(SharedExprNode *node) {
+    burn();
+    // Every node evaluated in a state sees the same names, so the value can be reused within it
+    std::unordered_map<const ExprNode *, double> &shared = getState()._shared;
+    auto it = shared.find(node);
+    if (it != shared.end()) {
+        push(it->second);
     } else {
-        throw std::runtime_error("Undefined function " + node->name());
+        double value = evaluate(node->value());
+        getState()._shared.emplace(node, value);
+        push(value);
     }
 }
 
@@ -99,6 +166,65 @@ double Executor::evaluate(ExprNode *node) {
     return pop();
 }
 
+/**
+ * @brief Calls a definition, with its parameters bound to arguments which are evaluated when used
+ * 
+ * @param definition Definition to call
+ * @param args Unevaluated arguments, parameters past the last argument aren't bound
+ * @return double Result of the call
+ */
+double Executor::call(FuncDefNode *definition, const std::vector<ExprNode::ptr> &args) {
+    pushState().bindArgs(definition->paramNames(), args);
+    double result;
+    try {
+        result = evaluate(definition->expression());
+    } catch (...) {
+        popState();
+        throw;
+    }
+    popState();
+    return result;
+}
+
+/**
+ * @brief Calls a native function with the values of its arguments, evaluated in order
+ * 
+ * @param index Index of the native function
+ * @param args Unevaluated arguments
+ * @return double Result of the call
+ */
+double Executor::callNative(int32_t index, const std::vector<ExprNode::ptr> &args) {
+    const NativeFunction &native = nativeFunction(index);
+    if (!native.accepts(args.size())) {
+        throw std::runtime_error(native.arityError(args.size()));
+    }
+    std::vector<double> values;
+    values.reserve(args.size());
+    for (const ExprNode::ptr &arg : args) {
+        values.push_back(evaluate(arg.get()));
+    }
+    return native.call(values.data(), values.size());
+}
+
+/**
+ * @brief Looks up a native function, remembering it so later calls don't lock the registry
+ *
+ * Native functions are registered for the whole process, so are seen by every executor, and never removed,
+ * so only names which were found are remembered.
+ */
+bool Executor::tryGetNative(const std::string &name, int32_t &index) {
+    auto it = _natives.find(name);
+    if (it != _natives.end()) {
+        index = it->second;
+        return true;
+    }
+    if (!quickcalc::tryGetNative(name, index)) {
+        return false;
+    }
+    _natives.emplace(name, index);
+    return true;
+}
+
 double Executor::lastResult() const {
     return _lastResult;
 }
@@ -109,6 +235,9 @@ bool Executor::hasResult() const {
 
 void Executor::push(double value) {
     _valueStack.push(value);
+#ifdef QC_STATS
+    _stats.valuePeak = std::max<uint64_t>(_stats.valuePeak, _valueStack.size());
+#endif
 }
 
 double Executor::pop() {
@@ -122,6 +251,7 @@ ExecutorState &Executor::getState() {
 }
 
 ExecutorState &Executor::pushState() {
+    count(_stats.statePushes);
     if (_stateStack.empty()) {
         return _stateStack.emplace();
     } else {
@@ -130,6 +260,7 @@ ExecutorState &Executor::pushState() {
 }
 
 ExecutorState &Executor::pushState(const ExecutorState &state) {
+    count(_stats.statePushes);
     ExecutorState *parent = _stateStack.empty() ? nullptr :&_stateStack.top();     
 
     ExecutorState &newstate = _stateStack.emplace(state);
@@ -138,56 +269,265 @@ ExecutorState &Executor::pushState(const ExecutorState &state) {
 }
 
 ExecutorState &Executor::pushState(ExecutorState &&state) {
+    count(_stats.statePushes);
     state._parent = _stateStack.empty() ? nullptr :&_stateStack.top();     
     return _stateStack.emplace(std::move(state));
 }
 
 ExecutorState Executor::popState() {
+    count(_stats.statePops);
     ExecutorState state = std::move(_stateStack.top());
     _stateStack.pop();
     return state;
 }
 
+/**
+ * @brief Evaluates a node as an integer, giving the result of a bitwise operator before it's rounded to a double
+ *
+ * Bitwise operators nested in each other pass their results along as integers, rounded as though
+ * they'd been converted to doubles and back.
+ */
+int64_t Executor::integer(ExprNode *node) {
+    if (auto *unary = dynamic_cast<UnaryOperationNode *>(node)) {
+        if (unary->operation() == UnaryOperation::NOT) {
+            burn();
+            return ~roundInteger(integer(unary->value()));
+        }
+    } else if (auto *binary = dynamic_cast<BinaryOperationNode *>(node)) {
+        if (isBitwise(binary->operation())) {
+            burn();
+            int64_t lhs = roundInteger(integer(binary->lhs()));
+            int64_t rhs = roundInteger(integer(binary->rhs()));
+            return bitwise(binary->operation(), lhs, rhs);
+        }
+    }
+    return toInteger(evaluate(node));
+}
+
+/**
+ * @brief Sets the fuel each statement starts with, does nothing unless built with QC_FUEL
+ *
+ * @param budget Nodes each statement may evaluate before the checkpoint is called, UNLIMITED_FUEL by default
+ */
+void Executor::setFuelBudget(uint64_t budget) {
+#ifdef QC_FUEL
+    _budget = budget;
+#endif
+}
+
+/**
+ * @brief Sets the fuel left for the evaluation in progress, or the next call of evaluate
+ */
+void Executor::setFuel(uint64_t fuel) {
+#ifdef QC_FUEL
+    _fuel = fuel;
+#endif
+}
+
+/**
+ * @brief Gives the fuel left, always UNLIMITED_FUEL unless built with QC_FUEL
+ */
+uint64_t Executor::fuel() const {
+#ifdef QC_FUEL
+    return _fuel;
+#else
+    return UNLIMITED_FUEL;
+#endif
+}
+
+/**
+ * @brief Sets the function called when an evaluation runs out of fuel
+ *
+ * The checkpoint runs in the middle of the evaluation, so the host can do other work there before
+ * it returns and the evaluation resumes. The checkpoint mustn't use this executor.
+ *
+ * @param checkpoint Gives more fuel to carry on, or 0 to stop with FuelExhausted, which is what happens without one
+ */
+void Executor::setCheckpoint(const Checkpoint &checkpoint) {
+#ifdef QC_FUEL
+    _checkpoint = checkpoint;
+#endif
+}
+
+/**
+ * @brief Records the calls of every statement run from now on, or stops recording them
+ *
+ * @param profiler Profiler to record calls to, which must outlive its use, or null to stop
+ */
+void Executor::setProfiler(Profiler *profiler) {
+    _profiler = profiler;
+}
+
+/**
+ * @brief Gives the work done by every statement run so far, in builds with QC_STATS
+ */
+const Stats &Executor::stats() const {
+    return _stats;
+}
+
+void Executor::refuel() {
+#ifdef QC_FUEL
+    uint64_t fuel = _checkpoint ? _checkpoint(*this) : 0;
+    if (fuel == 0) {
+        _fuel = 0;
+        throw FuelExhausted();
+    }
+    // Pays for the node which ran out
+    _fuel = fuel - 1;
+#endif
+}
+
+ExecutorState::Func ExecutorState::Func::ofBuiltin(int32_t index) {
+    Func func;
+    func.kind = FuncKind::BUILTIN;
+    func.index = index;
+    return func;
+}
+
+ExecutorState::Func ExecutorState::Func::ofDefinition(FuncDefNode *definition) {
+    Func func;
+    func.kind = FuncKind::DEFINITION;
+    func.definition = definition;
+    return func;
+}
+
+/**
+ * @brief Refers to a parameter, evaluated from the arguments of the call which bound it
+ *
+ * @param index Index of the argument in args
+ * @param args Arguments of the call, which must outlive the function
+ */
+ExecutorState::Func ExecutorState::Func::ofArgument(int32_t index, const std::vector<ExprNode::ptr> *args) {
+    Func func;
+    func.kind = FuncKind::ARGUMENT;
+    func.index = index;
+    func.args = args;
+    return func;
+}
+
+ExecutorState::Func ExecutorState::Func::ofHost(std::shared_ptr<const Native> host) {
+    Func func;
+    func.kind = FuncKind::HOST;
+    func.host = std::move(host);
+    return func;
+}
+
+ExecutorState::Func ExecutorState::Func::ofNative(int32_t index) {
+    Func func;
+    func.kind = FuncKind::NATIVE;
+    func.index = index;
+    return func;
+}
+
+ExecutorState::Func ExecutorState::Func::ofValue(const double *value) {
+    Func func;
+    func.kind = FuncKind::VALUE;
+    func.value = value;
+    return func;
+}
+
 ExecutorState::ExecutorState(): ExecutorState(nullptr) {
 }
 
-ExecutorState::ExecutorState(ExecutorState *parent): _parent(parent) {
+ExecutorState::ExecutorState(ExecutorState *parent): _parent(parent), _paramNames(nullptr), _args(nullptr) {
 }
 
 void ExecutorState::setFunction(const std::string &name, const Func &function) {
     _funcMap[name] = function;
 }
 
-void ExecutorState::setFunction(const std::string &name, Func &&function) {
-    _funcMap[name] = std::move(function);
+void ExecutorState::setFunction(const std::string &name, Native &&function) {
+    _funcMap[name] = Func::ofHost(std::make_shared<const Native>(std::move(function)));
 }
 
-void ExecutorState::setFunction(std::string &&name, Func &&function) {
-    _funcMap[std::move(name)] = std::move(function);
+/**
+ * @brief Makes parameters refer to the arguments of a call, without copying either
+ * 
+ * @param paramNames Names of the parameters, the last with a name wins
+ * @param args Unevaluated arguments, both must outlive the state
+ */
+void ExecutorState::bindArgs(const std::vector<std::string> &paramNames, const std::vector<ExprNode::ptr> &args) {
+    _paramNames = &paramNames;
+    _args = &args;
 }
 
-const ExecutorState::Func &ExecutorState::getFunction(const std::string &name) const {
-    const Func *func;
+ExecutorState::Func ExecutorState::getFunction(const std::string &name) const {
+    Func func;
     if (tryGetFunction(name, func)) {
-        return *func;
+        return func;
     } else {
         throw std::logic_error("Couldn't find function " + name);
     }
 }
 
 bool ExecutorState::hasFunction(const std::string &name) const {
-    const Func *func;
+    Func func;
     return tryGetFunction(name, func);
 }
 
-bool ExecutorState::tryGetFunction(const std::string &name, const Func *&function) const {
-    auto it = _funcMap.find(name);
-    if (it != _funcMap.end()) {
-        function = &it->second;
-        return true;
-    } else if (_parent) {
-        return _parent->tryGetFunction(name, function);
+bool ExecutorState::tryGetFunction(const std::string &name, Func &function) const {
+    uint64_t hops = 0;
+    return tryGetFunction(name, function, hops);
+}
+
+/**
+ * @brief Looks up a name, counting the parent states walked past in builds with QC_STATS
+ *
+ * @param hops Incremented for each state searched after this one
+ */
+bool ExecutorState::tryGetFunction(const std::string &name, Func &function, uint64_t &hops) const {
+    // Scoping is dynamic, so this walks every call being evaluated, which must be cheap
+    for (const ExecutorState *state = this; state; state = state->_parent) {
+        if (state != this) {
+            count(hops);
+        }
+        // States of calls rarely define anything, so don't hash the name just to find nothing
+        if (!state->_funcMap.empty()) {
+            auto it = state->_funcMap.find(name);
+            if (it != state->_funcMap.end()) {
+                function = it->second;
+                return true;
+            }
+        }
+        if (state->_paramNames) {
+            size_t bound = std::min(state->_paramNames->size(), state->_args->size());
+            for (size_t i = bound; i-- > 0;) {
+                if ((*state->_paramNames)[i] == name) {
+                    function = Func::ofArgument(static_cast<int32_t>(i), state->_args);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Binds a name to a value in the innermost state, without pushing a state of its own
+ * 
+ * Arguments are evaluated with the innermost state set aside, so a new state would hide the arguments
+ * of the call the loop is in.
+ * 
+ * @param executor Executor evaluating the loop
+ * @param name Name to bind, must outlive the binding
+ * @param value Value the name refers to, read whenever the name is used
+ */
+ValueBinding::ValueBinding(Executor &executor, const std::string &name, const double *value):
+    _executor(executor), _name(name) {
+    std::unordered_map<std::string, ExecutorState::Func> &functions = executor.getState()._funcMap;
+    auto it = functions.find(name);
+    if (it != functions.end()) {
+        _hidden = it->second;
+    }
+    functions[name] = ExecutorState::Func::ofValue(value);
+}
+
+ValueBinding::~ValueBinding() {
+    // Arguments move the state they set aside back, so look it up again
+    std::unordered_map<std::string, ExecutorState::Func> &functions = _executor.getState()._funcMap;
+    if (_hidden) {
+        functions[_name] = *_hidden;
     } else {
-        return false;
+        functions.erase(_name);
     }
 }
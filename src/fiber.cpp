@@ -0,0 +1,147 @@
+#include "fiber.hpp"
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) && __has_include(<ucontext.h>)
+#define QC_FIBERS 1
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+using namespace quickcalc;
+
+struct Fiber::Context {
+#ifdef QC_FIBERS
+    ucontext_t fiber;
+    // Whoever last resumed the fiber, which may be a different thread each time
+    ucontext_t caller;
+#endif
+};
+
+/**
+ * @brief Construct a new fiber, reserving its stack
+ *
+ * @param stackSize Bytes of stack, not counting the guard page which catches overflows
+ */
+Fiber::Fiber(size_t stackSize): _context(std::make_unique<Context>()), _stack(nullptr), _stackSize(0),
+    _running(false), _finished(true) {
+#ifdef QC_FIBERS
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    _stackSize = (stackSize + page - 1) / page * page + page;
+    _stack = mmap(nullptr, _stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                  -1, 0);
+    if (_stack == MAP_FAILED) {
+        _stack = nullptr;
+        throw std::bad_alloc();
+    }
+    // Stacks grow down, so overflowing runs into the lowest page
+    mprotect(_stack, page, PROT_NONE);
+#else
+    static_cast<void>(stackSize);
+#endif
+}
+
+Fiber::~Fiber() {
+#ifdef QC_FIBERS
+    if (_stack) {
+        munmap(_stack, _stackSize);
+    }
+#endif
+}
+
+/**
+ * @brief Checks whether fibers can suspend on this platform
+ *
+ * @return true Bodies run on their own stacks, otherwise they run on the caller's to completion and never yield
+ */
+bool Fiber::available() {
+#ifdef QC_FIBERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Sets the function the fiber runs when it's next resumed
+ *
+ * Only valid for new fibers and those which have finished, a suspended body is never unwound.
+ */
+void Fiber::start(Body &&body) {
+    if (!_finished) {
+        throw std::logic_error("Fiber is still running");
+    }
+    _body = std::move(body);
+    _error = nullptr;
+    _finished = false;
+#ifdef QC_FIBERS
+    getcontext(&_context->fiber);
+    _context->fiber.uc_stack.ss_sp = _stack;
+    _context->fiber.uc_stack.ss_size = _stackSize;
+    _context->fiber.uc_link = &_context->caller;
+    // Arguments to makecontext are ints, so the fiber is passed in halves
+    uintptr_t self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&_context->fiber, reinterpret_cast<void (*)()>(&Fiber::entry), 2,
+                static_cast<unsigned int>(self >> 32), static_cast<unsigned int>(self));
+#endif
+}
+
+/**
+ * @brief Runs the body until it yields or returns
+ *
+ * @return true The body has returned, rethrows anything it threw
+ */
+bool Fiber::resume() {
+    if (_finished) {
+        return true;
+    }
+    _running = true;
+#ifdef QC_FIBERS
+    swapcontext(&_context->caller, &_context->fiber);
+#else
+    run();
+#endif
+    _running = false;
+    if (_finished) {
+        _body = nullptr;
+        if (_error) {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+    return _finished;
+}
+
+/**
+ * @brief Suspends the body, returning from the call of resume which ran it
+ *
+ * Only called by the body, which carries on from here when it's next resumed.
+ */
+void Fiber::yield() {
+#ifdef QC_FIBERS
+    if (_running) {
+        swapcontext(&_context->fiber, &_context->caller);
+    }
+#endif
+}
+
+bool Fiber::finished() const {
+    return _finished;
+}
+
+void Fiber::entry(unsigned int high, unsigned int low) {
+    reinterpret_cast<Fiber *>((static_cast<uintptr_t>(high) << 32) | low)->run();
+}
+
+void Fiber::run() {
+    // Exceptions can't unwind past the start of the stack, so are rethrown by resume instead
+    try {
+        _body();
+    } catch (...) {
+        _error = std::current_exception();
+    }
+    _finished = true;
+}
@@ -0,0 +1,210 @@
+#include "folder.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+#include <cmath>
+
+using namespace quickcalc;
+
+namespace {
+    bool isConst(const ExprNode *node, double &value) {
+        auto *constant = dynamic_cast<const ConstNode *>(node);
+        if (constant) {
+            value = constant->value();
+        }
+        return constant != nullptr;
+    }
+
+    bool isConst(const ExprNode *node) {
+        double value;
+        return isConst(node, value);
+    }
+
+    bool isOne(const ExprNode *node) {
+        double value;
+        return isConst(node, value) && value == 1.0;
+    }
+
+    bool isZero(const ExprNode *node, bool negative) {
+        double value;
+        return isConst(node, value) && value == 0.0 && std::signbit(value) == negative;
+    }
+}
+
+Folder::Folder(): NodeVisitor(), _foldBuiltins(false) {
+    loadConcepts(_executor.getState());
+}
+
+/**
+ * @brief Simplifies a statement in place, before it's executed
+ * 
+ * Every statement must be passed through the same folder in the order they're executed, so it knows
+ * which builtins may have been redefined. Builtins, and pure native functions, are only folded in
+ * expression statements, as function bodies may be run after a builtin is redefined, or from a scope
+ * where it's a parameter.
+ * 
+ * @param node Statement to simplify
+ * @return size_t Number of nodes removed
+ */
+size_t Folder::fold(StmtNode *node) {
+    size_t before = countNodes(node);
+    node->accept(*this);
+    return before - countNodes(node);
+}
+
+void Folder::visit(ExprStmtNode *node) {
+    _foldBuiltins = true;
+    fold(node->mutableExpression());
+}
+
+void Folder::visit(FuncDefNode *node) {
+    _shadowed.insert(node->name());
+    _shadowed.insert(node->paramNames().begin(), node->paramNames().end());
+    _foldBuiltins = false;
+    fold(node->mutableExpression());
+}
+
+void Folder::visit(ConstNode *) {
+}
+
+void Folder::visit(UnaryOperationNode *node) {
+    fold(node->mutableValue());
+    if (isConst(node->value())) {
+        _replacement = evaluate(node);
+    } else if (auto *inner = dynamic_cast<UnaryOperationNode *>(node->value())) {
+        // Negating twice gives back the same bits, but not twice doesn't as it truncates
+        if (node->operation() == UnaryOperation::NEGATE && inner->operation() == UnaryOperation::NEGATE) {
+            _replacement = std::move(inner->mutableValue());
+        }
+    }
+}
+
+void Folder::visit(BinaryOperationNode *node) {
+    // Long chains lean right, so walk down them iteratively and simplify from the bottom up
+    std::vector<BinaryOperationNode *> spine;
+    ExprNode *rhs = node;
+    while (auto *binary = dynamic_cast<BinaryOperationNode *>(rhs)) {
+        spine.push_back(binary);
+        rhs = binary->rhs();
+    }
+    fold(spine.back()->mutableRhs());
+    for (size_t i = spine.size(); i-- > 0;) {
+        fold(spine[i]->mutableLhs());
+        ExprNode::ptr replacement = simplify(spine[i]);
+        if (i == 0) {
+            _replacement = std::move(replacement);
+        } else if (replacement) {
+            spine[i - 1]->mutableRhs() = std::move(replacement);
+        }
+    }
+}
+
+void Folder::visit(FunctionInvocationNode *node) {
+    // Names a loop binds may no longer refer to a builtin in its body, or in the rest of the statement
+    Builtin builtin;
+    LoopCall loop;
+    if (!_shadowed.count(node->name()) && tryGetBuiltin(node->name(), builtin)
+        && tryGetLoop(builtin, node->params(), loop)) {
+        _shadowed.insert(*loop.index);
+        if (loop.accumulator) {
+            _shadowed.insert(*loop.accumulator);
+        }
+    }
+
+    bool constant = true;
+    for (ExprNode::ptr &param : node->mutableParams()) {
+        fold(param);
+        constant = constant && isConst(param.get());
+    }
+
+    if (!_foldBuiltins || _shadowed.count(node->name())) {
+        return;
+    }
+    if (!tryGetBuiltin(node->name(), builtin)) {
+        // Pure native functions give the same result whenever they're called
+        int32_t index;
+        if (constant && tryGetNative(node->name(), index)) {
+            const NativeFunction &native = nativeFunction(index);
+            if (native.pure && native.accepts(node->params().size())) {
+                _replacement = evaluate(node);
+            }
+        }
+        return;
+    }
+    std::vector<ExprNode::ptr> &params = node->mutableParams();
+    double condition;
+    if (constant) {
+        _replacement = evaluate(node);
+    } else if (builtin == Builtin::IF && params.size() >= 2 && isConst(params[0].get(), condition)) {
+        // Only the branch taken is ever evaluated
+        if (!isFalse(condition)) {
+            _replacement = std::move(params[1]);
+        } else if (params.size() >= 3) {
+            _replacement = std::move(params[2]);
+        } else {
+            _replacement = std::move(params[0]);
+        }
+    }
+}
+
+void Folder::visit(SharedExprNode *node) {
+    fold(node->mutableValue());
+}
+
+/**
+ * @brief Folds a subtree, replacing it if it can be simplified
+ * 
+ * @param node Owner of the subtree
+ */
+void Folder::fold(ExprNode::ptr &node) {
+    node->accept(*this);
+    if (_replacement) {
+        node = std::move(_replacement);
+    }
+}
+
+/**
+ * @brief Simplifies a binary operation whose operands have been folded
+ * 
+ * x + 0 and 0 - x are left alone, as they turn -0 into 0.
+ * 
+ * @param node Operation to simplify
+ * @return ExprNode::ptr Replacement, or null to keep the operation
+ */
+ExprNode::ptr Folder::simplify(BinaryOperationNode *node) {
+    if (isConst(node->lhs()) && isConst(node->rhs())) {
+        return evaluate(node);
+    }
+    switch (node->operation()) {
+    case BinaryOperation::ADD:
+        if (isZero(node->rhs(), true)) {
+            return std::move(node->mutableLhs());
+        } else if (isZero(node->lhs(), true)) {
+            return std::move(node->mutableRhs());
+        }
+        break;
+    case BinaryOperation::SUBTRACT:
+        if (isZero(node->rhs(), false)) {
+            return std::move(node->mutableLhs());
+        }
+        break;
+    case BinaryOperation::MULTIPLY:
+        if (isOne(node->rhs())) {
+            return std::move(node->mutableLhs());
+        } else if (isOne(node->lhs())) {
+            return std::move(node->mutableRhs());
+        }
+        break;
+    case BinaryOperation::DIVIDE:
+        if (isOne(node->rhs())) {
+            return std::move(node->mutableLhs());
+        }
+        break;
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+ExprNode::ptr Folder::evaluate(ExprNode *node) {
+    return std::make_unique<ConstNode>(_executor.evaluate(node));
+}
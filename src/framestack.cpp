@@ -0,0 +1,60 @@
+#include "framestack.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+/**
+ * @brief Construct a new frame stack
+ * 
+ * @param capacity Number of bytes to preallocate, grows when needed
+ * @param limit Most bytes the stack may grow to
+ */
+FrameStack::FrameStack(size_t capacity, size_t limit): _capacity((capacity + WORD - 1) / WORD * WORD), _top(0),
+    _limit(limit) {
+    _memory = std::make_unique<std::byte[]>(_capacity);
+}
+
+/**
+ * @brief Allocates space at the top of the stack, pointers from at are invalidated if it grows
+ * 
+ * Throws a runtime_error if the stack would grow past its limit.
+ * 
+ * @param size Number of bytes needed
+ * @return size_t Offset of the allocation
+ */
+size_t FrameStack::push(size_t size) {
+    size_t offset = _top;
+    size_t top = _top + (size + WORD - 1) / WORD * WORD;
+    if (top > capacity()) {
+        if (top > _limit) {
+            throw std::runtime_error("Memory limit exceeded");
+        }
+        // Everything on the stack is trivially copyable, so copying the bytes carries the objects over
+        size_t grown = std::min(std::max(top, _capacity * 2), _limit) / WORD * WORD;
+        auto memory = std::make_unique<std::byte[]>(grown);
+        std::memcpy(memory.get(), _memory.get(), _top);
+        _memory = std::move(memory);
+        _capacity = grown;
+    }
+    _top = top;
+    return offset;
+}
+
+/**
+ * @brief Releases an allocation and everything allocated after it
+ * 
+ * @param offset Offset returned by push
+ */
+void FrameStack::pop(size_t offset) {
+    _top = offset;
+}
+
+size_t FrameStack::top() const {
+    return _top;
+}
+
+size_t FrameStack::capacity() const {
+    return _capacity;
+}
@@ -0,0 +1,280 @@
+#include "inliner.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+#include <algorithm>
+
+using namespace quickcalc;
+
+namespace {
+    // Replaces references to parameters in a copy of a body with the arguments passed
+    class Substitution: public NodeVisitor {
+        std::unordered_map<std::string, const ExprNode *> _args;
+        ExprNode::ptr _replacement;
+    public:
+        Substitution(const std::vector<std::string> &paramNames, const std::vector<ExprNode::ptr> &args) {
+            // The last parameter with a name wins, as when the function is called
+            for (size_t i = 0; i < paramNames.size(); i++) {
+                _args[paramNames[i]] = args[i].get();
+            }
+        }
+
+        void apply(ExprNode::ptr &node) {
+            node->accept(*this);
+            if (_replacement) {
+                node = std::move(_replacement);
+            }
+        }
+
+        void visit(ConstNode *) override {
+        }
+
+        void visit(UnaryOperationNode *node) override {
+            apply(node->mutableValue());
+        }
+
+        void visit(BinaryOperationNode *node) override {
+            apply(node->mutableLhs());
+            apply(node->mutableRhs());
+        }
+
+        void visit(FunctionInvocationNode *node) override {
+            auto it = _args.find(node->name());
+            if (it != _args.end()) {
+                // Anything passed to a parameter is ignored
+                _replacement = it->second->clone();
+                return;
+            }
+            for (ExprNode::ptr &param : node->mutableParams()) {
+                apply(param);
+            }
+        }
+
+        void visit(SharedExprNode *node) override {
+            apply(node->mutableValue());
+        }
+    };
+}
+
+/**
+ * @brief Construct a new inliner
+ * 
+ * @param maxSize Most nodes a definition's body can have, after inlining into it, to be inlined itself
+ */
+Inliner::Inliner(size_t maxSize): NodeVisitor(), _maxSize(maxSize), _order(0), _inlined(0),
+    _paramNames(nullptr), _dependencies(nullptr) {
+}
+
+/**
+ * @brief Inlines calls in a statement, before it's executed
+ * 
+ * Every statement must be passed through the same inliner in the order they're executed. Only
+ * definitions whose body calls nothing but their parameters and builtins are inlined, so the copy
+ * sees the same names whether the engine scopes them dynamically or lexically.
+ * 
+ * When a definition replaces one which was inlined, the definitions it was inlined into are
+ * restored and inlined again, and are listed by rebuilt so they can be passed to the engine again.
+ * 
+ * @param node Statement to inline calls in
+ * @return size_t Number of calls inlined, including in rebuilt definitions
+ */
+size_t Inliner::inlineCalls(StmtNode *node) {
+    _inlined = 0;
+    _rebuilt.clear();
+    node->accept(*this);
+    return _inlined;
+}
+
+/**
+ * @brief Definitions whose body was rebuilt by the last statement inlined
+ */
+const std::vector<FuncDefNode *> &Inliner::rebuilt() const {
+    return _rebuilt;
+}
+
+void Inliner::visit(ExprStmtNode *node) {
+    _paramNames = nullptr;
+    _dependencies = nullptr;
+    expand(node->mutableExpression());
+}
+
+void Inliner::visit(FuncDefNode *node) {
+    std::vector<std::string> changed = node->paramNames();
+    changed.push_back(node->name());
+    _shadowed.insert(node->paramNames().begin(), node->paramNames().end());
+
+    _definitions.erase(node->name());
+    Definition &definition = _definitions[node->name()];
+    definition.node = node;
+    definition.original = node->expression()->clone();
+    definition.order = _order++;
+    inlineBody(definition);
+
+    // Inline again into everything which relied on what the changed names meant before
+    std::vector<Definition *> stale;
+    for (auto &entry : _definitions) {
+        Definition &other = entry.second;
+        if (&other == &definition) {
+            continue;
+        }
+        bool isStale = std::any_of(changed.begin(), changed.end(), [&other] (const std::string &name) {
+            return other.dependencies.count(name) > 0;
+        });
+        if (isStale) {
+            stale.push_back(&other);
+        }
+    }
+    std::sort(stale.begin(), stale.end(), [] (const Definition *a, const Definition *b) {
+        return a->order < b->order;
+    });
+    for (Definition *other : stale) {
+        other->node->mutableExpression() = other->original->clone();
+        inlineBody(*other);
+        _rebuilt.push_back(other->node);
+    }
+}
+
+void Inliner::visit(ConstNode *) {
+}
+
+void Inliner::visit(UnaryOperationNode *node) {
+    expand(node->mutableValue());
+}
+
+void Inliner::visit(BinaryOperationNode *node) {
+    // Long chains lean right, so walk down them iteratively
+    BinaryOperationNode *binary = node;
+    for (;;) {
+        expand(binary->mutableLhs());
+        auto *next = dynamic_cast<BinaryOperationNode *>(binary->rhs());
+        if (!next) {
+            break;
+        }
+        binary = next;
+    }
+    expand(binary->mutableRhs());
+}
+
+void Inliner::visit(FunctionInvocationNode *node) {
+    // Names a loop binds refer to its index or accumulator, and are visible to copies inlined into it
+    if (std::find(_loopNames.begin(), _loopNames.end(), node->name()) != _loopNames.end()) {
+        return;
+    }
+    // The names are bound before any argument is visited, so they're left as they are
+    Builtin builtin;
+    LoopCall loop;
+    size_t bound = _loopNames.size();
+    if (!_definitions.count(node->name()) && tryGetBuiltin(node->name(), builtin)
+        && tryGetLoop(builtin, node->params(), loop)) {
+        _loopNames.push_back(*loop.index);
+        if (loop.accumulator) {
+            _loopNames.push_back(*loop.accumulator);
+        }
+    }
+    for (ExprNode::ptr &param : node->mutableParams()) {
+        expand(param);
+    }
+    _loopNames.resize(bound);
+
+    auto it = _definitions.find(node->name());
+    if (it == _definitions.end() || !canInline(it->second, node)) {
+        return;
+    }
+    const Definition &helper = it->second;
+    ExprNode::ptr body = helper.node->expression()->clone();
+    Substitution(helper.node->paramNames(), node->params()).apply(body);
+    // Arguments are copied for every use, so limit how much that can grow the tree
+    if (countNodes(body.get()) > countNodes(node) + _maxSize) {
+        return;
+    }
+    if (_dependencies) {
+        _dependencies->insert(node->name());
+        _dependencies->insert(helper.dependencies.begin(), helper.dependencies.end());
+        _dependencies->insert(helper.freeNames.begin(), helper.freeNames.end());
+    }
+    _replacement = std::move(body);
+    _inlined++;
+}
+
+void Inliner::visit(SharedExprNode *node) {
+    expand(node->mutableValue());
+}
+
+/**
+ * @brief Inlines calls in a subtree, replacing it if it's a call which was inlined
+ * 
+ * @param node Owner of the subtree
+ */
+void Inliner::expand(ExprNode::ptr &node) {
+    node->accept(*this);
+    if (_replacement) {
+        node = std::move(_replacement);
+    }
+}
+
+/**
+ * @brief Inlines calls in a definition's body and works out whether it can be inlined itself
+ * 
+ * @param definition Definition whose node has its original body
+ */
+void Inliner::inlineBody(Definition &definition) {
+    FuncDefNode *node = definition.node;
+    definition.inlinable = false;
+    definition.dependencies.clear();
+    _paramNames = &node->paramNames();
+    _dependencies = &definition.dependencies;
+    expand(node->mutableExpression());
+    _paramNames = nullptr;
+    _dependencies = nullptr;
+
+    const std::vector<std::string> &params = node->paramNames();
+    definition.freeNames = collectNames(node->expression());
+    for (const std::string &param : params) {
+        definition.freeNames.erase(param);
+    }
+    const std::unordered_set<std::string> &names = definition.freeNames;
+    // Loops bind names of their own, which a copy could capture from the call it replaces
+    bool onlyBuiltins = std::all_of(names.begin(), names.end(), [] (const std::string &name) {
+        Builtin builtin;
+        int32_t native;
+        return (tryGetBuiltin(name, builtin) && !isLoop(builtin)) || tryGetNative(name, native);
+    });
+    definition.inlinable = onlyBuiltins && countNodes(node->expression()) <= _maxSize;
+    if (definition.inlinable) {
+        // Redefining a builtin it calls means it can no longer be inlined
+        definition.dependencies.insert(names.begin(), names.end());
+    }
+}
+
+/**
+ * @brief Checks whether a call can be replaced with a copy of the definition's body
+ * 
+ * @param helper Definition the call's name refers to
+ * @param call Call whose arguments have already been inlined into
+ * @return true The copy behaves the same as the call
+ */
+bool Inliner::canInline(const Definition &helper, const FunctionInvocationNode *call) const {
+    const std::vector<std::string> &params = helper.node->paramNames();
+    if (!helper.inlinable || _shadowed.count(call->name()) || call->params().size() < params.size()) {
+        return false;
+    }
+    for (const std::string &name : helper.freeNames) {
+        if (_definitions.count(name)) {
+            return false;
+        }
+    }
+    // Names in the copy mustn't be captured by the parameters of the definition it's copied into
+    if (_paramNames) {
+        for (const std::string &name : *_paramNames) {
+            if (helper.freeNames.count(name)) {
+                return false;
+            }
+        }
+    }
+    // Nor by a loop it's copied into
+    for (const std::string &name : _loopNames) {
+        if (helper.freeNames.count(name)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,690 @@
+#include "jit.hpp"
+#include "concepts.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define QC_JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace quickcalc;
+
+namespace {
+    enum Register {
+        RAX = 0,
+        RCX = 1,
+        RDX = 2,
+        RBX = 3,
+        RSP = 4,
+        RBP = 5,
+        RSI = 6,
+        RDI = 7,
+        R12 = 12,
+    };
+
+    enum XmmRegister {
+        XMM0 = 0,
+        XMM1 = 1,
+    };
+
+    // Condition codes for SETcc and Jcc
+    enum Condition {
+        BELOW = 0x2,
+        ABOVE_EQUAL = 0x3,
+        EQUAL = 0x4,
+        NOT_EQUAL = 0x5,
+        ABOVE = 0x7,
+    };
+
+    // Memory operand of the form [base + disp32]
+    struct Mem {
+        int base;
+        int32_t disp;
+    };
+
+    constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    constexpr uint64_t ABS_MASK = 0x7FFFFFFFFFFFFFFF;
+
+    uint64_t bits(double value) {
+        uint64_t result;
+        std::memcpy(&result, &value, sizeof(double));
+        return result;
+    }
+
+    Mem stackAt(int depth) {
+        return { RSP, 8 * depth };
+    }
+
+    class Assembler {
+        std::vector<uint8_t> &_code;
+    public:
+        explicit Assembler(std::vector<uint8_t> &code): _code(code) {
+        }
+
+        void byte(uint8_t value) {
+            _code.push_back(value);
+        }
+
+        void u32(uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                byte(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        void u64(uint64_t value) {
+            for (int i = 0; i < 8; i++) {
+                byte(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        // Emits [prefix] [REX] opcode ModRM with a memory operand, always using a 32 bit displacement
+        void op(uint8_t prefix, bool wide, std::initializer_list<uint8_t> opcode, int reg, Mem mem) {
+            if (prefix) {
+                byte(prefix);
+            }
+            rex(wide, reg, mem.base);
+            for (uint8_t part : opcode) {
+                byte(part);
+            }
+            byte(0x80 | ((reg & 7) << 3) | (mem.base & 7));
+            if ((mem.base & 7) == RSP) {
+                // RSP and R12 as a base need a SIB byte
+                byte(0x24);
+            }
+            u32(static_cast<uint32_t>(mem.disp));
+        }
+
+        // Emits [prefix] [REX] opcode ModRM with both operands in registers
+        void op(uint8_t prefix, bool wide, std::initializer_list<uint8_t> opcode, int reg, int rm) {
+            if (prefix) {
+                byte(prefix);
+            }
+            rex(wide, reg, rm);
+            for (uint8_t part : opcode) {
+                byte(part);
+            }
+            byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        void push(int reg) {
+            rex(false, 0, reg);
+            byte(0x50 | (reg & 7));
+        }
+
+        void pop(int reg) {
+            rex(false, 0, reg);
+            byte(0x58 | (reg & 7));
+        }
+
+        void movImmediate(int reg, uint64_t value) {
+            rex(true, 0, reg);
+            byte(0xB8 | (reg & 7));
+            u64(value);
+        }
+
+        void movsdLoad(int xmm, Mem mem) {
+            op(0xF2, false, { 0x0F, 0x10 }, xmm, mem);
+        }
+
+        void movsdStore(Mem mem, int xmm) {
+            op(0xF2, false, { 0x0F, 0x11 }, xmm, mem);
+        }
+
+        void movLoad(int reg, Mem mem) {
+            op(0, true, { 0x8B }, reg, mem);
+        }
+
+        void movStore(Mem mem, int reg) {
+            op(0, true, { 0x89 }, reg, mem);
+        }
+
+        void movq(int xmm, int reg) {
+            op(0x66, true, { 0x0F, 0x6E }, xmm, reg);
+        }
+
+        void jump(uint8_t opcode) {
+            byte(opcode);
+            u32(0);
+        }
+
+        void jumpIf(Condition condition) {
+            byte(0x0F);
+            byte(0x80 | condition);
+            u32(0);
+        }
+
+        void setIf(Condition condition) {
+            // setcc al, then movzx eax, al
+            byte(0x0F);
+            byte(0x90 | condition);
+            byte(0xC0);
+            byte(0x0F);
+            byte(0xB6);
+            byte(0xC0);
+        }
+
+        void ret() {
+            byte(0xC3);
+        }
+
+    private:
+        void rex(bool wide, int reg, int rm) {
+            uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+            if (prefix != 0x40) {
+                byte(prefix);
+            }
+        }
+    };
+}
+
+NativeCode::NativeCode(): _memory(nullptr), _size(0), _entry(nullptr) {
+}
+
+NativeCode::~NativeCode() {
+#ifdef QC_JIT_X86_64
+    if (_memory) {
+        munmap(_memory, _size);
+    }
+#endif
+}
+
+/**
+ * @brief Runs the function natively
+ *
+ * @param args Value of every parameter, may be overwritten
+ * @param context Where to stop using the native stack, bailed is set if the call must be interpreted instead
+ * @return double Result of the function
+ */
+double NativeCode::call(const double *args, JitContext &context) const {
+    return _entry(args, &context);
+}
+
+/**
+ * @brief Construct a new JIT compiler
+ *
+ * @param callees Native code of the globals functions may call, used to call them directly
+ */
+Jit::Jit(const Lookup &callees): _callees(callees) {
+}
+
+/**
+ * @brief Checks whether native code can be generated on this platform
+ *
+ * @return true This is x86-64 with memory which can be made executable
+ */
+bool Jit::available() {
+#ifdef QC_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Checks whether a function only uses instructions native code implements
+ *
+ * Arguments are always evaluated before the call, so every call the function makes must pass
+ * strict arguments only, and the function itself needs the values of all of its arguments.
+ *
+ * @param function Compiled function
+ * @return true The function can be compiled, if everything it calls can be
+ */
+bool Jit::supports(const Function &function) {
+    for (const Instruction &instruction : function.code) {
+        switch (instruction.opcode) {
+        case OpCode::CONST:
+        case OpCode::ARG:
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::CALL_NATIVE:
+        case OpCode::RETURN:
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::DUP:
+        case OpCode::POP:
+        case OpCode::NEGATE:
+        case OpCode::NOT:
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::AND:
+        case OpCode::OR:
+        case OpCode::XOR:
+        case OpCode::INTEGER:
+        case OpCode::TO_INTEGER:
+        case OpCode::TO_DOUBLE:
+        case OpCode::EQ:
+        case OpCode::NE:
+        case OpCode::GT:
+        case OpCode::LT:
+        case OpCode::GE:
+        case OpCode::LE:
+        case OpCode::LOAD_SHARED:
+        case OpCode::STORE_SHARED:
+            break;
+        default:
+            return false;
+        }
+    }
+    for (const CallSite &site : function.callSites) {
+        if (static_cast<size_t>(site.strictArgs) != site.args.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Generates machine code for a function
+ *
+ * Values on the operand stack live in the native frame, at the same depth they'd have in the
+ * virtual machine, so strict arguments are already in order for the call. Calls to itself in tail
+ * position become jumps. Functions bail out when they run out of stack, leaving the call to be
+ * interpreted, and calls made from native code pass bailing out back up to the first native caller.
+ *
+ * @param function Function supported by this compiler
+ * @param slot Global slot of the function, so it can call itself
+ * @param code Where to put the generated code, which must stay at the same address while anything calls it
+ * @return true Code was generated
+ */
+bool Jit::compile(const Function &function, int32_t slot, NativeCode &code) {
+#ifdef QC_JIT_X86_64
+    _code.clear();
+    _fixups.clear();
+    _exits.clear();
+    _bailouts.clear();
+    Assembler as(_code);
+
+    int stackSlots = analyse(function);
+    int frameSlots = stackSlots + 2 * function.sharedSlots;
+    int32_t frameSize = (frameSlots * 8 + 15) & ~15;
+
+    // Keep the arguments in rbx and the context in r12, the stack is 16 byte aligned after these
+    as.push(RBP);
+    as.op(0, true, { 0x89 }, RSP, RBP);
+    as.push(RBX);
+    as.push(R12);
+    as.op(0, true, { 0x89 }, RDI, RBX);
+    as.op(0, true, { 0x89 }, RSI, R12);
+    as.op(0, true, { 0x81 }, 5, RSP);
+    as.u32(static_cast<uint32_t>(frameSize));
+    as.op(0, true, { 0x3B }, RSP, Mem { R12, static_cast<int32_t>(offsetof(JitContext, stackLimit)) });
+    as.jumpIf(BELOW);
+    _bailouts.push_back(_code.size() - 4);
+
+    // Calls to itself in tail position start again from here
+    _body = _code.size();
+    for (int i = 0; i < function.sharedSlots; i++) {
+        // mov qword [flag], 0
+        as.op(0, true, { 0xC7 }, 0, stackAt(stackSlots + function.sharedSlots + i));
+        as.u32(0);
+    }
+
+    _labels.assign(function.code.size(), 0);
+    for (size_t pc = 0; pc < function.code.size(); pc++) {
+        _labels[pc] = _code.size();
+        if (_depths[pc] >= 0 && !translate(function, slot, pc, stackSlots)) {
+            return false;
+        }
+    }
+
+    size_t bailout = _code.size();
+    // mov byte [r12 + bailed], 1
+    as.op(0, false, { 0xC6 }, 0, Mem { R12, static_cast<int32_t>(offsetof(JitContext, bailed)) });
+    as.byte(1);
+
+    size_t exit = _code.size();
+    as.op(0, true, { 0x8D }, RSP, Mem { RBP, -16 });
+    as.pop(R12);
+    as.pop(RBX);
+    as.pop(RBP);
+    as.ret();
+
+    auto patch = [this] (size_t position, size_t target) {
+        uint32_t relative = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(position + 4));
+        std::memcpy(_code.data() + position, &relative, sizeof(relative));
+    };
+    for (const Fixup &fixup : _fixups) {
+        patch(fixup.position, fixup.target < 0 ? _body : _labels[fixup.target]);
+    }
+    for (size_t position : _bailouts) {
+        patch(position, bailout);
+    }
+    for (size_t position : _exits) {
+        patch(position, exit);
+    }
+
+    // Map writable, then swap to executable so the memory is never both
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (_code.size() + page - 1) / page * page;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    std::memcpy(memory, _code.data(), _code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return false;
+    }
+
+    if (code._memory) {
+        munmap(code._memory, code._size);
+    }
+    code._memory = memory;
+    code._size = size;
+    code._entry = reinterpret_cast<NativeCode::Entry>(memory);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Finds the depth of the operand stack before each reachable instruction
+ *
+ * @param function Function to analyse
+ * @return int Number of stack slots the function needs
+ */
+int Jit::analyse(const Function &function) {
+    const std::vector<Instruction> &code = function.code;
+    _depths.assign(code.size(), -1);
+    std::vector<size_t> pending;
+    auto reach = [this, &code, &pending] (size_t pc, int depth) {
+        if (pc < code.size() && _depths[pc] < 0) {
+            _depths[pc] = depth;
+            pending.push_back(pc);
+        }
+    };
+
+    int stackSlots = 1;
+    reach(0, 0);
+    while (!pending.empty()) {
+        size_t pc = pending.back();
+        pending.pop_back();
+        int depth = _depths[pc];
+        stackSlots = std::max(stackSlots, depth + 1);
+        const Instruction &instruction = code[pc];
+        switch (instruction.opcode) {
+        case OpCode::CONST:
+        case OpCode::INTEGER:
+        case OpCode::ARG:
+        case OpCode::DUP:
+            reach(pc + 1, depth + 1);
+            break;
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+            reach(pc + 1, depth - function.callSites[instruction.operand].strictArgs + 1);
+            break;
+        case OpCode::CALL_NATIVE:
+            reach(pc + 1, depth - function.nativeCalls[instruction.operand].args + 1);
+            break;
+        case OpCode::RETURN:
+            break;
+        case OpCode::JUMP:
+            reach(instruction.operand, depth);
+            break;
+        case OpCode::JUMP_IF_FALSE:
+            reach(pc + 1, depth - 1);
+            reach(instruction.operand, depth - 1);
+            break;
+        case OpCode::NEGATE:
+        case OpCode::NOT:
+        case OpCode::TO_INTEGER:
+        case OpCode::TO_DOUBLE:
+        case OpCode::STORE_SHARED:
+            reach(pc + 1, depth);
+            break;
+        case OpCode::LOAD_SHARED:
+            // Followed by the jump taken when the value is ready
+            reach(pc + 1, depth + 1);
+            reach(pc + 2, depth);
+            break;
+        default:
+            reach(pc + 1, depth - 1);
+            break;
+        }
+    }
+    return stackSlots;
+}
+
+bool Jit::translate(const Function &function, int32_t slot, size_t pc, int stackSlots) {
+    Assembler as(_code);
+    const Instruction &instruction = function.code[pc];
+    int depth = _depths[pc];
+    switch (instruction.opcode) {
+    case OpCode::CONST:
+        as.movImmediate(RAX, bits(function.constants[instruction.operand]));
+        as.movStore(stackAt(depth), RAX);
+        break;
+    case OpCode::ARG:
+        as.movLoad(RAX, Mem { RBX, 8 * instruction.operand });
+        as.movStore(stackAt(depth), RAX);
+        break;
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL: {
+        const CallSite &site = function.callSites[instruction.operand];
+        int first = depth - site.strictArgs;
+        if (instruction.opcode == OpCode::TAIL_CALL && site.callee == slot) {
+            // Reuse this frame, nothing reads the old arguments again
+            for (size_t i = 0; i < function.paramNames.size(); i++) {
+                as.movLoad(RAX, stackAt(first + static_cast<int>(i)));
+                as.movStore(Mem { RBX, 8 * static_cast<int32_t>(i) }, RAX);
+            }
+            as.jump(0xE9);
+            _fixups.push_back({ _code.size() - 4, -1 });
+            break;
+        }
+        NativeCode *callee = _callees(site.callee);
+        if (!callee) {
+            return false;
+        }
+        as.op(0, true, { 0x8D }, RDI, stackAt(first));
+        as.op(0, true, { 0x89 }, R12, RSI);
+        as.movImmediate(RAX, reinterpret_cast<uintptr_t>(&callee->_entry));
+        // call [rax]
+        as.byte(0xFF);
+        as.byte(0x10);
+        // cmp byte [r12 + bailed], 0
+        as.op(0, false, { 0x80 }, 7, Mem { R12, static_cast<int32_t>(offsetof(JitContext, bailed)) });
+        as.byte(0);
+        as.jumpIf(NOT_EQUAL);
+        _exits.push_back(_code.size() - 4);
+        as.movsdStore(stackAt(first), XMM0);
+        break;
+    }
+    case OpCode::CALL_NATIVE: {
+        // Arguments are already in order in the frame, and native functions never bail out
+        const NativeCallSite &site = function.nativeCalls[instruction.operand];
+        int first = depth - site.args;
+        as.op(0, true, { 0x8D }, RDI, stackAt(first));
+        as.movImmediate(RSI, static_cast<uint64_t>(site.args));
+        as.movImmediate(RAX, reinterpret_cast<uintptr_t>(site.function));
+        // call rax
+        as.byte(0xFF);
+        as.byte(0xD0);
+        as.movsdStore(stackAt(first), XMM0);
+        break;
+    }
+    case OpCode::RETURN:
+        as.movsdLoad(XMM0, stackAt(depth - 1));
+        as.jump(0xE9);
+        _exits.push_back(_code.size() - 4);
+        break;
+    case OpCode::JUMP:
+        as.jump(0xE9);
+        _fixups.push_back({ _code.size() - 4, instruction.operand });
+        break;
+    case OpCode::JUMP_IF_FALSE:
+        emitIsFalse(depth - 1);
+        as.jumpIf(ABOVE);
+        _fixups.push_back({ _code.size() - 4, instruction.operand });
+        break;
+    case OpCode::DUP:
+        as.movLoad(RAX, stackAt(depth - 1));
+        as.movStore(stackAt(depth), RAX);
+        break;
+    case OpCode::POP:
+        break;
+    case OpCode::NEGATE:
+        // Flipping the sign bit is exactly what negating a double does
+        as.movImmediate(RAX, SIGN_BIT);
+        as.op(0, true, { 0x31 }, RAX, stackAt(depth - 1));
+        break;
+    case OpCode::NOT:
+        as.movLoad(RAX, stackAt(depth - 1));
+        emitRoundInteger();
+        as.op(0, true, { 0xF7 }, 2, RAX);
+        as.movStore(stackAt(depth - 1), RAX);
+        break;
+    case OpCode::ADD:
+    case OpCode::SUBTRACT:
+    case OpCode::MULTIPLY:
+    case OpCode::DIVIDE: {
+        uint8_t opcode = instruction.opcode == OpCode::ADD ? 0x58
+                         : instruction.opcode == OpCode::SUBTRACT ? 0x5C
+                         : instruction.opcode == OpCode::MULTIPLY ? 0x59
+                         : 0x5E;
+        as.movsdLoad(XMM0, stackAt(depth - 2));
+        as.op(0xF2, false, { 0x0F, opcode }, XMM0, stackAt(depth - 1));
+        as.movsdStore(stackAt(depth - 2), XMM0);
+        break;
+    }
+    case OpCode::AND:
+    case OpCode::OR:
+    case OpCode::XOR:
+        emitBitwise(instruction.opcode, depth);
+        break;
+    case OpCode::INTEGER:
+        as.movImmediate(RAX, static_cast<uint64_t>(static_cast<int64_t>(instruction.operand)));
+        as.movStore(stackAt(depth), RAX);
+        break;
+    case OpCode::TO_INTEGER:
+        // cvttsd2si gives INT64_MIN for NaN and out of range values, like toInteger
+        as.op(0xF2, true, { 0x0F, 0x2C }, RAX, stackAt(depth - 1));
+        as.movStore(stackAt(depth - 1), RAX);
+        break;
+    case OpCode::TO_DOUBLE:
+        as.op(0xF2, true, { 0x0F, 0x2A }, XMM0, stackAt(depth - 1));
+        as.movsdStore(stackAt(depth - 1), XMM0);
+        break;
+    case OpCode::EQ:
+    case OpCode::NE:
+    case OpCode::GT:
+    case OpCode::LT:
+    case OpCode::GE:
+    case OpCode::LE:
+        emitCompare(instruction.opcode, depth);
+        break;
+    case OpCode::LOAD_SHARED: {
+        // cmp qword [flag], 0
+        as.op(0, true, { 0x83 }, 7, stackAt(stackSlots + function.sharedSlots + instruction.operand));
+        as.byte(0);
+        as.jumpIf(EQUAL);
+        _fixups.push_back({ _code.size() - 4, static_cast<int32_t>(pc + 2) });
+        // Falls through to the jump past the code which evaluates it
+        as.movLoad(RAX, stackAt(stackSlots + instruction.operand));
+        as.movStore(stackAt(depth), RAX);
+        break;
+    }
+    case OpCode::STORE_SHARED:
+        as.movLoad(RAX, stackAt(depth - 1));
+        as.movStore(stackAt(stackSlots + instruction.operand), RAX);
+        // mov qword [flag], 1
+        as.op(0, true, { 0xC7 }, 0, stackAt(stackSlots + function.sharedSlots + instruction.operand));
+        as.u32(1);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+void Jit::emitCompare(OpCode opcode, int depth) {
+    Assembler as(_code);
+    Mem lhs = stackAt(depth - 2);
+    Mem rhs = stackAt(depth - 1);
+    Condition condition;
+    switch (opcode) {
+    case OpCode::EQ:
+    case OpCode::NE:
+        // Same as std::abs(lhs - rhs) compared with QC_EPSILON
+        as.movsdLoad(XMM0, lhs);
+        as.op(0xF2, false, { 0x0F, 0x5C }, XMM0, rhs);
+        as.movImmediate(RAX, ABS_MASK);
+        as.movq(XMM1, RAX);
+        as.op(0x66, false, { 0x0F, 0x54 }, XMM0, XMM1);
+        as.movImmediate(RAX, bits(QC_EPSILON));
+        as.movq(XMM1, RAX);
+        if (opcode == OpCode::EQ) {
+            as.op(0x66, false, { 0x0F, 0x2E }, XMM1, XMM0);
+            condition = ABOVE;
+        } else {
+            as.op(0x66, false, { 0x0F, 0x2E }, XMM0, XMM1);
+            condition = ABOVE_EQUAL;
+        }
+        break;
+    default: {
+        // Unordered comparisons set the carry flag, so NaN compares false like it does in C++
+        bool swap = opcode == OpCode::LT || opcode == OpCode::LE;
+        as.movsdLoad(XMM0, swap ? rhs : lhs);
+        as.op(0x66, false, { 0x0F, 0x2E }, XMM0, swap ? lhs : rhs);
+        condition = opcode == OpCode::GT || opcode == OpCode::LT ? ABOVE : ABOVE_EQUAL;
+        break;
+    }
+    }
+    as.setIf(condition);
+    as.op(0xF2, false, { 0x0F, 0x2A }, XMM0, RAX);
+    as.movsdStore(lhs, XMM0);
+}
+
+void Jit::emitBitwise(OpCode opcode, int depth) {
+    Assembler as(_code);
+    as.movLoad(RAX, stackAt(depth - 1));
+    emitRoundInteger();
+    as.op(0, true, { 0x89 }, RAX, RDX);
+    as.movLoad(RAX, stackAt(depth - 2));
+    emitRoundInteger();
+    uint8_t operation = opcode == OpCode::AND ? 0x21 : opcode == OpCode::OR ? 0x09 : 0x31;
+    as.op(0, true, { operation }, RDX, RAX);
+    as.movStore(stackAt(depth - 2), RAX);
+}
+
+/**
+ * @brief Rounds the integer in rax like roundInteger, only converting it when it's outside ±2^53
+ */
+void Jit::emitRoundInteger() {
+    Assembler as(_code);
+    // Within range if sign extending the low 54 bits gives the same value
+    as.op(0, true, { 0x89 }, RAX, RCX);
+    as.op(0, true, { 0xC1 }, 4, RCX);
+    as.byte(10);
+    as.op(0, true, { 0xC1 }, 7, RCX);
+    as.byte(10);
+    as.op(0, true, { 0x39 }, RAX, RCX);
+    // je past the conversion
+    size_t skip = _code.size();
+    as.byte(0x74);
+    as.byte(0);
+    as.op(0xF2, true, { 0x0F, 0x2A }, XMM0, RAX);
+    as.op(0xF2, true, { 0x0F, 0x2C }, RAX, XMM0);
+    _code[skip + 1] = static_cast<uint8_t>(_code.size() - skip - 2);
+}
+
+/**
+ * @brief Tests whether the value at a depth is false, afterwards the above condition is set if it is
+ */
+void Jit::emitIsFalse(int depth) {
+    Assembler as(_code);
+    as.movsdLoad(XMM0, stackAt(depth));
+    as.movImmediate(RAX, ABS_MASK);
+    as.movq(XMM1, RAX);
+    as.op(0x66, false, { 0x0F, 0x54 }, XMM0, XMM1);
+    as.movImmediate(RAX, bits(QC_EPSILON));
+    as.movq(XMM1, RAX);
+    as.op(0x66, false, { 0x0F, 0x2E }, XMM1, XMM0);
+}
@@ -3,6 +3,7 @@
 #include <array>
 #include <stdexcept>
 #include <sstream>
+#include <cstring>
 
 using namespace quickcalc;
 
@@ -82,12 +83,20 @@ Token Lexer::peek() {
     return _pending;
 }
 
+/**
+ * @brief Gives how many tokens have been read, in builds with QC_STATS
+ */
+const Stats &Lexer::stats() const {
+    return _stats;
+}
+
 /**
  * @brief Reads a token from the stream, internally used by read and peek
  * 
  * @return Token 
  */
 Token Lexer::readToken() {
+    count(_stats.tokens);
     int c = getChar();
     
     while (isspace(c)) {
@@ -1,51 +1,226 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
 #include <vector>
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "executor.hpp"
 #include "concepts.hpp"
+#include "natives.hpp"
+#include "vm.hpp"
+#include "folder.hpp"
+#include "inliner.hpp"
+#include "cse.hpp"
+#include "session.hpp"
 
 using namespace quickcalc;
 
+namespace {
+    // Optional passes run over each statement before it's executed
+    struct Passes {
+        std::unique_ptr<Inliner> inliner;
+        std::unique_ptr<Folder> folder;
+        std::unique_ptr<CommonSubexpressions> cse;
+    };
+
+    // Prints the statements a definition caused to be recomputed, numbered from the first statement
+    void reportUpdates(const Session &session) {
+        for (size_t formula : session.updated()) {
+            std::cout << "Result " << formula + 1 << " = ";
+            try {
+                std::cout << session.value(formula) << std::endl;
+            } catch (std::runtime_error &e) {
+                std::cout << "Exception: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    template<typename Engine>
+    int run(std::istream &input, Engine &engine, Passes &passes, Stats &stats) {
+        auto lex = std::make_unique<Lexer>(input);
+        Parser parser = Parser(*lex);
+
+        std::vector<StmtNode::ptr> vitalNodes;
+        int status = 0;
+
+        while (!input.eof()) {
+            try {
+                auto ast = parser.parse();
+                if (passes.inliner) {
+                    std::cout << "Inlined " << passes.inliner->inlineCalls(ast.get()) << " calls" << std::endl;
+                }
+                if (passes.folder) {
+                    std::cout << "Folded " << passes.folder->fold(ast.get()) << " nodes" << std::endl;
+                }
+                if (passes.cse) {
+                    std::cout << "Merged " << passes.cse->eliminate(ast.get()) << " nodes" << std::endl;
+                }
+                // Ensure vital nodes are kept in memory
+                auto &astRef = ast->canSafeDelete() ? ast : vitalNodes.emplace_back(std::move(ast));
+
+                astRef->accept(engine);
+                if (passes.inliner) {
+                    // Definitions which had an earlier version of this one inlined into them have changed too
+                    for (FuncDefNode *node : passes.inliner->rebuilt()) {
+                        if (passes.folder) {
+                            passes.folder->fold(node);
+                        }
+                        if (passes.cse) {
+                            passes.cse->eliminate(node);
+                        }
+                        node->accept(engine);
+                    }
+                }
+                if (engine.hasResult()) {
+                    std::cout << "Result = " << engine.lastResult() << std::endl;
+                } else {
+                    std::cout << "OK" << std::endl;
+                }
+                if constexpr (std::is_same_v<Engine, Session>) {
+                    reportUpdates(engine);
+                }
+            } catch (std::runtime_error &e) {
+                std::cout << "Exception: " << e.what() << std::endl;
+                status = 1;
+                break;
+            }
+        }
+
+        stats += lex->stats();
+        stats += parser.stats();
+        if constexpr (std::is_same_v<Engine, Executor>) {
+            stats += engine.stats();
+        }
+        return status;
+    }
+
+    // Only the executor counts what it evaluates, the other engines only count lexing and parsing
+    template<typename Engine>
+    int runAndReport(std::istream &input, Engine &engine, Passes &passes, bool printStats) {
+        Stats stats;
+        int status = run(input, engine, passes, stats);
+        if (printStats) {
+            stats.print(std::cout);
+        }
+        return status;
+    }
+}
+
 int main(int argc, char *argv[]) {
     std::cout << "QuickCalc" << std::endl;
+    bool useVm = false;
+    bool incremental = false;
+    Passes passes;
+    VMOptions vmOptions;
+    uint64_t fuel = UNLIMITED_FUEL;
+    bool profile = false;
+    bool printStats = false;
+    const char *collapsedPath = nullptr;
+    int firstArg = 1;
+    for (; firstArg < argc && strncmp(argv[firstArg], "--", 2) == 0; firstArg++) {
+        if (strcmp(argv[firstArg], "--vm") == 0) {
+            useVm = true;
+        } else if (strcmp(argv[firstArg], "--by-need") == 0) {
+            useVm = true;
+            vmOptions.arguments = ArgumentMode::BY_NEED;
+        } else if (strcmp(argv[firstArg], "--memo") == 0) {
+            useVm = true;
+            vmOptions.arguments = ArgumentMode::BY_NEED;
+            vmOptions.memoEntries = 4096;
+        } else if (strcmp(argv[firstArg], "--jit") == 0) {
+            useVm = true;
+            vmOptions.arguments = ArgumentMode::BY_NEED;
+            vmOptions.jit = true;
+        } else if (strncmp(argv[firstArg], "--loop-workers=", 15) == 0) {
+            useVm = true;
+            vmOptions.loopWorkers = std::max(std::atoi(argv[firstArg] + 15), 1);
+        } else if (strncmp(argv[firstArg], "--fuel=", 7) == 0) {
+            fuel = std::strtoull(argv[firstArg] + 7, nullptr, 10);
+        } else if (strcmp(argv[firstArg], "--profile") == 0) {
+            profile = true;
+        } else if (strncmp(argv[firstArg], "--profile=", 10) == 0) {
+            profile = true;
+            collapsedPath = argv[firstArg] + 10;
+        } else if (strcmp(argv[firstArg], "--stats") == 0) {
+            printStats = true;
+        } else if (strcmp(argv[firstArg], "--incremental") == 0) {
+            incremental = true;
+        } else if (strcmp(argv[firstArg], "--fold") == 0) {
+            passes.folder = std::make_unique<Folder>();
+        } else if (strcmp(argv[firstArg], "--inline") == 0) {
+            passes.inliner = std::make_unique<Inliner>();
+        } else if (strcmp(argv[firstArg], "--cse") == 0) {
+            passes.cse = std::make_unique<CommonSubexpressions>();
+        } else if (strncmp(argv[firstArg], "--library=", 10) == 0) {
+            try {
+                size_t count = loadNativeLibrary(argv[firstArg] + 10);
+                std::cout << "Loaded " << count << " native functions" << std::endl;
+            } catch (std::runtime_error &e) {
+                std::cout << "Exception: " << e.what() << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << "Unknown option " << argv[firstArg] << std::endl;
+            return 1;
+        }
+    }
+
+    if (fuel != UNLIMITED_FUEL && (!FUEL_METERED || useVm || incremental)) {
+        std::cout << "Fuel is only metered by the executor, in builds with QC_FUEL" << std::endl;
+        return 1;
+    }
+
+    if (printStats && !STATS_COUNTED) {
+        std::cout << "Statistics are only counted in builds with QC_STATS" << std::endl;
+        return 1;
+    }
+
+    if (profile && (useVm || incremental)) {
+        std::cout << "Only the executor can be profiled" << std::endl;
+        return 1;
+    }
+
     std::unique_ptr<std::stringstream> argInput;
     std::istream *input = &std::cin;
-    if (argc > 1) {
+    if (argc > firstArg) {
         argInput = std::make_unique<std::stringstream>();
-        for (int i = 1; i < argc; i++) {
+        for (int i = firstArg; i < argc; i++) {
             *argInput << argv[i] << " ";
         }
         input = argInput.get();
     }
-    
-    auto lex = std::make_unique<Lexer>(*input);
-    Parser parser = Parser(*lex);
-    auto executor = std::make_unique<Executor>();
-
-    loadConcepts(executor->getState());
 
-    std::vector<StmtNode::ptr> vitalNodes;
-
-    while (!input->eof()) {
-        try {
-            auto ast = parser.parse();
-            // Ensure vital nodes are kept in memory
-            auto &astRef = ast->canSafeDelete() ? ast : vitalNodes.emplace_back(std::move(ast));
+    if (incremental) {
+        auto session = std::make_unique<Session>(vmOptions);
+        return runAndReport(*input, *session, passes, printStats);
+    } else if (useVm) {
+        auto vm = std::make_unique<VM>(vmOptions);
+        return runAndReport(*input, *vm, passes, printStats);
+    } else {
+        auto executor = std::make_unique<Executor>();
+        loadConcepts(executor->getState());
+        executor->setFuelBudget(fuel);
+        if (!profile) {
+            return runAndReport(*input, *executor, passes, printStats);
+        }
 
-            astRef->accept(*executor);
-            if (executor->hasResult()) {
-                std::cout << "Result = " << executor->lastResult() << std::endl;
-            } else {
-                std::cout << "OK" << std::endl;
+        Profiler profiler;
+        executor->setProfiler(&profiler);
+        int status = runAndReport(*input, *executor, passes, printStats);
+        profiler.report(std::cout);
+        if (collapsedPath) {
+            std::ofstream collapsed(collapsedPath);
+            profiler.writeCollapsed(collapsed);
+            if (!collapsed) {
+                std::cout << "Couldn't write " << collapsedPath << std::endl;
+                return 1;
             }
-        } catch (std::runtime_error &e) {
-            std::cout << "Exception: " << e.what() << std::endl;
-            return 1;
         }
+        return status;
     }
-
-    return 0;
 }
@@ -0,0 +1,115 @@
+#include "memo.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace quickcalc;
+
+/**
+ * @brief Construct a new memo cache
+ * 
+ * @param arity Number of arguments in each key
+ * @param capacity Most results kept at once, at least one
+ */
+MemoCache::MemoCache(size_t arity, size_t capacity): _arity(arity), _capacity(std::max<size_t>(capacity, 1)),
+    _keys((_capacity + 1) * arity), _values(_capacity), _referenced(_capacity),
+    _entries(_capacity, KeyHash { this }, KeyEqual { this }), _hand(0) {
+}
+
+size_t MemoCache::arity() const {
+    return _arity;
+}
+
+/**
+ * @brief Gets the key used by find and insert, which the caller fills in with the arguments
+ * 
+ * @return double* Space for arity arguments
+ */
+double *MemoCache::probe() {
+    return _keys.data() + _capacity * _arity;
+}
+
+/**
+ * @brief Looks up the result for the arguments in the probe
+ * 
+ * @param value Set to the cached result if there is one
+ * @return true The result was cached
+ */
+bool MemoCache::find(double &value) {
+    auto it = _entries.find(_capacity);
+    if (it == _entries.end()) {
+        _stats.misses++;
+        return false;
+    }
+    _stats.hits++;
+    _referenced[*it] = true;
+    value = _values[*it];
+    return true;
+}
+
+/**
+ * @brief Caches the result for the arguments in the probe, evicting an older result if full
+ * 
+ * @param value Result of the function
+ */
+void MemoCache::insert(double value) {
+    auto it = _entries.find(_capacity);
+    if (it != _entries.end()) {
+        _values[*it] = value;
+        return;
+    }
+
+    if (_entries.size() < _capacity) {
+        size_t entry = _entries.size();
+        std::copy_n(_keys.begin() + _capacity * _arity, _arity, _keys.begin() + entry * _arity);
+        _values[entry] = value;
+        _referenced[entry] = false;
+        _entries.insert(entry);
+    } else {
+        // Reuse the evicted entry's node, so a full cache doesn't allocate
+        size_t entry = evict();
+        auto node = _entries.extract(entry);
+        std::copy_n(_keys.begin() + _capacity * _arity, _arity, _keys.begin() + entry * _arity);
+        _values[entry] = value;
+        _referenced[entry] = false;
+        _entries.insert(std::move(node));
+        _stats.evictions++;
+    }
+    _stats.size = _entries.size();
+}
+
+const MemoStats &MemoCache::stats() const {
+    return _stats;
+}
+
+/**
+ * @brief Picks an entry to replace, skipping and clearing entries used since the hand last passed
+ * 
+ * @return size_t Index of the entry
+ */
+size_t MemoCache::evict() {
+    while (_referenced[_hand]) {
+        _referenced[_hand] = false;
+        _hand = (_hand + 1) % _capacity;
+    }
+    size_t entry = _hand;
+    _hand = (_hand + 1) % _capacity;
+    return entry;
+}
+
+size_t MemoCache::KeyHash::operator()(size_t entry) const {
+    const double *key = cache->_keys.data() + entry * cache->_arity;
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < cache->_arity; i++) {
+        uint64_t bits;
+        std::memcpy(&bits, key + i, sizeof(bits));
+        hash = (hash ^ bits) * 0x100000001b3;
+        hash ^= hash >> 29;
+    }
+    return static_cast<size_t>(hash);
+}
+
+bool MemoCache::KeyEqual::operator()(size_t a, size_t b) const {
+    // Compared by bit pattern, so NaN keys can be found and 0 and -0 are kept apart
+    const double *keys = cache->_keys.data();
+    return std::memcmp(keys + a * cache->_arity, keys + b * cache->_arity, cache->_arity * sizeof(double)) == 0;
+}
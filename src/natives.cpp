@@ -0,0 +1,185 @@
+#include "natives.hpp"
+#include "concepts.hpp"
+#include <atomic>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define QC_NATIVE_LIBRARIES 1
+#include <dlfcn.h>
+#endif
+
+using namespace quickcalc;
+
+namespace {
+    // Most functions which can be registered, in chunks which are allocated as they're needed
+    constexpr size_t CHUNK_SIZE = 64;
+    constexpr size_t MAX_CHUNKS = 1024;
+
+    // Functions are appended with the mutex held and never moved or removed, then published by the count,
+    // so they're read by index without taking the mutex
+    struct Registry {
+        std::mutex mutex;
+        std::unique_ptr<NativeFunction[]> chunks[MAX_CHUNKS];
+        std::atomic<size_t> count;
+        std::unordered_map<std::string, int32_t> names;
+
+        Registry(): count(0) {
+            const NativeLibrary &math = mathConcepts();
+            for (uint32_t i = 0; i < math.count; i++) {
+                add(math.functions[i]);
+            }
+        }
+
+        // Adds an already checked definition, with the mutex held
+        int32_t add(const NativeDefinition &definition) {
+            std::string name = definition.name;
+            if (names.count(name)) {
+                throw std::invalid_argument("Native function " + name + " is already registered");
+            }
+            size_t next = count.load(std::memory_order_relaxed);
+            if (next >= CHUNK_SIZE * MAX_CHUNKS) {
+                throw std::invalid_argument("Too many native functions to register " + name);
+            }
+            std::unique_ptr<NativeFunction[]> &chunk = chunks[next / CHUNK_SIZE];
+            if (!chunk) {
+                chunk = std::make_unique<NativeFunction[]>(CHUNK_SIZE);
+            }
+            bool vectorizable = definition.flags & NATIVE_VECTORIZABLE;
+            chunk[next % CHUNK_SIZE] = {
+                name, definition.call, vectorizable ? definition.columns : nullptr, definition.minArgs,
+                definition.maxArgs, (definition.flags & NATIVE_PURE) != 0, vectorizable
+            };
+            int32_t index = static_cast<int32_t>(next);
+            names.emplace(std::move(name), index);
+            count.store(next + 1, std::memory_order_release);
+            return index;
+        }
+    };
+
+    Registry &registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    // Matches the identifiers the lexer produces, so the function can be called
+    bool isIdentifier(const char *name) {
+        if (!name || !std::isalpha(static_cast<unsigned char>(name[0]))) {
+            return false;
+        }
+        for (const char *c = name + 1; *c; c++) {
+            if (!std::isalnum(static_cast<unsigned char>(*c)) && *c != '_') {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+bool NativeFunction::accepts(size_t count) const {
+    return count >= minArgs && count <= maxArgs;
+}
+
+std::string NativeFunction::arityError(size_t count) const {
+    std::string expected = std::to_string(minArgs);
+    if (maxArgs == NATIVE_VARIADIC) {
+        expected = "at least " + expected;
+    } else if (maxArgs != minArgs) {
+        expected += " to " + std::to_string(maxArgs);
+    }
+    return name + " takes " + expected + " arguments, not " + std::to_string(count);
+}
+
+/**
+ * @brief Makes a native function callable by name from every executor, virtual machine and batch
+ *
+ * Functions are registered for the rest of the process, so register them before anything is
+ * compiled. Other threads may look functions up and call them while more are registered.
+ *
+ * @param definition Function to register, the name is copied
+ * @return int32_t Index of the function
+ * @throws std::invalid_argument The definition is malformed or the name is already taken
+ */
+int32_t quickcalc::registerNative(const NativeDefinition &definition) {
+    if (!isIdentifier(definition.name)) {
+        throw std::invalid_argument("Native functions must be named with an identifier");
+    }
+    std::string name = definition.name;
+    Builtin builtin;
+    if (tryGetBuiltin(name, builtin)) {
+        throw std::invalid_argument("Native function " + name + " would replace a builtin");
+    }
+    if (!definition.call || definition.minArgs > definition.maxArgs) {
+        throw std::invalid_argument("Native function " + name + " has no call or an invalid arity");
+    }
+
+    Registry &natives = registry();
+    std::lock_guard<std::mutex> lock(natives.mutex);
+    return natives.add(definition);
+}
+
+/**
+ * @brief Loads a shared library and registers every function it exports
+ *
+ * The library is never unloaded. Functions registered before one fails to register stay registered.
+ *
+ * @param path Path to the library, as given to the platform's loader
+ * @return size_t Number of functions registered
+ * @throws std::runtime_error The library can't be loaded or was built for another version of the ABI
+ */
+size_t quickcalc::loadNativeLibrary(const std::string &path) {
+#ifdef QC_NATIVE_LIBRARIES
+    void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        throw std::runtime_error("Couldn't load native library " + path + ": " + dlerror());
+    }
+    auto entry = reinterpret_cast<NativeEntry>(dlsym(handle, NATIVE_ENTRY));
+    if (!entry) {
+        throw std::runtime_error("Native library " + path + " doesn't export " + NATIVE_ENTRY);
+    }
+    const NativeLibrary *library = entry();
+    if (!library || library->abiVersion != NATIVE_ABI_VERSION) {
+        throw std::runtime_error("Native library " + path + " was built for another version of QuickCalc");
+    }
+    for (uint32_t i = 0; i < library->count; i++) {
+        try {
+            registerNative(library->functions[i]);
+        } catch (std::invalid_argument &e) {
+            throw std::runtime_error("Couldn't register from native library " + path + ": " + e.what());
+        }
+    }
+    return library->count;
+#else
+    throw std::runtime_error("Native libraries can't be loaded on this platform");
+#endif
+}
+
+bool quickcalc::tryGetNative(const std::string &name, int32_t &index) {
+    Registry &natives = registry();
+    std::lock_guard<std::mutex> lock(natives.mutex);
+    auto it = natives.names.find(name);
+    if (it != natives.names.end()) {
+        index = it->second;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+/**
+ * @brief Gives a registered function without locking the registry, so it's cheap enough to call every time
+ *
+ * @param index Index from registerNative or tryGetNative
+ * @throws std::out_of_range Nothing is registered at the index
+ */
+const NativeFunction &quickcalc::nativeFunction(int32_t index) {
+    Registry &natives = registry();
+    if (index < 0 || static_cast<size_t>(index) >= natives.count.load(std::memory_order_acquire)) {
+        throw std::out_of_range("No native function " + std::to_string(index));
+    }
+    size_t slot = static_cast<size_t>(index);
+    return natives.chunks[slot / CHUNK_SIZE][slot % CHUNK_SIZE];
+}
@@ -4,11 +4,28 @@
 
 using namespace quickcalc;
 
-Parser::Parser(ILexer &lexer): _lexer(lexer) {
+namespace {
+    // Brackets, negations and calls nest by recursion, so limit how deep they can go
+    constexpr int MAX_DEPTH = 1000;
+
+    // Chains of operators are right associative
+    ExprNode::ptr foldRight(std::vector<ExprNode::ptr> &operands, std::vector<BinaryOperation> &operations,
+                            uint64_t &nodes) {
+        count(nodes, operations.size());
+        ExprNode::ptr result = std::move(operands.back());
+        for (size_t i = operations.size(); i > 0; i--) {
+            result = std::make_unique<BinaryOperationNode>(operations[i - 1], std::move(operands[i - 1]), std::move(result));
+        }
+        return result;
+    }
+}
+
+Parser::Parser(ILexer &lexer): _lexer(lexer), _depth(0) {
 }
 
 std::unique_ptr<StmtNode> Parser::parse() {
     std::unique_ptr<StmtNode> stmt;
+    _depth = 0;
     Token tok = _lexer.peek();
     if (tok.type == TokenType::KEYWORD) {
         switch (std::get<Keyword>(tok.data)) {
@@ -30,7 +47,15 @@ std::unique_ptr<StmtNode> Parser::parse() {
     return stmt;
 }
 
+/**
+ * @brief Gives how many nodes have been built, in builds with QC_STATS
+ */
+const Stats &Parser::stats() const {
+    return _stats;
+}
+
 std::unique_ptr<StmtNode> Parser::exprStmt() {
+    count(_stats.nodes);
     return std::make_unique<ExprStmtNode>(additive());
 }
 
@@ -77,54 +102,80 @@ std::unique_ptr<StmtNode> Parser::funcDef() {
     }
 
     auto expr = additive();
+    count(_stats.nodes);
     return std::make_unique<FuncDefNode>(std::get<std::string>(name.data), std::move(expr), std::move(paramNames));
 }
 
-std::unique_ptr<ExprNode> Parser::additive() {
-    std::unique_ptr<ExprNode> lhs = multiplicative();
-    Token op = _lexer.peek();
-    switch (op.type) {
-    case TokenType::SYMBOL:
-        switch (std::get<Symbol>(op.data)) {
-        case Symbol::ADD:
-            _lexer.read();
-            return std::make_unique<BinaryOperationNode>(BinaryOperation::ADD, std::move(lhs), additive());
-
-        case Symbol::SUBTRACT:
-            _lexer.read();
-            return std::make_unique<BinaryOperationNode>(BinaryOperation::SUBTRACT, std::move(lhs), additive());
-        
-        case Symbol::BRACKET_CLOSE:
-        case Symbol::COMMA:
-            return lhs;
+ExprNode::ptr Parser::additive() {
+    // Operands are collected in a loop so long generated sums don't recurse
+    std::vector<ExprNode::ptr> operands;
+    std::vector<BinaryOperation> operations;
+    operands.push_back(multiplicative());
+    for (;;) {
+        Token op = _lexer.peek();
+        switch (op.type) {
+        case TokenType::SYMBOL:
+            switch (std::get<Symbol>(op.data)) {
+            case Symbol::ADD:
+                _lexer.read();
+                operations.push_back(BinaryOperation::ADD);
+                operands.push_back(multiplicative());
+                continue;
+
+            case Symbol::SUBTRACT:
+                _lexer.read();
+                operations.push_back(BinaryOperation::SUBTRACT);
+                operands.push_back(multiplicative());
+                continue;
+
+            case Symbol::BRACKET_CLOSE:
+            case Symbol::COMMA:
+                return foldRight(operands, operations, _stats.nodes);
+
+            default:
+                break;
+            }
+            // Any other symbol can't follow an operand
+            [[fallthrough]];
+        default:
+            throw std::runtime_error(generateError("Expected + or -", op));
+        case TokenType::END_OF_STMT:
+            return foldRight(operands, operations, _stats.nodes);
         }
-    default:
-        throw std::runtime_error(generateError("Expected + or -", op));
-    case TokenType::END_OF_STMT:
-        return lhs;
     }
 }
 
-std::unique_ptr<ExprNode> Parser::multiplicative() {
-    std::unique_ptr<ExprNode> lhs = expression();
-    Token op = _lexer.peek();
-    switch (op.type) {
-    case TokenType::SYMBOL:
-        switch (std::get<Symbol>(op.data)) {
-        case Symbol::MULTIPLY:
+ExprNode::ptr Parser::multiplicative() {
+    std::vector<ExprNode::ptr> operands;
+    std::vector<BinaryOperation> operations;
+    operands.push_back(expression());
+    for (;;) {
+        Token op = _lexer.peek();
+        if (op.type == TokenType::SYMBOL && std::get<Symbol>(op.data) == Symbol::MULTIPLY) {
             _lexer.read();
-            return std::make_unique<BinaryOperationNode>(BinaryOperation::MULTIPLY, std::move(lhs), multiplicative());
-
-        case Symbol::DIVIDE:
+            operations.push_back(BinaryOperation::MULTIPLY);
+        } else if (op.type == TokenType::SYMBOL && std::get<Symbol>(op.data) == Symbol::DIVIDE) {
             _lexer.read();
-            return std::make_unique<BinaryOperationNode>(BinaryOperation::DIVIDE, std::move(lhs), multiplicative());
+            operations.push_back(BinaryOperation::DIVIDE);
+        } else {
+            return foldRight(operands, operations, _stats.nodes);
         }
-    default:
-        return lhs;
+        operands.push_back(expression());
+    }
+}
+
+ExprNode::ptr Parser::expression() {
+    Token tok = _lexer.peek();
+    if (_depth >= MAX_DEPTH) {
+        throw std::runtime_error(generateError("Expression nested too deeply", tok));
     }
+    _depth++;
+    ExprNode::ptr expr = primary();
+    _depth--;
+    return expr;
 }
 
-std::unique_ptr<ExprNode> Parser::expression() {
+ExprNode::ptr Parser::primary() {
     Token tok = _lexer.peek();
     switch (tok.type) {
     case TokenType::SYMBOL:
@@ -137,12 +188,14 @@ std::unique_ptr<ExprNode> Parser::expression() {
             return expression();
         case Symbol::SUBTRACT:
             _lexer.read();
+            count(_stats.nodes);
             return std::make_unique<UnaryOperationNode>(UnaryOperation::NEGATE, expression());
         default:
             throw std::runtime_error(generateError("Expected ( + or -", tok));
         }
     case TokenType::NUMBER:
         _lexer.read();
+        count(_stats.nodes);
         return std::make_unique<ConstNode>(std::get<double>(tok.data));
     case TokenType::NAME:
         return funcCall();
@@ -151,8 +204,8 @@ std::unique_ptr<ExprNode> Parser::expression() {
     }
 }
 
-std::unique_ptr<ExprNode> Parser::brackets() {
-    std::unique_ptr<ExprNode> inner = additive();
+ExprNode::ptr Parser::brackets() {
+    ExprNode::ptr inner = additive();
     Token op = _lexer.read();
     if (op.type != TokenType::SYMBOL || std::get<Symbol>(op.data) != Symbol::BRACKET_CLOSE) {
         throw std::runtime_error(generateError("Expected closing bracket", op));
@@ -160,13 +213,13 @@ std::unique_ptr<ExprNode> Parser::brackets() {
     return inner;
 }
 
-std::unique_ptr<ExprNode> Parser::funcCall() {
+ExprNode::ptr Parser::funcCall() {
     Token name = _lexer.read();
     if (name.type != TokenType::NAME) {
         throw std::runtime_error(generateError("Expected name", name));
     }
 
-    std::vector<std::unique_ptr<ExprNode>> params;
+    std::vector<ExprNode::ptr> params;
 
     Token tok = _lexer.peek();
     if (tok.type == TokenType::SYMBOL && std::get<Symbol>(tok.data) == Symbol::BRACKET_OPEN) {
@@ -180,6 +233,7 @@ std::unique_ptr<ExprNode> Parser::funcCall() {
         } while (std::get<Symbol>(tok.data) != Symbol::BRACKET_CLOSE);
     }
     params.shrink_to_fit();
+    count(_stats.nodes);
 
     return std::make_unique<FunctionInvocationNode>(std::get<std::string>(name.data), std::move(params));
 }
@@ -188,7 +242,7 @@ std::string Parser::generateError(const std::string &msg, const Token &token) {
     std::ostringstream error;
     error << msg << " " << token.type;
     std::visit([&error] (auto &arg) {
-        using T = std::decay<decltype(arg)>::type;
+        using T = typename std::decay<decltype(arg)>::type;
         if constexpr (std::is_same<T, Symbol>::value || std::is_same<T, double>::value || std::is_same<T, Keyword>::value) {
             error << " " << arg;
         }
@@ -0,0 +1,191 @@
+#include "pool.hpp"
+#include <algorithm>
+
+using namespace quickcalc;
+
+namespace {
+    uint64_t pack(uint32_t begin, uint32_t end) {
+        return (static_cast<uint64_t>(begin) << 32) | end;
+    }
+
+    uint32_t rangeBegin(uint64_t range) {
+        return static_cast<uint32_t>(range >> 32);
+    }
+
+    uint32_t rangeEnd(uint64_t range) {
+        return static_cast<uint32_t>(range);
+    }
+}
+
+/**
+ * @brief Construct a new worker pool, starting a thread for every worker but the first
+ *
+ * @param workers Number of workers including the caller of run, at least one
+ */
+WorkerPool::WorkerPool(size_t workers): _workers(std::max<size_t>(workers, 1)), _run(0), _running(0),
+    _stopping(false), _task(nullptr), _items(0), _chunk(1), _failed(false) {
+    _queues = std::make_unique<Queue[]>(_workers);
+    _threads.reserve(_workers - 1);
+    for (size_t worker = 1; worker < _workers; worker++) {
+        _threads.emplace_back(&WorkerPool::loop, this, worker);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _started.notify_all();
+    for (std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+size_t WorkerPool::size() const {
+    return _workers;
+}
+
+/**
+ * @brief Runs a task over every item, split into chunks, returning once they've all been processed
+ *
+ * Each worker starts with an equal share of the chunks and takes them in order, so neighbouring items
+ * tend to be processed by the same worker. Workers which run out steal half of what another has left.
+ * If a task throws, no more chunks are started and the first exception is rethrown once every worker
+ * has stopped.
+ *
+ * @param items Number of items
+ * @param chunk Most items passed to a single call of the task
+ * @param task Called for each chunk, from any of the workers
+ */
+void WorkerPool::run(size_t items, size_t chunk, const Task &task) {
+    if (items == 0) {
+        return;
+    }
+    chunk = std::max<size_t>(chunk, 1);
+    // Chunk indices must fit half of a queue
+    chunk = std::max<size_t>(chunk, items / UINT32_MAX + 1);
+    size_t chunks = (items + chunk - 1) / chunk;
+    if (_workers == 1 || chunks == 1) {
+        task(0, 0, items);
+        return;
+    }
+
+    for (size_t worker = 0; worker < _workers; worker++) {
+        uint32_t begin = static_cast<uint32_t>(chunks * worker / _workers);
+        uint32_t end = static_cast<uint32_t>(chunks * (worker + 1) / _workers);
+        _queues[worker].range.store(pack(begin, end), std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _items = items;
+        _chunk = chunk;
+        _failed.store(false, std::memory_order_relaxed);
+        _error = nullptr;
+        _running = _threads.size();
+        _run++;
+    }
+    _started.notify_all();
+
+    work(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished.wait(lock, [this] { return _running == 0; });
+        _task = nullptr;
+        error = std::move(_error);
+        _error = nullptr;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkerPool::loop(size_t worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _started.wait(lock, [this, seen] { return _stopping || _run != seen; });
+            if (_stopping) {
+                return;
+            }
+            seen = _run;
+        }
+
+        work(worker);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_running == 0) {
+            _finished.notify_one();
+        }
+    }
+}
+
+void WorkerPool::work(size_t worker) {
+    uint32_t chunk;
+    while (!_failed.load(std::memory_order_relaxed) && (take(worker, chunk) || steal(worker, chunk))) {
+        size_t begin = chunk * _chunk;
+        size_t end = std::min(begin + _chunk, _items);
+        try {
+            (*_task)(worker, begin, end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+            _failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Takes the next chunk from the front of a worker's own queue
+ *
+ * @param worker Worker taking the chunk
+ * @param chunk Set to the index of the chunk taken
+ * @return true A chunk was taken, false if the queue is empty
+ */
+bool WorkerPool::take(size_t worker, uint32_t &chunk) {
+    std::atomic<uint64_t> &range = _queues[worker].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (rangeBegin(current) < rangeEnd(current)) {
+        uint64_t next = pack(rangeBegin(current) + 1, rangeEnd(current));
+        if (range.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            chunk = rangeBegin(current);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Takes the back half of another worker's queue, running its first chunk and queueing the rest
+ *
+ * Only called once the worker's own queue is empty, and nothing else writes to an empty queue, so
+ * the rest can be stored without a race.
+ *
+ * @param worker Worker stealing the chunks
+ * @param chunk Set to the index of the chunk to run
+ * @return true A chunk was stolen, false if every queue is empty
+ */
+bool WorkerPool::steal(size_t worker, uint32_t &chunk) {
+    for (size_t i = 1; i < _workers; i++) {
+        std::atomic<uint64_t> &range = _queues[(worker + i) % _workers].range;
+        uint64_t current = range.load(std::memory_order_acquire);
+        while (rangeBegin(current) < rangeEnd(current)) {
+            uint32_t begin = rangeBegin(current);
+            uint32_t end = rangeEnd(current);
+            uint32_t middle = begin + (end - begin) / 2;
+            if (range.compare_exchange_weak(current, pack(begin, middle), std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                chunk = middle;
+                _queues[worker].range.store(pack(middle + 1, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
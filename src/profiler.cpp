@@ -0,0 +1,172 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <iomanip>
+
+using namespace quickcalc;
+
+namespace {
+    // Parent of the stacks of outermost calls, which isn't a function itself
+    constexpr uint32_t ROOT = 0;
+
+    double milliseconds(Profiler::Clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+}
+
+Profiler::Call::Call(Profiler &profiler, const std::string &name): _profiler(profiler) {
+    _profiler.enter(name);
+}
+
+Profiler::Call::~Call() {
+    _profiler.leave();
+}
+
+Profiler::Profiler() {
+    clear();
+}
+
+/**
+ * @brief Starts timing a call, made from the innermost call in progress
+ *
+ * @param name Name the function was called by
+ */
+void Profiler::enter(const std::string &name) {
+    uint32_t function = intern(name);
+    Entry &entry = _functions[function];
+
+    // Otherwise every level of recursion would be a stack of its own, each printed with the whole path
+    if (entry.depth == 0) {
+        uint32_t parent = _frames.empty() ? ROOT : _frames.back().stack;
+        uint32_t stack = ROOT;
+        for (const std::pair<uint32_t, uint32_t> &child : _stacks[parent].children) {
+            if (child.first == function) {
+                stack = child.second;
+                break;
+            }
+        }
+        if (stack == ROOT) {
+            stack = static_cast<uint32_t>(_stacks.size());
+            _stacks[parent].children.emplace_back(function, stack);
+            _stacks.emplace_back(function, parent);
+        }
+        entry.stack = stack;
+    }
+
+    entry.depth++;
+    entry.function.maxDepth = std::max(entry.function.maxDepth, entry.depth);
+    // Read last, so none of the bookkeeping is counted as part of the call
+    _frames.push_back(Frame { function, entry.stack, Clock::now(), Clock::duration::zero() });
+}
+
+uint32_t Profiler::intern(const std::string &name) {
+    auto address = _addresses.find(&name);
+    // The string at an address may have been freed and another name allocated in its place
+    if (address != _addresses.end() && _functions[address->second].function.name == name) {
+        return address->second;
+    }
+    auto found = _names.find(name);
+    uint32_t function;
+    if (found != _names.end()) {
+        function = found->second;
+    } else {
+        function = static_cast<uint32_t>(_functions.size());
+        _functions.emplace_back().function.name = name;
+        _names.emplace(name, function);
+    }
+    _addresses[&name] = function;
+    return function;
+}
+
+/**
+ * @brief Stops timing the innermost call in progress
+ */
+void Profiler::leave() {
+    Clock::time_point end = Clock::now();
+    Frame frame = _frames.back();
+    _frames.pop_back();
+
+    Clock::duration elapsed = end - frame.start;
+    Clock::duration exclusive = elapsed - frame.children;
+    Entry &entry = _functions[frame.function];
+    entry.function.calls++;
+    entry.function.exclusive += exclusive;
+    if (--entry.depth == 0) {
+        entry.function.inclusive += elapsed;
+    }
+    _stacks[frame.stack].exclusive += exclusive;
+    if (!_frames.empty()) {
+        _frames.back().children += elapsed;
+    }
+}
+
+/**
+ * @brief Gives what was recorded for every function called, most exclusive time first
+ */
+std::vector<Profiler::Function> Profiler::functions() const {
+    std::vector<Function> functions;
+    functions.reserve(_functions.size());
+    for (const Entry &entry : _functions) {
+        functions.push_back(entry.function);
+    }
+    std::stable_sort(functions.begin(), functions.end(), [] (const Function &a, const Function &b) {
+        return a.exclusive > b.exclusive;
+    });
+    return functions;
+}
+
+/**
+ * @brief Prints a table of every function called, most exclusive time first
+ */
+void Profiler::report(std::ostream &stream) const {
+    std::ios_base::fmtflags flags = stream.flags();
+    stream << std::left << std::setw(24) << "Function" << std::right << std::setw(12) << "Calls"
+           << std::setw(16) << "Inclusive ms" << std::setw(16) << "Exclusive ms" << std::setw(12) << "Max depth"
+           << "\n";
+    stream << std::fixed << std::setprecision(3);
+    for (const Function &function : functions()) {
+        stream << std::left << std::setw(24) << function.name << std::right << std::setw(12) << function.calls
+               << std::setw(16) << milliseconds(function.inclusive)
+               << std::setw(16) << milliseconds(function.exclusive)
+               << std::setw(12) << function.maxDepth << "\n";
+    }
+    stream.flags(flags);
+}
+
+/**
+ * @brief Writes every stack of calls with the nanoseconds spent at its top, one per line
+ *
+ * Lines look like `<script>;f;g 1500`, which flamegraph.pl and similar tools read directly.
+ */
+void Profiler::writeCollapsed(std::ostream &stream) const {
+    std::vector<uint32_t> path;
+    for (uint32_t stack = ROOT + 1; stack < _stacks.size(); stack++) {
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(_stacks[stack].exclusive).count();
+        if (nanoseconds <= 0) {
+            // Tools work out the time of callers from their callees
+            continue;
+        }
+        path.clear();
+        for (uint32_t node = stack; node != ROOT; node = _stacks[node].parent) {
+            path.push_back(_stacks[node].function);
+        }
+        for (auto function = path.rbegin(); function != path.rend(); ++function) {
+            if (function != path.rbegin()) {
+                stream << ';';
+            }
+            stream << _functions[*function].function.name;
+        }
+        stream << ' ' << nanoseconds << '\n';
+    }
+}
+
+/**
+ * @brief Forgets everything recorded, only valid when no calls are in progress
+ */
+void Profiler::clear() {
+    _functions.clear();
+    _names.clear();
+    _addresses.clear();
+    _frames.clear();
+    _stacks.clear();
+    _stacks.emplace_back(ROOT, ROOT);
+}
@@ -0,0 +1,148 @@
+#include "program.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    template<typename T>
+    size_t vectorBytes(const std::vector<T> &vector) {
+        return vector.capacity() * sizeof(T);
+    }
+
+    size_t functionBytes(const Function &function) {
+        size_t bytes = sizeof(Function) + function.name.capacity() + vectorBytes(function.paramNames)
+                       + vectorBytes(function.code) + vectorBytes(function.constants)
+                       + vectorBytes(function.callSites) + vectorBytes(function.nativeCalls)
+                       + vectorBytes(function.loops) + vectorBytes(function.globals);
+        for (const std::string &name : function.paramNames) {
+            bytes += name.capacity();
+        }
+        for (const CallSite &site : function.callSites) {
+            bytes += vectorBytes(site.args);
+        }
+        for (const Loop &loop : function.loops) {
+            if (loop.split) {
+                bytes += functionBytes(*loop.split);
+            }
+        }
+        return bytes;
+    }
+}
+
+/**
+ * @brief Compiles a set of statements into a program
+ *
+ * Every definition is made before any formula is compiled, so formulas use the last definition of each
+ * name. Everything defined is compiled, and to machine code too if the options ask for it.
+ *
+ * @param statements Definitions and formulas, which don't need to outlive the call
+ * @param options How arguments are passed and whether to compile to machine code, memoization is ignored
+ * @throws CompileError Something refers to a name which isn't defined
+ */
+Program::Program(const std::vector<StmtNode *> &statements, const VMOptions &options):
+    _byNeed(options.arguments == ArgumentMode::BY_NEED) {
+    VMOptions compileOptions = options;
+    compileOptions.memoEntries = 0;
+    compileOptions.cacheConstants = false;
+    VM vm(compileOptions);
+
+    std::vector<ExprNode *> expressions;
+    for (StmtNode *statement : statements) {
+        if (auto *expression = dynamic_cast<ExprStmtNode *>(statement)) {
+            expressions.push_back(expression->expression());
+        } else {
+            statement->accept(vm);
+        }
+    }
+
+    std::vector<int32_t> used;
+    for (ExprNode *expression : expressions) {
+        Compiler compiler = vm.makeCompiler();
+        _formulas.push_back(compiler.compile(expression));
+        vm.resizeGlobals();
+        used.insert(used.end(), _formulas.back().globals.begin(), _formulas.back().globals.end());
+    }
+    for (size_t slot = 0; slot < vm._globals.size(); slot++) {
+        if (vm._symbols.isDefined(static_cast<int>(slot))) {
+            used.push_back(static_cast<int32_t>(slot));
+        }
+    }
+    vm.link(used);
+
+    _strict.resize(vm._globals.size());
+    for (int32_t slot : used) {
+        _strict[slot] = _byNeed ? vm.strictness(slot) : 0;
+    }
+    _symbols = vm._symbols;
+    _code = std::move(vm._code);
+}
+
+size_t Program::formulas() const {
+    return _formulas.size();
+}
+
+/**
+ * @brief Looks up a defined function, so it can be called without looking up its name every time
+ *
+ * @param name Name of the function
+ * @return int32_t Identifies the function to call
+ */
+int32_t Program::function(const std::string &name) const {
+    int slot;
+    if (!_symbols.tryGetSlot(name, slot) || !_symbols.isDefined(slot)) {
+        throw std::logic_error("Couldn't find function " + name);
+    }
+    return slot;
+}
+
+size_t Program::arity(int32_t function) const {
+    return _code[function].function->paramNames.size();
+}
+
+/**
+ * @brief Estimates the memory the program holds, for bounding caches of programs
+ *
+ * Counts the bytecode and constants of every function and formula, not machine code or the symbol table.
+ */
+size_t Program::bytes() const {
+    size_t bytes = sizeof(Program) + vectorBytes(_code) + vectorBytes(_strict) + vectorBytes(_formulas);
+    for (const Code &code : _code) {
+        if (code.function) {
+            bytes += functionBytes(*code.function);
+        }
+    }
+    for (const Function &formula : _formulas) {
+        bytes += functionBytes(formula) - sizeof(Function);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Evaluates one of the program's formulas
+ *
+ * @param context Context of the calling thread
+ * @param formula Index of the formula, in the order the statements were given
+ * @return double Result of the formula
+ */
+double Program::evaluate(ExecutionContext &context, size_t formula) const {
+    return context.run(_formulas[formula], _code, _byNeed);
+}
+
+/**
+ * @brief Calls a function of the program with the value of each argument
+ *
+ * @param context Context of the calling thread
+ * @param function Function returned by function(name)
+ * @param args Value of each argument
+ * @param count Number of arguments
+ * @return double Result of the call
+ */
+double Program::call(ExecutionContext &context, int32_t function, const double *args, size_t count) const {
+    return context.call(_code, _byNeed, function, _strict[function], args, count);
+}
+
+double Program::call(ExecutionContext &context, int32_t function, const std::vector<double> &args) const {
+    return call(context, function, args.data(), args.size());
+}
@@ -0,0 +1,126 @@
+#include "reduction.hpp"
+#include <cmath>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    // Past this every index is no longer exactly representable
+    constexpr double MAX_RANGE = 9007199254740992.0;
+}
+
+/**
+ * @brief Result of a loop over an empty range
+ */
+double quickcalc::reductionIdentity(Reduction reduction) {
+    switch (reduction) {
+    case Reduction::PRODUCT:
+        return 1.0;
+    case Reduction::MINIMUM:
+        return INFINITY;
+    case Reduction::MAXIMUM:
+        return -INFINITY;
+    default:
+        return 0.0;
+    }
+}
+
+/**
+ * @brief Combines two values of a loop, a coming before b
+ *
+ * Folds don't combine values, so b is the result.
+ */
+double quickcalc::combine(Reduction reduction, double a, double b) {
+    switch (reduction) {
+    case Reduction::SUM:
+        return a + b;
+    case Reduction::PRODUCT:
+        return a * b;
+    case Reduction::MINIMUM:
+        return std::fmin(a, b);
+    case Reduction::MAXIMUM:
+        return std::fmax(a, b);
+    default:
+        return b;
+    }
+}
+
+/**
+ * @brief Counts the indices lo, lo + 1, lo + 2 and so on which are at most hi
+ *
+ * @param lo First index
+ * @param hi Last index, need not differ from lo by a whole number
+ * @param length Set to the number of indices, 0 if hi is less than lo
+ * @return false Either bound is NaN, so the loop's result is NaN
+ * @throws std::runtime_error There are too many indices to count exactly
+ */
+bool quickcalc::rangeLength(double lo, double hi, uint64_t &length) {
+    if (std::isnan(lo) || std::isnan(hi)) {
+        return false;
+    }
+    if (hi < lo) {
+        length = 0;
+        return true;
+    }
+    double span = std::floor(hi - lo);
+    if (!(span < MAX_RANGE)) {
+        throw std::runtime_error("Range is too large to loop over");
+    }
+    length = static_cast<uint64_t>(span) + 1;
+    return true;
+}
+
+PairwiseReduction::PairwiseReduction(Reduction reduction): _reduction(reduction), _block(0.0), _count(0), _size(0) {
+}
+
+/**
+ * @brief Adds the value of the next index
+ */
+void PairwiseReduction::add(double value) {
+    _block = _count == 0 ? value : combine(_reduction, _block, value);
+    if (++_count == REDUCTION_BLOCK) {
+        _count = 0;
+        addBlocks(_block, 1);
+    }
+}
+
+/**
+ * @brief Adds the combined value of the next run of whole blocks
+ *
+ * @param value Result of reducing the run on its own
+ * @param blocks Length of the run, a power of two which the number of blocks added so far is a multiple of
+ */
+void PairwiseReduction::addBlocks(double value, uint64_t blocks) {
+    while (_size > 0 && _entries[_size - 1].blocks == blocks) {
+        value = combine(_reduction, _entries[--_size].value, value);
+        blocks *= 2;
+    }
+    _entries[_size++] = { value, blocks };
+}
+
+/**
+ * @brief Adds the combined value of the indices after the last whole run, nothing can be added after it
+ *
+ * @param value Result of reducing the indices on their own
+ */
+void PairwiseReduction::addPartial(double value) {
+    _block = value;
+    _count = 1;
+}
+
+/**
+ * @brief Combines everything added so far, from the last value back to the first
+ *
+ * @return double Result of the loop, the identity if nothing was added
+ */
+double PairwiseReduction::result() const {
+    if (_count == 0 && _size == 0) {
+        return reductionIdentity(_reduction);
+    }
+    size_t entry = _size;
+    double result = _count > 0 ? _block : _entries[--entry].value;
+    while (entry > 0) {
+        result = combine(_reduction, _entries[--entry].value, result);
+    }
+    return result;
+}
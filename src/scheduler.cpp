@@ -0,0 +1,202 @@
+#include "scheduler.hpp"
+#include "concepts.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    // Finished fibers kept for reuse, any more are freed so a burst of statements doesn't hold on to stacks
+    constexpr size_t IDLE_FIBERS = 64;
+}
+
+/**
+ * @brief Construct a new scheduler, starting its workers
+ */
+Scheduler::Scheduler(const SchedulerOptions &options): _options(options), _nextSession(0), _stopping(false) {
+    _options.workers = std::max<size_t>(_options.workers, 1);
+    _options.slice = std::max<uint64_t>(_options.slice, 1);
+    _threads.reserve(_options.workers);
+    for (size_t worker = 0; worker < _options.workers; worker++) {
+        _threads.emplace_back(&Scheduler::loop, this);
+    }
+}
+
+/**
+ * @brief Stops every statement in progress with FuelExhausted, abandons those not yet started, then
+ * stops the workers
+ *
+ * Without fuel metering statements in progress can't be stopped, so are waited for instead.
+ */
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _ready.notify_all();
+    for (std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Starts a new session, with only the builtins and concepts defined
+ *
+ * @return size_t Identifies the session to submit and close
+ */
+size_t Scheduler::open() {
+    auto session = std::make_unique<Session>();
+    Session *state = session.get();
+    loadConcepts(session->executor.getState());
+    session->executor.setCheckpoint([this, state] (Executor &) { return checkpoint(*state); });
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    state->id = _nextSession++;
+    _sessions.emplace(state->id, std::move(session));
+    return state->id;
+}
+
+/**
+ * @brief Frees a session once the statements already submitted to it have run
+ */
+void Scheduler::close(size_t session) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _sessions.find(session);
+    if (found == _sessions.end()) {
+        return;
+    }
+    if (found->second->scheduled) {
+        found->second->closed = true;
+    } else {
+        _sessions.erase(found);
+    }
+}
+
+/**
+ * @brief Queues a statement to run after the others submitted to the same session
+ *
+ * Definitions stay in the session's executor for later statements to call.
+ *
+ * @param session Session returned by open which hasn't been closed
+ * @param statement Statement to run, kept by the session if it's a definition
+ * @return std::future<Result> Value of an expression, or what it threw
+ */
+std::future<Scheduler::Result> Scheduler::submit(size_t session, StmtNode::ptr statement) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto found = _sessions.find(session);
+    if (found == _sessions.end() || found->second->closed) {
+        throw std::out_of_range("No such session");
+    }
+    if (_stopping) {
+        throw std::logic_error("Scheduler is stopping");
+    }
+
+    Session &state = *found->second;
+    state.tasks.push_back(Task { std::move(statement), std::promise<Result>() });
+    std::future<Result> result = state.tasks.back().result.get_future();
+    if (!state.scheduled) {
+        state.scheduled = true;
+        _queue.push_back(&state);
+        _ready.notify_one();
+    }
+    return result;
+}
+
+size_t Scheduler::sessions() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _sessions.size();
+}
+
+void Scheduler::loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _ready.wait(lock, [this] { return !_queue.empty() || _stopping; });
+        if (_queue.empty()) {
+            return;
+        }
+        Session *session = _queue.front();
+        _queue.pop_front();
+
+        if (_stopping && !session->fiber) {
+            // Dropping the promises tells whoever is waiting the statements will never run
+            session->tasks.clear();
+        } else {
+            if (!session->fiber) {
+                if (_fibers.empty()) {
+                    session->fiber = std::make_unique<Fiber>(_options.stackSize);
+                } else {
+                    session->fiber = std::move(_fibers.back());
+                    _fibers.pop_back();
+                }
+                start(*session);
+            }
+            // Submitting only adds to the back of the queue, so the statement being run isn't moved
+            lock.unlock();
+            bool finished = session->fiber->resume();
+            lock.lock();
+
+            if (finished) {
+                session->tasks.pop_front();
+                if (_fibers.size() < IDLE_FIBERS) {
+                    _fibers.push_back(std::move(session->fiber));
+                } else {
+                    session->fiber.reset();
+                }
+            }
+        }
+
+        if (!session->tasks.empty()) {
+            // Behind every session which was waiting, however much this one has left to do
+            _queue.push_back(session);
+        } else {
+            session->scheduled = false;
+            if (session->closed) {
+                _sessions.erase(session->id);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sets the session's fiber to run the statement at the front of its tasks
+ */
+void Scheduler::start(Session &session) {
+    Task &task = session.tasks.front();
+    session.fiber->start([this, &session, &task] () {
+        Executor &executor = session.executor;
+        uint64_t slice = std::min(_options.slice, _options.fuel);
+        session.fuel = _options.fuel - slice;
+        executor.setFuelBudget(slice);
+        try {
+            task.statement->accept(executor);
+        } catch (...) {
+            task.result.set_exception(std::current_exception());
+            return;
+        }
+        if (executor.hasResult()) {
+            task.result.set_value(executor.lastResult());
+        } else {
+            // The executor refers to the definition, so it has to outlive the session
+            session.definitions.push_back(std::move(task.statement));
+            task.result.set_value(std::nullopt);
+        }
+    });
+}
+
+/**
+ * @brief Called when a statement has used its slice, gives its turn to the next session before carrying on
+ *
+ * @return uint64_t Fuel for the next slice, or 0 to stop the statement
+ */
+uint64_t Scheduler::checkpoint(Session &session) {
+    if (session.fuel == 0) {
+        return 0;
+    }
+    session.fiber->yield();
+    if (_stopping) {
+        return 0;
+    }
+    uint64_t slice = std::min(_options.slice, session.fuel);
+    session.fuel -= slice;
+    return slice;
+}
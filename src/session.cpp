@@ -0,0 +1,154 @@
+#include "session.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    VMOptions cachingConstants(VMOptions options) {
+        options.cacheConstants = true;
+        return options;
+    }
+}
+
+/**
+ * @brief Construct a new session with nothing defined
+ *
+ * @param options Options of the virtual machine statements are run on, which always caches constants
+ */
+Session::Session(const VMOptions &options): NodeVisitor(), _vm(cachingConstants(options)), _recomputed(0),
+    _lastResult(0.0), _hasResult(false) {
+}
+
+/**
+ * @brief Evaluates a statement and keeps it, so it's recomputed whenever something it uses is redefined
+ *
+ * If evaluating it throws, the statement is still kept, and may evaluate once a later definition is made.
+ *
+ * @param node Statement to evaluate, which doesn't need to outlive the call
+ */
+void Session::visit(ExprStmtNode *node) {
+    size_t index = _formulas.size();
+    Formula &formula = _formulas.emplace_back();
+    formula.expression = node->expression()->clone();
+    for (const std::string &name : collectNames(formula.expression.get())) {
+        _readers[name].push_back(index);
+    }
+
+    _updated.clear();
+    _hasResult = false;
+    recompute(formula);
+    if (formula.error) {
+        std::rethrow_exception(formula.error);
+    }
+    _lastResult = formula.value;
+    _hasResult = true;
+}
+
+/**
+ * @brief Makes a definition and recomputes every kept statement which depends on it
+ *
+ * Statements are recomputed in the order they were made, errors are kept rather than thrown.
+ *
+ * @param node Definition, which must outlive the session as with the virtual machine
+ */
+void Session::visit(FuncDefNode *node) {
+    _vm.visit(node);
+
+    const std::string &name = node->name();
+    for (const std::string &callee : _calls[name]) {
+        _callers[callee].erase(name);
+    }
+    std::unordered_set<std::string> calls = collectNames(node->expression());
+    for (const std::string &param : node->paramNames()) {
+        calls.erase(param);
+    }
+    for (const std::string &callee : calls) {
+        _callers[callee].insert(name);
+    }
+    _calls[name] = std::move(calls);
+
+    // Definitions which call this one, even indirectly, have changed too
+    std::vector<std::string> changed = { name };
+    std::unordered_set<std::string> seen = { name };
+    for (size_t i = 0; i < changed.size(); i++) {
+        auto callers = _callers.find(changed[i]);
+        if (callers == _callers.end()) {
+            continue;
+        }
+        for (const std::string &caller : callers->second) {
+            if (seen.insert(caller).second) {
+                changed.push_back(caller);
+            }
+        }
+    }
+
+    _updated.clear();
+    for (const std::string &changedName : changed) {
+        auto readers = _readers.find(changedName);
+        if (readers != _readers.end()) {
+            _updated.insert(_updated.end(), readers->second.begin(), readers->second.end());
+        }
+    }
+    std::sort(_updated.begin(), _updated.end());
+    _updated.erase(std::unique(_updated.begin(), _updated.end()), _updated.end());
+    for (size_t formula : _updated) {
+        recompute(_formulas[formula]);
+    }
+    _hasResult = false;
+}
+
+double Session::lastResult() const {
+    return _lastResult;
+}
+
+bool Session::hasResult() const {
+    return _hasResult;
+}
+
+size_t Session::formulas() const {
+    return _formulas.size();
+}
+
+/**
+ * @brief Gets the current result of a kept statement
+ *
+ * @param formula Index of the statement, in the order they were made
+ * @return double Result as of the latest definitions
+ * @throws std::runtime_error The error the statement last evaluated to
+ */
+double Session::value(size_t formula) const {
+    const Formula &kept = _formulas.at(formula);
+    if (kept.error) {
+        std::rethrow_exception(kept.error);
+    }
+    return kept.value;
+}
+
+/**
+ * @brief Gets the statements recomputed by the last definition
+ *
+ * @return const std::vector<size_t>& Indices of the statements, in order
+ */
+const std::vector<size_t> &Session::updated() const {
+    return _updated;
+}
+
+/**
+ * @brief Counts how many times statements have been evaluated, including when they were first made
+ *
+ * @return size_t Number of evaluations
+ */
+size_t Session::recomputed() const {
+    return _recomputed;
+}
+
+void Session::recompute(Formula &formula) {
+    _recomputed++;
+    try {
+        formula.value = _vm.evaluate(formula.expression.get());
+        formula.error = nullptr;
+    } catch (std::runtime_error &) {
+        formula.error = std::current_exception();
+    }
+}
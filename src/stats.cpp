@@ -0,0 +1,28 @@
+#include "stats.hpp"
+#include <algorithm>
+
+using namespace quickcalc;
+
+/**
+ * @brief Adds the counters of another phase, or of another run, keeping the higher peak
+ */
+Stats &Stats::operator+=(const Stats &other) {
+    tokens += other.tokens;
+    nodes += other.nodes;
+    statePushes += other.statePushes;
+    statePops += other.statePops;
+    lookups += other.lookups;
+    lookupHops += other.lookupHops;
+    valuePeak = std::max(valuePeak, other.valuePeak);
+    return *this;
+}
+
+void Stats::print(std::ostream &stream) const {
+    stream << "Tokens read: " << tokens << "\n"
+           << "Nodes parsed: " << nodes << "\n"
+           << "States pushed: " << statePushes << "\n"
+           << "States popped: " << statePops << "\n"
+           << "Names looked up: " << lookups << "\n"
+           << "Parent states walked: " << lookupHops << "\n"
+           << "Most values on the stack: " << valuePeak << "\n";
+}
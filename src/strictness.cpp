@@ -0,0 +1,172 @@
+#include "strictness.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+#include <algorithm>
+
+using namespace quickcalc;
+
+/**
+ * @brief Construct a new strictness analysis
+ * 
+ * @param symbols Global names, used to resolve names the same way the compiler does
+ * @param lookup Gives the strictness of functions being called
+ */
+Strictness::Strictness(SymbolTable &symbols, const Lookup &lookup):
+    _symbols(symbols), _lookup(lookup), _paramNames(nullptr), _impure(false), _result(0) {
+}
+
+/**
+ * @brief Finds which parameters of a definition are evaluated whenever it's called
+ * 
+ * Those parameters can be evaluated before the call without changing the result.
+ * 
+ * @param node Definition to analyse
+ * @return StrictMask Parameters which are always evaluated
+ */
+StrictMask Strictness::analyse(FuncDefNode *node) {
+    return analyse(node->expression(), node->paramNames());
+}
+
+StrictMask Strictness::analyse(ExprNode *node, const std::vector<std::string> &paramNames) {
+    _paramNames = &paramNames;
+    _callees.clear();
+    _impure = false;
+    return evaluated(node);
+}
+
+/**
+ * @brief Globals called by the last expression analysed
+ */
+const std::vector<int32_t> &Strictness::callees() const {
+    return _callees;
+}
+
+/**
+ * @brief Whether the last expression analysed calls a native function which isn't pure itself
+ */
+bool Strictness::impure() const {
+    return _impure;
+}
+
+void Strictness::visit(ConstNode *) {
+    _result = 0;
+}
+
+void Strictness::visit(UnaryOperationNode *node) {
+    _result = evaluated(node->value());
+}
+
+void Strictness::visit(BinaryOperationNode *node) {
+    // Long chains lean right, so walk down them iteratively
+    StrictMask result = 0;
+    ExprNode *rhs = node;
+    while (auto *binary = dynamic_cast<BinaryOperationNode *>(rhs)) {
+        result |= evaluated(binary->lhs());
+        rhs = binary->rhs();
+    }
+    _result = result | evaluated(rhs);
+}
+
+void Strictness::visit(FunctionInvocationNode *node) {
+    const std::vector<ExprNode::ptr> &params = node->params();
+    Binding binding = _symbols.resolve(*_paramNames, node->name());
+    StrictMask result = 0;
+    switch (binding.kind) {
+    case BindingKind::PARAMETER:
+        if (binding.index < 64) {
+            result = StrictMask(1) << binding.index;
+        }
+        break;
+    case BindingKind::BUILTIN:
+        switch (static_cast<Builtin>(binding.index)) {
+        case Builtin::IF:
+            if (params.size() == 2) {
+                // The condition is the result when false
+                result = evaluated(params[0].get());
+                evaluated(params[1].get());
+            } else if (params.size() > 2) {
+                result = evaluated(params[0].get())
+                         | (evaluated(params[1].get()) & evaluated(params[2].get()));
+            }
+            break;
+        case Builtin::EQ:
+        case Builtin::NE:
+        case Builtin::GT:
+        case Builtin::LT:
+        case Builtin::GE:
+        case Builtin::LE:
+            if (params.size() >= 2) {
+                result = evaluated(params[0].get()) | evaluated(params[1].get());
+            }
+            break;
+        case Builtin::SUM:
+        case Builtin::PROD:
+        case Builtin::MINOF:
+        case Builtin::MAXOF:
+        case Builtin::FOLD:
+            result = loop(static_cast<Builtin>(binding.index), params);
+            break;
+        default:
+            break;
+        }
+        break;
+    case BindingKind::NATIVE:
+        // Native functions take evaluated arguments, so evaluate every one
+        _impure = _impure || !nativeFunction(binding.index).pure;
+        for (const ExprNode::ptr &param : params) {
+            result |= evaluated(param.get());
+        }
+        break;
+    case BindingKind::GLOBAL: {
+        if (std::find(_callees.begin(), _callees.end(), binding.index) == _callees.end()) {
+            _callees.push_back(binding.index);
+        }
+        StrictMask callee = _symbols.isDefined(binding.index) ? _lookup(binding.index) : 0;
+        for (size_t i = 0; i < params.size(); i++) {
+            // Still visited so every callee is recorded
+            StrictMask arg = evaluated(params[i].get());
+            if (i < 64 && (callee & (StrictMask(1) << i))) {
+                result |= arg;
+            }
+        }
+        break;
+    }
+    }
+    _result = result;
+}
+
+void Strictness::visit(SharedExprNode *node) {
+    _result = evaluated(node->value());
+}
+
+/**
+ * @brief Finds what a loop always evaluates, which is its bounds and initial value but not its body
+ * 
+ * The range may be empty, but the body is still visited so every callee is recorded, with the names
+ * the loop binds shadowing parameters.
+ */
+StrictMask Strictness::loop(Builtin builtin, const std::vector<ExprNode::ptr> &params) {
+    LoopCall loop;
+    if (!tryGetLoop(builtin, params, loop)) {
+        return 0;
+    }
+    StrictMask result = evaluated(loop.lo) | evaluated(loop.hi);
+    if (loop.init) {
+        result |= evaluated(loop.init);
+    }
+    const std::vector<std::string> *paramNames = _paramNames;
+    std::vector<std::string> scope = *paramNames;
+    scope.push_back(*loop.index);
+    if (loop.accumulator) {
+        scope.push_back(*loop.accumulator);
+    }
+    _paramNames = &scope;
+    evaluated(loop.body);
+    _paramNames = paramNames;
+    return result;
+}
+
+StrictMask Strictness::evaluated(ExprNode *node) {
+    node->accept(*this);
+    return _result;
+}
@@ -0,0 +1,85 @@
+#include "symbols.hpp"
+#include "concepts.hpp"
+#include "natives.hpp"
+
+using namespace quickcalc;
+
+/**
+ * @brief Binds a name to what it refers to within a function
+ * 
+ * Parameters shadow user definitions, which in turn shadow builtins and native functions.
+ * Any other name is bound to a global slot, which may be defined later.
+ * 
+ * @param paramNames Parameters of the function the name is used in
+ * @param name Name to resolve
+ * @return Binding What the name refers to
+ */
+Binding SymbolTable::resolve(const std::vector<std::string> &paramNames, const std::string &name) {
+    // Later parameters shadow earlier ones of the same name
+    for (int i = static_cast<int>(paramNames.size()) - 1; i >= 0; i--) {
+        if (paramNames[i] == name) {
+            return { BindingKind::PARAMETER, i };
+        }
+    }
+
+    if (!isDefined(name)) {
+        Builtin builtin;
+        int32_t native;
+        if (tryGetBuiltin(name, builtin)) {
+            return { BindingKind::BUILTIN, static_cast<int>(builtin) };
+        } else if (tryGetNative(name, native)) {
+            return { BindingKind::NATIVE, native };
+        }
+    }
+
+    return { BindingKind::GLOBAL, slot(name) };
+}
+
+/**
+ * @brief Gets the global slot for a name, allocating one if the name hasn't been seen before
+ * 
+ * @param name Name to look up
+ * @return int Index of the slot, stable for the lifetime of the table
+ */
+int SymbolTable::slot(const std::string &name) {
+    auto it = _slots.find(name);
+    if (it != _slots.end()) {
+        return it->second;
+    }
+    int slot = static_cast<int>(_names.size());
+    _slots.emplace(name, slot);
+    _names.push_back(name);
+    _defined.push_back(false);
+    return slot;
+}
+
+bool SymbolTable::tryGetSlot(const std::string &name, int &slot) const {
+    auto it = _slots.find(name);
+    if (it != _slots.end()) {
+        slot = it->second;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+const std::string &SymbolTable::name(int slot) const {
+    return _names[slot];
+}
+
+size_t SymbolTable::size() const {
+    return _names.size();
+}
+
+void SymbolTable::define(int slot) {
+    _defined[slot] = true;
+}
+
+bool SymbolTable::isDefined(int slot) const {
+    return _defined[slot];
+}
+
+bool SymbolTable::isDefined(const std::string &name) const {
+    int slot;
+    return tryGetSlot(name, slot) && _defined[slot];
+}
@@ -0,0 +1,579 @@
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "concepts.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    // Rows in each chunk of a batch shared between workers, a multiple of the rows evaluated at once
+    constexpr size_t MIN_BATCH_CHUNK = 4096;
+    constexpr size_t MAX_BATCH_CHUNK = 65536;
+}
+
+VM::VM(): VM(VMOptions()) {
+}
+
+VM::VM(size_t stackSize): VM(VMOptions { ArgumentMode::BY_NAME, stackSize }) {
+}
+
+/**
+ * @brief Construct a new bytecode virtual machine
+ * 
+ * @param options How arguments are passed and how much to preallocate
+ */
+VM::VM(const VMOptions &options): NodeVisitor(), _options(options), _generation(1), _context(options),
+    _lastResult(0.0), _hasResult(false) {
+}
+
+void VM::visit(ExprStmtNode *node) {
+    _lastResult = evaluate(node->expression());
+    _hasResult = true;
+}
+
+void VM::visit(FuncDefNode *node) {
+    int32_t slot = _symbols.slot(node->name());
+    Builtin builtin;
+    int32_t native;
+    bool replacesBuiltin = !_symbols.isDefined(slot)
+                           && (tryGetBuiltin(node->name(), builtin) || tryGetNative(node->name(), native));
+    _symbols.define(slot);
+    resizeGlobals();
+    _globals[slot].node = node;
+
+    Strictness analysis(_symbols, [] (int32_t) { return StrictMask(0); });
+    if (replacesBuiltin) {
+        // Code compiled so far may have inlined the builtin being replaced
+        for (size_t i = 0; i < _globals.size(); i++) {
+            Global &global = _globals[i];
+            reset(i);
+            if (global.node) {
+                analysis.analyse(global.node);
+                global.callees = analysis.callees();
+                global.impure = analysis.impure();
+            }
+        }
+        resizeGlobals();
+    } else {
+        analysis.analyse(node);
+        _globals[slot].callees = analysis.callees();
+        _globals[slot].impure = analysis.impure();
+        resizeGlobals();
+        invalidate(slot);
+    }
+
+    // Anything linked before may now reach a different set of definitions
+    _generation++;
+    _hasResult = false;
+}
+
+/**
+ * @brief Compiles and runs an expression
+ * 
+ * @param node Expression to evaluate, doesn't need to outlive the call
+ * @return double Result of the expression
+ */
+double VM::evaluate(ExprNode *node) {
+    Function script = prepare(node);
+    return run(script);
+}
+
+/**
+ * @brief Compiles an expression so it can be evaluated many times
+ * 
+ * @param node Expression to compile, doesn't need to outlive the call
+ * @return Function Compiled expression
+ */
+Function VM::prepare(ExprNode *node) {
+    Compiler compiler = makeCompiler();
+    Function script = compiler.compile(node);
+    resizeGlobals();
+    link(script.globals);
+    return script;
+}
+
+/**
+ * @brief Runs an expression compiled by prepare
+ * 
+ * Nothing is allocated unless the stacks need to grow, or a definition has changed since the last run.
+ * 
+ * @param script Compiled expression
+ * @return double Result of the expression
+ */
+double VM::evaluate(const Function &script) {
+    link(script.globals);
+    return run(script);
+}
+
+/**
+ * @brief Compiles an expression to be evaluated over many rows at once
+ * 
+ * @param node Expression to compile, doesn't need to outlive the call
+ * @param columns Names which refer to a column of inputs rather than a definition
+ * @return BatchProgram Compiled expression
+ */
+BatchProgram VM::prepare(ExprNode *node, const std::vector<std::string> &columns) {
+    BatchCompiler compiler(_symbols, [this] (int32_t slot) { return strictness(slot); });
+    BatchProgram program = compiler.compile(node, columns);
+    resizeGlobals();
+    link(program.globals);
+    return program;
+}
+
+/**
+ * @brief Runs an expression compiled by prepare for every row of its columns
+ * 
+ * Results match evaluating the expression for each row with its columns as arguments.
+ * 
+ * @param program Compiled expression
+ * @param columns Input for each column the program was compiled with, in the same order
+ * @param rows Number of values in each column
+ * @param results Output with space for a value per row
+ */
+void VM::evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                  double *results) {
+    link(program.globals);
+    BatchEvaluator evaluator([this] (int32_t callee, const double *args, size_t count) {
+        return call(callee, args, count);
+    });
+    evaluator.evaluate(program, columns, rows, results);
+}
+
+/**
+ * @brief Runs an expression compiled by prepare for every row of its columns, sharing the rows between workers
+ * 
+ * Every worker evaluates its chunks of rows with its own registers, and calls defined functions in its own
+ * execution context, writing straight into its part of results. Only the calling thread uses memo caches.
+ * Results are the same as evaluating on a single thread.
+ * 
+ * @param program Compiled expression
+ * @param columns Input for each column the program was compiled with, in the same order
+ * @param rows Number of values in each column
+ * @param results Output with space for a value per row
+ * @param pool Workers to share the rows between, only one batch may run on it at a time
+ */
+void VM::evaluate(const BatchProgram &program, const std::vector<const double *> &columns, size_t rows,
+                  double *results, WorkerPool &pool) {
+    size_t chunk = std::clamp(rows / (pool.size() * 16), MIN_BATCH_CHUNK, MAX_BATCH_CHUNK);
+    if (pool.size() == 1 || rows <= chunk) {
+        evaluate(program, columns, rows, results);
+        return;
+    }
+    // Everything the workers need is compiled and analysed up front, so they only ever read it
+    link(program.globals);
+    bool byNeed = _options.arguments == ArgumentMode::BY_NEED;
+    std::vector<StrictMask> strict(_code.size());
+    for (const BatchCall &call : program.calls) {
+        strict[call.callee] = byNeed ? strictness(call.callee) : 0;
+    }
+
+    std::vector<ExecutionContext *> contexts = { &_context };
+    VMOptions workerOptions = _options;
+    workerOptions.memoEntries = 0;
+    workerOptions.cacheConstants = false;
+    // Rows are already shared between threads, so loops in them aren't split further
+    workerOptions.loopWorkers = 1;
+    while (_workers.size() + 1 < pool.size()) {
+        _workers.push_back(std::make_unique<ExecutionContext>(workerOptions));
+    }
+    for (size_t worker = 1; worker < pool.size(); worker++) {
+        contexts.push_back(_workers[worker - 1].get());
+    }
+
+    std::vector<BatchEvaluator> evaluators;
+    std::vector<std::vector<const double *>> offsets(pool.size(), columns);
+    evaluators.reserve(pool.size());
+    for (ExecutionContext *context : contexts) {
+        evaluators.emplace_back([this, context, byNeed, &strict] (int32_t callee, const double *args, size_t count) {
+            return context->call(_code, byNeed, callee, strict[callee], args, count);
+        });
+    }
+    pool.run(rows, chunk, [&] (size_t worker, size_t begin, size_t end) {
+        std::vector<const double *> &offset = offsets[worker];
+        for (size_t i = 0; i < columns.size(); i++) {
+            offset[i] = columns[i] + begin;
+        }
+        evaluators[worker].evaluate(program, offset, end - begin, results + begin);
+    });
+}
+
+double VM::lastResult() const {
+    return _lastResult;
+}
+
+bool VM::hasResult() const {
+    return _hasResult;
+}
+
+bool VM::isDefined(const std::string &name) const {
+    return _symbols.isDefined(name);
+}
+
+/**
+ * @brief Finds which parameters of a definition are always evaluated when it's called
+ * 
+ * @param name Name of a defined function
+ * @return StrictMask Bit i is set if parameter i is always evaluated
+ */
+StrictMask VM::strictness(const std::string &name) {
+    int slot;
+    if (!_symbols.tryGetSlot(name, slot) || !_symbols.isDefined(slot)) {
+        throw std::logic_error("Couldn't find function " + name);
+    }
+    return strictness(slot);
+}
+
+/**
+ * @brief Drops compiled code and analysis which depend on a definition
+ * 
+ * @param slot Global slot of the definition which changed
+ */
+void VM::invalidate(int32_t slot) {
+    std::vector<bool> invalid(_globals.size());
+    invalid[slot] = true;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < _globals.size(); i++) {
+            if (invalid[i] || !_globals[i].node) {
+                continue;
+            }
+            for (int32_t callee : _globals[i].callees) {
+                if (invalid[callee]) {
+                    invalid[i] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < _globals.size(); i++) {
+        if (invalid[i]) {
+            reset(i);
+        }
+    }
+}
+
+void VM::reset(size_t slot) {
+    _code[slot] = Code();
+    _globals[slot].nativeKnown = false;
+    _globals[slot].strictKnown = false;
+}
+
+/**
+ * @brief Checks whether a function's results can be cached by its arguments
+ * 
+ * Functions have no side effects and only see their own parameters, so a function can be memoized
+ * as long as every argument is evaluated before it's called, and nothing it calls is a native function
+ * which isn't pure. Definitions without parameters always can be, and are when caching constants.
+ * 
+ * @param slot Global slot of a defined function
+ * @return true Calls to the function can be memoized
+ */
+bool VM::memoizable(int32_t slot) {
+    if (reachesImpure(slot)) {
+        return false;
+    }
+    if (_options.cacheConstants && _globals[slot].node->paramNames().empty()) {
+        return true;
+    }
+    return _options.memoEntries > 0 && takesEvaluatedArgs(slot);
+}
+
+/**
+ * @brief Checks whether a function, or anything it calls, calls a native function which isn't pure
+ * 
+ * @param slot Global slot of a defined function
+ * @return true Results of the function may differ between calls with the same arguments
+ */
+bool VM::reachesImpure(int32_t slot) {
+    std::vector<bool> seen(_globals.size());
+    std::vector<int32_t> pending = { slot };
+    seen[slot] = true;
+    while (!pending.empty()) {
+        const Global &global = _globals[pending.back()];
+        pending.pop_back();
+        if (global.impure) {
+            return true;
+        }
+        for (int32_t callee : global.callees) {
+            if (!seen[callee]) {
+                seen[callee] = true;
+                pending.push_back(callee);
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks whether every call to a function evaluates all of its arguments first
+ * 
+ * @param slot Global slot of a defined function
+ * @return true The function never sees an argument which hasn't been evaluated
+ */
+bool VM::takesEvaluatedArgs(int32_t slot) {
+    size_t arity = _globals[slot].node->paramNames().size();
+    if (arity == 0) {
+        return true;
+    }
+    if (_options.arguments != ArgumentMode::BY_NEED || arity > 64) {
+        return false;
+    }
+    StrictMask all = arity == 64 ? ALL_STRICT : (StrictMask(1) << arity) - 1;
+    return (strictness(slot) & all) == all;
+}
+
+/**
+ * @brief Gets the memo cache counters of a definition, which restart whenever it's recompiled
+ * 
+ * @param name Name of a defined function
+ * @return MemoStats Counters, all zero if the function isn't memoized
+ */
+MemoStats VM::memoStats(const std::string &name) const {
+    int slot;
+    if (!_symbols.tryGetSlot(name, slot) || !_symbols.isDefined(slot)) {
+        throw std::logic_error("Couldn't find function " + name);
+    }
+    const MemoCache *memo = _code[slot].memo.get();
+    return memo ? memo->stats() : MemoStats();
+}
+
+/**
+ * @brief Checks whether a definition is currently compiled to machine code
+ * 
+ * Definitions are compiled when something which calls them is first run after they change.
+ * 
+ * @param name Name of a defined function
+ * @return true Calls to the function with evaluated arguments run natively
+ */
+bool VM::isNative(const std::string &name) const {
+    int slot;
+    if (!_symbols.tryGetSlot(name, slot) || !_symbols.isDefined(slot)) {
+        throw std::logic_error("Couldn't find function " + name);
+    }
+    return _code[slot].native != nullptr;
+}
+
+StrictMask VM::strictness(int32_t slot) {
+    if (_globals[slot].strictKnown) {
+        return _globals[slot].strict;
+    }
+
+    // Everything reachable which hasn't been analysed is solved together, as it may be mutually recursive
+    std::vector<int32_t> group = { slot };
+    std::vector<bool> inGroup(_globals.size());
+    inGroup[slot] = true;
+    for (size_t i = 0; i < group.size(); i++) {
+        for (int32_t callee : _globals[group[i]].callees) {
+            if (!inGroup[callee] && _symbols.isDefined(callee) && !_globals[callee].strictKnown) {
+                inGroup[callee] = true;
+                group.push_back(callee);
+            }
+        }
+    }
+
+    // Start by assuming everything is strict and weaken until nothing changes
+    for (int32_t member : group) {
+        _globals[member].strict = ALL_STRICT;
+    }
+    Strictness analysis(_symbols, [this] (int32_t callee) { return _globals[callee].strict; });
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int32_t member : group) {
+            StrictMask strict = analysis.analyse(_globals[member].node);
+            if (strict != _globals[member].strict) {
+                _globals[member].strict = strict;
+                changed = true;
+            }
+        }
+    }
+
+    for (int32_t member : group) {
+        _globals[member].strictKnown = true;
+    }
+    return _globals[slot].strict;
+}
+
+Compiler VM::makeCompiler() {
+    // Slots allocated while compiling aren't defined, and resolve as impure
+    Compiler::Purity pure = [this] (int32_t slot) {
+        return static_cast<size_t>(slot) < _globals.size() && _symbols.isDefined(slot) && !reachesImpure(slot);
+    };
+    if (_options.arguments == ArgumentMode::BY_NEED) {
+        return Compiler(_symbols, [this] (int32_t slot) { return strictness(slot); }, pure);
+    } else {
+        return Compiler(_symbols, nullptr, pure);
+    }
+}
+
+/**
+ * @brief Compiles every definition reachable from a function, so running it needs no lookups
+ * 
+ * Undefined names are all reported together, before anything is evaluated.
+ * 
+ * @param function Function about to be run
+ */
+void VM::link(const std::vector<int32_t> &globals) {
+    bool linked = true;
+    for (int32_t slot : globals) {
+        linked = linked && _globals[slot].linked == _generation;
+    }
+    if (linked) {
+        return;
+    }
+
+    std::vector<int32_t> pending(globals.begin(), globals.end());
+    std::vector<int32_t> reached;
+    std::vector<int32_t> undefined;
+    std::vector<bool> seen(_symbols.size());
+
+    // Breadth first, so undefined names are reported roughly in the order they're used
+    for (size_t i = 0; i < pending.size(); i++) {
+        int32_t slot = pending[i];
+        if (seen[slot]) {
+            continue;
+        }
+        seen[slot] = true;
+        if (!_symbols.isDefined(slot)) {
+            undefined.push_back(slot);
+            continue;
+        }
+        reached.push_back(slot);
+        if (_globals[slot].linked == _generation) {
+            continue;
+        }
+        const Function &callee = compile(slot);
+        seen.resize(_symbols.size());
+        pending.insert(pending.end(), callee.globals.begin(), callee.globals.end());
+    }
+
+    if (!undefined.empty()) {
+        std::string message = undefined.size() == 1 ? "Undefined function " : "Undefined functions ";
+        for (size_t i = 0; i < undefined.size(); i++) {
+            message += (i == 0 ? "" : ", ") + _symbols.name(undefined[i]);
+        }
+        throw CompileError(message);
+    }
+
+    if (_options.jit) {
+        compileNative(reached);
+    }
+    for (int32_t slot : reached) {
+        _globals[slot].linked = _generation;
+    }
+}
+
+/**
+ * @brief Gets the compiled code for a defined global, compiling it if needed
+ * 
+ * @param slot Global slot of the definition
+ * @return const Function& The compiled function
+ */
+const Function &VM::compile(int32_t slot) {
+    if (!_code[slot].function) {
+        Compiler compiler = makeCompiler();
+        auto function = std::make_unique<Function>(compiler.compile(_globals[slot].node));
+        // Compiling may have allocated slots for names not seen before
+        resizeGlobals();
+        _code[slot].function = std::move(function);
+        if (memoizable(slot)) {
+            size_t arity = _globals[slot].node->paramNames().size();
+            // Without parameters there's only ever one result to keep
+            _code[slot].memo = std::make_unique<MemoCache>(arity, arity == 0 ? 1 : _options.memoEntries);
+        }
+    }
+    return *_code[slot].function;
+}
+
+/**
+ * @brief Compiles functions to machine code where every call they make can run natively too
+ * 
+ * Native code is only entered with every argument evaluated, so functions which are lazy in any
+ * parameter are left to the interpreter, as are memoized functions. Calls which run out of native
+ * stack are interpreted again from the start, so functions reaching an impure native are too.
+ * 
+ * @param slots Globals which have been compiled to bytecode, those already considered are skipped
+ */
+void VM::compileNative(const std::vector<int32_t> &slots) {
+    if (!Jit::available()) {
+        return;
+    }
+
+    // Start by assuming everything new can be compiled and drop functions until nothing changes
+    std::vector<int32_t> group;
+    std::vector<bool> candidate(_globals.size());
+    for (int32_t slot : slots) {
+        Global &global = _globals[slot];
+        if (!global.nativeKnown) {
+            group.push_back(slot);
+            // Running out of native stack starts the outermost native call over, which mustn't be seen
+            candidate[slot] = !_code[slot].memo && takesEvaluatedArgs(slot) && !reachesImpure(slot)
+                && Jit::supports(*_code[slot].function);
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int32_t member : group) {
+            if (!candidate[member]) {
+                continue;
+            }
+            for (const CallSite &site : _code[member].function->callSites) {
+                const Global &callee = _globals[site.callee];
+                bool native = candidate[site.callee] || (callee.nativeKnown && _code[site.callee].native);
+                if (!native || site.args.size() < callee.node->paramNames().size()) {
+                    candidate[member] = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Native callers refer to each other's code, so it all has to exist before any is generated
+    for (int32_t member : group) {
+        if (candidate[member]) {
+            _code[member].native = std::make_unique<NativeCode>();
+        }
+        _globals[member].nativeKnown = true;
+    }
+    Jit jit([this] (int32_t slot) { return _code[slot].native.get(); });
+    bool compiled = true;
+    for (int32_t member : group) {
+        if (candidate[member]) {
+            compiled = compiled && jit.compile(*_code[member].function, member, *_code[member].native);
+        }
+    }
+    if (!compiled) {
+        for (int32_t member : group) {
+            _code[member].native.reset();
+        }
+    }
+}
+
+double VM::run(const Function &entry) {
+    return _context.run(entry, _code, _options.arguments == ArgumentMode::BY_NEED);
+}
+
+/**
+ * @brief Calls a linked function with arguments which have already been evaluated
+ * 
+ * @param slot Global slot of the function
+ * @param args Value of each argument
+ * @param count Number of arguments
+ * @return double Result of the call
+ */
+double VM::call(int32_t slot, const double *args, size_t count) {
+    bool byNeed = _options.arguments == ArgumentMode::BY_NEED;
+    return _context.call(_code, byNeed, slot, byNeed ? strictness(slot) : 0, args, count);
+}
+
+void VM::resizeGlobals() {
+    _globals.resize(_symbols.size());
+    _code.resize(_symbols.size());
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    std::atomic<size_t> allocations = 0;
+}
+
+// Replacing the global allocator lets the tests count every heap allocation made by the VM
+void *operator new(size_t size) {
+    allocations++;
+    void *memory = std::malloc(size == 0 ? 1 : size);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+class AllocationTest: public testing::TestWithParam<ArgumentMode> {
+    std::vector<StmtNode::ptr> vitalNodes;
+protected:
+    std::istringstream input;
+    Lexer lexer = Lexer(input);
+    Parser parser = Parser(lexer);
+
+    void define(VM &vm, const std::string &source) {
+        input.clear();
+        input.str(source);
+        vitalNodes.emplace_back(parser.parse())->accept(vm);
+    }
+};
+
+TEST_P(AllocationTest, RecursionDoesNotAllocateAfterWarmUp) {
+    VM vm(VMOptions { GetParam() });
+    define(vm, "let count(n) = if(le(n, 0), 0, 1 + count(n - 1))");
+
+    // Passing by name reevaluates the whole chain of arguments, so recurse less deeply
+    const double depth = GetParam() == ArgumentMode::BY_NEED ? 1000.0 : 100.0;
+    std::vector<ExprNode::ptr> params;
+    params.push_back(std::make_unique<ConstNode>(depth));
+    auto expr = std::make_unique<FunctionInvocationNode>("count", std::move(params));
+    Function script = vm.prepare(expr.get());
+    EXPECT_DOUBLE_EQ(vm.evaluate(script), depth);
+
+    size_t before = allocations;
+    double total = 0.0;
+    for (int i = 0; i < 1000; i++) {
+        total += vm.evaluate(script);
+    }
+    EXPECT_EQ(allocations - before, 0);
+    EXPECT_DOUBLE_EQ(total, depth * 1000.0);
+}
+
+INSTANTIATE_TEST_SUITE_P(allocation, AllocationTest, testing::Values(ArgumentMode::BY_NAME, ArgumentMode::BY_NEED));
@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "cse.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <random>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    const double SPECIAL[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, -2.5, 3.0, 1e300, -1e300, 4294967296.0, 2147483648.0, -2147483649.0,
+        INFINITY, -INFINITY, NAN, 0.1 + 0.2, 0.3, 5e-324, 1e-15, -1e-16,
+    };
+
+    // Columns x and y, with every pair of special values followed by random values
+    std::vector<std::vector<double>> makeColumns(size_t rows) {
+        std::vector<std::vector<double>> columns(2);
+        std::mt19937 random(42);
+        std::uniform_real_distribution<double> distribution(-8.0, 8.0);
+        for (size_t row = 0; row < rows; row++) {
+            size_t count = std::size(SPECIAL);
+            if (row < count * count) {
+                columns[0].push_back(SPECIAL[row / count]);
+                columns[1].push_back(SPECIAL[row % count]);
+            } else {
+                columns[0].push_back(std::round(distribution(random) * 4) / 4);
+                columns[1].push_back(distribution(random));
+            }
+        }
+        return columns;
+    }
+
+    // Evaluates the last statement of a script over columns, checking every row against the executor
+    void testAgainstExecutor(const std::string &source, ArgumentMode mode = ArgumentMode::BY_NEED, size_t rows = 1003) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        std::vector<StmtNode::ptr> nodes;
+        while (!input.eof()) {
+            nodes.push_back(parser.parse());
+        }
+        auto *formula = dynamic_cast<ExprStmtNode *>(nodes.back().get());
+        ASSERT_NE(formula, nullptr);
+
+        VM vm(VMOptions { mode });
+        Executor executor;
+        loadConcepts(executor.getState());
+        for (size_t i = 0; i + 1 < nodes.size(); i++) {
+            nodes[i]->accept(vm);
+            nodes[i]->accept(executor);
+        }
+
+        std::vector<std::vector<double>> columns = makeColumns(rows);
+        BatchProgram program = vm.prepare(formula->expression(), { "x", "y" });
+        std::vector<double> results(rows);
+        vm.evaluate(program, { columns[0].data(), columns[1].data() }, rows, results.data());
+
+        double x, y;
+        executor.getState().setFunction("x", [&x] (Executor &, const std::vector<ExprNode::ptr> &) { return x; });
+        executor.getState().setFunction("y", [&y] (Executor &, const std::vector<ExprNode::ptr> &) { return y; });
+        for (size_t row = 0; row < rows; row++) {
+            x = columns[0][row];
+            y = columns[1][row];
+            double expected = executor.evaluate(formula->expression());
+            ASSERT_PRED2(sameBits, results[row], expected) << source << " at x = " << x << ", y = " << y;
+        }
+    }
+}
+
+TEST(batch, Arithmetic) {
+    testAgainstExecutor("x + y");
+    testAgainstExecutor("x - y * 3");
+    testAgainstExecutor("(x - y) / (x + y)");
+    testAgainstExecutor("-x * -(y / 7) + PI");
+}
+
+TEST(batch, Bitwise) {
+    for (BinaryOperation operation : { BinaryOperation::AND, BinaryOperation::OR, BinaryOperation::XOR }) {
+        auto expr = std::make_unique<BinaryOperationNode>(
+            operation,
+            std::make_unique<FunctionInvocationNode>("x", std::vector<ExprNode::ptr>()),
+            std::make_unique<UnaryOperationNode>(
+                UnaryOperation::NOT, std::make_unique<FunctionInvocationNode>("y", std::vector<ExprNode::ptr>())
+            )
+        );
+        std::vector<std::vector<double>> columns = makeColumns(500);
+        VM vm;
+        Executor executor;
+        BatchProgram program = vm.prepare(expr.get(), { "x", "y" });
+        std::vector<double> results(500);
+        vm.evaluate(program, { columns[0].data(), columns[1].data() }, 500, results.data());
+        for (size_t row = 0; row < 500; row++) {
+            double x = columns[0][row];
+            double y = columns[1][row];
+            executor.getState().setFunction("x", [x] (Executor &, const std::vector<ExprNode::ptr> &) { return x; });
+            executor.getState().setFunction("y", [y] (Executor &, const std::vector<ExprNode::ptr> &) { return y; });
+            ASSERT_PRED2(sameBits, results[row], executor.evaluate(expr.get())) << x << ", " << y;
+        }
+    }
+}
+
+TEST(batch, Comparisons) {
+    testAgainstExecutor("eq(x, y) + ne(x, y) * 2 + gt(x, y) * 4 + lt(x, y) * 8 + ge(x, y) * 16 + le(x, y) * 32");
+    testAgainstExecutor("eq(x) + if(x)");
+}
+
+TEST(batch, LaneMasks) {
+    testAgainstExecutor("if(x, y, -y)");
+    testAgainstExecutor("if(gt(x, y), x, if(lt(x, 0), y))");
+    testAgainstExecutor("if(x, y) * if(ge(y, 0), 2, 3)");
+}
+
+TEST(batch, SharedExpressions) {
+    std::string source = "(x * y + 1) / (x * y + 1) + if(gt(x, 0), x * y + 1, 0)";
+    std::istringstream input(source);
+    Lexer lexer(input);
+    Parser parser(lexer);
+    StmtNode::ptr stmt = parser.parse();
+    CommonSubexpressions cse;
+    EXPECT_GT(cse.eliminate(stmt.get()), 0);
+
+    VM vm;
+    BatchProgram program = vm.prepare(static_cast<ExprStmtNode *>(stmt.get())->expression(), { "x", "y" });
+    EXPECT_GE(program.sharedSlots, 1);
+    std::vector<std::vector<double>> columns = makeColumns(100);
+    std::vector<double> results(100);
+    vm.evaluate(program, { columns[0].data(), columns[1].data() }, 100, results.data());
+    Executor executor;
+    loadConcepts(executor.getState());
+    for (size_t row = 0; row < 100; row++) {
+        double x = columns[0][row];
+        double y = columns[1][row];
+        executor.getState().setFunction("x", [x] (Executor &, const std::vector<ExprNode::ptr> &) { return x; });
+        executor.getState().setFunction("y", [y] (Executor &, const std::vector<ExprNode::ptr> &) { return y; });
+        // Running the statement rather than its expression clears the executor's shared values between rows
+        stmt->accept(executor);
+        ASSERT_PRED2(sameBits, results[row], executor.lastResult()) << x << ", " << y;
+    }
+}
+
+TEST(batch, UserFunctions) {
+    for (ArgumentMode mode : { ArgumentMode::BY_NAME, ArgumentMode::BY_NEED }) {
+        testAgainstExecutor("let sq(a) = a * a; let rate = 0.07; sq(x) * rate + sq(y)", mode);
+        testAgainstExecutor(
+            "let count(n) = if(le(n, 0), 0, 1 + count(n - 1)); if(lt(x, 100), if(ge(x, -100), count(x), -1), -2)", mode
+        );
+    }
+}
+
+TEST(batch, CallsOnlyMadeForRowsTakingTheBranch) {
+    // Calling loop would never return, or run out of memory
+    testAgainstExecutor("let loop(n) = 1 + loop(n); if(lt(x, x), loop(x), x) + if(FALSE, loop(y)) + if(TRUE, y, loop(x))");
+}
+
+TEST(batch, LazyArgumentWithCallThrows) {
+    std::istringstream input("let first(a, b) = a; let sq(a) = a * a; first(x, sq(y))");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    VM vm(VMOptions { ArgumentMode::BY_NEED });
+    StmtNode::ptr first = parser.parse();
+    StmtNode::ptr square = parser.parse();
+    first->accept(vm);
+    square->accept(vm);
+    StmtNode::ptr stmt = parser.parse();
+    EXPECT_THROW(vm.prepare(static_cast<ExprStmtNode *>(stmt.get())->expression(), { "x", "y" }), CompileError);
+}
+
+TEST(batch, UndefinedFunctionThrows) {
+    auto expr = std::make_unique<FunctionInvocationNode>("missing", std::vector<ExprNode::ptr>());
+    VM vm;
+    EXPECT_THROW(vm.prepare(expr.get(), { "x" }), CompileError);
+}
+
+TEST(batch, KernelsNamed) {
+    std::string kernels = BatchEvaluator::kernels();
+    EXPECT_TRUE(kernels == "avx" || kernels == "sse2" || kernels == "scalar") << kernels;
+}
+
+TEST(batch, WorkersMatchSingleThread) {
+    std::istringstream input("let poly(a) = if(lt(a, 0), -a, a * a - 1); poly(x) * 3 - if(gt(y, 0), poly(y), y)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    StmtNode::ptr def = parser.parse();
+    StmtNode::ptr stmt = parser.parse();
+    VM vm(VMOptions { ArgumentMode::BY_NEED });
+    def->accept(vm);
+    BatchProgram program = vm.prepare(static_cast<ExprStmtNode *>(stmt.get())->expression(), { "x", "y" });
+
+    size_t rows = 100003;
+    std::vector<std::vector<double>> columns = makeColumns(rows);
+    std::vector<double> expected(rows);
+    std::vector<double> results(rows);
+    vm.evaluate(program, { columns[0].data(), columns[1].data() }, rows, expected.data());
+    WorkerPool pool(4);
+    for (int repeat = 0; repeat < 3; repeat++) {
+        std::fill(results.begin(), results.end(), 0.0);
+        vm.evaluate(program, { columns[0].data(), columns[1].data() }, rows, results.data(), pool);
+        for (size_t row = 0; row < rows; row++) {
+            ASSERT_PRED2(sameBits, results[row], expected[row]) << "row " << row;
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include "compilecache.hpp"
+#include "compiler.hpp"
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+TEST(compilecache, SameSourceSharesProgram) {
+    CompileCache cache(1 << 20);
+    auto first = cache.get("let sq(x) = x * x; sq(3) + 1");
+    auto second = cache.get("let sq(x) = x * x; sq(3) + 1");
+    auto other = cache.get("let sq(x) = x * x; sq(4) + 1");
+    EXPECT_EQ(first, second);
+    EXPECT_NE(first, other);
+
+    ExecutionContext context;
+    EXPECT_DOUBLE_EQ(first->evaluate(context, 0), 10.0);
+    EXPECT_DOUBLE_EQ(other->evaluate(context, 0), 17.0);
+    EXPECT_DOUBLE_EQ(first->call(context, first->function("sq"), { 5.0 }), 25.0);
+
+    CompileCacheStats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.evictions, 0);
+    EXPECT_EQ(stats.entries, 2);
+    EXPECT_GT(stats.bytes, 0);
+}
+
+TEST(compilecache, EvictsLeastRecentlyUsed) {
+    // One shard, so every source competes for the same space
+    size_t bytes;
+    {
+        CompileCache probe(1 << 20, VMOptions(), 1);
+        probe.get("1 + 0");
+        bytes = probe.stats().bytes;
+    }
+    CompileCache cache(bytes * 3 + bytes / 2, VMOptions(), 1);
+    cache.get("1 + 0");
+    cache.get("1 + 1");
+    cache.get("1 + 2");
+    // Using the first again makes the second the oldest
+    cache.get("1 + 0");
+    cache.get("1 + 3");
+    CompileCacheStats stats = cache.stats();
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_EQ(stats.entries, 3);
+    EXPECT_LE(stats.bytes, bytes * 3 + bytes / 2);
+
+    cache.get("1 + 0");
+    EXPECT_EQ(cache.stats().hits, 2);
+    cache.get("1 + 1");
+    EXPECT_EQ(cache.stats().misses, 5);
+
+    // Programs handed out outlive being evicted
+    auto held = cache.get("1 + 2");
+    cache.clear();
+    ExecutionContext context;
+    EXPECT_DOUBLE_EQ(held->evaluate(context, 0), 3.0);
+    EXPECT_EQ(cache.stats().entries, 0);
+}
+
+TEST(compilecache, ErrorsAreNotCached) {
+    CompileCache cache(1 << 20);
+    EXPECT_THROW(cache.get("1 +"), std::runtime_error);
+    EXPECT_THROW(cache.get("missing(1)"), CompileError);
+    EXPECT_THROW(cache.get("missing(1)"), CompileError);
+    EXPECT_EQ(cache.stats().misses, 3);
+    EXPECT_EQ(cache.stats().entries, 0);
+}
+
+TEST(compilecache, SharedBetweenThreads) {
+    CompileCache cache(1 << 20, VMOptions(), 4);
+    std::vector<std::thread> threads;
+    std::vector<double> totals(4);
+    for (size_t thread = 0; thread < totals.size(); thread++) {
+        threads.emplace_back([&cache, &totals, thread] () {
+            ExecutionContext context;
+            for (int i = 0; i < 1000; i++) {
+                auto program = cache.get("let f(x) = x * 2; f(" + std::to_string(i % 10) + ")");
+                totals[thread] += program->evaluate(context, 0);
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    for (double total : totals) {
+        EXPECT_DOUBLE_EQ(total, 9000.0);
+    }
+    CompileCacheStats stats = cache.stats();
+    EXPECT_EQ(stats.hits + stats.misses, 4000);
+    EXPECT_EQ(stats.entries, 10);
+    EXPECT_LE(stats.misses, 40);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include "compiler.hpp"
+
+using namespace quickcalc;
+
+namespace {
+    std::vector<OpCode> opcodes(const Function &function) {
+        std::vector<OpCode> result;
+        for (const Instruction &instruction : function.code) {
+            result.push_back(instruction.opcode);
+        }
+        return result;
+    }
+}
+
+TEST(compiler, ConstantCompilesToConst) {
+    auto expr = std::make_unique<ConstNode>(1.0);
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(expr.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::CONST, OpCode::RETURN }));
+    EXPECT_EQ(function.constants, std::vector<double>({ 1.0 }));
+    EXPECT_EQ(function.maxStack, 1);
+}
+
+TEST(compiler, BinaryOperationIsPostfix) {
+    auto expr = std::make_unique<BinaryOperationNode>(
+        BinaryOperation::SUBTRACT,
+        std::make_unique<ConstNode>(1.0),
+        std::make_unique<ConstNode>(2.0)
+    );
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(expr.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::CONST, OpCode::CONST, OpCode::SUBTRACT, OpCode::RETURN }));
+    EXPECT_EQ(function.maxStack, 2);
+}
+
+TEST(compiler, BitwiseChainsStayIntegers) {
+    // (a & 3) | ~b converts each parameter once and the result once, and 3 is an integer already
+    auto body = std::make_unique<BinaryOperationNode>(
+        BinaryOperation::OR,
+        std::make_unique<BinaryOperationNode>(
+            BinaryOperation::AND,
+            std::make_unique<FunctionInvocationNode>("a", std::vector<ExprNode::ptr>()),
+            std::make_unique<ConstNode>(3.0)
+        ),
+        std::make_unique<UnaryOperationNode>(
+            UnaryOperation::NOT,
+            std::make_unique<FunctionInvocationNode>("b", std::vector<ExprNode::ptr>())
+        )
+    );
+    auto stmt = std::make_unique<FuncDefNode>("foo", std::move(body), std::vector<std::string>({ "a", "b" }));
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(stmt.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({
+        OpCode::ARG, OpCode::TO_INTEGER, OpCode::INTEGER, OpCode::AND, OpCode::ARG, OpCode::TO_INTEGER, OpCode::NOT,
+        OpCode::OR, OpCode::TO_DOUBLE, OpCode::RETURN
+    }));
+    EXPECT_EQ(function.code[2].operand, 3);
+    EXPECT_EQ(function.maxStack, 2);
+}
+
+TEST(compiler, ParameterCompilesToArg) {
+    auto stmt = std::make_unique<FuncDefNode>(
+        "foo",
+        std::make_unique<FunctionInvocationNode>("b", std::vector<ExprNode::ptr>()),
+        std::vector<std::string>({ "a", "b" })
+    );
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(stmt.get());
+    ASSERT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::ARG, OpCode::RETURN }));
+    EXPECT_EQ(function.code[0].operand, 1);
+}
+
+TEST(compiler, CallCompilesArgumentsAfterBody) {
+    std::vector<ExprNode::ptr> params;
+    params.push_back(std::make_unique<ConstNode>(2.0));
+    auto expr = std::make_unique<FunctionInvocationNode>("foo", std::move(params));
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(expr.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::CALL, OpCode::RETURN, OpCode::CONST, OpCode::RETURN }));
+    ASSERT_EQ(function.callSites.size(), 1);
+    EXPECT_EQ(function.callSites[0].callee, symbols.slot("foo"));
+    EXPECT_EQ(function.globals, std::vector<int32_t>({ symbols.slot("foo") }));
+    EXPECT_EQ(function.callSites[0].args, std::vector<int32_t>({ 2 }));
+}
+
+TEST(compiler, BuiltinCompilesInline) {
+    auto expr = std::make_unique<FunctionInvocationNode>("PI", std::vector<ExprNode::ptr>());
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Function function = compiler.compile(expr.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::CONST, OpCode::RETURN }));
+    EXPECT_DOUBLE_EQ(function.constants[0], QC_PI);
+}
+
+TEST(compiler, UserDefinitionShadowsBuiltin) {
+    auto expr = std::make_unique<FunctionInvocationNode>("PI", std::vector<ExprNode::ptr>());
+    SymbolTable symbols;
+    symbols.define(symbols.slot("PI"));
+    Compiler compiler(symbols);
+    Function function = compiler.compile(expr.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::TAIL_CALL, OpCode::RETURN }));
+}
+
+TEST(compiler, ResolvesParameterBeforeGlobal) {
+    SymbolTable symbols;
+    symbols.define(symbols.slot("x"));
+    Compiler compiler(symbols);
+    auto stmt = std::make_unique<FuncDefNode>(
+        "foo",
+        std::make_unique<FunctionInvocationNode>("x", std::vector<ExprNode::ptr>()),
+        std::vector<std::string>({ "x" })
+    );
+    Function function = compiler.compile(stmt.get());
+    EXPECT_EQ(opcodes(function), std::vector<OpCode>({ OpCode::ARG, OpCode::RETURN }));
+    EXPECT_TRUE(function.globals.empty());
+}
+
+TEST(compiler, ResolvesUnknownNameToNewGlobal) {
+    SymbolTable symbols;
+    Compiler compiler(symbols);
+    Binding binding = compiler.resolve("foo");
+    EXPECT_EQ(binding.kind, BindingKind::GLOBAL);
+    EXPECT_EQ(binding.index, symbols.slot("foo"));
+    EXPECT_FALSE(symbols.isDefined(binding.index));
+}
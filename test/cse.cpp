@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "cse.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    // Runs a script through the executor as parsed, and through every engine after eliminating
+    void testAgainstPlain(const std::string &source) {
+        std::vector<StmtNode::ptr> plain = parseAll(source);
+        std::vector<StmtNode::ptr> shared = parseAll(source);
+        Executor plainExecutor, sharedExecutor;
+        loadConcepts(plainExecutor.getState());
+        loadConcepts(sharedExecutor.getState());
+        VM byName(VMOptions { ArgumentMode::BY_NAME });
+        VM byNeed(VMOptions { ArgumentMode::BY_NEED });
+        CommonSubexpressions cse;
+        for (size_t i = 0; i < plain.size(); i++) {
+            cse.eliminate(shared[i].get());
+            plain[i]->accept(plainExecutor);
+            shared[i]->accept(sharedExecutor);
+            shared[i]->accept(byName);
+            shared[i]->accept(byNeed);
+            if (plainExecutor.hasResult()) {
+                EXPECT_PRED2(sameValue, sharedExecutor.lastResult(), plainExecutor.lastResult()) << source;
+                EXPECT_PRED2(sameValue, byName.lastResult(), plainExecutor.lastResult()) << source;
+                EXPECT_PRED2(sameValue, byNeed.lastResult(), plainExecutor.lastResult()) << source;
+            }
+        }
+    }
+}
+
+TEST(cse, HashFollowsEquality) {
+    std::vector<StmtNode::ptr> nodes = parseAll("f(1, x + 2) * 3; f(1, x + 2) * 3; f(1, x + 2) * 4");
+    EXPECT_EQ(nodes[0]->hash(), nodes[1]->hash());
+    EXPECT_NE(nodes[0]->hash(), nodes[2]->hash());
+    EXPECT_EQ(ConstNode(0.0).hash(), ConstNode(-0.0).hash());
+}
+
+TEST(cse, MergesRepeatedSubexpressions) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let f(a, b) = (a + b) * (a + b)");
+    CommonSubexpressions cse;
+    EXPECT_EQ(cse.eliminate(nodes[0].get()), 3);
+    auto *body = dynamic_cast<BinaryOperationNode *>(static_cast<FuncDefNode *>(nodes[0].get())->expression());
+    ASSERT_NE(body, nullptr);
+    EXPECT_NE(dynamic_cast<SharedExprNode *>(body->lhs()), nullptr);
+    EXPECT_EQ(body->lhs(), body->rhs());
+    // Running again finds the same sharing
+    EXPECT_EQ(cse.eliminate(nodes[0].get()), 0);
+    EXPECT_EQ(body->lhs(), body->rhs());
+}
+
+TEST(cse, KeepsSignedZerosApart) {
+    auto stmt = std::make_unique<ExprStmtNode>(std::make_unique<BinaryOperationNode>(
+        BinaryOperation::ADD, std::make_unique<ConstNode>(0.0), std::make_unique<ConstNode>(-0.0)
+    ));
+    CommonSubexpressions cse;
+    EXPECT_EQ(cse.eliminate(stmt.get()), 0);
+}
+
+TEST(cse, EvaluatesSharedExpressionsOnce) {
+    std::vector<StmtNode::ptr> nodes = parseAll("(count + 1) * (count + 1)");
+    CommonSubexpressions cse;
+    cse.eliminate(nodes[0].get());
+    Executor executor;
+    int calls = 0;
+    executor.getState().setFunction("count", [&calls] (Executor &, const std::vector<ExprNode::ptr> &) {
+        calls++;
+        return 1.0;
+    });
+    nodes[0]->accept(executor);
+    EXPECT_EQ(executor.lastResult(), 4.0);
+    EXPECT_EQ(calls, 1);
+    // Each evaluation of the statement starts again
+    nodes[0]->accept(executor);
+    EXPECT_EQ(calls, 2);
+}
+
+TEST(cse, MatchesExecutor) {
+    testAgainstPlain("let f(a, b) = (a + b) * (a + b); f(2, 3) + f(2, 3)");
+    testAgainstPlain("let g(x) = if(gt(x, 0), x * x + 1, -(x * x + 1)); g(3) + g(-3)");
+    testAgainstPlain("let fib(n) = if(le(n, 1), n, fib(n - 1) + fib(n - 2)); fib(10) - fib(9) + fib(10)");
+    testAgainstPlain("let sq(x) = x * x; sq(sq(2) + sq(2)) + sq(2)");
+    testAgainstPlain("let h(x, y) = x; let k(x) = h(x * 2, 1/0) + h(x * 2, 1/0); k(4)");
+}
+
+TEST(cse, MillionTermSum) {
+    std::string source = "1";
+    for (int i = 1; i < 1000000; i++) {
+        source += "+1";
+    }
+    std::vector<StmtNode::ptr> nodes = parseAll(source);
+    CommonSubexpressions cse;
+    EXPECT_EQ(cse.eliminate(nodes[0].get()), 999999);
+    VM vm;
+    nodes[0]->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 1000000.0);
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include <optional>
+#include <sstream>
+#include "lexer.hpp"
+#include "parser.hpp"
 #include "executor.hpp"
+#include "concepts.hpp"
+#include "helpers.hpp"
 
 using namespace quickcalc;
 
@@ -131,9 +136,10 @@ TEST(executor, CanDefineFunction) {
     stmt->accept(executor);
     EXPECT_FALSE(executor.hasResult());
 
-    const ExecutorState::Func *func = nullptr;
+    ExecutorState::Func func;
     EXPECT_TRUE(executor.getState().tryGetFunction("foo", func));
-    EXPECT_NE(func, nullptr);
+    EXPECT_EQ(func.kind, FuncKind::DEFINITION);
+    EXPECT_EQ(func.definition, stmt.get());
 }
 
 TEST(executor, CanInvokeFunction) {
@@ -185,3 +191,74 @@ TEST(executor, CanInvokeFunctionWithParam) {
     EXPECT_TRUE(executor.hasResult());
     EXPECT_DOUBLE_EQ(executor.lastResult(), 3.0);
 }
+
+TEST(executor, FuelLimitsEachStatement) {
+    if (!FUEL_METERED) {
+        GTEST_SKIP() << "Built without QC_FUEL";
+    }
+    // Five nodes, and each statement starts again with the whole budget
+    std::vector<StmtNode::ptr> nodes = parseAll("1 + 2 * 3; 4 - 5 / 6");
+    Executor executor;
+    executor.setFuelBudget(5);
+    for (StmtNode::ptr &node : nodes) {
+        node->accept(executor);
+        EXPECT_EQ(executor.fuel(), 0);
+    }
+    executor.setFuelBudget(4);
+    EXPECT_THROW(nodes[0]->accept(executor), FuelExhausted);
+}
+
+TEST(executor, OutOfFuelLeavesExecutorUsable) {
+    if (!FUEL_METERED) {
+        GTEST_SKIP() << "Built without QC_FUEL";
+    }
+    std::vector<StmtNode::ptr> nodes = parseAll(
+        "let spin(n) = spin(n + 1); let first(a, b) = a; let inc(x) = x + 1;"
+        "spin(0); first(first(spin(1), 2), 3); sum(i, 1, 1e9, inc(i)); inc(inc(1))"
+    );
+    Executor executor;
+    loadConcepts(executor.getState());
+    executor.setFuelBudget(2000);
+    for (size_t i = 0; i < 3; i++) {
+        nodes[i]->accept(executor);
+    }
+    for (size_t i = 3; i < 6; i++) {
+        EXPECT_THROW(nodes[i]->accept(executor), FuelExhausted);
+        // Back in the global state, with the loop's index unbound again
+        EXPECT_TRUE(executor.getState().hasFunction("inc"));
+        EXPECT_FALSE(executor.getState().hasFunction("i"));
+    }
+    nodes[6]->accept(executor);
+    EXPECT_DOUBLE_EQ(executor.lastResult(), 3.0);
+}
+
+TEST(executor, CheckpointResumesEvaluation) {
+    if (!FUEL_METERED) {
+        GTEST_SKIP() << "Built without QC_FUEL";
+    }
+    std::vector<StmtNode::ptr> nodes = parseAll("let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); fib(15)");
+    Executor executor;
+    loadConcepts(executor.getState());
+    nodes[0]->accept(executor);
+    nodes[1]->accept(executor);
+    uint64_t used = UNLIMITED_FUEL - executor.fuel();
+    ASSERT_GT(used, 10000);
+
+    // Each checkpoint gives another slice, and the evaluation carries on where it was
+    uint64_t checkpoints = 0;
+    executor.setFuelBudget(1000);
+    executor.setCheckpoint([&checkpoints] (Executor &) {
+        checkpoints++;
+        return 1000;
+    });
+    nodes[1]->accept(executor);
+    EXPECT_DOUBLE_EQ(executor.lastResult(), 610.0);
+    EXPECT_EQ(checkpoints, (used - 1) / 1000);
+
+    checkpoints = 0;
+    executor.setCheckpoint([&checkpoints] (Executor &) {
+        return ++checkpoints < 4 ? 1000 : 0;
+    });
+    EXPECT_THROW(nodes[1]->accept(executor), FuelExhausted);
+    EXPECT_EQ(checkpoints, 4);
+}
@@ -1,41 +1,70 @@
 #include <gtest/gtest.h>
+#include "concepts.hpp"
 #include "executor.hpp"
 
 using namespace quickcalc;
 
 TEST(executorstate, UndefinedFunctionDoesNotExist) {
     ExecutorState state = ExecutorState();
-    const ExecutorState::Func *func;
+    ExecutorState::Func func;
     EXPECT_FALSE(state.tryGetFunction("foo", func));
     EXPECT_FALSE(state.hasFunction("foo"));
 }
 
 TEST(executorstate, CanStoreFunction) {
     ExecutorState state = ExecutorState();
-    const ExecutorState::Func *func;
+    ExecutorState::Func func;
     state.setFunction("foo", [] (auto&, const auto&) { return 0.0; });
     EXPECT_TRUE(state.tryGetFunction("foo", func));
     EXPECT_TRUE(state.hasFunction("foo"));
-    EXPECT_NE(func, nullptr);
+    EXPECT_EQ(func.kind, FuncKind::HOST);
+    EXPECT_NE(func.host, nullptr);
 }
 
 TEST(executorstate, CanRetreiveFunctionFromParent) {
     ExecutorState parent = ExecutorState();
     ExecutorState child = ExecutorState(&parent);
-    const ExecutorState::Func *func;
+    ExecutorState::Func func;
     parent.setFunction("foo", [] (auto&, const auto&) { return 0.0; });
     EXPECT_TRUE(child.tryGetFunction("foo", func));
     EXPECT_TRUE(child.hasFunction("foo"));
-    EXPECT_NE(func, nullptr);
+    EXPECT_EQ(func.kind, FuncKind::HOST);
+    EXPECT_NE(func.host, nullptr);
 }
 
 TEST(executorstate, CanOverrideFunctionFromParent) {
     ExecutorState parent = ExecutorState();
     ExecutorState child = ExecutorState(&parent);
-    const ExecutorState::Func *funcA, *funcB;
+    ExecutorState::Func funcA, funcB;
     parent.setFunction("foo", [] (auto&, const auto&) { return 0.0; });
     child.setFunction("foo", [] (auto&, const auto&) { return 1.0; });
     EXPECT_TRUE(child.tryGetFunction("foo", funcA));
     EXPECT_TRUE(parent.tryGetFunction("foo", funcB));
-    EXPECT_NE(funcA, funcB);
+    EXPECT_NE(funcA.host, funcB.host);
+}
+
+TEST(executorstate, ParamsShadowParentAndBuiltins) {
+    ExecutorState parent = ExecutorState();
+    loadConcepts(parent);
+    parent.setFunction("x", [] (auto&, const auto&) { return 0.0; });
+    ExecutorState child = ExecutorState(&parent);
+    std::vector<std::string> paramNames = { "x", "if", "y" };
+    std::vector<ExprNode::ptr> args;
+    args.push_back(std::make_unique<ConstNode>(1.0));
+    args.push_back(std::make_unique<ConstNode>(2.0));
+    child.bindArgs(paramNames, args);
+
+    ExecutorState::Func func;
+    EXPECT_TRUE(child.tryGetFunction("if", func));
+    EXPECT_EQ(func.kind, FuncKind::ARGUMENT);
+    EXPECT_EQ(func.index, 1);
+    EXPECT_TRUE(child.tryGetFunction("x", func));
+    EXPECT_EQ(func.kind, FuncKind::ARGUMENT);
+    EXPECT_EQ(func.index, 0);
+    // Parameters without an argument aren't bound
+    EXPECT_FALSE(child.hasFunction("y"));
+    EXPECT_TRUE(child.tryGetFunction("lt", func));
+    EXPECT_EQ(func.kind, FuncKind::BUILTIN);
+    EXPECT_TRUE(parent.tryGetFunction("x", func));
+    EXPECT_EQ(func.kind, FuncKind::HOST);
 }
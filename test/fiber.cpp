@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include "fiber.hpp"
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+TEST(fiber, YieldsAndResumes) {
+    if (!Fiber::available()) {
+        GTEST_SKIP() << "Fibers aren't supported on this platform";
+    }
+    Fiber fiber;
+    std::vector<int> steps;
+    fiber.start([&] () {
+        for (int i = 0; i < 3; i++) {
+            steps.push_back(i);
+            fiber.yield();
+        }
+    });
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_FALSE(fiber.resume());
+        EXPECT_EQ(steps.size(), i + 1);
+    }
+    EXPECT_TRUE(fiber.resume());
+    EXPECT_TRUE(fiber.finished());
+}
+
+TEST(fiber, ResumesOnAnotherThread) {
+    if (!Fiber::available()) {
+        GTEST_SKIP() << "Fibers aren't supported on this platform";
+    }
+    Fiber fiber;
+    std::vector<int> seen;
+    fiber.start([&] () {
+        // Locals on the fiber's stack survive moving between threads
+        int calls = 0;
+        while (calls < 2) {
+            seen.push_back(++calls);
+            fiber.yield();
+        }
+    });
+    EXPECT_FALSE(fiber.resume());
+    std::thread other([&] () {
+        EXPECT_FALSE(fiber.resume());
+        EXPECT_TRUE(fiber.resume());
+    });
+    other.join();
+    EXPECT_EQ(seen, std::vector<int>({ 1, 2 }));
+}
+
+TEST(fiber, ResumeRethrows) {
+    Fiber fiber;
+    fiber.start([] () { throw std::runtime_error("Thrown by the body"); });
+    EXPECT_THROW(fiber.resume(), std::runtime_error);
+    EXPECT_TRUE(fiber.finished());
+}
+
+TEST(fiber, RestartsOnceFinished) {
+    Fiber fiber(64 << 10);
+    int runs = 0;
+    for (int i = 0; i < 3; i++) {
+        fiber.start([&] () {
+            fiber.yield();
+            runs++;
+        });
+        while (!fiber.resume()) {
+        }
+    }
+    EXPECT_EQ(runs, 3);
+}
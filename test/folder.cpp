@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "folder.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    // Folds the last statement of a script after the ones before it
+    StmtNode::ptr foldLast(const std::string &source, size_t &removed) {
+        Folder folder;
+        std::vector<StmtNode::ptr> nodes = parseAll(source);
+        for (StmtNode::ptr &node : nodes) {
+            removed = folder.fold(node.get());
+        }
+        return std::move(nodes.back());
+    }
+
+    StmtNode::ptr expected(const std::string &source) {
+        return std::move(parseAll(source).back());
+    }
+
+    // Runs a script through the executor with and without folding, checking every statement agrees
+    void testAgainstUnfolded(const std::string &source) {
+        std::vector<StmtNode::ptr> plain = parseAll(source);
+        std::vector<StmtNode::ptr> folded = parseAll(source);
+        Executor plainExecutor, foldedExecutor;
+        loadConcepts(plainExecutor.getState());
+        loadConcepts(foldedExecutor.getState());
+        Folder folder;
+        for (size_t i = 0; i < plain.size(); i++) {
+            folder.fold(folded[i].get());
+            plain[i]->accept(plainExecutor);
+            folded[i]->accept(foldedExecutor);
+            if (plainExecutor.hasResult()) {
+                double a = plainExecutor.lastResult(), b = foldedExecutor.lastResult();
+                EXPECT_TRUE(std::memcmp(&a, &b, sizeof(double)) == 0 || (std::isnan(a) && std::isnan(b))) << source;
+            }
+        }
+    }
+}
+
+TEST(folder, FoldsConstantArithmetic) {
+    size_t removed;
+    StmtNode::ptr node = foldLast("PI*2/360", removed);
+    EXPECT_EQ(*node, ExprStmtNode(std::make_unique<ConstNode>(QC_PI * (2.0 / 360.0))));
+    EXPECT_EQ(removed, 4);
+}
+
+TEST(folder, FoldsInsideFunctions) {
+    size_t removed;
+    StmtNode::ptr node = foldLast("let f(x) = x * (60 * 60)", removed);
+    EXPECT_EQ(*node, *expected("let f(x) = x * 3600"));
+    EXPECT_EQ(removed, 2);
+}
+
+TEST(folder, AppliesSafeIdentities) {
+    size_t removed;
+    EXPECT_EQ(*foldLast("let f(x) = x * 1 / 1", removed), *expected("let f(x) = x"));
+    EXPECT_EQ(*foldLast("let f(x) = --x", removed), *expected("let f(x) = x"));
+    EXPECT_EQ(*foldLast("let f(x) = x - 0", removed), *expected("let f(x) = x"));
+    // Adding 0 turns -0 into 0
+    EXPECT_EQ(*foldLast("let f(x) = x + 0", removed), *expected("let f(x) = x + 0"));
+    EXPECT_EQ(removed, 0);
+}
+
+TEST(folder, LeavesBuiltinsInFunctions) {
+    size_t removed;
+    EXPECT_EQ(*foldLast("let f = PI * 2", removed), *expected("let f = PI * 2"));
+}
+
+TEST(folder, LeavesShadowedBuiltins) {
+    size_t removed;
+    EXPECT_EQ(*foldLast("let PI = 3; PI * 2", removed), *expected("PI * 2"));
+    EXPECT_EQ(*foldLast("let f(PI) = 1; PI * 2", removed), *expected("PI * 2"));
+}
+
+TEST(folder, TakesConstantBranch) {
+    size_t removed;
+    EXPECT_EQ(*foldLast("let f(x) = x; if(gt(2, 1), f(1), f(2))", removed), *expected("f(1)"));
+    EXPECT_EQ(removed, 6);
+}
+
+TEST(folder, MatchesExecutor) {
+    testAgainstUnfolded("3*(1+3-2/4)");
+    testAgainstUnfolded("1-2-3");
+    testAgainstUnfolded("-4/0 * 1");
+    testAgainstUnfolded("-(-(0/0))");
+    testAgainstUnfolded("let f(x) = x * 1 - 0; f(-0 * 1)");
+    testAgainstUnfolded("if(0.5, 1, 2) + if(0, 1) + eq(PI, 3.14159)");
+    testAgainstUnfolded("let f(PI) = g; let g = PI; f(1)");
+}
+
+TEST(folder, FoldsMillionTermSum) {
+    std::string source = "1";
+    for (int i = 1; i < 1000000; i++) {
+        source += "+1";
+    }
+    size_t removed;
+    StmtNode::ptr node = foldLast(source, removed);
+    EXPECT_EQ(*node, ExprStmtNode(std::make_unique<ConstNode>(1000000.0)));
+    EXPECT_EQ(removed, 1999998);
+}
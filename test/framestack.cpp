@@ -0,0 +1,32 @@
+#include <gtest/gtest.h>
+#include "framestack.hpp"
+
+using namespace quickcalc;
+
+TEST(framestack, PushBumpsTop) {
+    FrameStack frames(64);
+    size_t first = frames.push(12);
+    size_t second = frames.push(8);
+    EXPECT_EQ(first, 0);
+    EXPECT_EQ(second, 16);
+    EXPECT_EQ(frames.top(), 24);
+}
+
+TEST(framestack, PopReleasesEverythingAfter) {
+    FrameStack frames(64);
+    frames.push(8);
+    size_t second = frames.push(8);
+    frames.push(8);
+    frames.pop(second);
+    EXPECT_EQ(frames.top(), second);
+    EXPECT_EQ(frames.push(8), second);
+}
+
+TEST(framestack, GrowsKeepingContents) {
+    FrameStack frames(8);
+    size_t offset = frames.push(sizeof(double));
+    frames.emplace(offset, 1.5);
+    frames.push(1024);
+    EXPECT_GE(frames.capacity(), 1032);
+    EXPECT_DOUBLE_EQ(*frames.at<double>(offset), 1.5);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Fixtures shared by the unit tests and benchmarks
+namespace quickcalc {
+    /**
+     * @brief Parses every statement left in input, for tests which need the parser afterwards
+     */
+    inline std::vector<StmtNode::ptr> parseAll(Parser &parser, std::istream &input) {
+        std::vector<StmtNode::ptr> nodes;
+        while (!input.eof()) {
+            nodes.push_back(parser.parse());
+        }
+        return nodes;
+    }
+
+    /**
+     * @brief Parses every statement of a script
+     */
+    inline std::vector<StmtNode::ptr> parseAll(const std::string &source) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        return parseAll(parser, input);
+    }
+
+    /**
+     * @brief Whether two doubles are the same down to the sign of zero and the payload of NaN
+     */
+    inline bool sameBits(double a, double b) {
+        return std::memcmp(&a, &b, sizeof(double)) == 0;
+    }
+
+    /**
+     * @brief Whether two doubles are the same bits, or both NaN of any payload
+     */
+    inline bool sameValue(double a, double b) {
+        return sameBits(a, b) || (std::isnan(a) && std::isnan(b));
+    }
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "inliner.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    StmtNode::ptr expected(const std::string &source) {
+        return std::move(parseAll(source).back());
+    }
+
+    // Runs a script through the executor with and without inlining, checking every statement agrees
+    void testAgainstPlain(const std::string &source, size_t expectedInlined) {
+        std::vector<StmtNode::ptr> plain = parseAll(source);
+        std::vector<StmtNode::ptr> inlined = parseAll(source);
+        Executor plainExecutor, inlinedExecutor;
+        loadConcepts(plainExecutor.getState());
+        loadConcepts(inlinedExecutor.getState());
+        Inliner inliner;
+        size_t total = 0;
+        for (size_t i = 0; i < plain.size(); i++) {
+            total += inliner.inlineCalls(inlined[i].get());
+            plain[i]->accept(plainExecutor);
+            inlined[i]->accept(inlinedExecutor);
+            for (FuncDefNode *node : inliner.rebuilt()) {
+                node->accept(inlinedExecutor);
+            }
+            if (plainExecutor.hasResult()) {
+                double a = plainExecutor.lastResult(), b = inlinedExecutor.lastResult();
+                EXPECT_TRUE(std::memcmp(&a, &b, sizeof(double)) == 0 || (std::isnan(a) && std::isnan(b))) << source;
+            }
+        }
+        EXPECT_EQ(total, expectedInlined) << source;
+    }
+}
+
+TEST(inliner, InlinesSmallFunctions) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let deg(x) = x*PI/180; let f(y) = deg(y) + 1; f(90)");
+    Inliner inliner;
+    EXPECT_EQ(inliner.inlineCalls(nodes[0].get()), 0);
+    EXPECT_EQ(inliner.inlineCalls(nodes[1].get()), 1);
+    EXPECT_EQ(*nodes[1], *expected("let f(y) = (y*PI/180) + 1"));
+    // Definitions are inlined after being inlined into
+    EXPECT_EQ(inliner.inlineCalls(nodes[2].get()), 1);
+    EXPECT_EQ(*nodes[2], *expected("(90*PI/180) + 1"));
+}
+
+TEST(inliner, SkipsRecursiveAndLargeFunctions) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let f(n) = if(le(n, 0), 0, f(n - 1)); let g(x) = x*x*x*x; f(2) + g(2)");
+    Inliner inliner(4);
+    for (StmtNode::ptr &node : nodes) {
+        EXPECT_EQ(inliner.inlineCalls(node.get()), 0);
+    }
+    EXPECT_EQ(*nodes[2], *expected("f(2) + g(2)"));
+}
+
+TEST(inliner, RebuildsOnRedefinition) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let h(x) = x + 1; let f(y) = h(y) * 2; let h(x) = x + 2; let h(x) = g(x)");
+    Inliner inliner;
+    for (size_t i = 0; i < 2; i++) {
+        inliner.inlineCalls(nodes[i].get());
+    }
+    EXPECT_EQ(inliner.inlineCalls(nodes[2].get()), 1);
+    ASSERT_EQ(inliner.rebuilt(), std::vector<FuncDefNode *>({ static_cast<FuncDefNode *>(nodes[1].get()) }));
+    EXPECT_EQ(*nodes[1], *expected("let f(y) = (y + 2) * 2"));
+    EXPECT_EQ(inliner.inlineCalls(nodes[3].get()), 0);
+    EXPECT_EQ(*nodes[1], *expected("let f(y) = h(y) * 2"));
+}
+
+TEST(inliner, SkipsShadowedNames) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let h(x) = x; let f(y) = h(y); let g(h) = f(h)");
+    Inliner inliner;
+    inliner.inlineCalls(nodes[0].get());
+    EXPECT_EQ(inliner.inlineCalls(nodes[1].get()), 1);
+    // A parameter called h means h in f could refer to it when f is called from g
+    inliner.inlineCalls(nodes[2].get());
+    EXPECT_EQ(*nodes[1], *expected("let f(y) = h(y)"));
+}
+
+TEST(inliner, SkipsCapturedNames) {
+    std::vector<StmtNode::ptr> nodes = parseAll("let h(x) = x * PI; let f(PI) = h(2)");
+    Inliner inliner;
+    inliner.inlineCalls(nodes[0].get());
+    EXPECT_EQ(inliner.inlineCalls(nodes[1].get()), 0);
+}
+
+TEST(inliner, MatchesExecutor) {
+    testAgainstPlain("let deg(x) = x*PI/180; let sq(x) = x*x; sq(deg(45)) + deg(1)", 3);
+    testAgainstPlain("let first(a, b) = a; let f(x) = first(x, 1/0); f(3)", 2);
+    testAgainstPlain("let h(x) = x + 1; let f(y) = h(y) * 2; f(1); let h(x) = x - 1; f(1)", 4);
+    testAgainstPlain("let pick(c, a, b) = if(c, a, b); pick(0, 1, 2) + pick(1, 1, 2)", 2);
+    testAgainstPlain("let h(x) = x + PI; let f(y) = h(y); f(1); let PI = 3; f(1)", 5);
+}
@@ -0,0 +1,239 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    VMOptions jitOptions(ArgumentMode arguments) {
+        VMOptions options { arguments };
+        options.jit = true;
+        return options;
+    }
+
+    // Runs statements through the reference executor and the VM with the JIT enabled in each mode
+    class JitTest {
+        Executor _executor;
+        VM _byName;
+        VM _byNeed;
+    public:
+        JitTest(): _byName(jitOptions(ArgumentMode::BY_NAME)), _byNeed(jitOptions(ArgumentMode::BY_NEED)) {
+            loadConcepts(_executor.getState());
+        }
+
+        void run(StmtNode *stmt) {
+            stmt->accept(_executor);
+            for (VM *vm : { &_byName, &_byNeed }) {
+                stmt->accept(*vm);
+                if (_executor.hasResult()) {
+                    EXPECT_PRED2(sameBits, vm->lastResult(), _executor.lastResult());
+                }
+            }
+        }
+
+        void run(const std::string &source, std::vector<StmtNode::ptr> &nodes) {
+            std::istringstream input(source);
+            Lexer lexer(input);
+            Parser parser(lexer);
+            while (!input.eof()) {
+                run(nodes.emplace_back(parser.parse()).get());
+            }
+        }
+
+        VM &byNeed() {
+            return _byNeed;
+        }
+    };
+
+    double testAgainstExecutor(const std::string &source) {
+        std::vector<StmtNode::ptr> nodes;
+        JitTest test;
+        test.run(source, nodes);
+        return test.byNeed().lastResult();
+    }
+
+    ExprNode::ptr param(const std::string &name) {
+        return std::make_unique<FunctionInvocationNode>(name, std::vector<ExprNode::ptr>());
+    }
+
+    ExprNode::ptr call(const std::string &name, double a, double b) {
+        std::vector<ExprNode::ptr> args;
+        args.push_back(std::make_unique<ConstNode>(a));
+        args.push_back(std::make_unique<ConstNode>(b));
+        return std::make_unique<FunctionInvocationNode>(name, std::move(args));
+    }
+
+    const double VALUES[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, -2.5, 3.0, 1e-16, 1e300, -1e300, 4294967296.0, 2147483648.0, -2147483649.0,
+        INFINITY, -INFINITY, NAN, 0.1 + 0.2, 0.3, 4611686018427387904.0, -9223372036854775808.0, 9007199254740994.0,
+    };
+}
+
+TEST(jit, CompilesStrictFunctions) {
+    if (!Jit::available()) {
+        GTEST_SKIP() << "No JIT on this platform";
+    }
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    test.run("let sq(x) = x * x; let pick(c, a, b) = if(c, a, b); let f(x) = sq(x) + pick(1, x, 2); f(3)", nodes);
+    EXPECT_TRUE(test.byNeed().isNative("sq"));
+    // Lazy parameters, and calls to functions with them, are left to the interpreter
+    EXPECT_FALSE(test.byNeed().isNative("pick"));
+    EXPECT_FALSE(test.byNeed().isNative("f"));
+}
+
+TEST(jit, Arithmetic) {
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    test.run("let add(a, b) = a + b; let sub(a, b) = a - b; let mul(a, b) = a * b; let div(a, b) = a / b; "
+             "let neg(a, b) = -a", nodes);
+    for (const char *name : { "add", "sub", "mul", "div", "neg" }) {
+        for (double a : VALUES) {
+            for (double b : VALUES) {
+                test.run(nodes.emplace_back(std::make_unique<ExprStmtNode>(call(name, a, b))).get());
+            }
+        }
+    }
+}
+
+TEST(jit, Comparisons) {
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    test.run("let eq2(a, b) = eq(a, b); let ne2(a, b) = ne(a, b); let gt2(a, b) = gt(a, b); "
+             "let lt2(a, b) = lt(a, b); let ge2(a, b) = ge(a, b); let le2(a, b) = le(a, b); "
+             "let if2(a, b) = if(a, b); let if3(a, b) = if(a, b, -b)", nodes);
+    for (const char *name : { "eq2", "ne2", "gt2", "lt2", "ge2", "le2", "if2", "if3" }) {
+        for (double a : VALUES) {
+            for (double b : VALUES) {
+                test.run(nodes.emplace_back(std::make_unique<ExprStmtNode>(call(name, a, b))).get());
+            }
+        }
+    }
+}
+
+TEST(jit, Bitwise) {
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    std::vector<std::string> names;
+    for (BinaryOperation operation : { BinaryOperation::AND, BinaryOperation::OR, BinaryOperation::XOR }) {
+        // Not of the second parameter, so both operations are covered
+        auto body = std::make_unique<BinaryOperationNode>(
+            operation, param("a"), std::make_unique<UnaryOperationNode>(UnaryOperation::NOT, param("b"))
+        );
+        names.push_back("bitwise" + std::to_string(names.size()));
+        auto def = std::make_unique<FuncDefNode>(names.back(), std::move(body), std::vector<std::string>({ "a", "b" }));
+        test.run(nodes.emplace_back(std::move(def)).get());
+    }
+    // Results passed between operators stay integers, rounded as they're used: ((a ^ ~b) & (a | 2^62)) ^ ~(a & b)
+    auto chain = std::make_unique<BinaryOperationNode>(
+        BinaryOperation::XOR,
+        std::make_unique<BinaryOperationNode>(
+            BinaryOperation::AND,
+            std::make_unique<BinaryOperationNode>(
+                BinaryOperation::XOR, param("a"), std::make_unique<UnaryOperationNode>(UnaryOperation::NOT, param("b"))
+            ),
+            std::make_unique<BinaryOperationNode>(
+                BinaryOperation::OR, param("a"), std::make_unique<ConstNode>(4611686018427387904.0)
+            )
+        ),
+        std::make_unique<UnaryOperationNode>(
+            UnaryOperation::NOT, std::make_unique<BinaryOperationNode>(BinaryOperation::AND, param("a"), param("b"))
+        )
+    );
+    names.push_back("chain");
+    test.run(nodes.emplace_back(
+        std::make_unique<FuncDefNode>("chain", std::move(chain), std::vector<std::string>({ "a", "b" }))
+    ).get());
+    for (const std::string &name : names) {
+        for (double a : VALUES) {
+            for (double b : VALUES) {
+                test.run(nodes.emplace_back(std::make_unique<ExprStmtNode>(call(name, a, b))).get());
+            }
+        }
+    }
+    if (Jit::available()) {
+        EXPECT_TRUE(test.byNeed().isNative("chain"));
+    }
+}
+
+TEST(jit, UserFunctions) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); fib(20)"), 6765.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor(
+        "let even(n) = if(eq(n, 0), 1, odd(n - 1)); let odd(n) = if(eq(n, 0), 0, even(n - 1)); even(1001)"
+    ), 0.0);
+    testAgainstExecutor("let k = 2 * PI; let area(r) = r * r * k / 2; area(k)");
+    testAgainstExecutor("let f(x, y) = x * 3 - y / 7; let g(x) = f(x, x + 1) * f(x + 2, x); g(0.1); g(-1e308)");
+}
+
+TEST(jit, SharedExpressions) {
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    auto square = std::make_shared<SharedExprNode>(
+        std::make_unique<BinaryOperationNode>(BinaryOperation::ADD, param("x"), std::make_unique<ConstNode>(1.0)), 0
+    );
+    // Only one branch evaluates the shared expression, the other must not see a value from an earlier call
+    std::vector<ExprNode::ptr> args;
+    args.push_back(std::make_unique<FunctionInvocationNode>("gt", [&] {
+        std::vector<ExprNode::ptr> compared;
+        compared.push_back(param("x"));
+        compared.push_back(std::make_unique<ConstNode>(0.0));
+        return compared;
+    }()));
+    args.push_back(std::make_unique<BinaryOperationNode>(BinaryOperation::MULTIPLY, square, square));
+    args.push_back(std::make_unique<UnaryOperationNode>(UnaryOperation::NEGATE, square));
+    auto def = std::make_unique<FuncDefNode>(
+        "f", std::make_unique<FunctionInvocationNode>("if", std::move(args)), std::vector<std::string>({ "x" })
+    );
+    test.run(nodes.emplace_back(std::move(def)).get());
+    test.run("f(3) + f(-3) + f(2)", nodes);
+    EXPECT_DOUBLE_EQ(test.byNeed().lastResult(), 16.0 + 2.0 + 9.0);
+}
+
+TEST(jit, TailCallsRunInConstantSpace) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options = jitOptions(ArgumentMode::BY_NEED);
+    options.memoryLimit = 64 * 1024;
+    options.nativeStackSize = 4096;
+    VM vm(options);
+    std::istringstream input("let loop(n, acc) = if(le(n, 0), acc, loop(n - 1, acc + 1)); loop(10000000, 0)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    nodes.emplace_back(parser.parse())->accept(vm);
+    nodes.emplace_back(parser.parse())->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 10000000.0);
+}
+
+TEST(jit, DeepRecursionFallsBackToInterpreter) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options = jitOptions(ArgumentMode::BY_NEED);
+    options.nativeStackSize = 4096;
+    VM vm(options);
+    std::istringstream input("let count(n) = if(le(n, 0), 0, 1 + count(n - 1)); count(100000); count(10)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    nodes.emplace_back(parser.parse())->accept(vm);
+    nodes.emplace_back(parser.parse())->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 100000.0);
+    nodes.emplace_back(parser.parse())->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 10.0);
+}
+
+TEST(jit, RedefinitionDropsNativeCode) {
+    std::vector<StmtNode::ptr> nodes;
+    JitTest test;
+    test.run("let g(x) = x + 1; let f(x) = g(x) * 2; f(1); let g(x) = x - 1; f(1)", nodes);
+    EXPECT_DOUBLE_EQ(test.byNeed().lastResult(), 0.0);
+    if (Jit::available()) {
+        EXPECT_TRUE(test.byNeed().isNative("f"));
+    }
+    // Now g ignores its argument, so f can't evaluate it first and has to be interpreted
+    test.run("let g(x) = 1; f(1)", nodes);
+    EXPECT_DOUBLE_EQ(test.byNeed().lastResult(), 2.0);
+    EXPECT_FALSE(test.byNeed().isNative("f"));
+}
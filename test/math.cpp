@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "batchkernels.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    struct MathCase {
+        const char *name;
+        MathFunction function;
+        long double (*reference)(long double, long double);
+        // Largest error allowed, in units in the last place
+        double bound;
+        double low, high;
+    };
+
+    const MathCase CASES[] = {
+        { "sqrt", MathFunction::SQRT, [] (long double x, long double) { return sqrtl(x); }, 0.5, 0, 1e6 },
+        { "exp", MathFunction::EXP, [] (long double x, long double) { return expl(x); }, 1, -700, 700 },
+        { "log", MathFunction::LOG, [] (long double x, long double) { return logl(x); }, 1, 1e-3, 1e6 },
+        { "sin", MathFunction::SIN, [] (long double x, long double) { return sinl(x); }, 1, -1e4, 1e4 },
+        { "cos", MathFunction::COS, [] (long double x, long double) { return cosl(x); }, 1, -1e4, 1e4 },
+        { "tan", MathFunction::TAN, [] (long double x, long double) { return tanl(x); }, 2.5, -1e4, 1e4 },
+        { "pow", MathFunction::POW, [] (long double x, long double y) { return powl(x, y); }, 1, 1e-2, 1e2 },
+    };
+
+    const double SPECIAL[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, 2.0, 1e-310, -1e-310, 1e300, -1e300, 710.0, -746.0, 1647099.0, 1e22,
+        INFINITY, -INFINITY, NAN
+    };
+
+    double ulps(double value, long double reference) {
+        int exponent;
+        std::frexp(static_cast<double>(reference), &exponent);
+        return static_cast<double>(std::abs(value - reference) / std::ldexp(1.0, std::max(exponent, -1021) - 53));
+    }
+
+    double call(const NativeDefinition &definition, double x, double y) {
+        double args[] = { x, y };
+        return definition.call(args, definition.minArgs);
+    }
+
+    const NativeDefinition &definition(const char *name) {
+        const NativeLibrary &math = mathConcepts();
+        for (uint32_t i = 0; i < math.count; i++) {
+            if (std::strcmp(math.functions[i].name, name) == 0) {
+                return math.functions[i];
+            }
+        }
+        throw std::logic_error("Couldn't find function " + std::string(name));
+    }
+
+    // Arguments within the range of the function, with every special value against every other
+    void arguments(const MathCase &function, std::vector<double> &x, std::vector<double> &y) {
+        std::mt19937_64 random(3);
+        std::uniform_real_distribution<double> first(function.low, function.high);
+        std::uniform_real_distribution<double> second(-60, 60);
+        for (int i = 0; i < 20000; i++) {
+            x.push_back(first(random));
+            y.push_back(second(random));
+        }
+        for (double a : SPECIAL) {
+            for (double b : SPECIAL) {
+                x.push_back(a);
+                y.push_back(b);
+            }
+        }
+    }
+}
+
+TEST(math, WithinErrorBounds) {
+    for (const MathCase &function : CASES) {
+        const NativeDefinition &native = definition(function.name);
+        std::vector<double> x, y;
+        arguments(function, x, y);
+        for (size_t i = 0; i < 20000; i++) {
+            double result = call(native, x[i], y[i]);
+            ASSERT_LE(ulps(result, function.reference(x[i], y[i])), function.bound)
+                << function.name << "(" << x[i] << ", " << y[i] << ")";
+        }
+    }
+}
+
+TEST(math, SpecialValuesMatchLibm) {
+    for (const MathCase &function : CASES) {
+        const NativeDefinition &native = definition(function.name);
+        for (double x : SPECIAL) {
+            for (double y : SPECIAL) {
+                double expected;
+                switch (function.function) {
+                case MathFunction::SQRT: expected = std::sqrt(x); break;
+                case MathFunction::EXP: expected = std::exp(x); break;
+                case MathFunction::LOG: expected = std::log(x); break;
+                case MathFunction::SIN: expected = std::sin(x); break;
+                case MathFunction::COS: expected = std::cos(x); break;
+                case MathFunction::TAN: expected = std::tan(x); break;
+                default: expected = std::pow(x, y); break;
+                }
+                double result = call(native, x, y);
+                if (std::isnan(expected)) {
+                    EXPECT_TRUE(std::isnan(result)) << function.name << "(" << x << ", " << y << ")";
+                } else if (std::isinf(expected) || expected == 0.0) {
+                    EXPECT_PRED2(sameBits, result, expected) << function.name << "(" << x << ", " << y << ")";
+                } else {
+                    EXPECT_LE(ulps(result, expected), function.bound + 0.5) << function.name << "(" << x << ", " << y << ")";
+                }
+            }
+        }
+    }
+}
+
+TEST(math, KernelsMatchCalls) {
+    std::vector<const BatchKernelTable *> tables = { &portableKernels() };
+    if (avxKernels() && __builtin_cpu_supports("avx")) {
+        tables.push_back(avxKernels());
+    }
+    for (const MathCase &function : CASES) {
+        const NativeDefinition &native = definition(function.name);
+        std::vector<double> x, y;
+        arguments(function, x, y);
+        x.resize(x.size() & ~size_t(3));
+        for (const BatchKernelTable *table : tables) {
+            std::vector<double> results = x;
+            table->math(function.function, results.data(), y.data(), results.size());
+            for (size_t i = 0; i < x.size(); i++) {
+                ASSERT_PRED2(sameBits, results[i], call(native, x[i], y[i]))
+                    << table->name << " " << function.name << "(" << x[i] << ", " << y[i] << ")";
+            }
+        }
+    }
+}
+
+TEST(math, EnginesAgree) {
+    std::istringstream input("let f(x) = sqrt(x) * sin(x) + pow(x, 1.5) - log(x + 1) / exp(cos(x)); f(2) + tan(PI / 3)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    std::vector<StmtNode::ptr> nodes;
+    Executor executor;
+    loadConcepts(executor.getState());
+    VMOptions jit { ArgumentMode::BY_NEED };
+    jit.jit = true;
+    VM byName(VMOptions { ArgumentMode::BY_NAME });
+    VM native(jit);
+    while (!input.eof()) {
+        StmtNode::ptr node = parser.parse();
+        node->accept(executor);
+        node->accept(byName);
+        node->accept(native);
+        nodes.push_back(std::move(node));
+    }
+    EXPECT_PRED2(sameBits, byName.lastResult(), executor.lastResult());
+    EXPECT_PRED2(sameBits, native.lastResult(), executor.lastResult());
+    EXPECT_NEAR(executor.lastResult(), std::sqrt(2) * std::sin(2) + std::pow(2, 1.5) - std::log(3) / std::exp(std::cos(2))
+        + std::sqrt(3), 1e-12);
+
+    // Odd row counts leave lanes for calls after the kernels
+    std::istringstream batchInput("f(x) + pow(y, x)");
+    Lexer batchLexer(batchInput);
+    Parser batchParser(batchLexer);
+    StmtNode::ptr statement = batchParser.parse();
+    ExprNode *expr = static_cast<ExprStmtNode *>(statement.get())->expression();
+    BatchProgram program = byName.prepare(expr, { "x", "y" });
+    std::vector<double> x, y;
+    for (int i = 0; i < 1003; i++) {
+        x.push_back(i * 0.37 - 50);
+        y.push_back(i * 0.01);
+    }
+    std::vector<double> results(x.size());
+    byName.evaluate(program, { x.data(), y.data() }, x.size(), results.data());
+    for (size_t row = 0; row < x.size(); row++) {
+        double a = x[row];
+        double b = y[row];
+        executor.getState().setFunction("x", [a] (Executor &, const std::vector<ExprNode::ptr> &) { return a; });
+        executor.getState().setFunction("y", [b] (Executor &, const std::vector<ExprNode::ptr> &) { return b; });
+        ASSERT_PRED2(sameBits, results[row], executor.evaluate(expr)) << a << ", " << b;
+    }
+}
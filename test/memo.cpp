@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include "memo.hpp"
+#include <cmath>
+
+using namespace quickcalc;
+
+namespace {
+    void setKey(MemoCache &cache, double a, double b) {
+        cache.probe()[0] = a;
+        cache.probe()[1] = b;
+    }
+}
+
+TEST(memo, FindsInsertedResult) {
+    MemoCache cache(2, 4);
+    double value;
+    setKey(cache, 1.0, 2.0);
+    EXPECT_FALSE(cache.find(value));
+    cache.insert(3.0);
+    setKey(cache, 2.0, 1.0);
+    EXPECT_FALSE(cache.find(value));
+    setKey(cache, 1.0, 2.0);
+    EXPECT_TRUE(cache.find(value));
+    EXPECT_EQ(value, 3.0);
+    EXPECT_EQ(cache.stats().hits, 1);
+    EXPECT_EQ(cache.stats().misses, 2);
+    EXPECT_EQ(cache.stats().size, 1);
+}
+
+TEST(memo, KeysCompareByBits) {
+    MemoCache cache(2, 4);
+    double value;
+    setKey(cache, 0.0, NAN);
+    cache.insert(1.0);
+    setKey(cache, -0.0, NAN);
+    EXPECT_FALSE(cache.find(value));
+    setKey(cache, 0.0, NAN);
+    EXPECT_TRUE(cache.find(value));
+}
+
+TEST(memo, ClockEvictsUnreferencedEntries) {
+    MemoCache cache(2, 2);
+    double value;
+    setKey(cache, 1.0, 0.0);
+    cache.insert(1.0);
+    setKey(cache, 2.0, 0.0);
+    cache.insert(2.0);
+    // Referencing the first entry keeps it past the next eviction
+    setKey(cache, 1.0, 0.0);
+    EXPECT_TRUE(cache.find(value));
+    setKey(cache, 3.0, 0.0);
+    cache.insert(3.0);
+    EXPECT_EQ(cache.stats().evictions, 1);
+    EXPECT_EQ(cache.stats().size, 2);
+    setKey(cache, 1.0, 0.0);
+    EXPECT_TRUE(cache.find(value));
+    setKey(cache, 2.0, 0.0);
+    EXPECT_FALSE(cache.find(value));
+    setKey(cache, 3.0, 0.0);
+    EXPECT_TRUE(cache.find(value));
+    EXPECT_EQ(value, 3.0);
+}
@@ -0,0 +1,36 @@
+#include "natives.hpp"
+#include <cmath>
+
+using namespace quickcalc;
+
+namespace {
+    double hypotenuse(const double *args, size_t) {
+        return std::sqrt(args[0] * args[0] + args[1] * args[1]);
+    }
+
+    void hypotenuseColumns(const double *const *args, size_t, double *results, size_t rows) {
+        for (size_t i = 0; i < rows; i++) {
+            results[i] = std::sqrt(args[0][i] * args[0][i] + args[1][i] * args[1][i]);
+        }
+    }
+
+    // Evaluates a polynomial in x with the coefficients that follow, highest power first
+    double polynomial(const double *args, size_t count) {
+        double result = 0.0;
+        for (size_t i = 1; i < count; i++) {
+            result = result * args[0] + args[i];
+        }
+        return result;
+    }
+
+    const NativeDefinition FUNCTIONS[] = {
+        { "hypot", &hypotenuse, &hypotenuseColumns, 2, 2, NATIVE_PURE | NATIVE_VECTORIZABLE },
+        { "poly", &polynomial, nullptr, 1, NATIVE_VARIADIC, NATIVE_PURE },
+    };
+
+    const NativeLibrary LIBRARY = { NATIVE_ABI_VERSION, sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]), FUNCTIONS };
+}
+
+extern "C" const NativeLibrary *quickcalcNatives() {
+    return &LIBRARY;
+}
@@ -0,0 +1,225 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "compiler.hpp"
+#include "cse.hpp"
+#include "folder.hpp"
+#include "natives.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+namespace {
+    std::atomic<int> ticks(0);
+    std::atomic<int> guardedCalls(0);
+
+    double scale(const double *args, size_t count) {
+        return args[0] * 3.0 + (count > 1 ? args[1] : 0.0);
+    }
+
+    double tick(const double *, size_t) {
+        return ++ticks;
+    }
+
+    double guarded(const double *args, size_t) {
+        guardedCalls++;
+        return args[0] + 1.0;
+    }
+
+    // The unittests binary runs every test in one process and natives can't be registered twice, so only
+    // the first test to ask registers them
+    void registerTestNatives() {
+        static std::once_flag registered;
+        std::call_once(registered, [] {
+            registerNative({ "scale", &scale, nullptr, 1, 2, NATIVE_PURE });
+            registerNative({ "tick", &tick, nullptr, 0, 0, 0 });
+            registerNative({ "guarded", &guarded, nullptr, 1, 1, NATIVE_PURE });
+            loadNativeLibrary(QC_TEST_NATIVE_LIBRARY);
+        });
+    }
+
+
+    // Runs a script through the executor and every virtual machine, which must agree on the last result
+    double testAgainstExecutor(const std::string &source) {
+        registerTestNatives();
+        std::vector<StmtNode::ptr> nodes = parseAll(source);
+        Executor executor;
+        loadConcepts(executor.getState());
+        VMOptions jit { ArgumentMode::BY_NEED };
+        jit.jit = true;
+        VM byName(VMOptions { ArgumentMode::BY_NAME });
+        VM byNeed(VMOptions { ArgumentMode::BY_NEED });
+        VM native(jit);
+        for (StmtNode::ptr &node : nodes) {
+            node->accept(executor);
+            for (VM *vm : { &byName, &byNeed, &native }) {
+                node->accept(*vm);
+                if (executor.hasResult()) {
+                    EXPECT_DOUBLE_EQ(vm->lastResult(), executor.lastResult()) << source;
+                }
+            }
+        }
+        return executor.lastResult();
+    }
+}
+
+TEST(natives, EnginesAgree) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("scale(2)"), 6.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("scale(2, 1) + 1"), 8.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f(x) = scale(x, x) * 2; f(1) + f(2)"), 24.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f(n) = if(lt(n, 1), 0, scale(f(n - 1), 1)); f(4)"), 40.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("hypot(3, 4)"), 5.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("poly(2, 1, 0, -1)"), 3.0);
+}
+
+TEST(natives, ChecksArity) {
+    registerTestNatives();
+    auto call = parseAll("hypot(1)");
+    VM vm;
+    EXPECT_THROW(call[0]->accept(vm), CompileError);
+    Executor executor;
+    EXPECT_THROW(call[0]->accept(executor), std::runtime_error);
+    EXPECT_THROW(registerNative({ "if", &scale, nullptr, 1, 1, NATIVE_PURE }), std::invalid_argument);
+    EXPECT_THROW(registerNative({ "scale", &scale, nullptr, 1, 1, NATIVE_PURE }), std::invalid_argument);
+    EXPECT_THROW(registerNative({ "bad name", &scale, nullptr, 1, 1, NATIVE_PURE }), std::invalid_argument);
+}
+
+TEST(natives, RegistryGrowsWithoutMovingFunctions) {
+    registerTestNatives();
+    int32_t first;
+    ASSERT_TRUE(tryGetNative("scale", first));
+    const NativeFunction *scaleFunction = &nativeFunction(first);
+    // Enough to need more chunks of the table, while other threads read the functions already there
+    std::thread reader([scaleFunction] {
+        for (int i = 0; i < 1000; i++) {
+            Executor executor;
+            auto call = parseAll("scale(2, 1)");
+            call[0]->accept(executor);
+            EXPECT_DOUBLE_EQ(executor.lastResult(), 7.0);
+            EXPECT_EQ(&nativeFunction(0), &nativeFunction(0));
+        }
+    });
+    std::vector<int32_t> indices;
+    for (int i = 0; i < 200; i++) {
+        std::string name = "growth" + std::to_string(i);
+        indices.push_back(registerNative({ name.c_str(), &scale, nullptr, 1, 2, NATIVE_PURE }));
+    }
+    reader.join();
+    for (int i = 0; i < 200; i++) {
+        EXPECT_EQ(nativeFunction(indices[i]).name, "growth" + std::to_string(i));
+    }
+    EXPECT_EQ(&nativeFunction(first), scaleFunction);
+    EXPECT_THROW(nativeFunction(-1), std::out_of_range);
+    EXPECT_THROW(nativeFunction(indices.back() + 1), std::out_of_range);
+}
+
+TEST(natives, DefinitionsShadowNatives) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f(x) = scale(x); f(1); let scale(x) = x; f(1)"), 1.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f(scale) = scale + 1; f(1)"), 2.0);
+}
+
+TEST(natives, LoadsLibrariesOnce) {
+    registerTestNatives();
+    int32_t index;
+    ASSERT_TRUE(tryGetNative("hypot", index));
+    EXPECT_TRUE(nativeFunction(index).vectorizable);
+    EXPECT_THROW(loadNativeLibrary(QC_TEST_NATIVE_LIBRARY), std::runtime_error);
+    EXPECT_THROW(loadNativeLibrary("missing-library.so"), std::runtime_error);
+}
+
+TEST(natives, ImpureCallsAreNeverShared) {
+    registerTestNatives();
+    auto nodes = parseAll("tick - tick");
+    CommonSubexpressions cse;
+    EXPECT_EQ(cse.eliminate(nodes[0].get()), 0);
+    Folder folder;
+    EXPECT_EQ(folder.fold(nodes[0].get()), 0);
+
+    VMOptions options;
+    options.cacheConstants = true;
+    VM vm(options);
+    auto script = parseAll("let t = tick * 2; let u = t; u + 0; u + 0");
+    for (StmtNode::ptr &node : script) {
+        node->accept(vm);
+    }
+    EXPECT_EQ(vm.memoStats("t").misses, 0);
+    EXPECT_EQ(vm.memoStats("u").misses, 0);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), ticks * 2.0);
+}
+
+TEST(natives, FoldsPureCalls) {
+    registerTestNatives();
+    auto nodes = parseAll("scale(2, 1) + hypot(3, 4)");
+    Folder folder;
+    EXPECT_EQ(folder.fold(nodes[0].get()), 6);
+    VM vm;
+    nodes[0]->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 12.0);
+}
+
+TEST(natives, CompilesToMachineCode) {
+    registerTestNatives();
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.jit = true;
+    VM vm(options);
+    auto script = parseAll("let f(x, y) = hypot(x, y) + scale(x); f(3, 4)");
+    for (StmtNode::ptr &node : script) {
+        node->accept(vm);
+    }
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 14.0);
+    EXPECT_EQ(vm.isNative("f"), Jit::available());
+}
+
+TEST(natives, ImpureFunctionsStayInterpreted) {
+    registerTestNatives();
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.jit = true;
+    // Small enough to run out part way down, when native code would start the outermost call over
+    options.nativeStackSize = 4096;
+    VM vm(options);
+    auto script = parseAll("let count(n) = tick - tick + if(le(n, 0), 0, 1 + count(n - 1)); count(10000)");
+    int before = ticks;
+    for (StmtNode::ptr &node : script) {
+        node->accept(vm);
+    }
+    // Each level adds one less than the tick before it, and there's one more level than recursive calls
+    EXPECT_DOUBLE_EQ(vm.lastResult(), -1.0);
+    EXPECT_EQ(ticks - before, 2 * 10001);
+    EXPECT_FALSE(vm.isNative("count"));
+}
+
+TEST(natives, BatchesCallGuardedFunctionsForActiveRows) {
+    registerTestNatives();
+    VM vm;
+    auto expr = parseAll("if(gt(x, 0), guarded(x), hypot(x, y))");
+    BatchProgram program = vm.prepare(static_cast<ExprStmtNode *>(expr[0].get())->expression(), { "x", "y" });
+    std::vector<double> x, y;
+    for (int i = 0; i < 1000; i++) {
+        x.push_back(i % 3 - 1);
+        y.push_back(i);
+    }
+    std::vector<double> results(x.size());
+    guardedCalls = 0;
+    vm.evaluate(program, { x.data(), y.data() }, x.size(), results.data());
+    int active = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        if (x[i] > 0) {
+            active++;
+            EXPECT_DOUBLE_EQ(results[i], x[i] + 1.0);
+        } else {
+            EXPECT_DOUBLE_EQ(results[i], std::sqrt(x[i] * x[i] + y[i] * y[i]));
+        }
+    }
+    EXPECT_EQ(guardedCalls, active);
+}
@@ -374,7 +374,7 @@ TEST(parser, ParseInvokeNoArg) {
         std::make_unique<ExprStmtNode>(
             std::make_unique<BinaryOperationNode>(
                 BinaryOperation::ADD,
-                std::make_unique<FunctionInvocationNode>("foo", std::vector<std::unique_ptr<ExprNode>>()),
+                std::make_unique<FunctionInvocationNode>("foo", std::vector<ExprNode::ptr>()),
                 std::make_unique<ConstNode>(1.0)
             )
         );
@@ -390,7 +390,7 @@ TEST(parser, ParseInvokeSingleArg) {
         { 4, 0, TokenType::SYMBOL, Symbol::ADD },
         { 5, 0, TokenType::NUMBER, 2.0 },
     });
-    std::vector<std::unique_ptr<ExprNode>> params;
+    std::vector<ExprNode::ptr> params;
     params.push_back(std::make_unique<ConstNode>(1.0));
     std::unique_ptr<StmtNode> expected =
         std::make_unique<ExprStmtNode>(
@@ -414,7 +414,7 @@ TEST(parser, ParseInvokeMultiArg) {
         { 6, 0, TokenType::SYMBOL, Symbol::ADD },
         { 7, 0, TokenType::NUMBER, 3.0 },
     });
-    std::vector<std::unique_ptr<ExprNode>> params;
+    std::vector<ExprNode::ptr> params;
     params.push_back(std::make_unique<ConstNode>(1.0));
     params.push_back(std::make_unique<ConstNode>(2.0));
     std::unique_ptr<StmtNode> expected =
@@ -439,7 +439,7 @@ TEST(parser, ParseInvokeComplexArg) {
         { 6, 0, TokenType::SYMBOL, Symbol::ADD },
         { 7, 0, TokenType::NUMBER, 3.0 },
     });
-    std::vector<std::unique_ptr<ExprNode>> params;
+    std::vector<ExprNode::ptr> params;
     params.push_back(std::make_unique<BinaryOperationNode>(
         BinaryOperation::ADD,
         std::make_unique<ConstNode>(1.0),
@@ -455,3 +455,16 @@ TEST(parser, ParseInvokeComplexArg) {
         );
     testParser(lexer, expected);
 }
+
+TEST(parser, NestedTooDeeplyFail) {
+    std::vector<Token> tokens;
+    for (int i = 0; i < 2000; i++) {
+        tokens.push_back({ 0, i, TokenType::SYMBOL, Symbol::BRACKET_OPEN });
+    }
+    tokens.push_back({ 0, 2000, TokenType::NUMBER, 1.0 });
+    for (int i = 0; i < 2000; i++) {
+        tokens.push_back({ 0, 2001 + i, TokenType::SYMBOL, Symbol::BRACKET_CLOSE });
+    }
+    MockLexer lexer = MockLexer(std::move(tokens));
+    testParserThrows(lexer);
+}
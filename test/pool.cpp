@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+TEST(pool, ProcessesEveryItemOnce) {
+    WorkerPool pool(4);
+    for (size_t items : { 1, 7, 100, 10007 }) {
+        std::vector<std::atomic<int>> seen(items);
+        pool.run(items, 16, [&] (size_t, size_t begin, size_t end) {
+            EXPECT_LE(end - begin, 16);
+            for (size_t i = begin; i < end; i++) {
+                seen[i]++;
+            }
+        });
+        for (size_t i = 0; i < items; i++) {
+            ASSERT_EQ(seen[i], 1) << i << " of " << items;
+        }
+    }
+}
+
+TEST(pool, WorkerRunsOneTaskAtATime) {
+    WorkerPool pool(3);
+    std::vector<std::atomic<bool>> busy(pool.size());
+    pool.run(1000, 1, [&] (size_t worker, size_t, size_t) {
+        ASSERT_LT(worker, pool.size());
+        EXPECT_FALSE(busy[worker].exchange(true));
+        std::this_thread::yield();
+        busy[worker] = false;
+    });
+}
+
+TEST(pool, IdleWorkersSteal) {
+    WorkerPool pool(2);
+    // Every chunk dealt to the caller is slow, so the other worker finishes first and takes some of them
+    std::atomic<size_t> stolen(0);
+    pool.run(64, 1, [&] (size_t worker, size_t begin, size_t) {
+        if (begin < 32) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            if (worker != 0) {
+                stolen++;
+            }
+        }
+    });
+    EXPECT_GT(stolen, 0);
+}
+
+TEST(pool, SingleWorkerRunsOnCaller) {
+    WorkerPool pool(1);
+    std::thread::id caller = std::this_thread::get_id();
+    size_t calls = 0;
+    pool.run(100, 10, [&] (size_t worker, size_t begin, size_t end) {
+        EXPECT_EQ(worker, 0);
+        EXPECT_EQ(std::this_thread::get_id(), caller);
+        EXPECT_EQ(begin, 0);
+        EXPECT_EQ(end, 100);
+        calls++;
+    });
+    EXPECT_EQ(calls, 1);
+}
+
+TEST(pool, RethrowsFirstException) {
+    WorkerPool pool(4);
+    EXPECT_THROW(pool.run(1000, 1, [] (size_t, size_t begin, size_t) {
+        if (begin == 500) {
+            throw std::runtime_error("Failed");
+        }
+    }), std::runtime_error);
+
+    // Still usable afterwards
+    std::atomic<size_t> total(0);
+    pool.run(1000, 3, [&] (size_t, size_t begin, size_t end) {
+        total += end - begin;
+    });
+    EXPECT_EQ(total, 1000);
+}
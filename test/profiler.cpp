@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include "profiler.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace quickcalc;
+
+namespace {
+    const Profiler::Function *find(const std::vector<Profiler::Function> &functions, const std::string &name) {
+        for (const Profiler::Function &function : functions) {
+            if (function.name == name) {
+                return &function;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Profiler::Function> profile(const std::string &source, Profiler &profiler) {
+        std::vector<StmtNode::ptr> nodes = parseAll(source);
+        Executor executor;
+        loadConcepts(executor.getState());
+        executor.setProfiler(&profiler);
+        for (StmtNode::ptr &node : nodes) {
+            try {
+                node->accept(executor);
+            } catch (std::runtime_error &) {
+            }
+        }
+        return profiler.functions();
+    }
+}
+
+TEST(profiler, CountsCallsAndDepth) {
+    Profiler profiler;
+    auto functions = profile(
+        "let fact(n) = if(le(n, 1), 1, n * fact(n - 1)); let twice(x) = x + x;"
+        "fact(5); twice(fact(3))", profiler);
+
+    const Profiler::Function *fact = find(functions, "fact");
+    ASSERT_NE(fact, nullptr);
+    // Arguments are evaluated each time they're used, so twice calls fact(3) twice
+    EXPECT_EQ(fact->calls, 11);
+    EXPECT_EQ(fact->maxDepth, 5);
+    EXPECT_LE(fact->exclusive, fact->inclusive);
+
+    const Profiler::Function *twice = find(functions, "twice");
+    ASSERT_NE(twice, nullptr);
+    EXPECT_EQ(twice->calls, 1);
+    EXPECT_EQ(twice->maxDepth, 1);
+
+    // Builtins are timed too, but parameters aren't calls
+    ASSERT_NE(find(functions, "if"), nullptr);
+    EXPECT_EQ(find(functions, "if")->calls, 11);
+    EXPECT_EQ(find(functions, "n"), nullptr);
+    EXPECT_EQ(find(functions, "<script>")->calls, 2);
+}
+
+TEST(profiler, InclusiveTimeCoversCallees) {
+    Profiler profiler;
+    auto functions = profile("let inner(x) = sum(i, 1, 1000, i * x); let outer(x) = inner(x) + inner(x); outer(2)",
+                             profiler);
+    const Profiler::Function *outer = find(functions, "outer");
+    const Profiler::Function *inner = find(functions, "inner");
+    ASSERT_NE(outer, nullptr);
+    ASSERT_NE(inner, nullptr);
+    EXPECT_GE(outer->inclusive, inner->inclusive);
+    EXPECT_GE(find(functions, "<script>")->inclusive, outer->inclusive);
+}
+
+TEST(profiler, WritesCollapsedStacks) {
+    Profiler profiler;
+    profile("let leaf(x) = sum(i, 1, 10000, x); let branch(x) = leaf(x) * 2; branch(1); leaf(2)", profiler);
+    std::ostringstream collapsed;
+    profiler.writeCollapsed(collapsed);
+
+    std::vector<std::string> stacks;
+    std::istringstream lines(collapsed.str());
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t space = line.rfind(' ');
+        ASSERT_NE(space, std::string::npos) << line;
+        EXPECT_GT(std::stoll(line.substr(space + 1)), 0) << line;
+        stacks.push_back(line.substr(0, space));
+    }
+    auto has = [&] (const std::string &stack) {
+        return std::find(stacks.begin(), stacks.end(), stack) != stacks.end();
+    };
+    EXPECT_TRUE(has("<script>;branch;leaf;sum"));
+    EXPECT_TRUE(has("<script>;leaf;sum"));
+}
+
+TEST(profiler, RecursionIsFoldedIntoOutermostCall) {
+    Profiler profiler;
+    auto functions = profile(
+        "let even(n) = if(le(n, 0), 1, odd(n - 1)); let odd(n) = if(le(n, 0), 0, even(n - 1));"
+        "let down(n) = if(le(n, 0), 0, down(n - 1)); down(300); even(300)", profiler);
+    EXPECT_EQ(find(functions, "down")->maxDepth, 301);
+    EXPECT_EQ(find(functions, "even")->calls, 151);
+
+    std::ostringstream collapsed;
+    profiler.writeCollapsed(collapsed);
+    std::istringstream lines(collapsed.str());
+    std::string line;
+    size_t count = 0;
+    while (std::getline(lines, line)) {
+        count++;
+        // Stacks stop at the first repeat, so the deepest is the script, a function, if and the other function
+        EXPECT_LE(std::count(line.begin(), line.end(), ';'), 4) << line;
+    }
+    EXPECT_LE(count, 12);
+}
+
+TEST(profiler, ThrowingCallsAreRecorded) {
+    Profiler profiler;
+    auto functions = profile("let broken(x) = missing(x); broken(1); broken(2)", profiler);
+    const Profiler::Function *broken = find(functions, "broken");
+    ASSERT_NE(broken, nullptr);
+    EXPECT_EQ(broken->calls, 2);
+    EXPECT_EQ(broken->maxDepth, 1);
+
+    profiler.clear();
+    EXPECT_TRUE(profiler.functions().empty());
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "program.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+namespace {
+    // Parses source into statements which are all dropped before the program is used
+    Program compile(const std::string &source, const VMOptions &options = VMOptions()) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        std::vector<StmtNode::ptr> nodes;
+        std::vector<StmtNode *> statements;
+        while (!input.eof()) {
+            statements.push_back(nodes.emplace_back(parser.parse()).get());
+        }
+        return Program(statements, options);
+    }
+}
+
+TEST(program, EvaluatesFormulasAfterStatementsAreGone) {
+    for (ArgumentMode mode : { ArgumentMode::BY_NAME, ArgumentMode::BY_NEED }) {
+        Program program = compile("let sq(x) = x * x; sq(3); let k = 2; sq(k) + 1", VMOptions { mode });
+        ExecutionContext context;
+        ASSERT_EQ(program.formulas(), 2);
+        EXPECT_DOUBLE_EQ(program.evaluate(context, 0), 9.0);
+        EXPECT_DOUBLE_EQ(program.evaluate(context, 1), 5.0);
+    }
+}
+
+TEST(program, FormulasUseLastDefinition) {
+    Program program = compile("let k = 1; k; let k = 2");
+    ExecutionContext context;
+    EXPECT_DOUBLE_EQ(program.evaluate(context, 0), 2.0);
+}
+
+TEST(program, CallsFunctions) {
+    for (ArgumentMode mode : { ArgumentMode::BY_NAME, ArgumentMode::BY_NEED }) {
+        Program program = compile(
+            "let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); let pick(c, a, b) = if(c, a, b)", VMOptions { mode }
+        );
+        ExecutionContext context;
+        int32_t fib = program.function("fib");
+        int32_t pick = program.function("pick");
+        EXPECT_EQ(program.arity(fib), 1);
+        EXPECT_EQ(program.arity(pick), 3);
+        EXPECT_DOUBLE_EQ(program.call(context, fib, { 20 }), 6765.0);
+        EXPECT_DOUBLE_EQ(program.call(context, pick, { 1, 2, 3 }), 2.0);
+        EXPECT_DOUBLE_EQ(program.call(context, pick, { 0, 2, 3 }), 3.0);
+        EXPECT_DOUBLE_EQ(program.call(context, fib, { 10 }), 55.0);
+    }
+}
+
+TEST(program, UndefinedNamesThrowWhenCompiled) {
+    EXPECT_THROW(compile("let f(x) = g(x) + 1; 2"), CompileError);
+    EXPECT_THROW(compile("missing(1)"), CompileError);
+    Program program = compile("let f(x) = x");
+    EXPECT_THROW(program.function("g"), std::logic_error);
+}
+
+TEST(program, ErrorsLeaveContextUsable) {
+    VMOptions options;
+    options.memoryLimit = 64 * 1024;
+    Program program = compile("let count(n) = if(le(n, 0), 0, 1 + count(n - 1))", options);
+    ExecutionContext context(options);
+    int32_t count = program.function("count");
+    EXPECT_THROW(program.call(context, count, { 1e6 }), std::runtime_error);
+    EXPECT_DOUBLE_EQ(program.call(context, count, { 100 }), 100.0);
+}
+
+TEST(program, ThreadsShareProgram) {
+    for (bool jit : { false, true }) {
+        VMOptions options { ArgumentMode::BY_NEED };
+        options.jit = jit;
+        Program program = compile(
+            "let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); "
+            "let lazy(c, n) = if(c, fib(n), 0 - fib(n)); fib(15)", options
+        );
+        int32_t fib = program.function("fib");
+        int32_t lazy = program.function("lazy");
+
+        std::vector<std::thread> threads;
+        std::vector<double> totals(4);
+        for (size_t thread = 0; thread < totals.size(); thread++) {
+            threads.emplace_back([&, thread] {
+                ExecutionContext context;
+                double total = 0.0;
+                for (int i = 0; i < 200; i++) {
+                    total += program.call(context, fib, { static_cast<double>(i % 16) });
+                    total += program.call(context, lazy, { static_cast<double>(i % 2), static_cast<double>(i % 12) });
+                    total += program.evaluate(context, 0);
+                }
+                totals[thread] = total;
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+
+        ExecutionContext context;
+        double expected = 0.0;
+        for (int i = 0; i < 200; i++) {
+            expected += program.call(context, fib, { static_cast<double>(i % 16) });
+            expected += program.call(context, lazy, { static_cast<double>(i % 2), static_cast<double>(i % 12) });
+            expected += program.evaluate(context, 0);
+        }
+        for (double total : totals) {
+            EXPECT_DOUBLE_EQ(total, expected);
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "cse.hpp"
+#include "folder.hpp"
+#include "inliner.hpp"
+#include "reduction.hpp"
+#include "vm.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <random>
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    VMOptions options(ArgumentMode arguments, bool jit, size_t loopWorkers) {
+        VMOptions options { arguments };
+        options.jit = jit;
+        options.loopWorkers = loopWorkers;
+        return options;
+    }
+
+    // Runs a script through the executor, every engine, and the executor again after every pass, checking they agree
+    double testAgainstExecutor(const std::string &source) {
+        std::vector<StmtNode::ptr> plain = parseAll(source);
+        std::vector<StmtNode::ptr> passed = parseAll(source);
+        Executor executor, passedExecutor;
+        loadConcepts(executor.getState());
+        loadConcepts(passedExecutor.getState());
+        VM byName(options(ArgumentMode::BY_NAME, false, 1));
+        VM byNeed(options(ArgumentMode::BY_NEED, false, 1));
+        VM native(options(ArgumentMode::BY_NEED, true, 1));
+        VM split(options(ArgumentMode::BY_NAME, false, 3));
+        Inliner inliner;
+        Folder folder;
+        CommonSubexpressions cse;
+        double result = NAN;
+        for (size_t i = 0; i < plain.size(); i++) {
+            plain[i]->accept(executor);
+            inliner.inlineCalls(passed[i].get());
+            folder.fold(passed[i].get());
+            cse.eliminate(passed[i].get());
+            passed[i]->accept(passedExecutor);
+            if (!executor.hasResult()) {
+                for (VM *vm : { &byName, &byNeed, &native, &split }) {
+                    plain[i]->accept(*vm);
+                }
+                continue;
+            }
+            result = executor.lastResult();
+            EXPECT_PRED2(sameValue, passedExecutor.lastResult(), result) << source;
+            for (VM *vm : { &byName, &byNeed, &native, &split }) {
+                plain[i]->accept(*vm);
+                EXPECT_PRED2(sameValue, vm->lastResult(), result) << source;
+            }
+        }
+        return result;
+    }
+}
+
+TEST(reduction, Builtins) {
+    EXPECT_EQ(testAgainstExecutor("sum(i, 1, 100, i)"), 5050);
+    EXPECT_EQ(testAgainstExecutor("prod(i, 1, 10, i)"), 3628800);
+    EXPECT_EQ(testAgainstExecutor("minof(x, -3, 3, x * x - x)"), 0);
+    EXPECT_EQ(testAgainstExecutor("maxof(x, -3, 3, x * x - x)"), 12);
+    EXPECT_EQ(testAgainstExecutor("fold(i, 1, 5, acc, 0, acc * 10 + i)"), 12345);
+    // Indices step by one from lo, and stop at the last one no greater than hi
+    EXPECT_EQ(testAgainstExecutor("sum(i, 0.5, 3, i)"), 0.5 + 1.5 + 2.5);
+}
+
+TEST(reduction, EmptyAndMalformed) {
+    EXPECT_EQ(testAgainstExecutor("sum(i, 1, 0, i)"), 0);
+    EXPECT_EQ(testAgainstExecutor("prod(i, 1, 0, i)"), 1);
+    EXPECT_EQ(testAgainstExecutor("minof(i, 1, 0, i)"), INFINITY);
+    EXPECT_EQ(testAgainstExecutor("maxof(i, 1, 0, i)"), -INFINITY);
+    EXPECT_EQ(testAgainstExecutor("fold(i, 1, 0, a, 7, i)"), 7);
+    EXPECT_TRUE(std::isnan(testAgainstExecutor("sum(i, 0 / 0, 3, i)")));
+    EXPECT_TRUE(std::isnan(testAgainstExecutor("sum(i, 1, 3)")));
+    EXPECT_TRUE(std::isnan(testAgainstExecutor("sum(2, 1, 3, 4)")));
+    EXPECT_TRUE(std::isnan(testAgainstExecutor("fold(i, 1, 3, 0, 0, i)")));
+}
+
+TEST(reduction, Scoping) {
+    // Indices shadow definitions and parameters only within the body
+    EXPECT_EQ(testAgainstExecutor("let i = 100; sum(i, 1, 3, i) + i"), 106);
+    EXPECT_EQ(testAgainstExecutor("let f(i) = sum(i, 1, i, i) * i; f(4)"), 40);
+    EXPECT_EQ(testAgainstExecutor("sum(i, 1, 4, sum(j, 1, i, i * j))"), 1 + 6 + 18 + 40);
+    EXPECT_EQ(testAgainstExecutor("sum(i, 1, 3, sum(i, 1, 2, i))"), 9);
+    // Arguments passed by name are evaluated where the call is, inside the loop
+    EXPECT_EQ(testAgainstExecutor("let twice(x) = x + x; let g(n) = sum(i, 1, n, twice(i * n)); g(3)"), 36);
+    EXPECT_EQ(testAgainstExecutor("let lazy(c, x) = if(c, x, 0); sum(i, 1, 6, lazy(gt(i, 3), i))"), 15);
+    // Repeated subexpressions are merged outside loops, but not with ones inside
+    EXPECT_EQ(testAgainstExecutor("let i = 2; i * i + sum(i, 1, 3, i * i) + prod(i, 1, 3, i * i)"), 4 + 14 + 36);
+    EXPECT_EQ(testAgainstExecutor("let sq(x) = x * x; sum(PI, 1, 3, sq(PI)) + sq(PI)"), 14 + QC_PI * QC_PI);
+    EXPECT_EQ(testAgainstExecutor("fold(i, 1, 4, i, 1, i * 2)"), 16);
+}
+
+TEST(reduction, SplitMatchesInPlace) {
+    // Sums of values with very different magnitudes round differently if they're combined in another order
+    const char *script = "let f(x) = 1 / x + sin(x) * 1e6; sum(k, 1, 100000.5, f(k)) + prod(k, 1, 70000, 1 + 1e-5 / k)"
+                         " + maxof(k, -50000, 50000, cos(k))";
+    double reference = testAgainstExecutor(script);
+    for (size_t workers : { 1, 2, 3, 5, 8 }) {
+        std::vector<StmtNode::ptr> nodes = parseAll(script);
+        VMOptions splitOptions { ArgumentMode::BY_NEED };
+        splitOptions.loopWorkers = workers;
+        VM vm(splitOptions);
+        for (StmtNode::ptr &node : nodes) {
+            node->accept(vm);
+        }
+        EXPECT_PRED2(sameValue, vm.lastResult(), reference) << workers << " workers";
+    }
+}
+
+TEST(reduction, PairwiseOrder) {
+    std::mt19937_64 random(18);
+    std::uniform_real_distribution<double> values(-1e10, 1e10);
+    for (uint64_t length : { uint64_t(1), uint64_t(1000), uint64_t(1024), uint64_t(5000), uint64_t(70000) }) {
+        std::vector<double> data(length);
+        for (double &value : data) {
+            value = values(random);
+        }
+        PairwiseReduction whole(Reduction::SUM);
+        for (double value : data) {
+            whole.add(value);
+        }
+        // Parts of any power of two blocks combine the same way
+        for (uint64_t blocks : { 1, 2, 8 }) {
+            uint64_t partLength = blocks * REDUCTION_BLOCK;
+            PairwiseReduction parts(Reduction::SUM);
+            for (uint64_t first = 0; first < length; first += partLength) {
+                PairwiseReduction part(Reduction::SUM);
+                for (uint64_t i = first; i < std::min(length, first + partLength); i++) {
+                    part.add(data[i]);
+                }
+                if (first + partLength <= length) {
+                    parts.addBlocks(part.result(), blocks);
+                } else {
+                    parts.addPartial(part.result());
+                }
+            }
+            EXPECT_PRED2(sameValue, parts.result(), whole.result()) << length << " values, " << blocks << " blocks";
+        }
+    }
+}
+
+TEST(reduction, Errors) {
+    std::vector<StmtNode::ptr> nodes = parseAll("sum(i, 0, 1 / 0, i); sum(i, 1, 3, i * x)");
+    Executor executor;
+    loadConcepts(executor.getState());
+    VM vm;
+    for (StmtNode::ptr &node : nodes) {
+        EXPECT_THROW(node->accept(executor), std::runtime_error);
+        EXPECT_THROW(node->accept(vm), std::runtime_error);
+    }
+
+    // Each row would need a loop of its own
+    std::vector<StmtNode::ptr> batch = parseAll("sum(i, 1, x, i)");
+    ExprNode *expr = static_cast<ExprStmtNode *>(batch[0].get())->expression();
+    EXPECT_THROW(vm.prepare(expr, { "x" }), CompileError);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include "scheduler.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "helpers.hpp"
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace quickcalc;
+
+namespace {
+    std::vector<std::future<Scheduler::Result>> submitAll(Scheduler &scheduler, size_t session,
+                                                          const std::string &source) {
+        std::vector<std::future<Scheduler::Result>> results;
+        for (StmtNode::ptr &node : parseAll(source)) {
+            results.push_back(scheduler.submit(session, std::move(node)));
+        }
+        return results;
+    }
+}
+
+TEST(scheduler, RunsStatementsInOrder) {
+    Scheduler scheduler;
+    size_t session = scheduler.open();
+    auto results = submitAll(scheduler, session, "let square(x) = x * x; square(3); let square(x) = x; square(3)");
+    EXPECT_FALSE(results[0].get().has_value());
+    EXPECT_DOUBLE_EQ(*results[1].get(), 9.0);
+    EXPECT_FALSE(results[2].get().has_value());
+    EXPECT_DOUBLE_EQ(*results[3].get(), 3.0);
+}
+
+TEST(scheduler, SessionsHaveTheirOwnDefinitions) {
+    SchedulerOptions options;
+    options.workers = 2;
+    Scheduler scheduler(options);
+    size_t first = scheduler.open();
+    size_t second = scheduler.open();
+    submitAll(scheduler, first, "let x = 1");
+    submitAll(scheduler, second, "let x = 2");
+    EXPECT_DOUBLE_EQ(*submitAll(scheduler, first, "x + sqrt(4)")[0].get(), 3.0);
+    EXPECT_DOUBLE_EQ(*submitAll(scheduler, second, "x + sqrt(4)")[0].get(), 4.0);
+}
+
+TEST(scheduler, ErrorsGoToTheStatement) {
+    Scheduler scheduler;
+    size_t session = scheduler.open();
+    auto results = submitAll(scheduler, session, "missing(1); 2");
+    EXPECT_THROW(results[0].get(), std::exception);
+    EXPECT_DOUBLE_EQ(*results[1].get(), 2.0);
+    EXPECT_THROW(scheduler.submit(session + 1, std::move(parseAll("1")[0])), std::out_of_range);
+}
+
+TEST(scheduler, FuelLimitsEachStatement) {
+    if (!FUEL_METERED) {
+        GTEST_SKIP() << "Built without QC_FUEL";
+    }
+    SchedulerOptions options;
+    options.slice = 100;
+    options.fuel = 10000;
+    Scheduler scheduler(options);
+    size_t session = scheduler.open();
+    auto results = submitAll(scheduler, session, "sum(i, 1, 1e12, i); sum(i, 1, 100, i)");
+    EXPECT_THROW(results[0].get(), FuelExhausted);
+    EXPECT_DOUBLE_EQ(*results[1].get(), 5050.0);
+}
+
+TEST(scheduler, CheapStatementsOvertakeExpensiveOnes) {
+    if (!FUEL_METERED || !Fiber::available()) {
+        GTEST_SKIP() << "Statements only yield with QC_FUEL and fibers";
+    }
+    SchedulerOptions options;
+    options.slice = 1000;
+    options.fuel = 2000000;
+    Scheduler scheduler(options);
+    size_t expensive = scheduler.open();
+    size_t cheap = scheduler.open();
+    auto slow = submitAll(scheduler, expensive, "sum(i, 1, 1e12, i)");
+    for (int i = 0; i < 20; i++) {
+        EXPECT_DOUBLE_EQ(*submitAll(scheduler, cheap, "prod(i, 1, 5, i)")[0].get(), 120.0);
+    }
+    // The single worker was shared, so the expensive statement is still going
+    EXPECT_EQ(slow[0].wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+    EXPECT_THROW(slow[0].get(), FuelExhausted);
+}
+
+TEST(scheduler, InterleavesManySessions) {
+    SchedulerOptions options;
+    options.workers = 2;
+    options.slice = 50;
+    options.stackSize = 256 << 10;
+    Scheduler scheduler(options);
+    std::vector<size_t> sessions;
+    std::vector<std::future<Scheduler::Result>> results;
+    for (int i = 0; i < 1000; i++) {
+        size_t session = scheduler.open();
+        sessions.push_back(session);
+        submitAll(scheduler, session, "let n = " + std::to_string(i));
+        // Several slices each, so most are suspended at once
+        results.push_back(std::move(submitAll(scheduler, session, "sum(i, 1, 20, n)")[0]));
+    }
+    for (size_t session : sessions) {
+        scheduler.close(session);
+    }
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_DOUBLE_EQ(*results[i].get(), 20.0 * i);
+    }
+    // Sessions are freed by the worker after their last statement's result is set
+    for (int tries = 0; tries < 1000 && scheduler.sessions() != 0; tries++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(scheduler.sessions(), 0);
+}
+
+TEST(scheduler, StoppingEndsStatementsInProgress) {
+    if (!FUEL_METERED) {
+        GTEST_SKIP() << "Built without QC_FUEL";
+    }
+    std::future<Scheduler::Result> result;
+    {
+        Scheduler scheduler;
+        size_t session = scheduler.open();
+        result = std::move(submitAll(scheduler, session, "sum(i, 1, 1e300, i)")[0]);
+    }
+    // Stopped with FuelExhausted if it started, or abandoned if it didn't
+    EXPECT_THROW(result.get(), std::exception);
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "compiler.hpp"
+#include "session.hpp"
+#include "vm.hpp"
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace quickcalc;
+
+namespace {
+    // Runs statements through a session, keeping definitions alive as long as the session
+    class SessionTest {
+        std::vector<StmtNode::ptr> _nodes;
+    public:
+        Session session;
+
+        void run(const std::string &source) {
+            std::istringstream input(source);
+            Lexer lexer(input);
+            Parser parser(lexer);
+            while (!input.eof()) {
+                StmtNode::ptr node = parser.parse();
+                node->accept(session);
+                // Statements are copied, so only definitions are kept
+                if (!node->canSafeDelete()) {
+                    _nodes.push_back(std::move(node));
+                }
+            }
+        }
+    };
+}
+
+TEST(session, RecomputesOnlyDependents) {
+    SessionTest test;
+    test.run("let rate = 2; let tax(x) = x * rate; let other = 5; tax(10); other + 1; 3 * 3");
+    EXPECT_EQ(test.session.recomputed(), 3);
+    test.run("let rate = 3");
+    EXPECT_EQ(test.session.updated(), std::vector<size_t>({ 0 }));
+    EXPECT_EQ(test.session.recomputed(), 4);
+    EXPECT_DOUBLE_EQ(test.session.value(0), 30.0);
+    EXPECT_DOUBLE_EQ(test.session.value(1), 6.0);
+    EXPECT_DOUBLE_EQ(test.session.value(2), 9.0);
+    EXPECT_FALSE(test.session.hasResult());
+}
+
+TEST(session, FollowsDefinitionsTransitively) {
+    SessionTest test;
+    test.run("let a = 1; let b = a + 1; let c(x) = b * x; c(2); b; 7; let d(a) = a");
+    test.run("let a = 10");
+    EXPECT_EQ(test.session.updated(), std::vector<size_t>({ 0, 1 }));
+    EXPECT_DOUBLE_EQ(test.session.value(0), 22.0);
+    EXPECT_DOUBLE_EQ(test.session.value(1), 11.0);
+    // b no longer calls a, so changing a changes nothing
+    test.run("let b = 5; let a = 3");
+    EXPECT_TRUE(test.session.updated().empty());
+    EXPECT_DOUBLE_EQ(test.session.value(0), 10.0);
+}
+
+TEST(session, KeepsErrorsUntilFixed) {
+    SessionTest test;
+    EXPECT_THROW(test.run("x + 1"), CompileError);
+    EXPECT_THROW(test.session.value(0), CompileError);
+    test.run("let x = 2");
+    EXPECT_EQ(test.session.updated(), std::vector<size_t>({ 0 }));
+    EXPECT_DOUBLE_EQ(test.session.value(0), 3.0);
+    test.run("let x = y");
+    EXPECT_THROW(test.session.value(0), CompileError);
+}
+
+TEST(session, ConstantsCachedUntilRedefined) {
+    VMOptions options;
+    options.cacheConstants = true;
+    VM vm(options);
+    std::istringstream input("let n = 20; let fib(x) = if(lt(x, 2), x, fib(x - 1) + fib(x - 2)); let k = fib(n); k + k; k");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    std::vector<StmtNode::ptr> nodes;
+    while (!input.eof()) {
+        nodes.emplace_back(parser.parse())->accept(vm);
+    }
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 6765.0);
+    EXPECT_EQ(vm.memoStats("k").misses, 1);
+    EXPECT_EQ(vm.memoStats("k").hits, 2);
+    // Functions with parameters aren't memoized
+    EXPECT_EQ(vm.memoStats("fib").misses, 0);
+
+    auto redefinition = std::make_unique<FuncDefNode>("n", std::make_unique<ConstNode>(10.0), std::vector<std::string>());
+    redefinition->accept(vm);
+    auto statement = std::make_unique<ExprStmtNode>(std::make_unique<FunctionInvocationNode>("k", std::vector<ExprNode::ptr>()));
+    statement->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 55.0);
+}
+
+TEST(session, MatchesRunningEverythingAgain) {
+    std::mt19937 random(7);
+    const char *names[] = { "a", "b", "c", "d" };
+    SessionTest test;
+    std::vector<std::string> definitions;
+    std::vector<std::string> formulas;
+    for (int step = 0; step < 60; step++) {
+        std::string name = names[random() % 4];
+        std::string other = names[random() % 4];
+        std::string source;
+        if (random() % 3 == 0) {
+            source = name + " * 2 + " + other;
+            formulas.push_back(source);
+        } else {
+            // Only refer to names defined earlier in the list, so nothing recurses forever
+            std::string body = std::to_string(random() % 10);
+            if (other < name) {
+                body += " + " + other + " * 3";
+            }
+            source = "let " + name + " = " + body;
+            definitions.push_back(source);
+        }
+        try {
+            test.run(source);
+        } catch (std::runtime_error &) {
+        }
+
+        std::string everything;
+        for (const std::string &definition : definitions) {
+            everything += definition + "; ";
+        }
+        for (size_t i = 0; i < formulas.size(); i++) {
+            std::istringstream input(everything + formulas[i]);
+            Lexer lexer(input);
+            Parser parser(lexer);
+            std::vector<StmtNode::ptr> nodes;
+            VM vm;
+            bool failed = false;
+            while (!input.eof()) {
+                try {
+                    nodes.emplace_back(parser.parse())->accept(vm);
+                } catch (std::runtime_error &) {
+                    failed = true;
+                }
+            }
+            if (failed) {
+                EXPECT_THROW(test.session.value(i), std::runtime_error) << formulas[i];
+            } else {
+                EXPECT_DOUBLE_EQ(test.session.value(i), vm.lastResult()) << formulas[i];
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "stats.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "helpers.hpp"
+#include <sstream>
+#include <vector>
+
+using namespace quickcalc;
+
+TEST(stats, CountsTokensAndNodes) {
+    if (!STATS_COUNTED) {
+        GTEST_SKIP() << "Built without QC_STATS";
+    }
+    std::istringstream input("let f(x) = x * 2; f(1 + 2)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    parseAll(parser, input);
+    // let f ( x ) = x * 2 ; then f ( 1 + 2 ) and the end of the input
+    EXPECT_EQ(lexer.stats().tokens, 17);
+    // Definition, multiply, x, 2, then statement, call, add, 1, 2
+    EXPECT_EQ(parser.stats().nodes, 9);
+}
+
+TEST(stats, CountsExecutorWork) {
+    if (!STATS_COUNTED) {
+        GTEST_SKIP() << "Built without QC_STATS";
+    }
+    std::istringstream input("let g(y) = y + 1; let f(x) = g(x) * 2; f(3)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    std::vector<StmtNode::ptr> nodes = parseAll(parser, input);
+    Executor executor;
+    uint64_t initialPushes = executor.stats().statePushes;
+    for (StmtNode::ptr &node : nodes) {
+        node->accept(executor);
+    }
+    EXPECT_DOUBLE_EQ(executor.lastResult(), 8.0);
+
+    const Stats &stats = executor.stats();
+    // f and g push a state each, and evaluating the arguments y and x sets one aside and puts it back
+    EXPECT_EQ(stats.statePushes - initialPushes, 4);
+    EXPECT_EQ(stats.statePops, 4);
+    // f, g, x from within g, y
+    EXPECT_EQ(stats.lookups, 4);
+    // Only g is found past the innermost state, x is looked up once g's state is set aside
+    EXPECT_EQ(stats.lookupHops, 1);
+    // g(x) and 2 are both on the stack for the multiply
+    EXPECT_GE(stats.valuePeak, 2);
+}
+
+TEST(stats, AddsCounters) {
+    Stats total;
+    Stats part;
+    part.tokens = 3;
+    part.valuePeak = 5;
+    total += part;
+    part.valuePeak = 2;
+    total += part;
+    EXPECT_EQ(total.tokens, 6);
+    EXPECT_EQ(total.valuePeak, 5);
+
+    std::ostringstream printed;
+    total.print(printed);
+    EXPECT_NE(printed.str().find("Tokens read: 6"), std::string::npos);
+}
@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "executor.hpp"
+#include "concepts.hpp"
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "helpers.hpp"
+#include <sstream>
+
+using namespace quickcalc;
+
+namespace {
+    // Runs a script through the reference executor and the VM in each mode, checking every statement agrees
+    double testAgainstExecutor(const std::string &source) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        Executor executor;
+        VM byName(VMOptions { ArgumentMode::BY_NAME });
+        VM byNeed(VMOptions { ArgumentMode::BY_NEED });
+        loadConcepts(executor.getState());
+
+        std::vector<StmtNode::ptr> nodes;
+        double result = NAN;
+        while (!input.eof()) {
+            StmtNode *stmt = nodes.emplace_back(parser.parse()).get();
+            stmt->accept(executor);
+            for (VM *vm : { &byName, &byNeed }) {
+                stmt->accept(*vm);
+                EXPECT_EQ(vm->hasResult(), executor.hasResult());
+                if (executor.hasResult()) {
+                    EXPECT_PRED2(sameValue, vm->lastResult(), executor.lastResult()) << source;
+                    result = vm->lastResult();
+                }
+            }
+        }
+        return result;
+    }
+
+    VM runScript(const std::string &source, const VMOptions &options, std::vector<StmtNode::ptr> &nodes) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        Parser parser(lexer);
+        VM vm(options);
+        while (!input.eof()) {
+            nodes.emplace_back(parser.parse())->accept(vm);
+        }
+        return vm;
+    }
+}
+
+TEST(vm, Arithmetic) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("3*(1+3-2/4)"), 10.5);
+    testAgainstExecutor("1-2-3");
+    testAgainstExecutor("-4/0");
+    testAgainstExecutor("0/0");
+}
+
+TEST(vm, Bitwise) {
+    for (BinaryOperation operation : { BinaryOperation::AND, BinaryOperation::OR, BinaryOperation::XOR }) {
+        auto expr = std::make_unique<BinaryOperationNode>(
+            operation,
+            std::make_unique<ConstNode>(6.0),
+            std::make_unique<UnaryOperationNode>(
+                UnaryOperation::NOT,
+                std::make_unique<ConstNode>(3.0)
+            )
+        );
+        Executor executor;
+        VM vm;
+        EXPECT_DOUBLE_EQ(vm.evaluate(expr.get()), executor.evaluate(expr.get()));
+    }
+}
+
+TEST(vm, BitwiseIsSixtyFourBit) {
+    auto constant = [] (double value) -> ExprNode::ptr { return std::make_unique<ConstNode>(value); };
+    auto bitwise = [] (BinaryOperation operation, ExprNode::ptr lhs, ExprNode::ptr rhs) -> ExprNode::ptr {
+        return std::make_unique<BinaryOperationNode>(operation, std::move(lhs), std::move(rhs));
+    };
+    auto bitNot = [] (ExprNode::ptr value) -> ExprNode::ptr {
+        return std::make_unique<UnaryOperationNode>(UnaryOperation::NOT, std::move(value));
+    };
+    std::vector<std::pair<ExprNode::ptr, double>> cases;
+    cases.emplace_back(bitwise(BinaryOperation::OR, constant(4294967296.0), constant(5.0)), 4294967301.0);
+    cases.emplace_back(bitwise(BinaryOperation::AND, bitNot(constant(0.0)), constant(1099511627775.0)), 1099511627775.0);
+    cases.emplace_back(bitwise(BinaryOperation::XOR, constant(-4294967297.0), constant(1.0)), -4294967298.0);
+    // NaN and values out of range convert to the smallest integer
+    cases.emplace_back(bitwise(BinaryOperation::OR, constant(NAN), constant(0.0)), -9223372036854775808.0);
+    cases.emplace_back(bitwise(BinaryOperation::AND, constant(1e300), bitNot(constant(0.0))), -9223372036854775808.0);
+    // Results too large to be exact are rounded before they're used by another operator
+    cases.emplace_back(bitNot(constant(NAN)), 9223372036854775808.0);
+    cases.emplace_back(bitwise(BinaryOperation::XOR, bitNot(constant(NAN)), constant(0.0)), -9223372036854775808.0);
+    cases.emplace_back(bitwise(BinaryOperation::XOR, bitNot(constant(4611686018427387904.0)), constant(1.0)),
+                       -4611686018427387904.0);
+    // Mixed with arithmetic on either side
+    cases.emplace_back(
+        bitwise(BinaryOperation::ADD, constant(0.5), bitwise(BinaryOperation::AND, constant(6.9), bitwise(
+            BinaryOperation::MULTIPLY, constant(2.0), bitwise(BinaryOperation::OR, constant(1.0), constant(2.0))
+        ))),
+        6.5
+    );
+    Executor executor;
+    VM vm;
+    for (auto &[expr, expected] : cases) {
+        EXPECT_EQ(executor.evaluate(expr.get()), expected);
+        EXPECT_EQ(vm.evaluate(expr.get()), expected);
+    }
+}
+
+TEST(vm, Builtins) {
+    testAgainstExecutor("eq(1, 1); ne(1, 2); gt(2, 1); lt(2, 1); ge(1, 1); le(2, 1)");
+    testAgainstExecutor("if(1, 2, 3); if(0, 2, 3); if(0, 2); if(0.5, 2, 3); if(1)");
+    testAgainstExecutor("PI; TRUE; true; FALSE; false; EPSILON; eq(1)");
+}
+
+TEST(vm, UserFunctions) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let a(x) = x; let b(x) = a(x); b(5)"), 5.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let add(x, y) = x + y; add(add(1, 2), add(3, 4))"), 10.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let fact(n) = if(le(n, 1), 1, n * fact(n - 1)); fact(10)"), 3628800.0);
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let fib(n) = if(lt(n, 2), n, fib(n - 1) + fib(n - 2)); fib(15)"), 610.0);
+}
+
+TEST(vm, UnusedArgumentIsNotEvaluated) {
+    // Calling f without its argument would throw if evaluated
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f(x) = x; let first(a, b) = a; first(1, f)"), 1.0);
+}
+
+TEST(vm, LateBinding) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f = g + 1; let g = 1; f; let g = 2; f"), 3.0);
+}
+
+TEST(vm, RedefiningBuiltin) {
+    EXPECT_DOUBLE_EQ(testAgainstExecutor("let f = PI; f; let PI = 3; f"), 3.0);
+}
+
+TEST(vm, UndefinedFunctionThrows) {
+    VM vm;
+    auto stmt = std::make_unique<ExprStmtNode>(
+        std::make_unique<FunctionInvocationNode>("foo", std::vector<ExprNode::ptr>())
+    );
+    EXPECT_THROW(stmt->accept(vm), CompileError);
+}
+
+TEST(vm, UndefinedNamesReportedBeforeEvaluation) {
+    std::istringstream input("let f = if(1, 1, g + h); f");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    VM vm;
+    auto def = parser.parse();
+    EXPECT_NO_THROW(def->accept(vm));
+    auto stmt = parser.parse();
+    try {
+        stmt->accept(vm);
+        FAIL() << "Expected CompileError";
+    } catch (CompileError &e) {
+        EXPECT_STREQ(e.what(), "Undefined functions g, h");
+    }
+}
+
+TEST(vm, MissingArgumentThrows) {
+    std::istringstream input("let f(x) = x; f");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    VM vm;
+    auto def = parser.parse();
+    def->accept(vm);
+    auto stmt = parser.parse();
+    EXPECT_THROW(stmt->accept(vm), std::runtime_error);
+}
+
+TEST(vm, DeepRecursionGrowsStack) {
+    VM vm(1);
+    std::istringstream input("let count(n) = if(le(n, 0), 0, 1 + count(n - 1)); count(1000)");
+    Lexer lexer(input);
+    Parser parser(lexer);
+    auto def = parser.parse();
+    def->accept(vm);
+    auto stmt = parser.parse();
+    stmt->accept(vm);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 1000.0);
+}
+
+TEST(vm, ByNeedEvaluatesArgumentsOnce) {
+    std::vector<StmtNode::ptr> nodes;
+    // Exponential when arguments are passed by name
+    std::string source = "let sq(x) = x * x; let id(x) = if(1, x); ";
+    source += "sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(sq(id(1.000001)))))))))))))))))))))))))";
+    VM vm = runScript(source, VMOptions { ArgumentMode::BY_NEED }, nodes);
+    double expected = 1.000001;
+    for (int i = 0; i < 24; i++) {
+        expected = expected * expected;
+    }
+    EXPECT_EQ(vm.lastResult(), expected);
+}
+
+TEST(vm, ByNeedCountsDeepRecursion) {
+    std::vector<StmtNode::ptr> nodes;
+    VM vm = runScript("let count(n) = if(le(n, 0), 0, 1 + count(n - 1)); count(100000)", VMOptions { ArgumentMode::BY_NEED }, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 100000.0);
+}
+
+TEST(vm, ByNeedKeepsLazyArguments) {
+    testAgainstExecutor("let f(x) = x; let pick(c, a, b) = if(c, a, b); pick(1, 2, f); pick(0, f, 3)");
+}
+
+TEST(vm, StrictnessFollowsBothBranches) {
+    std::vector<StmtNode::ptr> nodes;
+    VM vm = runScript(
+        "let pick(c, a, b) = if(c, a, b); "
+        "let both(c, a) = if(c, a, a + 1); "
+        "let cond(c, a) = if(c, a); "
+        "let sum(n, acc) = if(le(n, 0), acc, sum(n - 1, acc + n)); "
+        "let wrap(c, a, b) = pick(c, a, b) + both(b, c)",
+        VMOptions { ArgumentMode::BY_NEED }, nodes);
+    EXPECT_EQ(vm.strictness("pick"), 0b001);
+    EXPECT_EQ(vm.strictness("both"), 0b11);
+    EXPECT_EQ(vm.strictness("cond"), 0b01);
+    EXPECT_EQ(vm.strictness("sum"), 0b11);
+    EXPECT_EQ(vm.strictness("wrap"), 0b101);
+}
+
+TEST(vm, StrictnessUpdatesOnRedefinition) {
+    std::vector<StmtNode::ptr> nodes;
+    VM vm = runScript("let g(x) = x; let f(x) = g(x)", VMOptions { ArgumentMode::BY_NEED }, nodes);
+    EXPECT_EQ(vm.strictness("f"), 0b1);
+    auto redefine = std::make_unique<FuncDefNode>("g", std::make_unique<ConstNode>(1.0), std::vector<std::string>({ "x" }));
+    redefine->accept(vm);
+    EXPECT_EQ(vm.strictness("f"), 0b0);
+}
+
+TEST(vm, TailCallsRunInConstantSpace) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.memoryLimit = 64 * 1024;
+    VM vm = runScript("let loop(n, acc) = if(le(n, 0), acc, loop(n - 1, acc + 1)); loop(10000000, 0)", options, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 10000000.0);
+}
+
+TEST(vm, MemoryLimitThrowsAndRecovers) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.memoryLimit = 64 * 1024;
+    VM vm = runScript("let count(n) = if(le(n, 0), 0, 1 + count(n - 1))", options, nodes);
+    auto count = [](double n) {
+        std::vector<ExprNode::ptr> args;
+        args.push_back(std::make_unique<ConstNode>(n));
+        return std::make_unique<FunctionInvocationNode>("count", std::move(args));
+    };
+    EXPECT_THROW(vm.evaluate(count(1000000.0).get()), std::runtime_error);
+    EXPECT_DOUBLE_EQ(vm.evaluate(count(100.0).get()), 100.0);
+}
+
+TEST(vm, MillionTermSum) {
+    std::string source = "1";
+    for (int i = 1; i < 1000000; i++) {
+        source += "+1";
+    }
+    std::vector<StmtNode::ptr> nodes;
+    VM vm = runScript(source, VMOptions {}, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 1000000.0);
+}
+
+TEST(vm, MemoizesStrictFunctions) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.memoEntries = 64;
+    VM vm = runScript("let fib(n) = if(le(n, 1), n, fib(n - 1) + fib(n - 2)); fib(60)", options, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 1548008755920.0);
+    MemoStats stats = vm.memoStats("fib");
+    EXPECT_EQ(stats.misses, 61);
+    EXPECT_EQ(stats.hits, 58);
+}
+
+TEST(vm, MemoSkipsLazyFunctions) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.memoEntries = 64;
+    VM vm = runScript("let pick(c, a, b) = if(c, a, b); pick(1, 2, 3) + pick(1, 2, 3)", options, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 4.0);
+    EXPECT_EQ(vm.memoStats("pick").misses, 0);
+}
+
+TEST(vm, MemoClearedOnRedefinition) {
+    std::vector<StmtNode::ptr> nodes;
+    VMOptions options { ArgumentMode::BY_NEED };
+    options.memoEntries = 64;
+    VM vm = runScript("let g(x) = x; let f(x) = g(x) + 1; f(1)", options, nodes);
+    EXPECT_DOUBLE_EQ(vm.lastResult(), 2.0);
+    auto redefine = std::make_unique<FuncDefNode>(
+        "g",
+        std::make_unique<BinaryOperationNode>(
+            BinaryOperation::MULTIPLY,
+            std::make_unique<FunctionInvocationNode>("x", std::vector<ExprNode::ptr>()),
+            std::make_unique<ConstNode>(10.0)
+        ),
+        std::vector<std::string>({ "x" })
+    );
+    redefine->accept(vm);
+    std::vector<ExprNode::ptr> args;
+    args.push_back(std::make_unique<ConstNode>(1.0));
+    auto call = std::make_unique<FunctionInvocationNode>("f", std::move(args));
+    EXPECT_DOUBLE_EQ(vm.evaluate(call.get()), 11.0);
+}